@@ -0,0 +1,428 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Бенчмарки B-деревьев (Google Benchmark)
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Каждый бенчмарк параметризуется порядком дерева, размером записи и хранилищем
+/// (файловый поток, выровненные страницы в потоке или с прямым вводом-выводом, оперативная
+/// память). Результаты в JSON для отслеживания от сборки
+/// к сборке дает цель bench_json или ключи --benchmark_out=<file> --benchmark_out_format=json.
+///
+/// Рабочие файлы деревьев создаются в каталоге из ключа --bench_dir=<dir>, иначе из переменной
+/// окружения BTREE_BENCH_DIR, иначе во временном каталоге (TMPDIR, TEMP или /tmp).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+#include <list>
+#include <string>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+#include "btree.h"
+#include "btree_adapters.h"
+#include "btree_builder.h"
+#include "parallel_scan.h"
+#include "memory_btree.h"
+#include "direct_btree.h"
+
+
+/** \brief Каталог с рабочими файлами бенчмарков (см. main()). */
+static std::string benchDir;
+
+
+
+using namespace xi;
+
+
+typedef OrderedKeyCodec<UInt> UIntCodec;
+
+
+/** \brief Число ключей в дереве для одного прогона. */
+static const UInt KEYS_NUM = 1 << 14;
+
+/** \brief Число копий каждого ключа в бенчмарке searchAll(). */
+static const UInt DUPS_NUM = 8;
+
+/** \brief Число ключей в бенчмарке построения дерева. */
+static const UInt BUILD_KEYS_NUM = 1 << 20;
+
+
+/** \brief Хранилище дерева. */
+enum Backend {
+    bkFile = 0,             ///< FileBaseBTree (файловый поток).
+    bkMemory = 1,           ///< MemoryBaseBTree (страницы в оперативной памяти).
+    bkAligned = 2,          ///< FileBaseBTree с выровненными страницами (createForPageSize()).
+    bkDirect = 3,           ///< DirectFileBaseBTree (выровненные страницы, O_DIRECT).
+};
+
+
+/** \brief Дерево для бенчмарка: порядок, размер записи и хранилище берутся из аргументов
+ *  бенчмарка (0, 1 и 2 соответственно).
+ *
+ *  Для выровненных хранилищ (bkAligned, bkDirect) порядок задает размер страницы: берется
+ *  наименьшая степень двойки, в которую помещается узел не меньше заданного порядка; сам
+ *  порядок дерева при этом может оказаться больше.
+ */
+class BenchTree {
+public:
+    BenchTree(const benchmark::State& state)
+    {
+        _order = (UShort) state.range(0);
+        _recSize = (UShort) state.range(1);
+        _backend = (Backend) state.range(2);
+        _fn = benchDir;
+        if (!_fn.empty() && _fn[_fn.size() - 1] != '/' && _fn[_fn.size() - 1] != '\\')
+            _fn.append("/");
+        _fn.append("bench.xibt");
+    }
+
+    ~BenchTree()
+    {
+        close();
+    }
+
+    /** \brief Создает пустое дерево. */
+    BaseBTree& create()
+    {
+        close();
+        if (_backend == bkFile)
+        {
+            _file.setComparator(&_comparator);
+            _file.create(_order, _recSize, _fn);
+            return _file;
+        }
+
+        if (_backend == bkAligned)
+        {
+            _file.setComparator(&_comparator);
+            _file.createForPageSize(getPageSize(), _recSize, _fn);
+            return _file;
+        }
+
+        if (_backend == bkDirect)
+        {
+            _direct.setComparator(&_comparator);
+            _direct.createForPageSize(getPageSize(), _recSize, _fn);
+            return _direct;
+        }
+
+        _mem.setComparator(&_comparator);
+        _mem.create(_order, _recSize);
+        return _mem;
+    }
+
+    void close()
+    {
+        _file.close();
+        _direct.close();
+        _mem.close();
+    }
+
+    /** \brief Записывает в \c rec (размером getRecSize()) запись с ключом \c key. */
+    void makeRec(Byte* rec, UInt key) const
+    {
+        memset(rec, 0, _recSize);
+        UIntCodec::encode(rec, key);
+    }
+
+    UShort getRecSize() const { return _recSize; }
+
+    /** \brief Возвращает подпись бенчмарка с хранилищем дерева. */
+    const char* getLabel() const
+    {
+        switch (_backend)
+        {
+        case bkMemory:  return "memory";
+        case bkAligned: return "aligned";
+        case bkDirect:  return "direct";
+        default:        return "file";
+        }
+    }
+
+protected:
+    /** \brief Возвращает размер выровненной страницы для заданного порядка. */
+    UInt getPageSize() const
+    {
+        UInt pageSize = BaseBTree::MIN_ALIGNED_PAGE_SIZE;
+        while (BaseBTree::calcOrderForPageSize(_recSize, pageSize) < _order)
+            pageSize *= 2;
+        return pageSize;
+    }
+
+protected:
+    UShort _order;
+    UShort _recSize;
+    Backend _backend;
+    std::string _fn;
+
+    BTreeLexComparator _comparator;
+    FileBaseBTree _file;
+    DirectFileBaseBTree _direct;
+    MemoryBaseBTree _mem;
+}; // class BenchTree
+
+
+/** \brief Возвращает ключи 0..n-1 (с шагом \c step), перемешанные, если \c shuffle. */
+static std::vector<UInt> makeKeys(UInt n, UInt step, bool shuffle)
+{
+    std::vector<UInt> keys(n);
+    for (UInt i = 0; i < n; ++i)
+        keys[i] = i * step;
+
+    if (shuffle)
+    {
+        std::mt19937 rng(12345);
+        std::shuffle(keys.begin(), keys.end(), rng);
+    }
+
+    return keys;
+}
+
+
+/** \brief Вставка KEYS_NUM ключей в пустое дерево (по возрастанию или вперемешку). */
+static void insertKeys(benchmark::State& state, bool shuffle)
+{
+    BenchTree bt(state);
+    std::vector<UInt> keys = makeKeys(KEYS_NUM, 1, shuffle);
+    std::vector<Byte> rec(bt.getRecSize());
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        BaseBTree& tree = bt.create();
+        state.ResumeTiming();
+
+        for (UInt k : keys)
+        {
+            bt.makeRec(rec.data(), k);
+            tree.insert(rec.data());
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * KEYS_NUM);
+    state.SetLabel(bt.getLabel());
+}
+
+
+static void BM_InsertSequential(benchmark::State& state)
+{
+    insertKeys(state, false);
+}
+
+
+static void BM_InsertRandom(benchmark::State& state)
+{
+    insertKeys(state, true);
+}
+
+
+/** \brief Поиск по дереву с четными ключами: \c hit — существующих, иначе — нечетных. */
+static void searchKeys(benchmark::State& state, bool hit)
+{
+    BenchTree bt(state);
+    std::vector<Byte> rec(bt.getRecSize());
+
+    BaseBTree& tree = bt.create();
+    for (UInt k : makeKeys(KEYS_NUM, 2, true))
+    {
+        bt.makeRec(rec.data(), k);
+        tree.insert(rec.data());
+    }
+
+    std::vector<UInt> probes = makeKeys(KEYS_NUM, 2, true);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        bt.makeRec(rec.data(), probes[i] + (hit ? 0 : 1));
+        Byte* res = tree.search(rec.data());
+        benchmark::DoNotOptimize(res);
+        delete[] res;
+
+        if (++i == probes.size())
+            i = 0;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(bt.getLabel());
+}
+
+
+static void BM_SearchHit(benchmark::State& state)
+{
+    searchKeys(state, true);
+}
+
+
+static void BM_SearchMiss(benchmark::State& state)
+{
+    searchKeys(state, false);
+}
+
+
+/** \brief searchAll() по дереву, где каждый ключ повторяется DUPS_NUM раз. */
+static void BM_SearchAllDups(benchmark::State& state)
+{
+    BenchTree bt(state);
+    std::vector<Byte> rec(bt.getRecSize());
+
+    const UInt distinct = KEYS_NUM / DUPS_NUM;
+    BaseBTree& tree = bt.create();
+    for (UInt d = 0; d < DUPS_NUM; ++d)
+        for (UInt k : makeKeys(distinct, 1, true))
+        {
+            bt.makeRec(rec.data(), k);
+            tree.insert(rec.data());
+        }
+
+    std::vector<UInt> probes = makeKeys(distinct, 1, true);
+    std::list<Byte*> found;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        bt.makeRec(rec.data(), probes[i]);
+        int n = tree.searchAll(rec.data(), found);
+        benchmark::DoNotOptimize(n);
+
+        for (Byte* r : found)
+            delete[] r;
+        found.clear();
+
+        if (++i == probes.size())
+            i = 0;
+    }
+
+    state.SetItemsProcessed(state.iterations() * DUPS_NUM);
+    state.SetLabel(bt.getLabel());
+}
+
+
+/** \brief Построение дерева из BUILD_KEYS_NUM перемешанных записей (с сортировкой)
+ *  строителем ParallelBTreeBuilder; число потоков — аргумент 3.
+ */
+static void BM_BuildParallel(benchmark::State& state)
+{
+    BenchTree bt(state);
+    UInt threads = (UInt) state.range(3);
+
+    std::vector<UInt> keys = makeKeys(BUILD_KEYS_NUM, 1, true);
+    std::vector<Byte> recs((size_t) BUILD_KEYS_NUM * bt.getRecSize());
+    for (UInt i = 0; i < BUILD_KEYS_NUM; ++i)
+        bt.makeRec(&recs[(size_t) i * bt.getRecSize()], keys[i]);
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        BaseBTree& tree = bt.create();
+        state.ResumeTiming();
+
+        ParallelBTreeBuilder builder(&tree, 1.0, threads);
+        builder.build(BUILD_KEYS_NUM, recs.data(), false);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BUILD_KEYS_NUM);
+    state.SetLabel(bt.getLabel());
+}
+
+
+/** \brief Подсчет всех записей дерева из BUILD_KEYS_NUM ключей сканером
+ *  ParallelRangeScanner; число потоков — аргумент 3.
+ */
+static void BM_ScanParallel(benchmark::State& state)
+{
+    BenchTree bt(state);
+    UInt threads = (UInt) state.range(3);
+
+    std::vector<Byte> recs((size_t) BUILD_KEYS_NUM * bt.getRecSize());
+    for (UInt i = 0; i < BUILD_KEYS_NUM; ++i)
+        bt.makeRec(&recs[(size_t) i * bt.getRecSize()], i);
+
+    BaseBTree& tree = bt.create();
+    ParallelBTreeBuilder builder(&tree, 1.0, 1);
+    builder.build(BUILD_KEYS_NUM, recs.data());
+
+    ParallelRangeScanner scanner(&tree, threads);
+    for (auto _ : state)
+    {
+        CountAggregator count;
+        scanner.scan(nullptr, nullptr, count);
+        benchmark::DoNotOptimize(count.getCount());
+    }
+
+    state.SetItemsProcessed(state.iterations() * BUILD_KEYS_NUM);
+    state.SetLabel(bt.getLabel());
+}
+
+
+/** \brief Порядки {8, 32, 128} x размеры записи {8, 64} x все хранилища (см. Backend). */
+static void treeArgs(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({ "order", "rec", "store" });
+    b->ArgsProduct({ { 8, 32, 128 }, { 8, 64 }, { bkFile, bkMemory, bkAligned, bkDirect } });
+}
+
+
+BENCHMARK(BM_InsertSequential)->Apply(treeArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_InsertRandom)->Apply(treeArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SearchHit)->Apply(treeArgs);
+BENCHMARK(BM_SearchMiss)->Apply(treeArgs);
+BENCHMARK(BM_SearchAllDups)->Apply(treeArgs);
+BENCHMARK(BM_BuildParallel)
+        ->ArgNames({ "order", "rec", "store", "threads" })
+        ->ArgsProduct({ { 32 }, { 8, 64 }, { bkFile, bkMemory, bkAligned, bkDirect }, { 1, 2, 4, 8 } })
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK(BM_ScanParallel)
+        ->ArgNames({ "order", "rec", "store", "threads" })
+        ->ArgsProduct({ { 32 }, { 8, 64 }, { bkFile, bkMemory, bkAligned, bkDirect }, { 1, 2, 4, 8 } })
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+
+/** \brief Возвращает каталог для рабочих файлов по умолчанию: BTREE_BENCH_DIR или временный. */
+static std::string getDefaultBenchDir()
+{
+    for (const char* var : { "BTREE_BENCH_DIR", "TMPDIR", "TEMP", "TMP" })
+    {
+        const char* dir = std::getenv(var);
+        if (dir && *dir)
+            return dir;
+    }
+
+    return "/tmp";
+}
+
+
+/** \brief Как BENCHMARK_MAIN(), но сначала забирает из аргументов собственный ключ
+ *  --bench_dir=<dir>, неизвестный библиотеке.
+ */
+int main(int argc, char** argv)
+{
+    static const char DIR_FLAG[] = "--bench_dir=";
+    const size_t DIR_FLAG_LEN = sizeof(DIR_FLAG) - 1;
+
+    benchDir = getDefaultBenchDir();
+    int n = 0;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (i > 0 && strncmp(argv[i], DIR_FLAG, DIR_FLAG_LEN) == 0)
+            benchDir = argv[i] + DIR_FLAG_LEN;
+        else
+            argv[n++] = argv[i];
+    }
+    argc = n;
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
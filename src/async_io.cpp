@@ -0,0 +1,409 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  async_io.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "async_io.h"
+
+#include <cerrno>
+#include <cstring>          // memset
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <unistd.h>         // pread, pwrite
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
+namespace xi
+{
+
+
+//==============================================================================
+// class IAsyncPageIO
+//==============================================================================
+
+
+IAsyncPageIO *IAsyncPageIO::create(int fd, UInt depth, UInt threads)
+{
+#ifdef __linux__
+    IAsyncPageIO *uring = UringPageIO::create(fd, depth);
+    if (uring)
+        return uring;
+#endif
+
+    return new ThreadPoolPageIO(fd, threads);
+}
+
+
+void IAsyncPageIO::executeSync(int fd, PageIORequest &req)
+{
+#ifndef _WIN32
+    size_t done = 0;
+    while (done < req.size)
+    {
+        ssize_t res = req.isWrite
+                      ? ::pwrite(fd, req.buf + done, req.size - done, (off_t) (req.offset + done))
+                      : ::pread(fd, req.buf + done, req.size - done, (off_t) (req.offset + done));
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            req.result = -errno;
+            return;
+        }
+
+        if (res == 0)                   // конец файла
+            break;
+
+        done += (size_t) res;
+    }
+
+    req.result = (long) done;
+#else
+    req.result = -ENOSYS;
+#endif
+}
+
+
+//==============================================================================
+// class ThreadPoolPageIO
+//==============================================================================
+
+
+ThreadPoolPageIO::ThreadPoolPageIO(int fd, UInt threads)
+        : _fd(fd),
+          _pending(0),
+          _stop(false)
+{
+    if (threads == 0)
+        threads = 1;
+
+    for (UInt i = 0; i < threads; ++i)
+        _workers.push_back(std::thread(&ThreadPoolPageIO::workerLoop, this));
+}
+
+
+ThreadPoolPageIO::~ThreadPoolPageIO()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _workCond.notify_all();
+
+    for (std::thread &t : _workers)
+        t.join();
+}
+
+
+void ThreadPoolPageIO::submit(PageIORequest *reqs, UInt n)
+{
+    if (n == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (UInt i = 0; i < n; ++i)
+            _queue.push_back(&reqs[i]);
+        _pending += n;
+    }
+    _workCond.notify_all();
+}
+
+
+void ThreadPoolPageIO::waitAll()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_pending != 0)
+        _doneCond.wait(lock);
+}
+
+
+void ThreadPoolPageIO::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        while (!_stop && _queue.empty())
+            _workCond.wait(lock);
+
+        if (_queue.empty())             // _stop и работы не осталось
+            return;
+
+        PageIORequest *req = _queue.front();
+        _queue.pop_front();
+
+        lock.unlock();
+        executeSync(_fd, *req);
+        lock.lock();
+
+        if (--_pending == 0)
+            _doneCond.notify_all();
+    }
+}
+
+
+#ifdef __linux__
+
+//==============================================================================
+// class UringPageIO
+//==============================================================================
+
+
+UringPageIO *UringPageIO::create(int fd, UInt depth)
+{
+    UringPageIO *engine = new UringPageIO(fd);
+    if (!engine->setup(depth))
+    {
+        delete engine;
+        return nullptr;
+    }
+
+    return engine;
+}
+
+
+UringPageIO::UringPageIO(int fd)
+        : _fd(fd), _ringFd(-1),
+          _entries(0), _inFlight(0), _toSubmit(0),
+          _sqRing(MAP_FAILED), _cqRing(MAP_FAILED), _sqes(MAP_FAILED),
+          _sqRingSize(0), _cqRingSize(0), _sqesSize(0),
+          _sqHead(nullptr), _sqTail(nullptr), _sqMask(nullptr), _sqArray(nullptr),
+          _cqHead(nullptr), _cqTail(nullptr), _cqMask(nullptr), _cqes(nullptr)
+{
+}
+
+
+UringPageIO::~UringPageIO()
+{
+    // недождавшиеся запросы ссылаются на буферы вызывающего: дожидаемся
+    if (_ringFd >= 0 && (_inFlight || _toSubmit || !_backlog.empty()))
+        waitAll();
+
+    if (_sqes != MAP_FAILED)
+        munmap(_sqes, _sqesSize);
+    if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+        munmap(_cqRing, _cqRingSize);
+    if (_sqRing != MAP_FAILED)
+        munmap(_sqRing, _sqRingSize);
+    if (_ringFd >= 0)
+        ::close(_ringFd);
+}
+
+
+bool UringPageIO::setup(UInt depth)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    _ringFd = (int) syscall(__NR_io_uring_setup, depth ? depth : 1, &p);
+    if (_ringFd < 0)
+        return false;               // ENOSYS, EPERM (seccomp) и т.п.
+
+    _entries = p.sq_entries;
+    _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (_cqRingSize > _sqRingSize)
+            _sqRingSize = _cqRingSize;
+        _cqRingSize = _sqRingSize;
+    }
+
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   _ringFd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED)
+        return false;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        _cqRing = _sqRing;
+    else
+    {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       _ringFd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED)
+            return false;
+    }
+
+    _sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 _ringFd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED)
+        return false;
+
+    Byte *sq = (Byte *) _sqRing;
+    _sqHead = (unsigned *) (sq + p.sq_off.head);
+    _sqTail = (unsigned *) (sq + p.sq_off.tail);
+    _sqMask = (unsigned *) (sq + p.sq_off.ring_mask);
+    _sqArray = (unsigned *) (sq + p.sq_off.array);
+
+    Byte *cq = (Byte *) _cqRing;
+    _cqHead = (unsigned *) (cq + p.cq_off.head);
+    _cqTail = (unsigned *) (cq + p.cq_off.tail);
+    _cqMask = (unsigned *) (cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+
+    // в полете не больше, чем помещается в кольцо отправки (кольцо завершений вдвое больше)
+    _slots.resize(_entries);
+    for (UInt i = _entries; i > 0; --i)
+        _freeSlots.push_back(i - 1);
+
+    return true;
+}
+
+
+void UringPageIO::submit(PageIORequest *reqs, UInt n)
+{
+    for (UInt i = 0; i < n; ++i)
+    {
+        if (_freeSlots.empty())
+        {
+            // кольцо занято: отдаем ядру накопленное, остальное — в очередь ожидания
+            for (; i < n; ++i)
+                _backlog.push_back(&reqs[i]);
+            break;
+        }
+
+        pushRequest(&reqs[i]);
+    }
+
+    enter(_toSubmit, 0);
+}
+
+
+void UringPageIO::waitAll()
+{
+    while (_inFlight || _toSubmit || !_backlog.empty())
+    {
+        if (reap() == 0)
+            enter(_toSubmit, 1);        // ждем хотя бы одно завершение
+
+        // освободившиеся слоты — запросам из очереди ожидания
+        while (!_freeSlots.empty() && !_backlog.empty())
+        {
+            pushRequest(_backlog.front());
+            _backlog.pop_front();
+        }
+
+        if (_toSubmit)
+            enter(_toSubmit, 0);
+    }
+}
+
+
+void UringPageIO::pushRequest(PageIORequest *req)
+{
+    UInt slot = _freeSlots.back();
+    _freeSlots.pop_back();
+
+    Slot &s = _slots[slot];
+    s.req = req;
+    s.iov.iov_base = req->buf;
+    s.iov.iov_len = req->size;
+
+    unsigned tail = *_sqTail;                   // хвост двигаем только мы
+    unsigned idx = tail & *_sqMask;
+
+    io_uring_sqe *sqe = (io_uring_sqe *) _sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = _fd;
+    sqe->addr = (unsigned long long) &s.iov;
+    sqe->len = 1;
+    sqe->off = (unsigned long long) req->offset;
+    sqe->user_data = slot;
+
+    _sqArray[idx] = idx;
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ++_toSubmit;
+}
+
+
+void UringPageIO::enter(UInt toSubmit, UInt minComplete)
+{
+    if (toSubmit == 0 && minComplete == 0)
+        return;
+
+    while (true)
+    {
+        long res = syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete,
+                           minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (res >= 0)
+        {
+            _toSubmit -= (UInt) res;
+            _inFlight += (UInt) res;
+            return;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            throw std::runtime_error("io_uring_enter failed");
+
+        // ядро занято: освобождаем кольцо завершений и пробуем снова
+        if (errno != EINTR)
+            reap();
+    }
+}
+
+
+UInt UringPageIO::reap()
+{
+    UInt num = 0;
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        io_uring_cqe *cqe = (io_uring_cqe *) _cqes + (head & *_cqMask);
+        UInt slot = (UInt) cqe->user_data;
+        int res = cqe->res;
+        ++head;
+        ++num;
+
+        PageIORequest *req = _slots[slot].req;
+        _freeSlots.push_back(slot);
+        --_inFlight;
+
+        complete(req, res);
+    }
+
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+
+    return num;
+}
+
+
+void UringPageIO::complete(PageIORequest *req, int res)
+{
+    if (res < 0 || res == 0 || (UInt) res == req->size)
+    {
+        req->result = res;
+        return;
+    }
+
+    // короткая операция: хвост доделываем синхронно
+    PageIORequest rest = *req;
+    rest.buf += res;
+    rest.size -= (UInt) res;
+    rest.offset += res;
+    executeSync(_fd, rest);
+
+    req->result = (rest.result < 0) ? rest.result : res + rest.result;
+}
+
+#endif // __linux__
+
+
+} // namespace xi
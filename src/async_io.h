@@ -0,0 +1,211 @@
+﻿
+/// \file
+/// \brief     Асинхронный ввод-вывод страниц B-дерева
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле async_io.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_ASYNC_IO_H_
+#define BTREE_ASYNC_IO_H_
+
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <sys/uio.h>        // iovec
+#endif
+
+#include "utils.h"
+
+
+
+namespace xi {
+
+
+/** \brief Запрос на чтение или запись одного непрерывного блока (страницы) файла. */
+struct PageIORequest {
+    Byte* buf;                  ///< Буфер (для O_DIRECT — выровненный).
+    UInt size;                  ///< Размер блока.
+    long long offset;           ///< Смещение блока в файле.
+    bool isWrite;               ///< Истина — запись, ложь — чтение.
+
+    /** \brief Результат: число прочитанных/записанных байт или -errno.
+     *
+     *  Движок дочитывает/дописывает короткие операции сам, поэтому неотрицательный результат
+     *  меньше \c size возможен только при чтении за концом файла.
+     */
+    long result;
+}; // struct PageIORequest
+
+
+/** \brief Интерфейс движка асинхронного ввода-вывода страниц над одним дескриптором файла.
+ *
+ *  Вызывающий отправляет пачку запросов методом submit() и, пока они выполняются, может
+ *  заниматься своими делами; waitAll() дожидается завершения всех отправленных запросов.
+ *  Запросы (и их буферы) должны оставаться живыми до возврата из waitAll().
+ *  Движок не потокобезопасен: им пользуется один поток — владелец дерева.
+ */
+class IAsyncPageIO {
+public:
+    virtual ~IAsyncPageIO() {}
+
+    /** \brief Ставит в очередь \c n запросов \c reqs, не дожидаясь их выполнения. */
+    virtual void submit(PageIORequest* reqs, UInt n) = 0;
+
+    /** \brief Дожидается выполнения всех отправленных запросов. */
+    virtual void waitAll() = 0;
+
+    /** \brief Возвращает имя движка (для отчетов). */
+    virtual const char* getName() const = 0;
+
+    /** \brief Выполняет \c n запросов и дожидается их завершения. */
+    void execute(PageIORequest* reqs, UInt n)
+    {
+        submit(reqs, n);
+        waitAll();
+    }
+
+    /** \brief Создает лучший доступный движок для дескриптора \c fd: io_uring, если ядро
+     *  его поддерживает, иначе пул из \c threads потоков. \c depth — число запросов в полете.
+     */
+    static IAsyncPageIO* create(int fd, UInt depth, UInt threads);
+
+    /** \brief Синхронно выполняет запрос \c req целиком (с дочитыванием коротких операций). */
+    static void executeSync(int fd, PageIORequest& req);
+}; // class IAsyncPageIO
+
+
+/** \brief Движок на основе пула потоков: каждый поток выполняет pread()/pwrite().
+ *
+ *  Переносим на любую POSIX-систему; число одновременно выполняемых запросов равно числу потоков.
+ */
+class ThreadPoolPageIO : public IAsyncPageIO {
+public:
+    ThreadPoolPageIO(int fd, UInt threads);
+    ~ThreadPoolPageIO();
+
+protected:
+    ThreadPoolPageIO(const ThreadPoolPageIO&);                  ///< КК не доступен.
+    ThreadPoolPageIO& operator= (ThreadPoolPageIO&);            ///< Оператор присваивания недоступен.
+
+public:
+    virtual void submit(PageIORequest* reqs, UInt n) override;
+    virtual void waitAll() override;
+    virtual const char* getName() const override { return "threads"; }
+
+protected:
+    /** \brief Тело рабочего потока. */
+    void workerLoop();
+
+protected:
+    int _fd;
+    std::vector<std::thread> _workers;
+    std::deque<PageIORequest*> _queue;          ///< Ожидающие запросы.
+    UInt _pending;                              ///< Отправленные, но не выполненные запросы.
+    bool _stop;
+
+    std::mutex _mutex;
+    std::condition_variable _workCond;          ///< Появилась работа или пора завершаться.
+    std::condition_variable _doneCond;          ///< Все запросы выполнены.
+}; // class ThreadPoolPageIO
+
+
+#ifdef __linux__
+
+/** \brief Движок на основе io_uring (Linux 5.1+), работающий через системные вызовы напрямую.
+ *
+ *  Держит в полете до \c depth запросов, поэтому позволяет загрузить очередь NVMe-накопителя
+ *  из одного потока.
+ */
+class UringPageIO : public IAsyncPageIO {
+public:
+    /** \brief Создает движок с очередью на \c depth запросов; если ядро не поддерживает
+     *  io_uring (или он запрещен), возвращает nullptr.
+     */
+    static UringPageIO* create(int fd, UInt depth);
+
+    ~UringPageIO();
+
+protected:
+    UringPageIO(int fd);
+
+    UringPageIO(const UringPageIO&);                            ///< КК не доступен.
+    UringPageIO& operator= (UringPageIO&);                      ///< Оператор присваивания недоступен.
+
+public:
+    virtual void submit(PageIORequest* reqs, UInt n) override;
+    virtual void waitAll() override;
+    virtual const char* getName() const override { return "io_uring"; }
+
+protected:
+    /** \brief Настраивает кольца; возвращает ложь, если не получилось. */
+    bool setup(UInt depth);
+
+    /** \brief Кладет запрос \c req в кольцо отправки (место в кольце должно быть). */
+    void pushRequest(PageIORequest* req);
+
+    /** \brief Отправляет ядру накопленные запросы. */
+    void enter(UInt toSubmit, UInt minComplete);
+
+    /** \brief Забирает готовые результаты, возвращает их число. */
+    UInt reap();
+
+    /** \brief Обрабатывает результат запроса: короткие операции доделывает синхронно. */
+    void complete(PageIORequest* req, int res);
+
+protected:
+    int _fd;                                    ///< Дескриптор файла данных.
+    int _ringFd;                                ///< Дескриптор io_uring.
+
+    UInt _entries;                              ///< Размер кольца отправки.
+    UInt _inFlight;                             ///< Запросы в ядре.
+    UInt _toSubmit;                             ///< Запросы в кольце, еще не отправленные ядру.
+    std::deque<PageIORequest*> _backlog;        ///< Запросы, не поместившиеся в кольцо.
+
+    // отображенные кольца
+    void* _sqRing;
+    void* _cqRing;
+    void* _sqes;
+    size_t _sqRingSize;
+    size_t _cqRingSize;
+    size_t _sqesSize;
+
+    // указатели на поля колец
+    unsigned* _sqHead;
+    unsigned* _sqTail;
+    unsigned* _sqMask;
+    unsigned* _sqArray;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned* _cqMask;
+    void* _cqes;
+
+    /** \brief Слот запроса в полете: сам запрос и его вектор ввода-вывода, адрес которого
+     *  должен жить до завершения операции.
+     */
+    struct Slot {
+        PageIORequest* req;
+        struct iovec iov;
+    };
+
+    std::vector<Slot> _slots;                   ///< Слоты, номер слота — user_data запроса.
+    std::vector<UInt> _freeSlots;               ///< Свободные слоты.
+}; // class UringPageIO
+
+#endif // __linux__
+
+
+} // namespace xi
+
+
+#endif // BTREE_ASYNC_IO_H_
@@ -11,9 +11,16 @@
 
 
 #include "btree.h"
+#include "crc32c.h"
 
 #include <stdexcept>        // std::invalid_argument
 #include <cstring>          // memset
+#include <algorithm>        // std::sort
+
+#ifndef _WIN32
+#include <fcntl.h>          // open, posix_fallocate
+#include <unistd.h>         // close
+#endif
 
 
 namespace xi
@@ -28,17 +35,40 @@ namespace xi
 
 bool BaseBTree::Header::checkIntegrity()
 {
-    return (sign == VALID_SIGN) && (order >= 1) && (recSize > 0);
+    return (sign == VALID_SIGN || sign == EXT_SIGN || sign == V2_SIGN || sign == V2_EXT_SIGN)
+           && (order >= 1) && (recSize > 0);
+}
+
+
+UInt BaseBTree::Header::makeSign(UShort version, bool ext)
+{
+    if (version >= 2)
+        return ext ? V2_EXT_SIGN : V2_SIGN;
+
+    return ext ? EXT_SIGN : VALID_SIGN;
 }
 
 
 BaseBTree::BaseBTree(UShort order, UShort recSize, IComparator *comparator, std::iostream *stream)
         : _order(order),
+          _alignedPageSize(0),
+          _firstPageOfs(FIRST_PAGE_OFS),
+          _formatVersion(1),
+          _pageCrc(false),
+          _pageCrcOnCreate(false),
           _recSize(recSize),
-          _comparator(comparator),
-          _stream(stream),
           _lastPageNum(0),
-          _rootPageNum(0), _rootPage(this)
+          _rootPageNum(0),
+          _stream(stream),
+          _rootPage(this),
+          _comparator(comparator),
+          _lexKeys(comparator != nullptr && comparator->isLexicographic()),
+          _cacheSize(0),
+          _writeBack(false),
+          _latencies(nullptr),
+          _tracer(nullptr),
+          _growthExtent(0),
+          _reservedPages(0)
 {
 }
 
@@ -55,6 +85,102 @@ BaseBTree::BaseBTree(IComparator *comparator, std::iostream *stream) :
 
 BaseBTree::~BaseBTree()
 {
+    delete _latencies;
+}
+
+
+void BaseBTree::Stats::reset()
+{
+    pageReads = 0;
+    pageWrites = 0;
+    bytesRead = 0;
+    bytesWritten = 0;
+    pageAllocs = 0;
+    splits = 0;
+    keyCompares = 0;
+    cacheHits = 0;
+    cacheMisses = 0;
+}
+
+
+BaseBTree::Stats &BaseBTree::Stats::operator+=(const Stats &rhv)
+{
+    pageReads += rhv.pageReads;
+    pageWrites += rhv.pageWrites;
+    bytesRead += rhv.bytesRead;
+    bytesWritten += rhv.bytesWritten;
+    pageAllocs += rhv.pageAllocs;
+    splits += rhv.splits;
+    keyCompares += rhv.keyCompares;
+    cacheHits += rhv.cacheHits;
+    cacheMisses += rhv.cacheMisses;
+
+    return *this;
+}
+
+
+BaseBTree::Stats BaseBTree::Stats::operator-(const Stats &rhv) const
+{
+    Stats res;
+    res.pageReads = pageReads - rhv.pageReads;
+    res.pageWrites = pageWrites - rhv.pageWrites;
+    res.bytesRead = bytesRead - rhv.bytesRead;
+    res.bytesWritten = bytesWritten - rhv.bytesWritten;
+    res.pageAllocs = pageAllocs - rhv.pageAllocs;
+    res.splits = splits - rhv.splits;
+    res.keyCompares = keyCompares - rhv.keyCompares;
+    res.cacheHits = cacheHits - rhv.cacheHits;
+    res.cacheMisses = cacheMisses - rhv.cacheMisses;
+
+    return res;
+}
+
+
+void BaseBTree::Latencies::reset()
+{
+    insert.reset();
+    search.reset();
+    searchAll.reset();
+    pageRead.reset();
+    pageWrite.reset();
+}
+
+
+void BaseBTree::Latencies::printText(std::ostream &os) const
+{
+    insert.printText(os, "insert");
+    search.printText(os, "search");
+    searchAll.printText(os, "searchAll");
+    pageRead.printText(os, "pageRead");
+    pageWrite.printText(os, "pageWrite");
+}
+
+
+void BaseBTree::Latencies::printJson(std::ostream &os) const
+{
+    os << "{\"insert\": ";
+    insert.printJson(os);
+    os << ", \"search\": ";
+    search.printJson(os);
+    os << ", \"searchAll\": ";
+    searchAll.printJson(os);
+    os << ", \"pageRead\": ";
+    pageRead.printJson(os);
+    os << ", \"pageWrite\": ";
+    pageWrite.printJson(os);
+    os << "}";
+}
+
+
+void BaseBTree::setLatencyTracking(bool on)
+{
+    if (!on)
+    {
+        delete _latencies;
+        _latencies = nullptr;
+    }
+    else if (!_latencies)
+        _latencies = new Latencies();
 }
 
 
@@ -62,8 +188,14 @@ void BaseBTree::resetBTree()
 {
     _order = 0;
     _recSize = 0;
+    _lastPageNum = 0;           // иначе новое дерево продолжит нумерацию страниц закрытого
+    _rootPageNum = 0;
+    _rootPage._pageNum = 0;
+    _reservedPages = 0;
     _stream = nullptr;
-    _comparator = nullptr;      // для порядку его тоже сбасываем, но это не очень обязательно
+    _pageCache.reset(0, 0, 0);  // кадры кэша освобождаем, заданная емкость остается
+    _prefetchPnums.clear();     // хранилище уже закрыто и дождалось своих запросов
+    setComparator(nullptr);     // для порядку его тоже сбасываем, но это не очень обязательно
 }
 
 
@@ -73,19 +205,311 @@ void BaseBTree::readPage(UInt pnum, Byte *dst)
     if (pnum == 0 || pnum > getLastPageNum())
         throw std::invalid_argument("Can't read a non-existing page");
 
-    readPageInternal(pnum, dst);
+    tracePage(pnum, false);
+    completePrefetch();
+    if (!_pageCache.isEnabled())
+    {
+        {
+            LatencyTimer timer(getIoHistogram(false));
+            readPageInternal(pnum, dst);
+        }
+        countPageReads(1);
+        checkPageCrc(pnum, dst);
+        return;
+    }
+
+    Byte *frame = _pageCache.find(pnum);
+    if (frame)
+        ++_stats.cacheHits;
+    else
+    {
+        // промах: читаем страницу прямо в кадр кэша
+        ++_stats.cacheMisses;
+        countPageReads(1);
+        frame = insertCacheFrame(pnum);
+        try
+        {
+            {
+                LatencyTimer timer(getIoHistogram(false));
+                readPageInternal(pnum, frame);
+            }
+            checkPageCrc(pnum, frame);
+        }
+        catch (...)
+        {
+            _pageCache.invalidate(pnum);
+            throw;
+        }
+    }
+
+    memcpy(dst, frame, getNodePageSize());
 }
 
 
 void BaseBTree::writePage(UInt pnum, const Byte *dst)
+{
+    if (!_pageCrc)
+    {
+        writeStampedPage(pnum, dst);
+        return;
+    }
+
+    // чужой буфер менять нельзя: сумму дописываем в копию
+    _crcBuf.assign(dst, dst + getNodePageSize());
+    stampPageCrc(pnum, _crcBuf.data());
+    writeStampedPage(pnum, _crcBuf.data());
+}
+
+
+void BaseBTree::writePage(UInt pnum, Byte *dst)
+{
+    if (_pageCrc)
+        stampPageCrc(pnum, dst);
+
+    writeStampedPage(pnum, dst);
+}
+
+
+void BaseBTree::writeStampedPage(UInt pnum, const Byte *dst)
 {
     checkForOpenStream();
 
     if (pnum == 0 || pnum > getLastPageNum())
         throw std::invalid_argument("Can't write a non-existing page");
 
-    writePageInternal(pnum, dst);
+    storePage(pnum, dst);
+}
+
+
+void BaseBTree::storePage(UInt pnum, const Byte *src)
+{
+    tracePage(pnum, true);
+    completePrefetch();
+    cachePage(pnum, src);
+
+    // отложенная запись: страница остается в кэше грязной до ближайшего сброса
+    if (_writeBack && _pageCache.isEnabled() && !getResidentPage(pnum))
+    {
+        _pageCache.setDirty(pnum, true);
+        return;
+    }
+
+    {
+        LatencyTimer timer(getIoHistogram(true));
+        writePageInternal(pnum, src);
+    }
+    countPageWrites(1);
+}
+
+
+Byte *BaseBTree::insertCacheFrame(UInt pnum)
+{
+    if (!_pageCache.contains(pnum) && _pageCache.isVictimDirty())
+        checkpoint();
+
+    return _pageCache.insert(pnum);
+}
+
+
+void BaseBTree::setWriteBack(bool on)
+{
+    if (!on && isOpen())
+        checkpoint();
+
+    _writeBack = on;
+}
+
+
+void BaseBTree::checkpoint()
+{
+    completePrefetch();
+    if (!_pageCache.getDirtyCount())
+        return;
+
+    std::vector<UInt> pnums;
+    _pageCache.getDirtyPages(pnums);
+
+    std::vector<const Byte*> srcs(pnums.size());
+    for (size_t i = 0; i < pnums.size(); ++i)
+        srcs[i] = _pageCache.peek(pnums[i]);
 
+    LatencyTimer timer(getIoHistogram(true));
+    writePagesInternal((UInt) pnums.size(), pnums.data(), srcs.data());
+    recordIoBatch(timer, (UInt) pnums.size());
+    countPageWrites((UInt) pnums.size());
+
+    // чистыми помечаем только после успешной записи всей пачки
+    for (UInt pnum : pnums)
+        _pageCache.setDirty(pnum, false);
+}
+
+
+void BaseBTree::readPages(UInt n, const UInt *pnums, Byte *const *dsts)
+{
+    checkForOpenStream();
+    for (UInt i = 0; i < n; ++i)
+        if (pnums[i] == 0 || pnums[i] > getLastPageNum())
+            throw std::invalid_argument("Can't read a non-existing page");
+
+    for (UInt i = 0; i < n; ++i)
+        tracePage(pnums[i], false);
+
+    completePrefetch();
+    if (!_pageCache.isEnabled())
+    {
+        LatencyTimer timer(getIoHistogram(false));
+        readPagesInternal(n, pnums, dsts);
+        recordIoBatch(timer, n);
+        countPageReads(n);
+        for (UInt i = 0; i < n; ++i)
+            checkPageCrc(pnums[i], dsts[i]);
+        return;
+    }
+
+    // попадания копируем сразу, промахи собираем в одну пачку
+    std::vector<UInt> missNums;
+    std::vector<Byte*> missDsts;
+    for (UInt i = 0; i < n; ++i)
+    {
+        const Byte *frame = _pageCache.find(pnums[i]);
+        if (frame)
+            memcpy(dsts[i], frame, getNodePageSize());
+        else
+        {
+            missNums.push_back(pnums[i]);
+            missDsts.push_back(dsts[i]);
+        }
+    }
+
+    _stats.cacheHits += n - missNums.size();
+    _stats.cacheMisses += missNums.size();
+    if (missNums.empty())
+        return;
+
+    LatencyTimer timer(getIoHistogram(false));
+    readPagesInternal((UInt) missNums.size(), missNums.data(), missDsts.data());
+    recordIoBatch(timer, (UInt) missNums.size());
+    countPageReads((UInt) missNums.size());
+    for (size_t i = 0; i < missNums.size(); ++i)
+        checkPageCrc(missNums[i], missDsts[i]);
+    for (size_t i = 0; i < missNums.size(); ++i)
+        cachePage(missNums[i], missDsts[i]);
+}
+
+
+void BaseBTree::prefetchPages(UInt n, const UInt *pnums)
+{
+    if (!_pageCache.isEnabled())
+        return;
+
+    checkForOpenStream();
+    completePrefetch();
+
+    // больше, чем вмещает кэш, загружать бессмысленно: кадры вытеснят друг друга
+    std::vector<UInt> missNums;
+    std::vector<Byte*> frames;
+    for (UInt i = 0; i < n && missNums.size() < _pageCache.getCapacity(); ++i)
+    {
+        UInt pnum = pnums[i];
+        if (pnum == 0 || pnum > getLastPageNum())
+            throw std::invalid_argument("Can't read a non-existing page");
+
+        if (_pageCache.contains(pnum))          // заодно отсекает повторы
+            continue;
+
+        missNums.push_back(pnum);
+        frames.push_back(insertCacheFrame(pnum));
+    }
+
+    if (missNums.empty())
+        return;
+
+    // асинхронно: кадры заняты до completePrefetch(), а вызывающий тем временем работает
+    countPageReads((UInt) missNums.size());
+    bool started;
+    try
+    {
+        started = beginReadPagesInternal((UInt) missNums.size(), missNums.data(), frames.data());
+    }
+    catch (...)
+    {
+        for (UInt pnum : missNums)
+            _pageCache.invalidate(pnum);
+        throw;
+    }
+
+    if (started)
+    {
+        _prefetchPnums.swap(missNums);
+        return;
+    }
+
+    try
+    {
+        LatencyTimer timer(getIoHistogram(false));
+        readPagesInternal((UInt) missNums.size(), missNums.data(), frames.data());
+        recordIoBatch(timer, (UInt) missNums.size());
+        for (size_t i = 0; i < missNums.size(); ++i)
+            checkPageCrc(missNums[i], frames[i]);
+    }
+    catch (...)
+    {
+        for (UInt pnum : missNums)
+            _pageCache.invalidate(pnum);
+        throw;
+    }
+}
+
+
+void BaseBTree::finishPrefetch()
+{
+    std::vector<UInt> pnums;
+    pnums.swap(_prefetchPnums);
+
+    try
+    {
+        endReadPagesInternal();
+        for (UInt pnum : pnums)
+            checkPageCrc(pnum, _pageCache.peek(pnum));
+    }
+    catch (...)
+    {
+        for (UInt pnum : pnums)
+            _pageCache.invalidate(pnum);
+        throw;
+    }
+}
+
+
+void BaseBTree::cachePage(UInt pnum, const Byte *src)
+{
+    if (!_pageCache.isEnabled())
+        return;
+
+    completePrefetch();
+
+    Byte *frame = insertCacheFrame(pnum);
+    if (frame != src)
+        memcpy(frame, src, getNodePageSize());
+}
+
+
+void BaseBTree::setCacheSize(UInt pages)
+{
+    _cacheSize = pages;
+
+    if (isOpen())
+    {
+        checkpoint();               // отбрасываемый кэш может держать грязные страницы
+        resetPageCache();
+    }
+}
+
+
+void BaseBTree::resetPageCache()
+{
+    completePrefetch();
+    _pageCache.reset(_cacheSize, getNodePageSize(), getPageBufAlign());
 }
 
 
@@ -133,6 +557,8 @@ void BaseBTree::insert(const xi::Byte *k)
 
     if (k == nullptr)
         return;;
+    LatencyTimer timer(_latencies ? &_latencies->insert : nullptr);
+    traceOp();
     //create a new root to insert
     UInt newRoot = _rootPageNum;
 
@@ -144,7 +570,7 @@ void BaseBTree::insert(const xi::Byte *k)
 
         _rootPage.setCursor(0, newRoot); //set the cursor for the new root
 
-        _rootPageNum = _rootPage.getPageNum(); //write the new page number as root
+        setRootPageNum(_rootPage.getPageNum()); //write the new page number as root (to the file as well)
 
         _rootPage.splitChild(0); //split
 
@@ -161,45 +587,46 @@ void BaseBTree::insert(const xi::Byte *k)
 
 Byte *BaseBTree::search(const Byte *k)
 {
-    // TODO: релаизовать студентам!
+    if (k == nullptr)
+        return nullptr;
 
+    if (!_comparator)
+        throw std::runtime_error("Comparator not set. Can't search");
+
+    LatencyTimer timer(_latencies ? &_latencies->search : nullptr);
+    traceOp();
     PageWrapper currentPage(this); //create a new object to write page data
 
     currentPage.readPage(_rootPageNum); //start the search from the root, read data from it
 
-    UShort key; //key storage variable
-
-    //a cycle in order to search for elements, we will leave as soon as we reach the end of the tree,
-    //or we will return the key, or nullptr if it is not found
+    //go down the tree until the key is found or a leaf is reached
     while (true)
     {
-        key = currentPage.getKeysNum(); //remember the key of the current page
+        //the first key on the page that is not less than k
+        UShort i = currentPage.lowerBound(k);
 
-        UShort i = 0; //create a counter so that it is visible outside the nested loop while
-
-        //go over the page and look for the item you want
-        while (i < key && _comparator->compare(currentPage.getKey(i), k, _recSize))
-        {
-            //if the item is found then return it
-            if (i < key && _comparator->isEqual(k, currentPage.getKey(i), _recSize))
-                return new Byte(*currentPage.getKey(i));
-
-            ++i;
-        }
+        //if the item is found then return its copy
+        if (i < currentPage.getKeysNum() && isKeysEqual(k, currentPage.getKey(i)))
+            return cloneKey(currentPage.getKey(i));
 
         //if the page has no descendants, return nullptr
         if (currentPage.isLeaf())
             return nullptr;
-        else
-            currentPage.readPageFromChild(currentPage, i); //otherwise look for an element in the descendants
 
+        currentPage.readPageFromChild(currentPage, i); //otherwise look for an element in the descendants
     }
 }
 
 int BaseBTree::searchAll(const Byte *k, std::list<Byte *> &keys)
 {
-    // TODO: релаизовать студентам!   
+    if (k == nullptr)
+        return 0;
+
+    if (!_comparator)
+        throw std::runtime_error("Comparator not set. Can't search");
 
+    LatencyTimer timer(_latencies ? &_latencies->searchAll : nullptr);
+    traceOp();
     _rootPage.readPage(_rootPageNum); //start the search from the root, read data from it
 
     int needKey = _rootPage.searchAll(k, keys); //start the search but from the object PageWrapper
@@ -209,17 +636,13 @@ int BaseBTree::searchAll(const Byte *k, std::list<Byte *> &keys)
 
 int BaseBTree::PageWrapper::searchAll(const Byte *k, std::list<Byte *> &keys)
 {
-    // TODO: релаизовать студентам!
-
     PageWrapper currentPage(_tree); //create a new page for working with wood
     int counNeedElement = 0;    //counter to count the number of items sought
 
     UShort key = getKeysNum(); //remember the current key
 
-    UShort i = 0; //create a counter
-    //run up the page to find the highest index of the desired item
-    while (i < key && _tree->_comparator->compare(getKey(i), k, _tree->_recSize))
-        ++i;
+    //the first key on the page that is not less than k
+    UShort i = lowerBound(k);
 
     //if our node is not a leaf, then go to its leftmost descendant
     if (!isLeaf())
@@ -231,11 +654,12 @@ int BaseBTree::PageWrapper::searchAll(const Byte *k, std::list<Byte *> &keys)
     }
 
     //go over the page to find all the desired items, if they exist
-    while (i < key && _tree->_comparator->isEqual(k, getKey(i), _tree->_recSize))
+    while (i < key && _tree->isKeysEqual(k, getKey(i)))
     {
         //if found, add its key to the list, and increase the counter
         ++counNeedElement;
-        keys.push_back(new Byte(*getKey(++i)));
+        keys.push_back(_tree->cloneKey(getKey(i)));
+        ++i;
 
         //check the right subtree like the left
         if (!isLeaf())
@@ -248,18 +672,193 @@ int BaseBTree::PageWrapper::searchAll(const Byte *k, std::list<Byte *> &keys)
     return counNeedElement;
 }
 
+
+int BaseBTree::searchRange(const Byte *from, const Byte *to, std::list<Byte *> &keys)
+{
+    RangeCursor cur(this);
+    cur.seek(from, to);
+
+    int num = 0;
+    while (cur.next())
+    {
+        keys.push_back(cloneKey(cur.getKey()));
+        ++num;
+    }
+
+    return num;
+}
+
+
+void BaseBTree::searchBatch(UInt n, const Byte *const *keys, Byte **results)
+{
+    if (!_comparator)
+        throw std::runtime_error("Comparator not set. Can't search");
+
+    for (UInt i = 0; i < n; ++i)
+        results[i] = nullptr;
+
+    if (_rootPageNum == 0)
+        return;
+
+    traceOp();
+    completePrefetch();
+
+    // ключи в пути: (номер страницы текущего уровня, номер ключа)
+    std::vector<std::pair<UInt, UInt> > active;
+    for (UInt i = 0; i < n; ++i)
+        if (keys[i])
+            active.push_back(std::make_pair(_rootPageNum, i));
+
+    std::vector<PageWrapper *> pages;               // обертки уникальных страниц уровня
+    std::vector<UInt> pnums;
+    std::vector<char> isMiss;
+    std::vector<UInt> missNums;
+    std::vector<Byte *> missDsts;
+
+    try
+    {
+        while (!active.empty())
+        {
+            // группируем ключи по страницам: каждая страница уровня читается один раз
+            std::sort(active.begin(), active.end());
+            pnums.clear();
+            for (const std::pair<UInt, UInt> &a : active)
+                if (pnums.empty() || pnums.back() != a.first)
+                    pnums.push_back(a.first);
+
+            while (pages.size() < pnums.size())
+                pages.push_back(new PageWrapper(this));
+
+            // промахи кэша читаем одной пачкой в собственные буферы оберток
+            // (страницы, постоянно находящиеся в памяти, промахами не считаются)
+            isMiss.assign(pnums.size(), 0);
+            missNums.clear();
+            missDsts.clear();
+            for (size_t j = 0; j < pnums.size(); ++j)
+            {
+                if (_pageCache.contains(pnums[j]) || getResidentPage(pnums[j]))
+                    continue;
+
+                PageWrapper &pw = *pages[j];
+                if (!pw.isDataOwned())
+                    pw.reallocData(getNodePageSize());
+                pw._pageNum = pnums[j];
+
+                isMiss[j] = 1;
+                missNums.push_back(pnums[j]);
+                missDsts.push_back(pw.getData());
+            }
+
+            if (!missNums.empty())
+                readPages((UInt) missNums.size(), missNums.data(), missDsts.data());
+
+            // попадания используем прямо из кадров кэша и просим процессор подгрузить
+            // начало страницы и середину области ключей, с которой начнется бинарный поиск
+            for (size_t j = 0; j < pnums.size(); ++j)
+            {
+                PageWrapper &pw = *pages[j];
+                if (!isMiss[j])
+                {
+                    Byte *frame = _pageCache.find(pnums[j]);
+                    if (frame)
+                    {
+                        ++_stats.cacheHits;
+                        pw.attachData(frame, pnums[j]);
+                    }
+                    else
+                        pw.readPage(pnums[j]);      // страница в памяти или кадр уже вытеснен
+                }
+
+                prefetchRead(pw.getData());
+                prefetchRead(pw.getData() + KEYS_OFS + getKeysSize() / 2);
+            }
+
+            // поиск в узлах; ключи, которым надо спускаться дальше, переносим на следующий уровень
+            size_t next = 0;
+            size_t j = 0;
+            for (size_t a = 0; a < active.size(); ++a)
+            {
+                while (pnums[j] != active[a].first)
+                    ++j;
+
+                PageWrapper &pw = *pages[j];
+                UInt idx = active[a].second;
+                const Byte *k = keys[idx];
+
+                UShort i = pw.lowerBound(k);
+                if (i < pw.getKeysNum() && isKeysEqual(k, pw.getKey(i)))
+                {
+                    results[idx] = cloneKey(pw.getKey(i));
+                    continue;
+                }
+
+                if (pw.isLeaf())
+                    continue;
+
+                active[next++] = std::make_pair(pw.getCursor(i), idx);
+            }
+            active.resize(next);
+        }
+    }
+    catch (...)
+    {
+        for (PageWrapper *pw : pages)
+            delete pw;
+        for (UInt i = 0; i < n; ++i)
+        {
+            delete[] results[i];
+            results[i] = nullptr;
+        }
+        throw;
+    }
+
+    for (PageWrapper *pw : pages)
+        delete pw;
+}
+
+
+Byte *BaseBTree::cloneKey(const Byte *k) const
+{
+    Byte *res = new Byte[_recSize];
+    memcpy(res, k, _recSize);
+
+    return res;
+}
+
 //UInt BaseBTree::allocPageInternal(UShort keysNum, NodeType nt, PageWrapper& pw)
 UInt BaseBTree::allocPageInternal(PageWrapper &pw, UShort keysNum, bool isRoot, bool isLeaf)
 {
-    // подготовим страничку для вывода
+    // подготовим страничку для вывода; представление чужой страницы затирать нельзя
+    if (!pw.isDataOwned())
+        pw.reallocData(getNodePageSize());
     pw.clear();
     pw.setKeyNumLeaf(keysNum, isRoot, isLeaf);    // nt);
+    ++_stats.pageAllocs;
+    if (_pageCrc)
+        stampPageCrc(_lastPageNum + 1, pw.getData());
 
-    // пока что просто позиционируемся в конец, считая, что так и будет, но держать под контролем
-    _stream->seekg(0, std::ios_base::end);
-    _stream->write((const char *) pw.getData(), getNodePageSize());
+    // резервируем место экстентом, если следующая страница в зарезервированное не влезает
+    if (_growthExtent && _lastPageNum + 1 > _reservedPages)
+    {
+        UInt target = _lastPageNum + _growthExtent;
+        growStorage(target);
+        _reservedPages = target;
+    }
 
+    // пишем на место следующей страницы: при выровненной геометрии оно может
+    // не совпадать с концом файла, если заголовок еще не дополнен до границы страницы;
+    // страница уже должна считаться существующей (в отложенном режиме она попадает в кэш)
     ++_lastPageNum;
+    try
+    {
+        storePage(_lastPageNum, pw.getData());
+    }
+    catch (...)
+    {
+        _pageCache.invalidate(_lastPageNum);
+        --_lastPageNum;
+        throw;
+    }
     writePageCounter();
 
 
@@ -286,15 +885,39 @@ void BaseBTree::writePageInternal(UInt pnum, const Byte *dst)
 }
 
 
+void BaseBTree::readPagesInternal(UInt n, const UInt *pnums, Byte *const *dsts)
+{
+    for (UInt i = 0; i < n; ++i)
+        readPageInternal(pnums[i], dsts[i]);
+}
+
+
+void BaseBTree::writePagesInternal(UInt n, const UInt *pnums, const Byte *const *srcs)
+{
+    for (UInt i = 0; i < n; ++i)
+        writePageInternal(pnums[i], srcs[i]);
+}
+
+
 void BaseBTree::gotoPage(UInt pnum)
 {
-    // рассчитаем смещение до нужной страницы
-    UInt pageOfs = FIRST_PAGE_OFS + getNodePageSize() * (pnum - 1);     // т.к. нумеруются с единицы
+    // рассчитаем смещение до нужной страницы (в 64 битах, иначе за 4 ГиБ смещение переполняется)
+    std::streamoff pageOfs = getPageOffset(pnum);
     _stream->seekg(pageOfs, std::ios_base::beg);
 }
 
 
 void BaseBTree::loadTree()
+{
+    loadHeader();
+    preparePageStorage(false);
+
+    // загрузить корневую страницу
+    loadRootPage();
+}
+
+
+void BaseBTree::loadHeader()
 {
     // _stream->seekg(0, std::ios_base::beg);       // пока загружаем с текущего места в потоке!
     // читаем заголовок
@@ -316,8 +939,34 @@ void BaseBTree::loadTree()
         throw std::runtime_error("Stream is not a valid xi B-tree file");
     }
 
+    // для расширенного заголовка дочитываем геометрию страниц
+    UInt pageSize = 0;
+    bool pageCrc = false;
+    if (hdr.isExtended())
+    {
+        HeaderExt ext;
+        _stream->seekg(HEADER_EXT_OFS, std::ios_base::beg);
+        _stream->read((char *) &ext, HEADER_EXT_SIZE);
+
+        if (_stream->fail() || ext.pageSize < MIN_ALIGNED_PAGE_SIZE
+                || (ext.pageSize & (ext.pageSize - 1)) != 0)
+            throw std::runtime_error("Stream is not a valid xi B-tree file: bad page geometry");
+
+        if (ext.flags & ~HeaderExt::KNOWN_FLAGS)
+            throw std::runtime_error("B-tree file uses unsupported features");
+
+        if ((ext.flags & HeaderExt::STORAGE_FLAGS) != getStorageFlags())
+            throw std::runtime_error("B-tree file page storage doesn't match the tree class");
+
+        pageSize = ext.pageSize;
+        pageCrc = (ext.flags & HeaderExt::FLAG_PAGE_CRC) != 0;
+    }
+    else if (getStorageFlags())
+        throw std::runtime_error("B-tree file page storage doesn't match the tree class");
+
     // задаем порядок и т.д.
-    setOrder(hdr.order, hdr.recSize);
+    setOrder(hdr.order, hdr.recSize, pageSize, pageCrc);
+    _formatVersion = hdr.getVersion();
 
     // далее без проверки читаем два следующих поля
     readPageCounter();             // номер текущей свободной страницы
@@ -329,10 +978,6 @@ void BaseBTree::loadTree()
         //_fileStream.close();
         throw std::runtime_error("Can't read necessary fields. File corrupted");
     }
-
-    // загрузить корневую страницу
-    loadRootPage();
-
 }
 
 
@@ -349,6 +994,12 @@ void BaseBTree::loadRootPage()  //PageWrapper& pw)
 
 void BaseBTree::createTree(UShort order, UShort recSize)
 {
+    if (_pageCrcOnCreate)
+        throw std::invalid_argument("Page checksums require aligned page geometry");
+
+    if (getStorageFlags())
+        throw std::invalid_argument("The page storage requires aligned page geometry");
+
     setOrder(order, recSize);
 
     writeHeader();                  // записываем заголовок файла
@@ -357,10 +1008,69 @@ void BaseBTree::createTree(UShort order, UShort recSize)
 
 
     // создать корневую страницу
+    preparePageStorage(true);
+    createRootPage();
+}
+
+
+void BaseBTree::createAlignedTree(UInt pageSize, UShort recSize)
+{
+    checkPageSize(pageSize, recSize);
+
+    // контрольная сумма занимает хвост страницы, узел должен поместиться перед ней
+    UInt crcSize = _pageCrcOnCreate ? PAGE_CRC_SZ : 0;
+    UShort order = calcOrderForPageSize(recSize, pageSize - crcSize);
+    if (order < 1)
+        throw std::invalid_argument("Page size is too small for the record size");
+
+    setOrder(order, recSize, pageSize, _pageCrcOnCreate);
+
+    writeHeader();                  // записываем заголовок файла (вместе с расширением)
+    writePageCounter();             // и номер текущей свободной страницы
+    writeRootPageNum();             // и номер корневой страницы
+
+    preparePageStorage(true);
     createRootPage();
 }
 
 
+UShort BaseBTree::calcOrderForPageSize(UShort recSize, UInt pageSize)
+{
+    // узел порядка t: KEYS_OFS + recSize * (2t - 1) + CURSOR_SZ * 2t <= pageSize
+    UInt perOrder = 2 * (recSize + CURSOR_SZ);
+    if (pageSize + recSize < KEYS_OFS + perOrder)
+        return 0;
+
+    UInt order = (pageSize + recSize - KEYS_OFS) / perOrder;
+
+    // не больше, чем позволяет поле числа ключей
+    UInt maxOrder = (MAX_KEYS_NUM + 1) / 2;
+    if (order > maxOrder)
+        order = maxOrder;
+
+    return (UShort) order;
+}
+
+
+void BaseBTree::checkPageSize(UInt pageSize, UShort recSize)
+{
+    if (pageSize < MIN_ALIGNED_PAGE_SIZE || (pageSize & (pageSize - 1)) != 0)
+        throw std::invalid_argument("Page size must be a power of 2 not less than 512");
+
+    if (calcOrderForPageSize(recSize, pageSize) < 1)
+        throw std::invalid_argument("Page size is too small for the record size");
+}
+
+
+UInt BaseBTree::getPageBufAlign() const
+{
+    if (!_alignedPageSize)
+        return CACHE_LINE_SIZE;
+
+    return (_alignedPageSize < MAX_BUF_ALIGN) ? _alignedPageSize : MAX_BUF_ALIGN;
+}
+
+
 void BaseBTree::createRootPage()
 {
     _rootPage.allocPage(0, true);
@@ -378,9 +1088,32 @@ void BaseBTree::checkForOpenStream()
 
 void BaseBTree::writeHeader()
 {
+    // у дерева без потока (см. MemoryBaseBTree) метаданные живут только в памяти
+    if (!_stream)
+        return;
+
     Header hdr(_order, _recSize);
+    hdr.sign = Header::makeSign(_formatVersion, _alignedPageSize != 0);
+    _stream->seekg(HEADER_OFS, std::ios_base::beg);
     _stream->write((const char *) (void *) &hdr, HEADER_SIZE);
 
+    if (!_alignedPageSize)
+        return;
+
+    // расширение заголовка и дополнение нулями до первой страницы
+    HeaderExt ext(_alignedPageSize);
+    ext.flags = getStorageFlags();
+    if (_pageCrc)
+        ext.flags |= HeaderExt::FLAG_PAGE_CRC;
+    _stream->seekg(HEADER_EXT_OFS, std::ios_base::beg);
+    _stream->write((const char *) (void *) &ext, HEADER_EXT_SIZE);
+
+    UInt padSize = _firstPageOfs - (HEADER_EXT_OFS + HEADER_EXT_SIZE);
+    Byte *pad = new Byte[padSize];
+    memset(pad, 0, padSize);
+    _stream->write((const char *) pad, padSize);
+    delete[] pad;
+
 }
 
 void BaseBTree::readHeader(Header &hdr)
@@ -393,6 +1126,13 @@ void BaseBTree::readHeader(Header &hdr)
 
 void BaseBTree::writePageCounter() //UInt pc)
 {
+    // файл перерос адресацию формата v1 — переводим его на v2, чтобы старые читатели его не открыли
+    if (_formatVersion < 2 && _lastPageNum && getPageOffset(_lastPageNum) > V1_MAX_PAGE_OFS)
+        setFormatVersion(2);
+
+    if (!_stream)
+        return;
+
     _stream->seekg(PAGE_COUNTER_OFS, std::ios_base::beg);
     _stream->write((const char *) &_lastPageNum, PAGE_COUNTER_SZ);
 }
@@ -408,6 +1148,9 @@ void BaseBTree::readPageCounter()
 
 void BaseBTree::writeRootPageNum() //UInt rpn)
 {
+    if (!_stream)
+        return;
+
     _stream->seekg(ROOT_PAGE_NUM_OFS, std::ios_base::beg);
     _stream->write((const char *) &_rootPageNum, ROOT_PAGE_NUM_SZ);
 
@@ -422,6 +1165,21 @@ void BaseBTree::readRootPageNum()
 }
 
 
+void BaseBTree::setFormatVersion(UShort version)
+{
+    checkForOpenStream();
+
+    if (version < 1 || version > MAX_FORMAT_VERSION)
+        throw std::invalid_argument("Unsupported B-tree file format version");
+
+    if (version < 2 && _lastPageNum && getPageOffset(_lastPageNum) > V1_MAX_PAGE_OFS)
+        throw std::invalid_argument("B-tree file is too large for format version 1");
+
+    _formatVersion = version;
+    writeHeader();
+}
+
+
 void BaseBTree::setRootPageNum(UInt pnum, bool writeFlag /*= true*/)
 {
     _rootPageNum = pnum;
@@ -430,7 +1188,7 @@ void BaseBTree::setRootPageNum(UInt pnum, bool writeFlag /*= true*/)
 }
 
 
-void BaseBTree::setOrder(UShort order, UShort recSize)
+void BaseBTree::setOrder(UShort order, UShort recSize, UInt pageSize /*= 0*/, bool pageCrc /*= false*/)
 {
     // метод закрытый, корректность параметров должно проверять в вызывающих методах
 
@@ -448,6 +1206,20 @@ void BaseBTree::setOrder(UShort order, UShort recSize)
     _cursorsOfs = _keysSize + KEYS_OFS;             // смещение области курсоров на дочерние
     _nodePageSize = _cursorsOfs + CURSOR_SZ * (2 * order);  // размер узла целиком, опр. концом области страницы
 
+    // при выровненной геометрии страница занимает ровно pageSize байт, заголовок — тоже
+    _alignedPageSize = pageSize;
+    _firstPageOfs = FIRST_PAGE_OFS;
+    _formatVersion = 1;                 // новое дерево начинается с формата v1
+    _pageCrc = pageCrc;
+    if (pageSize)
+    {
+        if (_nodePageSize + (pageCrc ? PAGE_CRC_SZ : 0) > pageSize)
+            throw std::invalid_argument("B-tree node doesn't fit into the page");
+
+        _nodePageSize = pageSize;
+        _firstPageOfs = pageSize;
+    }
+
     // Q: номер текущей корневой надо устанавливать?
 
     // пока-что распределяем память под рабочую страницу/узел здесь, но это сомнительно
@@ -455,9 +1227,70 @@ void BaseBTree::setOrder(UShort order, UShort recSize)
 }
 
 
+void BaseBTree::stampPageCrc(UInt pnum, Byte *page) const
+{
+    UInt crcOfs = _nodePageSize - PAGE_CRC_SZ;
+    UInt crc = crc32c(page, crcOfs, pnum);      // номер страницы ловит запись не на свое место
+    memcpy(page + crcOfs, &crc, PAGE_CRC_SZ);
+}
+
+
+bool BaseBTree::isPageCrcValid(UInt pnum, const Byte *page) const
+{
+    UInt crcOfs = _nodePageSize - PAGE_CRC_SZ;
+    UInt crc;
+    memcpy(&crc, page + crcOfs, PAGE_CRC_SZ);
+
+    return crc == crc32c(page, crcOfs, pnum);
+}
+
+
+void BaseBTree::checkPageCrc(UInt pnum, const Byte *page) const
+{
+    if (_pageCrc && !isPageCrcValid(pnum, page))
+        throw std::runtime_error("Page checksum mismatch: page is corrupted");
+}
+
+
+UInt BaseBTree::verifyPages(std::vector<UInt> *bad /*= nullptr*/)
+{
+    checkForOpenStream();
+    if (!_pageCrc)
+        throw std::runtime_error("Page checksums are not enabled for the B-tree");
+
+    checkpoint();                   // проверяем то, что действительно лежит на носителе
+
+    Byte *page = allocAligned(_nodePageSize, getPageBufAlign());
+    UInt badNum = 0;
+    try
+    {
+        for (UInt p = 1; p <= _lastPageNum; ++p)
+        {
+            readPageInternal(p, page);
+            countPageReads(1);
+            if (isPageCrcValid(p, page))
+                continue;
+
+            ++badNum;
+            if (bad)
+                bad->push_back(p);
+        }
+    }
+    catch (...)
+    {
+        freeAligned(page);
+        throw;
+    }
+    freeAligned(page);
+
+    return badNum;
+}
+
+
 void BaseBTree::reallocWorkPages()
 {
     _rootPage.reallocData(_nodePageSize);
+    resetPageCache();
 }
 
 
@@ -468,7 +1301,7 @@ void BaseBTree::reallocWorkPages()
 
 
 BaseBTree::PageWrapper::PageWrapper(BaseBTree *tr) :
-        _data(nullptr), _tree(tr), _pageNum(0)
+        _data(nullptr), _tree(tr), _pageNum(0), _ownsData(true)
 {
     // если к моменту создания странички дерево уже в работе (открыто), надо
     // сразу распределить память!
@@ -486,14 +1319,27 @@ BaseBTree::PageWrapper::~PageWrapper()
 
 void BaseBTree::PageWrapper::reallocData(UInt sz)
 {
-    if (_data)
-        delete[] _data;
+    if (_data && _ownsData)
+        freeAligned(_data);
+    _data = nullptr;
+    _ownsData = true;
 
+    // буферы выравниваем хотя бы по строке кэша, а для выровненных страниц — по странице
     if (sz)
-        _data = new Byte[sz];
+        _data = allocAligned(sz, _tree->getPageBufAlign());
+
+}
+
+void BaseBTree::PageWrapper::attachData(Byte *data, UInt pnum)
+{
+    reallocData(0);
 
+    _data = data;
+    _ownsData = false;
+    _pageNum = pnum;
 }
 
+
 void BaseBTree::PageWrapper::clear()
 {
     if (!_data)
@@ -504,6 +1350,22 @@ void BaseBTree::PageWrapper::clear()
 }
 
 
+void BaseBTree::PageWrapper::clearUnused()
+{
+    if (!_data)
+        return;
+
+    UShort keysNum = getKeysNum();
+    UInt recSize = _tree->getRecSize();
+    memset(_data + KEYS_OFS + recSize * keysNum, 0, recSize * (_tree->_maxKeys - keysNum));
+
+    // курсоров на один больше, чем ключей
+    UInt cursorsNum = 2 * _tree->getOrder();
+    memset(_data + _tree->getCursorsOfs() + CURSOR_SZ * (keysNum + 1), 0,
+           CURSOR_SZ * (cursorsNum - keysNum - 1));
+}
+
+
 void BaseBTree::PageWrapper::setKeyNumLeaf(UShort keysNum, bool isRoot, bool isLeaf) //NodeType nt)
 {
     _tree->checkKeysNumberExc(keysNum, isRoot);
@@ -655,6 +1517,81 @@ int BaseBTree::PageWrapper::getKeyOfs(UShort num) const
 }
 
 
+UShort BaseBTree::PageWrapper::lowerBound(const Byte *k) const
+{
+    return boundInternal(k, false);
+}
+
+
+UShort BaseBTree::PageWrapper::upperBound(const Byte *k) const
+{
+    return boundInternal(k, true);
+}
+
+
+UShort BaseBTree::PageWrapper::boundInternal(const Byte *k, bool upper) const
+{
+    IComparator *c = _tree->getComparator();
+    if (!c)
+        throw std::runtime_error("Comparator not set. Can't search");
+
+    UShort lo = 0;
+    UShort hi = getKeysNum();
+    if (hi == 0)
+        return 0;
+
+    UInt recSize = _tree->getRecSize();
+
+    // для лексикографического порядка общий префикс ключей узла сравниваем один раз:
+    // если ключ с ним не совпадает, он целиком левее или правее всех ключей узла
+    if (_tree->_lexKeys)
+    {
+        // ключи упорядочены, поэтому общий префикс всех ключей — общий префикс крайних
+        const Byte *first = getKey(0);
+        const Byte *last = getKey((UShort) (hi - 1));
+        UInt prefLen = 0;
+        while (prefLen < recSize && first[prefLen] == last[prefLen])
+            ++prefLen;
+
+        int pc = memcmp(k, first, prefLen);
+        ++_tree->_stats.keyCompares;
+        if (pc < 0)
+            return 0;
+        if (pc > 0)
+            return hi;
+
+        const Byte *ks = k + prefLen;
+        UInt sfxLen = recSize - prefLen;
+        while (lo < hi)
+        {
+            ++_tree->_stats.keyCompares;
+            UShort mid = (UShort) (lo + (hi - lo) / 2);
+            int r = memcmp(getKey(mid) + prefLen, ks, sfxLen);
+            if (r < 0 || (upper && r == 0))
+                lo = (UShort) (mid + 1);
+            else
+                hi = mid;
+        }
+
+        return lo;
+    }
+
+    while (lo < hi)
+    {
+        ++_tree->_stats.keyCompares;
+        UShort mid = (UShort) (lo + (hi - lo) / 2);
+        bool toRight = upper ? !c->compare(k, getKey(mid), recSize)         // key[mid] <= k
+                             : c->compare(getKey(mid), k, recSize);         // key[mid] < k
+        if (toRight)
+            lo = (UShort) (mid + 1);
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
 void BaseBTree::PageWrapper::setAsRoot(bool writeFlag /*= true*/)
 {
     _tree->_rootPageNum = _pageNum;         // ид корень по номеру страницы в памяти
@@ -694,6 +1631,7 @@ void BaseBTree::PageWrapper::splitChild(UShort iChild)
 {
     if (isFull())
         throw std::domain_error("A parent node is full, so its child can't be splitted");
+    ++_tree->_stats.splits;
 
     if (iChild > getKeysNum())
         throw std::invalid_argument("Cursor not exists");
@@ -741,6 +1679,7 @@ void BaseBTree::PageWrapper::splitChild(UShort iChild)
     copyKey(getKey(iChild), left.getKey((UShort) _tree->_minKeys));
 
     left.setKeyNum((UShort) _tree->_minKeys); //we cut off all unnecessary elements
+    left.clearUnused();                         // хвост ушел в правый узел, не оставляем его копию
 
     //write all changes to the file ->
     right.writePage();
@@ -765,11 +1704,8 @@ void BaseBTree::PageWrapper::insertNonFull(const Byte *k)
     {
         PageWrapper currentPage(_tree); //create a new page for writing
 
-        UShort currentKey = getKeysNum(); //read current key
-
-        //looking for a tree in which to insert an element
-        while (currentKey > 0 && c->compare(k, getKey((UShort) (currentKey - 1)), _tree->_recSize))
-            --currentKey;
+        //looking for a tree in which to insert an element (after all equal keys)
+        UShort currentKey = upperBound(k);
 
         currentPage.readPageFromChild(*this, currentKey); //read the current page
 
@@ -788,15 +1724,14 @@ void BaseBTree::PageWrapper::insertNonFull(const Byte *k)
 
     } else
     {
-        UShort currentKeyLeaf = getKeysNum(); //read current key
+        UShort keysNum = getKeysNum(); //read current keys number
+        UShort currentKeyLeaf = upperBound(k); //position of the new item (after all equal keys)
 
         //make room for a new item ->
-        setKeyNum((UShort) (getKeysNum() + 1));
-        while (currentKeyLeaf > 0 && c->compare(k, getKey((UShort) (currentKeyLeaf - 1)), _tree->_recSize))
-        {
-            copyKey(getKey(currentKeyLeaf), getKey((UShort) (currentKeyLeaf - 1)));
-            --currentKeyLeaf;
-        }
+        setKeyNum((UShort) (keysNum + 1));
+        if (currentKeyLeaf < keysNum)
+            memmove(getKey((UShort) (currentKeyLeaf + 1)), getKey(currentKeyLeaf),
+                    (size_t) _tree->_recSize * (keysNum - currentKeyLeaf));
         // <-
 
         copyKey(getKey(currentKeyLeaf), k); //insert item
@@ -808,6 +1743,164 @@ void BaseBTree::PageWrapper::insertNonFull(const Byte *k)
 
 
 
+//==============================================================================
+// class BaseBTree::RangeCursor
+//==============================================================================
+
+
+BaseBTree::RangeCursor::RangeCursor(BaseBTree *tr)
+        : _tree(tr), _curKey(nullptr), _to(nullptr), _readAhead(DEFAULT_READ_AHEAD)
+{
+}
+
+
+BaseBTree::RangeCursor::~RangeCursor()
+{
+    finish();
+    for (PageWrapper *pw : _pages)
+        delete pw;
+
+    delete[] _curKey;
+    delete[] _to;
+}
+
+
+void BaseBTree::RangeCursor::seek(const Byte *from, const Byte *to)
+{
+    if (!_tree->_comparator)
+        throw std::runtime_error("Comparator not set. Can't search");
+
+    finish();
+
+    // дерево могли переоткрыть с другой геометрией: буферы распределяем заново
+    for (PageWrapper *pw : _pages)
+        delete pw;
+    _pages.clear();
+
+    delete[] _curKey;
+    _curKey = new Byte[_tree->getRecSize()];
+
+    delete[] _to;
+    _to = to ? _tree->cloneKey(to) : nullptr;
+
+    if (_tree->getRootPageNum() == 0)
+        return;
+
+    _tree->traceOp();
+
+    // спуск к первому ключу, не меньшему from: в этом B-дереве ключи, эквивалентные from,
+    // могут лежать только в ребенке под lower bound или правее
+    UInt pnum = _tree->getRootPageNum();
+    while (true)
+    {
+        PageWrapper &pw = *pushLevel(pnum, 0).page;
+        UShort i = from ? pw.lowerBound(from) : (UShort) 0;
+        _path.back().pos = i;
+
+        if (pw.isLeaf())
+            return;
+
+        pnum = pw.getCursor(i);
+    }
+}
+
+
+bool BaseBTree::RangeCursor::next()
+{
+    while (!_path.empty())
+    {
+        Level &lev = _path.back();
+        PageWrapper &pw = *lev.page;
+
+        // узел пройден: для внутреннего это значит, что пройден и последний ребенок
+        if (lev.pos >= pw.getKeysNum())
+        {
+            _path.pop_back();
+            continue;
+        }
+
+        memcpy(_curKey, pw.getKey(lev.pos), _tree->getRecSize());
+        ++lev.pos;
+
+        // за ключем внутреннего узла следует поддерево его правого ребенка
+        if (!pw.isLeaf())
+            descendLeftmost(lev.pos);
+
+        if (_to && _tree->isKeyLess(_to, _curKey))
+        {
+            finish();
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+
+void BaseBTree::RangeCursor::descendLeftmost(UShort chNum)
+{
+    UInt pnum = _path.back().page->getCursor(chNum);
+    while (true)
+    {
+        PageWrapper &pw = *pushLevel(pnum, 0).page;
+        if (pw.isLeaf())
+            return;
+
+        pnum = pw.getCursor(0);
+    }
+}
+
+
+BaseBTree::RangeCursor::Level &BaseBTree::RangeCursor::pushLevel(UInt pnum, UShort pos)
+{
+    size_t depth = _path.size();
+    if (depth == _pages.size())
+        _pages.push_back(new PageWrapper(_tree));
+
+    PageWrapper *pw = _pages[depth];
+    pw->readPage(pnum);
+
+    Level lev = { pw, pos, 0 };
+    _path.push_back(lev);
+
+    // спустились в лист: пока вызывающий его читает, подгружаем соседей справа
+    if (pw->isLeaf() && depth > 0)
+        readAheadChildren(_path[depth - 1], _path[depth - 1].pos);
+
+    return _path.back();
+}
+
+
+void BaseBTree::RangeCursor::readAheadChildren(Level &lev, UShort chNum)
+{
+    // без кэша загруженные страницы негде держать
+    if (_readAhead == 0 || !_tree->_pageCache.isEnabled() || chNum < lev.raNext)
+        return;
+
+    // окно обновляем, когда пройдена его половина: следующая пачка успевает загрузиться
+    // до того, как понадобится
+    PageWrapper &pw = *lev.page;
+    UShort lastChild = pw.getKeysNum();
+
+    _raPages.clear();
+    for (UInt c = chNum + 1u; c <= lastChild && _raPages.size() < _readAhead; ++c)
+        _raPages.push_back(pw.getCursor((UShort) c));
+
+    lev.raNext = chNum + (_readAhead + 1) / 2;
+
+    if (!_raPages.empty())
+        _tree->prefetchPages((UInt) _raPages.size(), _raPages.data());
+}
+
+
+void BaseBTree::RangeCursor::finish()
+{
+    _path.clear();
+}
+
+
 //==============================================================================
 // class FileBaseBTree
 //==============================================================================
@@ -822,7 +1915,7 @@ FileBaseBTree::FileBaseBTree(UShort order, UShort recSize, IComparator *comparat
                              const std::string &fileName)
         : FileBaseBTree()
 {
-    _comparator = comparator;
+    setComparator(comparator);
 
     checkTreeParams(order, recSize);
     createInternal(order, recSize, fileName);
@@ -832,13 +1925,13 @@ FileBaseBTree::FileBaseBTree(UShort order, UShort recSize, IComparator *comparat
 FileBaseBTree::FileBaseBTree(const std::string &fileName, IComparator *comparator)
         : FileBaseBTree()
 {
-    _comparator = comparator;
+    setComparator(comparator);
     loadInternal(fileName); // , comparator);
 }
 
 FileBaseBTree::~FileBaseBTree()
 {
-    close();            // именно для удобства такого использования не кидаем внутри искл. ситуацию!
+    closeNoThrow();     // именно для удобства такого использования не кидаем внутри искл. ситуацию!
 }
 
 
@@ -853,8 +1946,21 @@ void FileBaseBTree::create(UShort order, UShort recSize, //IComparator* comparat
 }
 
 
+void FileBaseBTree::createForPageSize(UInt pageSize, UShort recSize, const std::string &fileName)
+{
+    if (isOpen())
+        throw std::runtime_error("B-tree file is already open");
+
+    if (recSize == 0)
+        throw std::invalid_argument("B-tree record size can't be 0");
+    checkPageSize(pageSize, recSize);
+
+    createInternal(0, recSize, fileName, pageSize);
+}
+
+
 void FileBaseBTree::createInternal(UShort order, UShort recSize, // IComparator* comparator,
-                                   const std::string &fileName)
+                                   const std::string &fileName, UInt pageSize /*= 0*/)
 {
     _fileStream.open(fileName,
                      std::fstream::in | std::fstream::out |      // чтение запись
@@ -875,7 +1981,21 @@ void FileBaseBTree::createInternal(UShort order, UShort recSize, // IComparator*
     _fileName = fileName;
     _stream = &_fileStream;                         // привязываем к потоку
 
-    createTree(order, recSize);                     // в базовом дереве
+    // в базовом дереве; если не вышло, закрываем вместе с хранилищем страниц наследника
+    try
+    {
+        if (pageSize)
+            createAlignedTree(pageSize, recSize);   // порядок подбирается под страницу
+        else
+            createTree(order, recSize);
+
+        openPageStorage();
+    }
+    catch (...)
+    {
+        closeInternal();
+        throw;
+    }
 }
 
 
@@ -913,16 +2033,26 @@ void FileBaseBTree::loadInternal(const std::string &fileName) // , IComparator*
     {
         loadTree();
     }
-    catch (std::exception &e)
+    catch (std::exception &)
     {
         _fileStream.close();
-        throw e;
+        throw;                      // исходного типа, без срезки до std::exception
     }
     catch (...)                     // для левых исключений
     {
         _fileStream.close();
         throw std::runtime_error("Error when loading btree");
     }
+
+    // все, что есть в файле за последней страницей, — зарезервированный ранее хвост
+    _fileStream.seekg(0, std::ios_base::end);
+    long long fileSize = (long long)_fileStream.tellg();
+    long long pagesSpace = fileSize - (long long)getFirstPageOfs();
+    _reservedPages = pagesSpace > 0 ? (UInt)(pagesSpace / getNodePageSize()) : 0;
+    if (_reservedPages < getLastPageNum())
+        _reservedPages = getLastPageNum();
+
+    openPageStorage();
 }
 
 
@@ -931,6 +2061,24 @@ void FileBaseBTree::close()
     if (!isOpen())
         return;
 
+    checkpoint();                   // отложенные страницы — на носитель
+    closeInternal();
+}
+
+
+void FileBaseBTree::closeNoThrow()
+{
+    if (!isOpen())
+        return;
+
+    try
+    {
+        checkpoint();
+    }
+    catch (...)
+    {
+    }
+
     closeInternal();
 }
 
@@ -944,11 +2092,36 @@ void FileBaseBTree::closeInternal()
     resetBTree();
 }
 
+void FileBaseBTree::growStorage(UInt lastPnum)
+{
+#ifndef _WIN32
+    int fd = ::open(_fileName.c_str(), O_WRONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can't open file to grow it");
+
+    // дописываем от конца зарезервированного до конца страницы lastPnum; экстент выделяет ФС
+    long long from = getPageOffset(_reservedPages + 1);
+    long long to = getPageOffset(lastPnum + 1);
+    int res = (to > from) ? posix_fallocate(fd, (off_t)from, (off_t)(to - from)) : 0;
+    ::close(fd);
+
+    if (res != 0)
+        throw std::runtime_error("Can't preallocate B-tree file");
+#endif
+}
+
+
 void FileBaseBTree::checkTreeParams(UShort order, UShort recSize)
 {
     if (order < 1 || recSize == 0)
         throw std::invalid_argument("B-tree order can't be less than 1 and record siaze can't be 0");
 
+    // проверяем до открытия файла, см. createTree()
+    if (_pageCrcOnCreate)
+        throw std::invalid_argument("Page checksums require aligned page geometry");
+
+    if (getStorageFlags())
+        throw std::invalid_argument("The page storage requires aligned page geometry");
 }
 
 bool FileBaseBTree::isOpen() const
@@ -20,8 +20,13 @@
 #include <string>
 #include <fstream>
 #include <list>
+#include <vector>
+#include <cstring>          // memcmp
 
 #include "utils.h"
+#include "page_cache.h"
+#include "latency_histogram.h"
+#include "page_trace.h"
 
 
 
@@ -58,6 +63,9 @@ public:
      */
     struct Header {
         static const UInt VALID_SIGN = 0x54424958;  ///< правильная сигнатура
+        static const UInt EXT_SIGN = 0x41424958;    ///< сигнатура файла с расширенным заголовком (HeaderExt)
+        static const UInt V2_SIGN = 0x32424958;     ///< сигнатура файла формата v2 ("XIB2")
+        static const UInt V2_EXT_SIGN = 0x32414958; ///< сигнатура файла формата v2 с HeaderExt ("XIA2")
     public:
         Header() : order(0), recSize(0), sign(0) {}
         Header(UShort ord, UShort rs) : 
@@ -67,11 +75,40 @@ public:
     public:
         /** \brief Проверяет структуру на целостность и возвращает истину, если все ок.*/
         bool checkIntegrity();
+
+        /** \brief Возвращает истину, если за заголовком следует расширение HeaderExt. */
+        bool isExtended() const { return sign == EXT_SIGN || sign == V2_EXT_SIGN; }
+
+        /** \brief Возвращает версию формата файла (1 или 2) по сигнатуре. */
+        UShort getVersion() const { return (sign == V2_SIGN || sign == V2_EXT_SIGN) ? 2 : 1; }
+
+        /** \brief Возвращает сигнатуру для версии формата \c version и наличия расширения \c ext. */
+        static UInt makeSign(UShort version, bool ext);
     public:
         UInt sign;  // = 0x54424958;       // сигнатура
         UShort order;
         UShort recSize;
     }; // struct Header
+
+    /** \brief Расширение заголовка файла.
+     *
+     *  Присутствует, если сигнатура заголовка — Header::EXT_SIGN, и располагается сразу за полем
+     *  номера корневой страницы. Описывает выровненную геометрию страниц: каждая страница занимает
+     *  ровно \c pageSize байт, а первая страница начинается со смещения \c pageSize (заголовок
+     *  дополняется нулями до границы страницы).
+     */
+    struct HeaderExt {
+        static const UInt FLAG_PAGE_CRC = 0x1;      ///< в конце каждой страницы — CRC32C (см. PAGE_CRC_SZ)
+        static const UInt FLAG_COMPRESSED_PAGES = 0x2;  ///< страницы сжаты (см. CompressedFileBaseBTree)
+        static const UInt STORAGE_FLAGS = FLAG_COMPRESSED_PAGES;    ///< флаги формата хранения страниц
+        static const UInt KNOWN_FLAGS = FLAG_PAGE_CRC | FLAG_COMPRESSED_PAGES;  ///< флаги, которые понимает эта версия
+    public:
+        HeaderExt() : pageSize(0), flags(0) {}
+        HeaderExt(UInt ps) : pageSize(ps), flags(0) {}
+    public:
+        UInt pageSize;          ///< размер (выровненной) страницы
+        UInt flags;             ///< флаги (FLAG_PAGE_CRC), остальные биты — 0
+    }; // struct HeaderExt
 #pragma pack(pop)
 
     /** \brief Смещение структуры заголовка известен уже на этапе компиляции. */
@@ -99,6 +136,39 @@ public:
     /** \brief Смещение первой реальной страницы. */
     static const UInt FIRST_PAGE_OFS = ROOT_PAGE_NUM_OFS + ROOT_PAGE_NUM_SZ;//PAGE_COUNTER_OFS + PAGE_COUNTER_SZ;
 
+    /** \brief Смещение расширения заголовка (для файлов с сигнатурой Header::EXT_SIGN). */
+    static const UInt HEADER_EXT_OFS = FIRST_PAGE_OFS;
+
+    /** \brief Размер расширения заголовка. */
+    static const UInt HEADER_EXT_SIZE = sizeof(HeaderExt);
+
+    /** \brief Размер контрольной суммы страницы, которая при включенных контрольных суммах
+     *  (см. setPageChecksums()) занимает последние байты выровненной страницы.
+     */
+    static const UInt PAGE_CRC_SZ = 4;
+
+    /** \brief Последняя версия формата файла.
+     *
+     *  Версия 1 — исходный формат, читатели которого считают смещения страниц в 32 битах и потому
+     *  не могут адресовать страницы за границей 4 ГиБ. Версия 2 отличается только сигнатурой
+     *  (Header::V2_SIGN, Header::V2_EXT_SIGN): смещения страниц в ней 64-битные, что не дает
+     *  старым читателям открыть такой файл и молча прочитать не те страницы. Курсоры остаются
+     *  4-байтовыми номерами страниц, поэтому ветвистость узлов не меняется.
+     */
+    static const UShort MAX_FORMAT_VERSION = 2;
+
+    /** \brief Наибольшее смещение страницы, которое может адресовать читатель формата v1. */
+    static const long long V1_MAX_PAGE_OFS = 0xFFFFFFFFLL;
+
+    /** \brief Минимальный размер выровненной страницы (размер сектора). */
+    static const UInt MIN_ALIGNED_PAGE_SIZE = 512;
+
+    /** \brief Выравнивание буферов страниц в памяти по умолчанию — размер строки кэша. */
+    static const UInt CACHE_LINE_SIZE = 64;
+
+    /** \brief Максимальное выравнивание буферов страниц в памяти — размер страницы ОС. */
+    static const UInt MAX_BUF_ALIGN = 4096;
+
     /** \brief Смещение поля информации об узле/странице. */
     static const UInt NODE_INFO_OFS = 0;
 
@@ -138,9 +208,27 @@ public:
         /** \brief Перераспределяет память под рабочую страницу/узел. */
         void reallocData(UInt sz);
 
+        /** \brief Делает обертку представлением чужого буфера \c data страницы \c pnum,
+         *  без копирования (например, кадра кэша страниц).
+         *
+         *  Собственный буфер освобождается; буфер \c data должен жить, пока обертка им пользуется.
+         *  Следующий reallocData() снова распределяет собственный буфер.
+         */
+        void attachData(Byte* data, UInt pnum);
+
+        /** \brief Возвращает истину, если обертка владеет своим буфером. */
+        bool isDataOwned() const { return _ownsData; }
+
         /** \brief Обнуляет массив данных. */
         void clear();
 
+        /** \brief Обнуляет ключи и курсоры за пределами используемых узлом.
+         *
+         *  Неиспользуемые области страницы остаются нулевыми, что позволяет сжимать листья
+         *  (см. CompressedFileBaseBTree).
+         */
+        void clearUnused();
+
 
         /** \brief Устанаваливает сразу два поля: число ключей в ноде \c keyNum и признак, что это  
          *  лист \c isLeaf.
@@ -239,6 +327,22 @@ public:
         int getKeyOfs(UShort num) const;
 
 
+        /** \brief Возвращает номер первого ключа узла, который не меньше \c k (lower bound).
+         *
+         *  Поиск бинарный. Если компаратор дерева лексикографический (см.
+         *  IComparator::isLexicographic()), общий префикс ключей узла сравнивается с \c k один раз,
+         *  а далее сравниваются только суффиксы.
+         *  Если компаратор не задан, кидает исключение.
+         */
+        UShort lowerBound(const Byte* k) const;
+
+        /** \brief Возвращает номер первого ключа узла, который строго больше \c k (upper bound).
+         *
+         *  Остальное аналогично lowerBound().
+         */
+        UShort upperBound(const Byte* k) const;
+
+
 
         /** \brief Возвращает номер ассоциированной страницы. */
         UInt getPageNum() const { return _pageNum; }
@@ -282,9 +386,21 @@ public:
         /** \brief Читает содержимое страницы номер \c pnum из файла в память текущего врепера.
         *
          *  Требования аналогичны методу BaseBTree::readPage();
+         *  Если страницы дерева постоянно находятся в памяти (см. BaseBTree::getResidentPage()),
+         *  обертка не копирует страницу, а становится ее представлением (см. attachData()).
          */
         void readPage(UInt pnum)
         {
+            Byte* resident = _tree->getResidentPage(pnum);
+            if (resident)
+            {
+                attachData(resident, pnum);
+                return;
+            }
+
+            if (!_ownsData)
+                reallocData(_tree->getNodePageSize());
+
             _tree->readPage(pnum, _data);
             _pageNum = pnum;
         }
@@ -306,6 +422,12 @@ public:
         //my method for search inside PageWrapper
         int searchAll(const Byte* k, std::list<Byte*>& keys);
 
+    protected:
+        /** \brief Общая часть lowerBound() и upperBound(): при \c upper == true ищет первый
+         *  ключ, строго больший \c k, иначе — первый не меньший.
+         */
+        UShort boundInternal(const Byte* k, bool upper) const;
+
     public: 
         //----<Основные части алгоритма работы над b-деревом>----
         
@@ -358,6 +480,11 @@ public:
          */
         UInt _pageNum;
 
+        /** \brief Истина, если \c _data распределен самой оберткой (см. attachData()). */
+        bool _ownsData;
+
+        friend class BaseBTree;
+
     }; // class PageWrapper
 
     friend class PageWrapper;
@@ -388,16 +515,206 @@ public:
           * под ними массивы побайтно равны.
           */
         virtual bool isEqual(const Byte* lhv, const Byte* rhv, UInt sz) = 0;
+
+        /** \brief Возвращает истину, если порядок, задаваемый компаратором, совпадает с
+         *  лексикографическим (побайтным беззнаковым, как у memcmp()) порядком ключей.
+         *
+         *  Для таких компараторов дерево может не сравнивать общий префикс ключей узла
+         *  повторно (см. PageWrapper::lowerBound()). По умолчанию — ложь.
+         */
+        virtual bool isLexicographic() const { return false; }
     protected:
         ~IComparator() {};
 
     }; // class IComparator
 
 
+    /** \brief Курсор упорядоченного просмотра ключей дерева в диапазоне [from, to].
+     *
+     *  Хранит путь от корня до текущего узла (по странице на уровень), поэтому переход
+     *  к следующему ключу не требует нового спуска от корня. Пока курсор используется,
+     *  дерево изменять нельзя.
+     *
+     *  Листья дерева, построенного последовательными расщеплениями, разбросаны по файлу,
+     *  поэтому курсор умеет упреждающе читать (см. setReadAhead()): переходя к очередному
+     *  листу, он одной пачкой запрашивает в кэш дерева следующие листья того же родителя
+     *  (BaseBTree::prefetchPages()). Если хранилище дерева читает асинхронно (DirectFileBaseBTree
+     *  с движком IAsyncPageIO), пачка загружается, пока вызывающий обрабатывает ключи текущего
+     *  листа, и курсор дожидается ее, только перейдя к следующему листу; иначе пачка читается
+     *  сразу, синхронно. Без кэша страниц (BaseBTree::setCacheSize()) упреждающее чтение
+     *  выключено: загруженные страницы негде держать.
+     */
+    class RangeCursor {
+    public:
+        /** \brief Число листьев упреждающего чтения по умолчанию. */
+        static const UInt DEFAULT_READ_AHEAD = 8;
+
+    public:
+        RangeCursor(BaseBTree* tr);
+
+        ~RangeCursor();
+
+    protected:
+        RangeCursor(const RangeCursor&);                        ///< КК не доступен.
+        RangeCursor& operator= (RangeCursor&);                  ///< Оператор присваивания недоступен.
+
+    public:
+        /** \brief Задает число листьев \c k, загружаемых упреждающе (0 — не загружать). */
+        void setReadAhead(UInt k) { _readAhead = k; }
+
+        /** \brief Возвращает число листьев упреждающего чтения. */
+        UInt getReadAhead() const { return _readAhead; }
+
+        /** \brief Устанавливает курсор перед первым ключем, не меньшим \c from, и задает
+         *  верхнюю границу \c to (включительно).
+         *
+         *  nullptr для \c from означает начало дерева, для \c to — отсутствие верхней границы.
+         *  Границы копируются. Если компаратор не задан, кидает исключение.
+         */
+        void seek(const Byte* from, const Byte* to = nullptr);
+
+        /** \brief Переходит к следующему ключу диапазона.
+         *
+         *  \returns истину, если ключ есть (он доступен через getKey()), ложь, если
+         *  диапазон исчерпан.
+         */
+        bool next();
+
+        /** \brief Возвращает текущий ключ (действителен до следующего вызова next()). */
+        const Byte* getKey() const { return _curKey; }
+
+    protected:
+        /** \brief Уровень пути: страница и позиция в ней.
+         *
+         *  Для листа \c pos — номер следующего выдаваемого ключа, для внутреннего узла — номер
+         *  дочернего курсора, по которому курсор спустился (после обхода этого ребенка выдается
+         *  ключ с тем же номером).
+         */
+        struct Level {
+            PageWrapper* page;
+            UShort pos;
+            UInt raNext;            ///< С какого ребенка обновлять окно упреждающего чтения.
+        };
+
+        /** \brief Спускается в ребенка номер \c chNum узла на вершине пути и далее по крайним
+         *  левым курсорам до листа.
+         */
+        void descendLeftmost(UShort chNum);
+
+        /** \brief Кладет на путь уровень со страницей \c pnum и позицией \c pos. */
+        Level& pushLevel(UInt pnum, UShort pos);
+
+        /** \brief Упреждающе загружает листья, следующие за ребенком \c chNum уровня \c lev. */
+        void readAheadChildren(Level& lev, UShort chNum);
+
+        /** \brief Завершает просмотр. */
+        void finish();
+
+    protected:
+        BaseBTree* _tree;
+        std::vector<Level> _path;               ///< Путь от корня.
+        std::vector<PageWrapper*> _pages;       ///< Страницы уровней (переиспользуются).
+        Byte* _curKey;                          ///< Копия текущего ключа.
+        Byte* _to;                              ///< Копия верхней границы или nullptr.
+        UInt _readAhead;
+        std::vector<UInt> _raPages;             ///< Номера страниц очередного окна.
+    }; // class RangeCursor
+
+    friend class RangeCursor;
+
+
+    /** \brief Счетчики операций дерева (см. getStats()).
+     *
+     *  Байты считаются по логическому размеру страницы, независимо от того, сколько
+     *  наследник фактически передал на носитель (см., например, CompressedFileBaseBTree).
+     */
+    struct Stats {
+        unsigned long long pageReads;       ///< Страниц прочитано с носителя.
+        unsigned long long pageWrites;      ///< Страниц записано на носитель.
+        unsigned long long bytesRead;       ///< Байт прочитано с носителя.
+        unsigned long long bytesWritten;    ///< Байт записано на носитель.
+        unsigned long long pageAllocs;      ///< Распределено новых страниц.
+        unsigned long long splits;          ///< Разбиений узлов (PageWrapper::splitChild()).
+        unsigned long long keyCompares;     ///< Сравнений ключей (через компаратор или memcmp()).
+        unsigned long long cacheHits;       ///< Чтений страниц, обслуженных кэшем.
+        unsigned long long cacheMisses;     ///< Чтений страниц, не нашедших страницу в кэше.
+
+        Stats() { reset(); }
+
+        /** \brief Обнуляет все счетчики. */
+        void reset();
+
+        /** \brief Прибавляет счетчики \c rhv. */
+        Stats& operator+= (const Stats& rhv);
+
+        /** \brief Возвращает разность счетчиков (например, двух снимков). */
+        Stats operator- (const Stats& rhv) const;
+    }; // struct Stats
+
+
+    /** \brief Собирает счетчики операций дерева, выполненных за время жизни объекта.
+     *
+     *  Запоминает снимок счетчиков дерева при создании; get() возвращает прирост с этого
+     *  момента. Если задан \c total, при разрушении прибавляет к нему итоговый прирост, что
+     *  позволяет копить стоимость операций одного вида:
+     *  \code
+     *  { BaseBTree::StatsScope scope(&tree, &insertStats); tree.insert(k); }
+     *  \endcode
+     */
+    class StatsScope {
+    public:
+        StatsScope(const BaseBTree* tree, Stats* total = nullptr)
+            : _tree(tree), _start(tree->getStats()), _total(total) {}
+
+        ~StatsScope()
+        {
+            if (_total)
+                *_total += get();
+        }
+
+        /** \brief Возвращает прирост счетчиков дерева с момента создания объекта. */
+        Stats get() const { return _tree->getStats() - _start; }
+
+    protected:
+        StatsScope(const StatsScope&);                          ///< КК не доступен.
+        StatsScope& operator= (StatsScope&);                    ///< Оператор присваивания недоступен.
+
+    protected:
+        const BaseBTree* _tree;
+        Stats _start;
+        Stats* _total;
+    }; // class StatsScope
+
+
+    /** \brief Гистограммы задержек операций дерева (см. setLatencyTracking()). */
+    struct Latencies {
+        LatencyHistogram insert;            ///< insert().
+        LatencyHistogram search;            ///< search().
+        LatencyHistogram searchAll;         ///< searchAll().
+        LatencyHistogram pageRead;          ///< Чтение страницы с носителя (в пачке — доля пачки).
+        LatencyHistogram pageWrite;         ///< Запись страницы на носитель (аналогично).
+
+        /** \brief Очищает все гистограммы. */
+        void reset();
+
+        /** \brief Выводит сводку по каждой гистограмме строкой текста. */
+        void printText(std::ostream& os) const;
+
+        /** \brief Выводит все гистограммы JSON-объектом. */
+        void printJson(std::ostream& os) const;
+    }; // struct Latencies
+
+    /** \brief Строителям (см. BTreeBuilder, ParallelBTreeBuilder) нужен доступ к распределению
+     *  и записи страниц.
+     */
+    friend class BTreeBuilder;
+    friend class ParallelBTreeBuilder;
+
+
      
 public:
     /** \brief Деструктор. */
-    ~BaseBTree();
+    virtual ~BaseBTree();
 protected:
     /** \brief Конструирует новое B-дерево со структурой, определяемой переданными параметрами.
      *
@@ -427,6 +744,15 @@ public:
      */
     virtual bool isOpen() const { return false; } // = 0;
 
+    /** \brief Возвращает истину, если страницы дерева лежат в его файле как есть, по смещениям
+     *  getPageOffset(), и другие потоки могут читать и писать их через собственные дескрипторы
+     *  файла в обход дерева (см. ParallelBTreeBuilder, ParallelRangeScanner).
+     *
+     *  По умолчанию ложь. Истину возвращает FileBaseBTree; наследник, который хранит страницы
+     *  иначе, должен переопределить метод.
+     */
+    virtual bool canAccessPagesDirectly() const { return false; }
+
 
     /** \brief Читает содержимое страницы номер \c pnum из файла в память в \c dst.
      *
@@ -450,6 +776,32 @@ public:
      */
     void writePage(UInt pnum, const Byte* dst);
 
+    /** \brief Аналогично writePage(UInt, const Byte*), но контрольную сумму страницы (если
+     *  они включены) дописывает прямо в буфер \c dst, не копируя его.
+     */
+    void writePage(UInt pnum, Byte* dst);
+
+    /** \brief Читает \c n страниц с номерами \c pnums в буферы \c dsts одной пачкой.
+     *
+     *  Страницы, которых нет в кэше, читаются одним пакетным запросом readPagesInternal(),
+     *  который наследники могут выполнять асинхронно (см. DirectFileBaseBTree).
+     *  Требования к номерам страниц такие же, как и у readPage().
+     */
+    void readPages(UInt n, const UInt* pnums, Byte* const* dsts);
+
+    /** \brief Загружает в кэш страницы \c pnums, которых там еще нет, одной пачкой.
+     *
+     *  Предназначен для упреждающего чтения: последующие readPage() этих страниц обслуживаются
+     *  из кэша. Если кэш выключен, ничего не делает; если страниц больше, чем вмещает кэш,
+     *  загружаются только первые из них.
+     *
+     *  Если хранилище умеет читать асинхронно (см. beginReadPagesInternal()), метод только
+     *  отправляет запросы и возвращается сразу; чтение завершается при следующем обращении
+     *  к страницам или кэшу дерева (readPage(), writePage(), checkpoint() и т.д.), и тогда же
+     *  выпускаются его ошибки.
+     */
+    void prefetchPages(UInt n, const UInt* pnums);
+
 
     ///** \brief Записывает рабочую страницу. Остальное аналогично writePage(). */
     //DEPRECATED void writeWorkPage(UInt pnum);
@@ -475,18 +827,40 @@ public:
 
     void insert(const Byte* k);
     
-    /** \brief Для заданного ключа \c k ищет первое его вхождение в дерево по принципу эквивалентности. 
-     *  Если ключ найден, возвращает указатель на подлежащий массив, иначе nullptr.
+    /** \brief Для заданного ключа \c k ищет первое его вхождение в дерево по принципу эквивалентности.
+     *  Если ключ найден, возвращает указатель на копию записи (размером getRecSize()), иначе nullptr.
+     *
+     *  Память под копию распределяется через new[], освобождать ее должен вызывающий (delete[]).
      */
     Byte* search(const Byte* k);
 
     /** \brief Для заданного ключа \c k ищет все его его вхождения в дерево по принципу эквивалентности.
      *  Каждый найденный ключ добавляется в переданный список ключей \c keys.
+     *  Ключи добавляются копиями, как и в search().
      *
      *  \returns число найденных элементов
      */
     int searchAll(const Byte* k, std::list<Byte*>& keys);
 
+    /** \brief Добавляет в список \c keys копии (как в search()) всех ключей из диапазона
+     *  [from, to] в порядке возрастания. Границы задаются так же, как в RangeCursor::seek().
+     *
+     *  \returns число найденных элементов
+     */
+    int searchRange(const Byte* from, const Byte* to, std::list<Byte*>& keys);
+
+    /** \brief Ищет пачку из \c n ключей \c keys; для каждого найденного ключа записывает
+     *  в \c results по тому же индексу копию записи (как в search()), иначе nullptr.
+     *
+     *  Спуск идет по уровням для всех ключей сразу (group prefetching): на каждом уровне
+     *  собираются страницы, нужные всем ключам, отсутствующие в кэше читаются одной пачкой
+     *  (см. readPages()), для страниц из кэша процессору заранее подсказывается их загрузка,
+     *  и только затем выполняется поиск внутри узлов. Так ожидание одной страницы не
+     *  останавливает спуск остальных ключей.
+     *  Ключи, равные nullptr, пропускаются.
+     */
+    void searchBatch(UInt n, const Byte* const* keys, Byte** results);
+
 
 #ifdef BTREE_WITH_DELETION
 
@@ -529,9 +903,55 @@ public:
     UInt getCursorsOfs() const { return _cursorsOfs; }
 
 
-    /** \brief Возвращает размер всего узла, он же определяет размер страницы. */
+    /** \brief Возвращает размер всего узла, он же определяет размер страницы. 
+     *
+     *  Для выровненной геометрии (см. isPageAligned()) это заданный при создании размер страницы,
+     *  который может быть больше, чем требуется узлу: хвост страницы заполнен нулями.
+     */
     UInt getNodePageSize() const { return _nodePageSize; }
 
+    /** \brief Возвращает истину, если страницы дерева выровнены (созданы с заданным размером страницы). */
+    bool isPageAligned() const { return _alignedPageSize != 0; }
+
+    /** \brief Возвращает смещение первой страницы в файле. */
+    UInt getFirstPageOfs() const { return _firstPageOfs; }
+
+    /** \brief Возвращает смещение страницы \c pnum в файле (в 64 битах). */
+    long long getPageOffset(UInt pnum) const
+    {
+        return (long long) _firstPageOfs + (long long) _nodePageSize * (pnum - 1);
+    }
+
+    /** \brief Возвращает версию формата файла дерева (см. MAX_FORMAT_VERSION). */
+    UShort getFormatVersion() const { return _formatVersion; }
+
+    /** \brief Переводит файл дерева в версию формата \c version, переписывая заголовок.
+     *
+     *  Дерево переходит на формат v2 само, как только смещение последней страницы перестает
+     *  помещаться в 32 бита (см. V1_MAX_PAGE_OFS). Вернуть формат v1 можно, только если файл
+     *  еще не вырос за эту границу.
+     */
+    void setFormatVersion(UShort version);
+
+    /** \brief Возвращает выравнивание, с которым распределяются буферы страниц в памяти.
+     *
+     *  Для выровненной геометрии — размер страницы (но не более MAX_BUF_ALIGN), что позволяет
+     *  использовать буферы для небуферизованного ввода-вывода, иначе — CACHE_LINE_SIZE.
+     */
+    UInt getPageBufAlign() const;
+
+    /** \brief Возвращает максимальный порядок дерева с размером записи \c recSize, узел которого
+     *  помещается в страницу размером \c pageSize байт.
+     *
+     *  Если не помещается даже узел порядка 1, возвращает 0.
+     */
+    static UShort calcOrderForPageSize(UShort recSize, UInt pageSize);
+
+    /** \brief Проверяет, годится ли \c pageSize для выровненной геометрии страниц дерева
+     *  с размером записи \c recSize, и если нет, кидает std::invalid_argument.
+     */
+    static void checkPageSize(UInt pageSize, UShort recSize);
+
     /** \brief Возвращает длину записи ключа. */
     UShort getRecSize() const { return _recSize; }
 
@@ -572,12 +992,127 @@ public:
     //PageWrapper& getWP1() { return _wp1; }  ///< DONE:
     //PageWrapper& getWP2() { return _wp2; }  ///< DONE:
 
-    /** \brief Задает компаратор для дерева. */
-    void setComparator(IComparator* c) { _comparator = c; }
+    /** \brief Задает компаратор для дерева.
+     *
+     *  Заодно запоминает, лексикографический ли он: для таких компараторов ядро дерева
+     *  сравнивает ключи напрямую через memcmp(), без виртуальных вызовов.
+     */
+    void setComparator(IComparator* c)
+    {
+        _comparator = c;
+        _lexKeys = (c != nullptr) && c->isLexicographic();
+    }
 
     /** \brief Возвращает компаратор. */
     IComparator* getComparator() const { return _comparator; }
 
+    /** \brief Задает емкость собственного кэша страниц дерева в страницах (0 — без кэша).
+     *
+     *  Кэш работает в режиме сквозной записи: readPage() обслуживается из кэша, если страница
+     *  там есть, writePage() обновляет кэш и сразу пишет страницу в поток.
+     *  Можно задавать как до открытия дерева, так и для открытого дерева (кэш сбрасывается).
+     */
+    void setCacheSize(UInt pages);
+
+    /** \brief Возвращает заданную емкость кэша страниц. */
+    UInt getCacheSize() const { return _cacheSize; }
+
+    /** \brief Возвращает кэш страниц дерева. */
+    const PageCache& getPageCache() const { return _pageCache; }
+
+    /** \brief Возвращает истину, если асинхронное упреждающее чтение (prefetchPages()) еще
+     *  не завершено.
+     */
+    bool isPrefetchPending() const { return !_prefetchPnums.empty(); }
+
+    /** \brief Возвращает накопленные счетчики операций (снимок — копия результата). */
+    const Stats& getStats() const { return _stats; }
+
+    /** \brief Обнуляет счетчики операций. */
+    void resetStats() { _stats.reset(); }
+
+    /** \brief Включает (\c on) или выключает гистограммы задержек операций и ввода-вывода
+     *  страниц. Выключенные гистограммы стоят одной проверки указателя на операцию.
+     */
+    void setLatencyTracking(bool on);
+
+    /** \brief Возвращает гистограммы задержек или nullptr, если они выключены. */
+    Latencies* getLatencies() { return _latencies; }
+
+    /** \brief Константный вариант метода getLatencies(). */
+    const Latencies* getLatencies() const { return _latencies; }
+
+    /** \brief Устанавливает трассировщик обращений к страницам (nullptr — без трассы).
+     *
+     *  В трассу попадают логические обращения — чтения readPage()/readPages() и записи
+     *  страниц, включая попадания в кэш, — поэтому по ней можно моделировать кэш любой
+     *  емкости (см. CacheSimulator). Каждая операция поиска, вставки или сканирования
+     *  получает свой номер. Трассировщиком дерево не владеет.
+     */
+    void setPageTracer(PageTracer* tracer) { _tracer = tracer; }
+
+    /** \brief Возвращает трассировщик обращений к страницам или nullptr. */
+    PageTracer* getPageTracer() const { return _tracer; }
+
+    /** \brief Включает (\c on) или выключает режим отложенной записи страниц.
+     *
+     *  В этом режиме writePage() и новые страницы только обновляют кэш и помечают страницу
+     *  грязной; на носитель грязные страницы пишутся пачкой, в порядке номеров, при
+     *  checkpoint(), при вытеснении грязной страницы из кэша и при закрытии дерева.
+     *  Без кэша (см. setCacheSize()) и для страниц, постоянно находящихся в памяти, запись
+     *  остается сквозной. При выключении режима грязные страницы сбрасываются.
+     */
+    void setWriteBack(bool on);
+
+    /** \brief Возвращает истину, если включен режим отложенной записи. */
+    bool isWriteBack() const { return _writeBack; }
+
+    /** \brief Записывает на носитель все грязные страницы кэша.
+     *
+     *  Соседние по номерам страницы наследники могут писать одной операцией
+     *  (см. writePagesInternal()).
+     */
+    void checkpoint();
+
+    /** \brief Задает шаг роста файла в страницах (0 — файл растет ровно на одну страницу).
+     *
+     *  При ненулевом шаге, когда новая страница не помещается в уже зарезервированную часть
+     *  файла, хранилище растет сразу на \c pages страниц (см. growStorage()), что избавляет
+     *  файловую систему от выделения экстента на каждую страницу. Зарезервированный хвост
+     *  файла страницами дерева не считается: их число по-прежнему хранится в заголовке.
+     */
+    void setGrowthExtent(UInt pages) { _growthExtent = pages; }
+
+    /** \brief Возвращает заданный шаг роста файла в страницах. */
+    UInt getGrowthExtent() const { return _growthExtent; }
+
+    /** \brief Возвращает число страниц, под которые зарезервировано место в хранилище
+     *  (не меньше getLastPageNum() при включенном шаге роста).
+     */
+    UInt getReservedPages() const { return _reservedPages; }
+
+    /** \brief Включает (или выключает) контрольные суммы страниц для создаваемых далее деревьев.
+     *
+     *  В последние PAGE_CRC_SZ байт каждой страницы при записи пишется CRC32C ее содержимого
+     *  вместе с номером страницы, а при чтении с носителя сумма проверяется: не совпавшая
+     *  (например, после прерванной записи) приводит к исключению std::runtime_error.
+     *  Поддерживается только для выровненной геометрии страниц (признак хранится в HeaderExt),
+     *  порядок дерева подбирается с учетом места под сумму. Для открываемых файлов признак
+     *  берется из заголовка, см. hasPageChecksums().
+     */
+    void setPageChecksums(bool enable) { _pageCrcOnCreate = enable; }
+
+    /** \brief Возвращает истину, если страницы открытого дерева снабжены контрольными суммами. */
+    bool hasPageChecksums() const { return _pageCrc; }
+
+    /** \brief Перечитывает с носителя все страницы дерева в обход кэша и проверяет их
+     *  контрольные суммы.
+     *
+     *  Возвращает число поврежденных страниц, номера которых, если задан \c bad, дописывает
+     *  туда. Если контрольные суммы у дерева не включены, кидает std::runtime_error.
+     */
+    UInt verifyPages(std::vector<UInt>* bad = nullptr);
+
 
 protected:
  
@@ -587,6 +1122,11 @@ protected:
      */
     void loadTree();
 
+    /** \brief Загружает из потока заголовок дерева, число страниц и номер корневой страницы,
+     *  но не саму корневую страницу (первая часть loadTree()).
+     */
+    void loadHeader();
+
     /** \brief Загружает корневую страницу в одну из рабочих страниц, переданных параметром \c pw. 
      *
      *  Если файле информации о корневой странице не значится, кидает исключение.
@@ -599,6 +1139,13 @@ protected:
      */
     void createTree(UShort order, UShort recSize);
 
+    /** \brief Создает дерево с выровненной геометрией страниц размером \c pageSize.
+     *
+     *  Порядок подбирается методом calcOrderForPageSize(), заголовок дополняется до границы
+     *  страницы, и каждая страница начинается со смещения, кратного \c pageSize.
+     */
+    void createAlignedTree(UInt pageSize, UShort recSize);
+
     /** \brief Создает и записывает корневую страницу при создании дерева с нуля. */
     void createRootPage();
 
@@ -622,7 +1169,11 @@ protected:
     //void checkKeysNumberExc(UShort keysNum, NodeType nt); // bool isRoot);
 
 
-    /** \brief Записывает в поток (в текущую позицию!) заголовок дерева. */
+    /** \brief Записывает в поток (в текущую позицию!) заголовок дерева.
+     *
+     *  Для выровненной геометрии записывает также расширение заголовка и дополняет его нулями
+     *  до первой страницы.
+     */
     void writeHeader();
 
     /** \brief Читает из потока заголовок дерева. */
@@ -641,7 +1192,10 @@ protected:
     void readPageCounter();
 
 
-    /** \brief Осуществляет запись номера страницы/нода, соответствующего корню дерева. */
+    /** \brief Осуществляет запись номера страницы/нода, соответствующего корню дерева.
+     *
+     *  Как и writeHeader() с writePageCounter(), для дерева без потока ничего не делает.
+     */
     void writeRootPageNum(); // UInt rpn);
 
     // /** \brief Запись текущего номера корневой страницы. */
@@ -657,18 +1211,172 @@ protected:
      */
     void setRootPageNum(UInt pnum, bool writeFlag = true);
 
-    /** \brief Задает порядок дерва и пересчитывает связанные значения. */
-    void setOrder(UShort order, UShort recSize);
+    /** \brief Задает порядок дерва и пересчитывает связанные значения.
+     *
+     *  Ненулевой \c pageSize задает выровненную геометрию страниц (см. createAlignedTree()).
+     */
+    void setOrder(UShort order, UShort recSize, UInt pageSize = 0, bool pageCrc = false);
+
+    /** \brief Записывает в конец страницы \c page ее контрольную сумму (для номера \c pnum). */
+    void stampPageCrc(UInt pnum, Byte* page) const;
+
+    /** \brief Возвращает истину, если контрольная сумма страницы \c page номер \c pnum верна. */
+    bool isPageCrcValid(UInt pnum, const Byte* page) const;
+
+    /** \brief Проверяет контрольную сумму только что прочитанной страницы, если они включены,
+     *  и кидает std::runtime_error, если она не сошлась.
+     */
+    void checkPageCrc(UInt pnum, const Byte* page) const;
+
+    /** \brief Общая часть обоих методов writePage(): страница уже снабжена контрольной суммой. */
+    void writeStampedPage(UInt pnum, const Byte* dst);
+
+    /** \brief Кладет страницу в кэш и пишет ее на носитель или, в режиме отложенной записи,
+     *  помечает грязной. Номер страницы не проверяет.
+     */
+    void storePage(UInt pnum, const Byte* src);
+
+    /** \brief Возвращает гистограмму чтения (или записи, если \c write) страниц или nullptr. */
+    LatencyHistogram* getIoHistogram(bool write)
+    {
+        if (!_latencies)
+            return nullptr;
+
+        return write ? &_latencies->pageWrite : &_latencies->pageRead;
+    }
+
+    /** \brief Записывает в трассу обращение к странице \c pnum, если трасса ведется. */
+    void tracePage(UInt pnum, bool write)
+    {
+        if (_tracer)
+            _tracer->record(pnum, write);
+    }
+
+    /** \brief Начинает в трассе новую операцию, если трасса ведется. */
+    void traceOp()
+    {
+        if (_tracer)
+            _tracer->beginOp();
+    }
+
+    /** \brief Учитывает в гистограмме (см. getIoHistogram()) пачку из \c n страниц,
+     *  которая заняла время, замеренное \c timer: каждой странице — равная доля.
+     */
+    void recordIoBatch(LatencyTimer& timer, UInt n)
+    {
+        if (!_latencies || !n)
+            return;
+
+        LatencyHistogram* h = timer.getHistogram();
+        h->record(timer.getElapsed() / n, n);
+        timer.cancel();
+    }
+
+    /** \brief Учитывает в счетчиках \c n страниц, прочитанных с носителя. */
+    void countPageReads(UInt n)
+    {
+        _stats.pageReads += n;
+        _stats.bytesRead += (unsigned long long) n * _nodePageSize;
+    }
+
+    /** \brief Учитывает в счетчиках \c n страниц, записанных на носитель. */
+    void countPageWrites(UInt n)
+    {
+        _stats.pageWrites += n;
+        _stats.bytesWritten += (unsigned long long) n * _nodePageSize;
+    }
+
+    /** \brief Распределяет в кэше кадр под страницу \c pnum, предварительно сбросив грязные
+     *  страницы, если иначе пришлось бы вытеснить грязную.
+     */
+    Byte* insertCacheFrame(UInt pnum);
 
     /** \brief Перераспределяе память для/под рабочие страницы. */
     void reallocWorkPages();
 
 
-    /** \brief Закрытая и основная часть метода readPage(). */
-    void readPageInternal(UInt pnum, Byte* dst);
+    /** \brief Закрытая и основная часть метода readPage(): читает страницу с носителя, минуя кэш.
+     *
+     *  Вместе с writePageInternal() образует точку расширения для наследников, хранящих
+     *  страницы не в потоке \c _stream (см., например, DirectFileBaseBTree).
+     */
+    virtual void readPageInternal(UInt pnum, Byte* dst);
+
+    /** \brief Закрытая и основная часть метода writePage(): пишет страницу на носитель.
+     *
+     *  Страница с номером getLastPageNum() + 1 дописывается в конец.
+     */
+    virtual void writePageInternal(UInt pnum, const Byte* dst);
+
+    /** \brief Пакетная часть методов readPages() и prefetchPages(): читает \c n страниц
+     *  с носителя, минуя кэш. По умолчанию читает их по одной методом readPageInternal().
+     */
+    virtual void readPagesInternal(UInt n, const UInt* pnums, Byte* const* dsts);
+
+    /** \brief Асинхронная часть prefetchPages(): отправляет запросы на чтение \c n страниц
+     *  в буферы \c dsts и возвращается, не дожидаясь их выполнения.
+     *
+     *  Буферы остаются занятыми до вызова endReadPagesInternal(). Возвращает ложь, если
+     *  хранилище не умеет читать асинхронно (по умолчанию) — тогда ничего не читается.
+     */
+    virtual bool beginReadPagesInternal(UInt, const UInt*, Byte* const*) { return false; }
+
+    /** \brief Дожидается чтений, начатых beginReadPagesInternal(). Ошибку кидает только
+     *  после того, как выполнены все запросы.
+     */
+    virtual void endReadPagesInternal() {}
+
+    /** \brief Завершает асинхронное упреждающее чтение, если оно идет. Вызывается перед любым
+     *  обращением к кэшу страниц, кадры которого заняты чтением.
+     */
+    void completePrefetch()
+    {
+        if (!_prefetchPnums.empty())
+            finishPrefetch();
+    }
+
+    /** \brief Дожидается асинхронного упреждающего чтения и проверяет прочитанные страницы;
+     *  при ошибке убирает их из кэша.
+     */
+    void finishPrefetch();
+
+    /** \brief Пакетная часть метода checkpoint(): пишет \c n страниц (номера по возрастанию)
+     *  на носитель. По умолчанию пишет их по одной методом writePageInternal().
+     */
+    virtual void writePagesInternal(UInt n, const UInt* pnums, const Byte* const* srcs);
+
+    /** \brief Возвращает адрес страницы \c pnum, если страницы дерева постоянно находятся
+     *  в памяти по неизменным адресам, иначе nullptr (по умолчанию).
+     *
+     *  Для таких деревьев PageWrapper::readPage() не копирует страницу, а только перенастраивает
+     *  указатель (см. MemoryBaseBTree).
+     */
+    virtual Byte* getResidentPage(UInt /*pnum*/) { return nullptr; }
+
+    /** \brief Возвращает флаги HeaderExt::STORAGE_FLAGS формата хранения страниц, который
+     *  реализует класс дерева (по умолчанию 0 — страницы лежат в потоке по порядку).
+     *
+     *  Открыть файл можно только деревом с тем же форматом хранения. Ненулевой формат
+     *  требует выровненной геометрии страниц, так как флаги хранятся в HeaderExt.
+     */
+    virtual UInt getStorageFlags() const { return 0; }
+
+    /** \brief Подготавливает хранилище страниц наследника, когда геометрия дерева уже известна,
+     *  а страниц еще не читали и не писали: при создании дерева (\c create) — перед записью
+     *  корневой страницы, при загрузке — перед ее чтением. По умолчанию ничего не делает.
+     */
+    virtual void preparePageStorage(bool /*create*/) {}
 
-    /** \brief Закрытая и основная часть метода writePage(). */
-    void writePageInternal(UInt pnum, const Byte* dst);
+    /** \brief Резервирует в хранилище место под страницы с номерами до \c lastPnum включительно
+     *  (сверх уже зарезервированных getReservedPages()). По умолчанию ничего не делает.
+     */
+    virtual void growStorage(UInt /*lastPnum*/) {}
+
+    /** \brief Кладет в кэш копию страницы \c pnum из \c src, если кэш включен. */
+    void cachePage(UInt pnum, const Byte* src);
+
+    /** \brief Перераспределяет кэш страниц под текущие размер и выравнивание страницы. */
+    void resetPageCache();
 
     /** \brief Позиционируется на смещение в файле, соответствующее номеру страницы \c pnum. */
     void gotoPage(UInt pnum);
@@ -683,7 +1391,33 @@ protected:
      */
     void resetBTree();
 
-    
+    /** \brief Возвращает копию записи \c k (размером getRecSize()), распределенную через new[]. */
+    Byte* cloneKey(const Byte* k) const;
+
+    /** \brief Возвращает истину, если ключи \c lhv и \c rhv эквивалентны.
+     *
+     *  Для лексикографического компаратора сравнивает через memcmp(), иначе — через компаратор.
+     */
+    bool isKeysEqual(const Byte* lhv, const Byte* rhv)
+    {
+        ++_stats.keyCompares;
+        if (_lexKeys)
+            return memcmp(lhv, rhv, _recSize) == 0;
+
+        return _comparator->isEqual(lhv, rhv, _recSize);
+    }
+
+    /** \brief Возвращает истину, если ключ \c lhv меньше \c rhv. Аналогично isKeysEqual(). */
+    bool isKeyLess(const Byte* lhv, const Byte* rhv)
+    {
+        ++_stats.keyCompares;
+        if (_lexKeys)
+            return memcmp(lhv, rhv, _recSize) < 0;
+
+        return _comparator->compare(lhv, rhv, _recSize);
+    }
+
+
 
 protected:
 
@@ -707,6 +1441,24 @@ protected:
 
     /** \brief Размер всего узла, он же определяет размер страницы. */
     UInt _nodePageSize;
+
+    /** \brief Размер выровненной страницы или 0, если страницы не выравниваются. */
+    UInt _alignedPageSize;
+
+    /** \brief Смещение первой страницы в файле. */
+    UInt _firstPageOfs;
+
+    /** \brief Версия формата файла (1 или 2). */
+    UShort _formatVersion;
+
+    /** \brief Истина, если страницы открытого дерева снабжены контрольными суммами. */
+    bool _pageCrc;
+
+    /** \brief Включать ли контрольные суммы страниц у создаваемых деревьев. */
+    bool _pageCrcOnCreate;
+
+    /** \brief Буфер для страниц, записываемых через writePage(UInt, const Byte*) с контрольной суммой. */
+    std::vector<Byte> _crcBuf;
     
     
     /** \brief Определяет длину записи ключа. */
@@ -749,6 +1501,36 @@ protected:
     /** \brief Компаратор для сравнения ключей. */
     IComparator* _comparator;
 
+    /** \brief Истина, если компаратор лексикографический (см. IComparator::isLexicographic()). */
+    bool _lexKeys;
+
+    /** \brief Заданная емкость кэша страниц. */
+    UInt _cacheSize;
+
+    /** \brief Истина, если включен режим отложенной записи страниц. */
+    bool _writeBack;
+
+    /** \brief Счетчики операций. */
+    Stats _stats;
+
+    /** \brief Гистограммы задержек или nullptr, если они выключены. */
+    Latencies* _latencies;
+
+    /** \brief Трассировщик обращений к страницам или nullptr. */
+    PageTracer* _tracer;
+
+    /** \brief Шаг роста хранилища в страницах (0 — без резервирования). */
+    UInt _growthExtent;
+
+    /** \brief Число страниц, под которые зарезервировано место в хранилище. */
+    UInt _reservedPages;
+
+    /** \brief Собственный кэш страниц дерева. */
+    PageCache _pageCache;
+
+    /** \brief Страницы, асинхронное чтение которых в кадры кэша начато, но не завершено. */
+    std::vector<UInt> _prefetchPnums;
+
 
 }; // class BaseBTree
 
@@ -806,6 +1588,14 @@ public:
     void create(UShort order, UShort recSize, //IComparator* comparator, 
         const std::string& fileName);
 
+    /** \brief Создает дерево с выровненной геометрией страниц размером \c pageSize байт
+     *  (степень двойки, не меньше 512, например 4096 или 16384).
+     *
+     *  Порядок дерева подбирается максимальным, при котором узел помещается в страницу.
+     *  Если дерево уже открыто, генерирует исключительную ситуацию.
+     */
+    void createForPageSize(UInt pageSize, UShort recSize, const std::string& fileName);
+
     /** \brief Загружает дерево из файла.
      *
      *  Если дерево уже открыто, генерирует исключительную ситуацию.
@@ -816,13 +1606,37 @@ public:
      *
      *  Закрывает дерево и ассоциированные с ним потоки.
      *  Если дерево не открыто, просто ничего не делает (искл. НЕ генерирует для удобства).
+     *  Если не удалось записать отложенные страницы (см. setWriteBack()), кидает исключение,
+     *  и дерево остается открытым.
      */
     void close();
+
+    /** \brief Закрывает дерево, как close(), но не выпускает исключений: отложенные страницы,
+     *  которые не удалось записать, теряются. Предназначен для деструкторов.
+     */
+    void closeNoThrow();
 public:
 
     // /** \brief Возвращает истину, если дерево открыто, ложь иначе. */
     //\copydoc
     virtual bool isOpen() const override;
+
+    /** \brief Страницы лежат в файле дерева по порядку, без преобразований. */
+    virtual bool canAccessPagesDirectly() const override { return true; }
+
+    /** \brief Возвращает имя файла открытого дерева. */
+    const std::string& getFileName() const { return _fileName; }
+
+    /** \brief Создает новый, не открытый объект дерева того же класса хранения страниц и с теми же
+     *  его настройками (распределен через new). Используется, когда дерево нужно пересоздать в
+     *  другом файле, например, при дефрагментации (см. BTreeBuilder::compactFile()).
+     */
+    virtual FileBaseBTree* createEmptyLike() const { return new FileBaseBTree; }
+
+    /** \brief Добавляет в \c suffixes суффиксы имен вспомогательных файлов дерева: такой файл
+     *  называется как файл дерева с суффиксом и переносится вместе с ним.
+     */
+    virtual void getAuxFileSuffixes(std::vector<std::string>&) const {}
     
 protected:
 
@@ -830,7 +1644,7 @@ protected:
      *  и метода open() не выполняет никаких проверок, которые подразумеваются быть сделанными там.
      */
     void createInternal(UShort order, UShort recSize, // IComparator* comparator, 
-        const std::string& fileName);
+        const std::string& fileName, UInt pageSize = 0);
 
     /** \brief Загружает дерево из файла \c fileName.
      *
@@ -843,8 +1657,19 @@ protected:
     /** \brief Закрывает файловые потоки, ассоциированные с деревом.
      *
      *  Выполняет инициализацию объекта к такому состоянию, чтобы можно было повторно открыть.
+     *  Наследники, держащие собственные ресурсы ввода-вывода, освобождают их здесь.
      */
-    void closeInternal();
+    virtual void closeInternal();
+
+    /** \brief Вызывается после того, как дерево создано или загружено из потока.
+     *
+     *  Точка расширения для наследников, которые обслуживают ввод-вывод страниц не через
+     *  поток (см. DirectFileBaseBTree). По умолчанию ничего не делает.
+     */
+    virtual void openPageStorage() {}
+
+    /** \brief Резервирует место в файле через posix_fallocate(), без записи данных. */
+    virtual void growStorage(UInt lastPnum) override;
 
     /** \brief Проверяет параметры дерева и, если они некорректны, киает исключение. */
     void checkTreeParams(UShort order, UShort recSize);
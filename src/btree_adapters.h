@@ -18,6 +18,12 @@
 
 #include <string>
 #include <fstream>
+#include <cstring>          // memcmp
+#include <cstdint>
+#include <list>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 
 #include "btree.h"
 
@@ -126,6 +132,234 @@ struct BTreeAdapterTraits {
 
 
 
+//==============================================================================
+// Порядкосохраняющее кодирование ключей
+//==============================================================================
+
+/** \brief Кодек, отображающий типизированный ключ в строку байт фиксированной длины так, что
+ *  лексикографический (memcmp) порядок кодов совпадает с естественным порядком ключей.
+ *
+ *  Общий шаблон определен для целочисленных типов: число записывается в big-endian,
+ *  у знаковых дополнительно инвертируется знаковый бит. Специализации ниже покрывают
+ *  числа с плавающей точкой, кортежи и строки.
+ *
+ *  Каждый кодек предоставляет константу \c SIZE (длина кода) и методы encode()/decode().
+ */
+template <typename T>
+struct OrderedKeyCodec {
+
+    static_assert(std::is_integral<T>::value, "OrderedKeyCodec is defined for integral, floating point "
+                  "and tuple types; use OrderedStringCodec for strings");
+
+    /** \brief Беззнаковый тип того же размера. */
+    typedef typename std::make_unsigned<T>::type TUnsigned;
+
+    /** \brief Длина кода в байтах. */
+    static const UShort SIZE = sizeof(T);
+
+    /** \brief Записывает код ключа \c key по адресу \c raw. */
+    static void encode(Byte* raw, T key)
+    {
+        TUnsigned u = (TUnsigned)key;
+        if (std::is_signed<T>::value)
+            u ^= signBit();
+
+        writeBE(raw, u);
+    }
+
+    /** \brief Восстанавливает ключ \c key по его коду, расположенному по адресу \c raw. */
+    static void decode(const Byte* raw, T& key)
+    {
+        TUnsigned u = readBE(raw);
+        if (std::is_signed<T>::value)
+            u ^= signBit();
+
+        key = (T)u;
+    }
+
+    /** \brief Записывает беззнаковое \c u в \c raw, начиная со старшего байта. */
+    static void writeBE(Byte* raw, TUnsigned u)
+    {
+        for (int i = SIZE - 1; i >= 0; --i)
+        {
+            raw[i] = (Byte)(u & 0xFF);
+            u = (TUnsigned)(u >> 8);
+        }
+    }
+
+    /** \brief Читает беззнаковое, записанное методом writeBE(). */
+    static TUnsigned readBE(const Byte* raw)
+    {
+        TUnsigned u = 0;
+        for (int i = 0; i < SIZE; ++i)
+            u = (TUnsigned)((u << 8) | raw[i]);
+
+        return u;
+    }
+
+    /** \brief Маска старшего (знакового) бита. */
+    static TUnsigned signBit() { return (TUnsigned)((TUnsigned)1 << (SIZE * 8 - 1)); }
+
+}; // struct OrderedKeyCodec
+
+
+/** \brief Общая часть кодеков чисел с плавающей точкой: \c TBits — беззнаковый целый того же размера.
+ *
+ *  У неотрицательных чисел инвертируется знаковый бит, у отрицательных — все биты, после чего
+ *  результат записывается в big-endian. -0.0 при этом оказывается строго меньше +0.0,
+ *  а NaN-ы — по краям диапазона.
+ */
+template <typename T, typename TBits>
+struct OrderedFloatCodec {
+
+    static_assert(sizeof(T) == sizeof(TBits), "Float and its bits must have the same size");
+
+    static const UShort SIZE = sizeof(T);
+
+    static void encode(Byte* raw, T key)
+    {
+        TBits u;
+        memcpy(&u, &key, SIZE);
+        if (u & OrderedKeyCodec<TBits>::signBit())
+            u = (TBits)~u;
+        else
+            u ^= OrderedKeyCodec<TBits>::signBit();
+
+        OrderedKeyCodec<TBits>::writeBE(raw, u);
+    }
+
+    static void decode(const Byte* raw, T& key)
+    {
+        TBits u = OrderedKeyCodec<TBits>::readBE(raw);
+        if (u & OrderedKeyCodec<TBits>::signBit())
+            u ^= OrderedKeyCodec<TBits>::signBit();
+        else
+            u = (TBits)~u;
+
+        memcpy(&key, &u, SIZE);
+    }
+}; // struct OrderedFloatCodec
+
+
+/** \brief Кодек для float. */
+template <>
+struct OrderedKeyCodec<float> : public OrderedFloatCodec<float, uint32_t> {};
+
+/** \brief Кодек для double. */
+template <>
+struct OrderedKeyCodec<double> : public OrderedFloatCodec<double, uint64_t> {};
+
+
+/** \brief Рекурсивная часть кодека кортежей: кодирует элементы с номера \c I по конец кортежа. */
+template <typename Tuple, std::size_t I = 0, bool End = (I == std::tuple_size<Tuple>::value)>
+struct OrderedTupleCodecImpl {
+
+    typedef typename std::tuple_element<I, Tuple>::type TElem;
+    typedef OrderedKeyCodec<TElem> TElemCodec;
+    typedef OrderedTupleCodecImpl<Tuple, I + 1> TRest;
+
+    static const UShort SIZE = TElemCodec::SIZE + TRest::SIZE;
+
+    static void encode(Byte* raw, const Tuple& key)
+    {
+        TElemCodec::encode(raw, std::get<I>(key));
+        TRest::encode(raw + TElemCodec::SIZE, key);
+    }
+
+    static void decode(const Byte* raw, Tuple& key)
+    {
+        TElemCodec::decode(raw, std::get<I>(key));
+        TRest::decode(raw + TElemCodec::SIZE, key);
+    }
+}; // struct OrderedTupleCodecImpl
+
+
+/** \brief Конец рекурсии кодека кортежей. */
+template <typename Tuple, std::size_t I>
+struct OrderedTupleCodecImpl<Tuple, I, true> {
+    static const UShort SIZE = 0;
+    static void encode(Byte*, const Tuple&) {}
+    static void decode(const Byte*, Tuple&) {}
+};
+
+
+/** \brief Кодек для кортежей: коды элементов записываются друг за другом, поэтому
+ *  memcmp-порядок кодов совпадает с лексикографическим порядком кортежей.
+ */
+template <typename... Ts>
+struct OrderedKeyCodec<std::tuple<Ts...>> : public OrderedTupleCodecImpl<std::tuple<Ts...>> {};
+
+
+/** \brief Кодек для строк с ограничением длины \c N байт.
+ *
+ *  Строка дополняется нулевыми байтами до \c N, поэтому строки, различающиеся только
+ *  хвостовыми нулями, считаются равными. Строки длиннее \c N не кодируются: кидается
+ *  исключение std::invalid_argument.
+ */
+template <UShort N>
+struct OrderedStringCodec {
+
+    static const UShort SIZE = N;
+
+    static void encode(Byte* raw, const std::string& key)
+    {
+        if (key.size() > N)
+            throw std::invalid_argument("String key is too long for the record size");
+
+        memcpy(raw, key.data(), key.size());
+        memset(raw + key.size(), 0, N - key.size());
+    }
+
+    static void decode(const Byte* raw, std::string& key)
+    {
+        const Byte* end = (const Byte*)memchr(raw, 0, N);
+        key.assign((const char*)raw, end ? (std::size_t)(end - raw) : N);
+    }
+}; // struct OrderedStringCodec
+
+
+/** \brief Класс свойств для ключей, хранимых в порядкосохраняющей кодировке \c Codec.
+ *
+ *  В отличие от BTreeAdapterTraits, ключи в файле лежат не в машинном представлении,
+ *  а в виде кодов, сравниваемых побайтно (memcmp). Такие деревья используют компаратор
+ *  BTreeLexComparator, и ядро дерева сравнивает ключи без обращения к компаратору.
+ */
+template <typename T, typename Codec = OrderedKeyCodec<T>>
+struct BTreeOrderedTraits {
+
+    typedef const T&                TArg;
+    typedef T&                      TRef;
+    typedef T                       TRes;
+    typedef T&                      TRefRes;
+    typedef const T*                TConstPtr;
+
+    /** \brief Размер записи — длина кода. */
+    static const UShort REC_SIZE = Codec::SIZE;
+
+    static bool compare(const Byte* lhv, const Byte* rhv, UInt sz)
+    {
+        return memcmp(lhv, rhv, sz) < 0;
+    }
+
+    static bool isEqual(const Byte* lhv, const Byte* rhv, UInt sz)
+    {
+        return memcmp(lhv, rhv, sz) == 0;
+    }
+
+    static void raw2keyRes(const Byte* raw, TRef key)
+    {
+        Codec::decode(raw, key);
+    }
+
+    static void key2Raw(Byte* raw, TArg key)
+    {
+        Codec::encode(raw, key);
+    }
+
+}; // struct BTreeOrderedTraits
+
+
+
 /** \brief Реализация компаратора по умолчанию, основанная на соответствуем методе compare()
  *  из класса свойств.
  */
@@ -150,6 +384,29 @@ struct BTreeComparator : public BaseBTree::IComparator {
 }; // struct BTreeComparator
 
 
+/** \brief Компаратор, упорядочивающий ключи как массивы беззнаковых байт (как memcmp()).
+ *
+ *  Подходит для строковых ключей фиксированной длины (URL, составные идентификаторы),
+ *  дополненных нулями до размера записи. Так как порядок лексикографический, дерево
+ *  при поиске в узле сравнивает общий префикс ключей узла лишь один раз.
+ */
+struct BTreeLexComparator : public BaseBTree::IComparator {
+
+    virtual bool compare(const Byte* lhv, const Byte* rhv, UInt sz) override
+    {
+        return memcmp(lhv, rhv, sz) < 0;
+    }
+
+    virtual bool isEqual(const Byte* lhv, const Byte* rhv, UInt sz) override
+    {
+        return memcmp(lhv, rhv, sz) == 0;
+    }
+
+    virtual bool isLexicographic() const override { return true; }
+
+}; // struct BTreeLexComparator
+
+
 /** \brief Адаптер для B-дерева, получающий тип ключа из параметра шаблона, а дополнительную
  *  информацию из специального класса свойств (traits).
  *
@@ -200,7 +457,7 @@ public:
     /** \brief Деструктор. */
     ~BTreeAdapter()
     {
-        _btree.close();
+        _btree.closeNoThrow();
     }
 
 protected:
@@ -222,6 +479,14 @@ public:
         createInternal(order, fileName);
     }
 
+    /** \brief Создает дерево с выровненными страницами размером \c pageSize байт, подбирая
+     *  порядок под размер страницы (см. FileBaseBTree::createForPageSize()).
+     */
+    void createForPageSize(UInt pageSize, const std::string& fileName)
+    {
+        _btree.createForPageSize(pageSize, REC_SIZE, fileName);
+    }
+
 
     /** \brief Прокси-хелпер для закрытия дерева. */
     void close()
@@ -272,8 +537,83 @@ public:
 
 
 
-//public:
-//    // некоторые прокси-методы, для удо
+public:
+    // прокси-методы основных операций дерева для типизированных ключей
+
+    /** \brief Вставляет в дерево ключ \c key. */
+    void insert(TArg key)
+    {
+        Byte raw[REC_SIZE];
+        Traits::key2Raw(raw, key);
+
+        _btree.insert(raw);
+    }
+
+    /** \brief Ищет первое вхождение ключа \c key; если найден, записывает его в \c res
+     *  и возвращает истину.
+     */
+    bool search(TArg key, TRes& res)
+    {
+        Byte raw[REC_SIZE];
+        Traits::key2Raw(raw, key);
+
+        Byte* found = _btree.search(raw);
+        if (!found)
+            return false;
+
+        Traits::raw2keyRes(found, res);
+        delete[] found;
+
+        return true;
+    }
+
+    /** \brief Ищет все вхождения ключа \c key и добавляет их в список \c keys.
+     *
+     *  \returns число найденных элементов
+     */
+    int searchAll(TArg key, std::list<TRes>& keys)
+    {
+        Byte raw[REC_SIZE];
+        Traits::key2Raw(raw, key);
+
+        std::list<Byte*> found;
+        int num = _btree.searchAll(raw, found);
+        for (Byte* f : found)
+        {
+            TRes res;
+            Traits::raw2keyRes(f, res);
+            keys.push_back(res);
+            delete[] f;
+        }
+
+        return num;
+    }
+
+    /** \brief Добавляет в список \c keys все ключи из диапазона [from, to] в порядке возрастания.
+     *
+     *  \returns число найденных элементов
+     */
+    int searchRange(TArg from, TArg to, std::list<TRes>& keys)
+    {
+        Byte rawFrom[REC_SIZE];
+        Byte rawTo[REC_SIZE];
+        Traits::key2Raw(rawFrom, from);
+        Traits::key2Raw(rawTo, to);
+
+        BaseBTree::RangeCursor cur(&_btree);
+        cur.seek(rawFrom, rawTo);
+
+        int num = 0;
+        while (cur.next())
+        {
+            TRes res;
+            Traits::raw2keyRes(cur.getKey(), res);
+            keys.push_back(res);
+            ++num;
+        }
+
+        return num;
+    }
 
 
 
@@ -327,6 +667,12 @@ protected:
 //class BTreeIntAdapter : public BTreeAdapter<>
 typedef BTreeAdapter<int> BTreeIntAdapter;
 
+/** \brief Адаптер для int, хранящий ключи в порядкосохраняющей кодировке (сравнение — memcmp). */
+typedef BTreeAdapter<int, BTreeOrderedTraits<int>, BTreeLexComparator> BTreeOrderedIntAdapter;
+
+/** \brief Адаптер для double в порядкосохраняющей кодировке. */
+typedef BTreeAdapter<double, BTreeOrderedTraits<double>, BTreeLexComparator> BTreeOrderedDoubleAdapter;
+
 
 
 
@@ -0,0 +1,936 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  btree_builder.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "btree_builder.h"
+
+#include <stdexcept>        // std::invalid_argument
+#include <cstdio>           // std::remove, std::rename
+#include <climits>          // UINT_MAX
+#include <thread>
+#include <exception>        // std::exception_ptr
+#include <algorithm>        // std::sort, std::inplace_merge
+#include <fstream>          // std::ifstream
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>          // open
+#include <unistd.h>         // pwrite, close
+#endif
+
+
+namespace xi
+{
+
+
+/** \brief Предел насыщения при подсчете емкости поддеревьев. */
+static const unsigned long long SUBTREE_KEYS_LIMIT = ~0ULL >> 2;
+
+
+BTreeBuilder::BTreeBuilder(BaseBTree *tree, double fillFactor)
+        : _tree(tree), _targetKeys(0), _src(nullptr), _prevKey(nullptr), _hasPrev(false)
+{
+    if (!(fillFactor > 0.0 && fillFactor <= 1.0))
+        throw std::invalid_argument("Fill factor must be in (0, 1]");
+
+    // целевое заполнение узла: доля от максимума, но в пределах, допустимых порядком
+    _targetKeys = (UInt) (fillFactor * _tree->getMaxKeys() + 0.5);
+    if (_targetKeys < _tree->getMinKeys())
+        _targetKeys = _tree->getMinKeys();
+    if (_targetKeys < 1)
+        _targetKeys = 1;
+    if (_targetKeys > _tree->getMaxKeys())
+        _targetKeys = _tree->getMaxKeys();
+}
+
+
+BTreeBuilder::~BTreeBuilder()
+{
+    for (BaseBTree::PageWrapper *pw : _pages)
+        delete pw;
+
+    delete[] _prevKey;
+}
+
+
+void BTreeBuilder::build(unsigned long long n, IKeySource &src)
+{
+    checkEmpty(*_tree);
+    planShape(n);
+    allocPages();
+
+    _levelNext.assign(_levelKeys.size(), 0);
+    while (_pages.size() < _levelKeys.size())
+        _pages.push_back(new BaseBTree::PageWrapper(_tree));
+
+    delete[] _prevKey;
+    _prevKey = new Byte[_tree->getRecSize()];
+    _hasPrev = false;
+    _src = &src;
+
+    fillNode(0);
+    _src = nullptr;
+
+    finishBuild();
+}
+
+
+void BTreeBuilder::allocPages()
+{
+    // страницы: уровни подряд, корень остается первой страницей
+    _levelBase.clear();
+    unsigned long long pages = 0;
+    for (const std::vector<UShort> &level : _levelKeys)
+    {
+        _levelBase.push_back((UInt) pages + 1);
+        pages += level.size();
+    }
+    if (pages >= UINT_MAX)
+        throw std::invalid_argument("Too many keys for a B-tree");
+
+    // все страницы распределяем сразу: записываются они не по порядку номеров
+    _tree->_lastPageNum = (UInt) pages;
+    _tree->writePageCounter();
+}
+
+
+void BTreeBuilder::finishBuild()
+{
+    _tree->setRootPageNum(_levelBase[0]);
+    _tree->_rootPage.readPage(_levelBase[0]);
+}
+
+
+void BTreeBuilder::planShape(unsigned long long n)
+{
+    _levelKeys.clear();
+
+    // наименьшая высота при целевом заполнении; если при ней корню не набрать
+    // допустимого числа детей (ключей слишком мало для минимального заполнения),
+    // дерево делаем ниже — тогда узлы заполняются плотнее целевого
+    UInt height = 1;
+    while (calcSubtreeKeys(_targetKeys, height) < n)
+        ++height;
+    while (height > 1 && !isRootFeasible(n, height))
+        --height;
+
+    // уровень за уровнем от корня: размеры поддеревьев делим между детьми поровну
+    std::vector<unsigned long long> sizes(1, n);
+    for (UInt h = height; h >= 1; --h)
+    {
+        std::vector<UShort> keys;
+        std::vector<unsigned long long> next;
+        keys.reserve(sizes.size());
+
+        for (unsigned long long sz : sizes)
+        {
+            if (h == 1)
+            {
+                keys.push_back((UShort) sz);
+                continue;
+            }
+
+            UInt c = calcChildrenNum(sz, h, h == height);
+            keys.push_back((UShort) (c - 1));
+
+            unsigned long long rest = sz - (c - 1);
+            for (UInt i = 0; i < c; ++i)
+                next.push_back(rest / c + (i < rest % c ? 1 : 0));
+        }
+
+        _levelKeys.push_back(keys);
+        sizes.swap(next);
+    }
+}
+
+
+UInt BTreeBuilder::calcChildrenNum(unsigned long long n, UInt h, bool isRoot) const
+{
+    // c детей с поддеревьями из s_i ключей и c - 1 ключей в самом узле:
+    // c * (min + 1) <= n + 1 <= c * (max + 1)
+    unsigned long long tgt = calcSubtreeKeys(_targetKeys, h - 1) + 1;
+    unsigned long long mn = calcSubtreeKeys(_tree->getMinKeys(), h - 1) + 1;
+    unsigned long long mx = calcSubtreeKeys(_tree->getMaxKeys(), h - 1) + 1;
+
+    unsigned long long lo = (n + mx) / mx;                          // ceil((n + 1) / mx)
+    unsigned long long minChildren = isRoot ? 2 : _tree->getMinKeys() + 1;
+    if (lo < minChildren)
+        lo = minChildren;
+
+    unsigned long long hi = (n + 1) / mn;
+    if (hi > _tree->getMaxKeys() + 1)
+        hi = _tree->getMaxKeys() + 1;
+
+    if (lo > hi)
+        throw std::logic_error("Can't plan B-tree shape");
+
+    unsigned long long c = (n + tgt) / tgt;                         // ceil((n + 1) / tgt)
+    if (c < lo)
+        c = lo;
+    if (c > hi)
+        c = hi;
+
+    return (UInt) c;
+}
+
+
+bool BTreeBuilder::isRootFeasible(unsigned long long n, UInt h) const
+{
+    unsigned long long mn = calcSubtreeKeys(_tree->getMinKeys(), h - 1) + 1;
+    unsigned long long mx = calcSubtreeKeys(_tree->getMaxKeys(), h - 1) + 1;
+
+    unsigned long long lo = (n + mx) / mx;
+    if (lo < 2)
+        lo = 2;
+
+    unsigned long long hi = (n + 1) / mn;
+    if (hi > _tree->getMaxKeys() + 1)
+        hi = _tree->getMaxKeys() + 1;
+
+    return lo <= hi;
+}
+
+
+unsigned long long BTreeBuilder::calcSubtreeKeys(UInt keysPerNode, UInt h)
+{
+    unsigned long long base = (unsigned long long) keysPerNode + 1;
+    unsigned long long res = 1;
+    for (UInt i = 0; i < h; ++i)
+    {
+        if (res > SUBTREE_KEYS_LIMIT / base)
+            return SUBTREE_KEYS_LIMIT;
+        res *= base;
+    }
+
+    return res - 1;
+}
+
+
+UInt BTreeBuilder::fillNode(UInt level)
+{
+    UInt idx = _levelNext[level]++;
+    UShort keysNum = _levelKeys[level][idx];
+    UInt pnum = _levelBase[level] + idx;
+    bool isLeaf = (level + 1 == _levelKeys.size());
+
+    BaseBTree::PageWrapper &pw = *_pages[level];
+    pw.clear();
+    pw.setKeyNumLeaf(keysNum, level == 0, isLeaf);
+
+    // симметричный обход: поддерево ребенка i, затем ключ i
+    for (UShort i = 0; i <= keysNum; ++i)
+    {
+        if (!isLeaf)
+            pw.setCursor(i, fillNode(level + 1));
+
+        if (i < keysNum)
+            nextKey(pw.getKey(i));
+    }
+
+    _tree->writePage(pnum, pw.getData());
+
+    return pnum;
+}
+
+
+void BTreeBuilder::nextKey(Byte *dst)
+{
+    if (!_src->next(dst))
+        throw std::runtime_error("Key source has fewer keys than expected");
+
+    if (_tree->getComparator())
+    {
+        if (_hasPrev && _tree->isKeyLess(dst, _prevKey))
+            throw std::invalid_argument("Keys must be sorted to build a B-tree");
+
+        memcpy(_prevKey, dst, _tree->getRecSize());
+        _hasPrev = true;
+    }
+}
+
+
+void BTreeBuilder::checkEmpty(BaseBTree &dst)
+{
+    if (!dst.isOpen())
+        throw std::runtime_error("B-tree is not open");
+
+    // строим только в только что созданном дереве: один пустой корень
+    if (dst.getLastPageNum() != 1 || dst.getRootPageNum() != 1
+            || dst.getRootPage().getKeysNum() != 0)
+        throw std::invalid_argument("B-tree must be empty to be built");
+}
+
+
+/** \brief Замещает каждый файл \c dsts[i] файлом \c srcs[i] — все или ни одного.
+ *
+ *  Возвращает ложь, если заместить не удалось; прежние файлы \c dsts при этом возвращаются
+ *  на место, а файлы \c srcs остаются нетронутыми.
+ */
+static bool replaceFiles(const std::vector<std::string> &srcs, const std::vector<std::string> &dsts)
+{
+#ifndef _WIN32
+    // один файл rename() замещает атомарно
+    if (srcs.size() == 1)
+        return std::rename(srcs[0].c_str(), dsts[0].c_str()) == 0;
+#endif
+
+    // несколько файлов (и любой файл под Windows, где rename() не перезаписывает) атомарно
+    // не заместить: сначала откладываем все прежние файлы, затем ставим новые, а при
+    // любой неудаче возвращаем прежние — иначе файлы дерева разошлись бы между собой
+    size_t n = srcs.size();
+    std::vector<std::string> backups(n);
+    std::vector<bool> hadDst(n, false);
+    size_t moved = 0;
+    for (; moved < n; ++moved)
+    {
+        backups[moved] = dsts[moved] + ".bak";
+        std::remove(backups[moved].c_str());
+        std::ifstream exists(dsts[moved].c_str());
+        hadDst[moved] = exists.is_open();
+        exists.close();
+        if (hadDst[moved] && std::rename(dsts[moved].c_str(), backups[moved].c_str()) != 0)
+            break;
+    }
+
+    size_t installed = 0;
+    if (moved == n)
+    {
+        for (; installed < n; ++installed)
+            if (std::rename(srcs[installed].c_str(), dsts[installed].c_str()) != 0)
+                break;
+    }
+
+    if (installed < n)
+    {
+        for (size_t i = 0; i < installed; ++i)
+            std::rename(dsts[i].c_str(), srcs[i].c_str());
+        for (size_t i = 0; i < moved; ++i)
+            if (hadDst[i])
+                std::rename(backups[i].c_str(), dsts[i].c_str());
+        return false;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        if (hadDst[i])
+            std::remove(backups[i].c_str());
+    return true;
+}
+
+
+/** \brief Источник ключей — курсор по всему дереву. */
+class CursorKeySource : public BTreeBuilder::IKeySource {
+public:
+    CursorKeySource(BaseBTree* tree) : _cur(tree), _recSize(tree->getRecSize())
+    {
+        _cur.seek(nullptr);
+    }
+
+    virtual bool next(Byte* dst) override
+    {
+        if (!_cur.next())
+            return false;
+
+        memcpy(dst, _cur.getKey(), _recSize);
+        return true;
+    }
+
+protected:
+    BaseBTree::RangeCursor _cur;
+    UShort _recSize;
+}; // class CursorKeySource
+
+
+void BTreeBuilder::compact(BaseBTree &src, BaseBTree &dst, double fillFactor)
+{
+    if (src.getRecSize() != dst.getRecSize())
+        throw std::invalid_argument("Record sizes of B-trees differ");
+
+    unsigned long long n = 0;
+    {
+        BaseBTree::RangeCursor cur(&src);
+        cur.seek(nullptr);
+        while (cur.next())
+            ++n;
+    }
+
+    CursorKeySource keys(&src);
+    BTreeBuilder builder(&dst, fillFactor);
+    builder.build(n, keys);
+}
+
+
+void BTreeBuilder::compactFile(FileBaseBTree &tree, double fillFactor)
+{
+    if (!tree.isOpen())
+        throw std::runtime_error("B-tree is not open");
+
+    std::string fileName = tree.getFileName();
+    std::string tmpName = fileName + ".compact";
+    BaseBTree::IComparator *comparator = tree.getComparator();
+
+    // файл дерева и вспомогательные файлы его класса хранения (например, файл данных сжатого)
+    std::vector<std::string> suffixes(1);
+    tree.getAuxFileSuffixes(suffixes);
+
+    FileBaseBTree *dst = tree.createEmptyLike();
+    try
+    {
+        dst->setComparator(comparator);
+        dst->setPageChecksums(tree.hasPageChecksums());
+        if (tree.isPageAligned())
+            dst->createForPageSize(tree.getNodePageSize(), tree.getRecSize(), tmpName);
+        else
+            dst->create(tree.getOrder(), tree.getRecSize(), tmpName);
+
+        compact(tree, *dst, fillFactor);
+        dst->close();
+    }
+    catch (...)
+    {
+        delete dst;
+        for (const std::string &sfx : suffixes)
+            std::remove((tmpName + sfx).c_str());
+        throw;
+    }
+    delete dst;
+
+    // замещаем исходные файлы все вместе: если не вышло, исходное дерево остается целым
+    std::vector<std::string> srcs;
+    std::vector<std::string> dsts;
+    for (const std::string &sfx : suffixes)
+    {
+        srcs.push_back(tmpName + sfx);
+        dsts.push_back(fileName + sfx);
+    }
+
+    tree.close();
+    bool replaced = replaceFiles(srcs, dsts);
+    if (!replaced)
+    {
+        for (const std::string &src : srcs)
+            std::remove(src.c_str());
+    }
+
+    tree.setComparator(comparator);
+    tree.open(fileName);
+    if (!replaced)
+        throw std::runtime_error("Can't replace B-tree file with its compacted copy");
+}
+
+
+void BTreeBuilder::collectShape(BaseBTree &tree, Shape &shape)
+{
+    shape.pages.clear();
+    shape.firstChild.clear();
+    shape.childNum.clear();
+    shape.height = 0;
+
+    if (tree.getRootPageNum() == 0)
+        return;
+
+    // обход в ширину: дети узла добавляются в очередь подряд
+    BaseBTree::PageWrapper pw(&tree);
+    shape.pages.push_back(tree.getRootPageNum());
+    UInt levelEnd = 1;
+    for (UInt i = 0; i < shape.pages.size(); ++i)
+    {
+        if (i == 0 || i == levelEnd)
+        {
+            ++shape.height;
+            levelEnd = (UInt) shape.pages.size();
+        }
+
+        pw.readPage(shape.pages[i]);
+        shape.firstChild.push_back((UInt) shape.pages.size());
+
+        if (pw.isLeaf())
+        {
+            shape.childNum.push_back(0);
+            continue;
+        }
+
+        UShort n = pw.getKeysNum();
+        shape.childNum.push_back((UShort) (n + 1));
+        for (UShort c = 0; c <= n; ++c)
+            shape.pages.push_back(pw.getCursor(c));
+    }
+}
+
+
+void BTreeBuilder::vanEmdeBoasOrder(const Shape &shape, UInt node, UInt h, std::vector<UInt> &order)
+{
+    if (h == 1)
+    {
+        order.push_back(node);
+        return;
+    }
+
+    // верхнее поддерево, затем нижние — слева направо
+    UInt top = h / 2;
+    vanEmdeBoasOrder(shape, node, top, order);
+
+    // потомки узла на глубине top занимают в обходе в ширину непрерывный диапазон
+    UInt lo = node, hi = node + 1;
+    for (UInt d = 0; d < top && lo < hi; ++d)
+    {
+        UInt last = hi - 1;
+        lo = shape.firstChild[lo];
+        hi = shape.firstChild[last] + shape.childNum[last];
+    }
+
+    for (UInt x = lo; x < hi; ++x)
+        vanEmdeBoasOrder(shape, x, h - top, order);
+}
+
+
+void BTreeBuilder::calcPageOrder(BaseBTree &tree, PageOrder order, std::vector<UInt> &pages)
+{
+    Shape shape;
+    collectShape(tree, shape);
+
+    pages.clear();
+    if (order == poBreadthFirst)
+    {
+        pages = shape.pages;
+        return;
+    }
+
+    std::vector<UInt> idx;
+    idx.reserve(shape.pages.size());
+    if (!shape.pages.empty())
+        vanEmdeBoasOrder(shape, 0, shape.height, idx);
+
+    pages.reserve(idx.size());
+    for (UInt i : idx)
+        pages.push_back(shape.pages[i]);
+}
+
+
+void BTreeBuilder::exportLayout(BaseBTree &src, BaseBTree &dst, PageOrder order)
+{
+    if (src.getOrder() != dst.getOrder() || src.getRecSize() != dst.getRecSize())
+        throw std::invalid_argument("B-trees must have the same order and record size");
+
+    checkEmpty(dst);
+
+    Shape shape;
+    collectShape(src, shape);
+    if (shape.pages.empty())
+        return;
+
+    std::vector<UInt> idx;
+    if (order == poBreadthFirst)
+    {
+        for (UInt i = 0; i < shape.pages.size(); ++i)
+            idx.push_back(i);
+    }
+    else
+        vanEmdeBoasOrder(shape, 0, shape.height, idx);
+
+    // новые номера страниц узлов (по индексу в обходе в ширину)
+    std::vector<UInt> newPages(shape.pages.size());
+    for (UInt i = 0; i < idx.size(); ++i)
+        newPages[idx[i]] = i + 1;
+
+    dst._lastPageNum = (UInt) shape.pages.size();
+    dst.writePageCounter();
+
+    BaseBTree::PageWrapper from(&src);
+    BaseBTree::PageWrapper to(&dst);
+    for (UInt i = 0; i < shape.pages.size(); ++i)
+    {
+        from.readPage(shape.pages[i]);
+
+        UShort n = from.getKeysNum();
+        to.clear();
+        to.setKeyNumLeaf(n, i == 0, from.isLeaf());
+        if (n)
+            memcpy(to.getKey(0), from.getKey(0), (size_t) n * src.getRecSize());
+
+        for (UShort c = 0; c < shape.childNum[i]; ++c)
+            to.setCursor(c, newPages[shape.firstChild[i] + c]);
+
+        dst.writePage(newPages[i], to.getData());
+    }
+
+    dst.setRootPageNum(newPages[0]);
+    dst._rootPage.readPage(newPages[0]);
+}
+
+
+void BTreeBuilder::readImage(BaseBTree &tree, std::vector<Byte> &image)
+{
+    UInt pageSize = tree.getNodePageSize();
+    image.resize((size_t) pageSize * tree.getLastPageNum());
+
+    for (UInt p = 1; p <= tree.getLastPageNum(); ++p)
+        tree.readPage(p, &image[(size_t) (p - 1) * pageSize]);
+}
+
+
+ParallelBTreeBuilder::ParallelBTreeBuilder(BaseBTree *tree, double fillFactor, UInt threadsNum)
+        : BTreeBuilder(tree, fillFactor), _threadsNum(threadsNum), _splitLevel(0), _recs(nullptr),
+          _ownFiles(false)
+{
+    if (_threadsNum == 0)
+        _threadsNum = std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+template<typename F>
+void ParallelBTreeBuilder::runThreads(UInt n, F fn)
+{
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto body = [&](UInt t)
+    {
+        try
+        {
+            fn(t);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    try
+    {
+        // последнюю часть выполняет вызывающий поток
+        for (UInt t = 0; t + 1 < n; ++t)
+            threads.push_back(std::thread(body, t));
+        if (n)
+            body(n - 1);
+    }
+    catch (...)
+    {
+        for (std::thread &th : threads)
+            th.join();
+        throw;
+    }
+
+    for (std::thread &th : threads)
+        th.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+void ParallelBTreeBuilder::build(unsigned long long n, const Byte *recs, bool sorted)
+{
+    checkEmpty(*_tree);
+    if (!sorted && !_tree->getComparator())
+        throw std::runtime_error("Comparator not set. Can't sort keys");
+
+    _recs = recs;
+    _order.clear();
+    if (!sorted)
+        sortRecs(n);
+    else if (_tree->getComparator())
+        checkSorted(n);
+
+    planShape(n);
+    allocPages();
+    planSubtrees();
+
+    UInt height = getHeight();
+    if (_splitLevel < height)
+    {
+        // поддерево узла уровня разделения начинается после ключей поддеревьев левее
+        // и разделяющих их ключей предков — по одному между соседними поддеревьями
+        const std::vector<unsigned long long> &sub = _subtreeKeys[_splitLevel];
+        std::vector<unsigned long long> starts(sub.size());
+        unsigned long long pos = 0;
+        for (size_t i = 0; i < sub.size(); ++i)
+        {
+            starts[i] = pos;
+            pos += sub[i] + 1;
+        }
+
+        // страницы потоков не пересекаются, поэтому дерево, страницы которого лежат в файле
+        // как есть, потоки пишут сами, каждый через свой дескриптор; прочие деревья (сжатые,
+        // в памяти и т.п.) хранят страницы по-своему — им страницы передаются под блокировкой
+#ifndef _WIN32
+        _ownFiles = _tree->canAccessPagesDirectly();
+#endif
+        if (_ownFiles)
+        {
+            // все, что дерево еще держит в кэше и буфере потока, должно попасть в файл раньше
+            _tree->checkpoint();
+            _tree->_stream->flush();
+        }
+
+        UInt nodes = (UInt) sub.size();
+        std::vector<Worker> workers(_threadsNum);
+        runThreads(_threadsNum, [&](UInt t)
+        {
+            UInt from = (UInt) ((unsigned long long) nodes * t / _threadsNum);
+            UInt to = (UInt) ((unsigned long long) nodes * (t + 1) / _threadsNum);
+            if (from == to)
+                return;
+
+            Worker &w = workers[t];
+            initWorker(w);
+            if (_ownFiles)
+                openFile(w);
+            for (UInt i = from; i < to; ++i)
+            {
+                unsigned long long p = starts[i];
+                fillSubtree(_splitLevel, i, p, height, w);
+            }
+            flushPages(w);
+        });
+
+        if (_ownFiles)
+        {
+            // страницы записаны в обход дерева: прежние копии в кэше устарели
+            unsigned long long written = 0;
+            for (const Worker &w : workers)
+                written += w.written;
+            _tree->countPageWrites((UInt) written);
+            _tree->resetPageCache();
+            _ownFiles = false;
+        }
+    }
+
+    // верхние уровни: их ключи разделяют поддеревья, построенные потоками
+    Worker top;
+    initWorker(top);
+    unsigned long long pos = 0;
+    fillSubtree(0, 0, pos, _splitLevel, top);
+    flushPages(top);
+
+    std::vector<const Byte*>().swap(_order);
+    finishBuild();
+}
+
+
+void ParallelBTreeBuilder::sortRecs(unsigned long long n)
+{
+    UShort recSize = _tree->getRecSize();
+    _order.resize((size_t) n);
+    for (size_t i = 0; i < _order.size(); ++i)
+        _order[i] = _recs + i * recSize;
+
+    BaseBTree::IComparator *cmp = _tree->getComparator();
+    auto less = [cmp, recSize](const Byte *a, const Byte *b) { return cmp->compare(a, b, recSize); };
+
+    // каждый поток сортирует свою часть, затем соседние части сливаются попарно
+    UInt parts = (UInt) std::min<unsigned long long>(_threadsNum, n ? n : 1);
+    std::vector<size_t> bounds(parts + 1);
+    for (UInt p = 0; p <= parts; ++p)
+        bounds[p] = (size_t) (n * p / parts);
+
+    std::vector<const Byte*>::iterator begin = _order.begin();
+    runThreads(parts, [&](UInt t)
+    {
+        std::sort(begin + bounds[t], begin + bounds[t + 1], less);
+    });
+
+    for (UInt width = 1; width < parts; width *= 2)
+    {
+        runThreads((parts + 2 * width - 1) / (2 * width), [&](UInt m)
+        {
+            UInt lo = m * 2 * width;
+            UInt mid = std::min(lo + width, parts);
+            UInt hi = std::min(lo + 2 * width, parts);
+            if (mid < hi)
+                std::inplace_merge(begin + bounds[lo], begin + bounds[mid], begin + bounds[hi], less);
+        });
+    }
+}
+
+
+void ParallelBTreeBuilder::checkSorted(unsigned long long n)
+{
+    UShort recSize = _tree->getRecSize();
+    BaseBTree::IComparator *cmp = _tree->getComparator();
+
+    UInt parts = (UInt) std::min<unsigned long long>(_threadsNum, n ? n : 1);
+    runThreads(parts, [&](UInt t)
+    {
+        // первая пара части захватывает последнюю запись предыдущей
+        unsigned long long from = n * t / parts;
+        unsigned long long to = n * (t + 1) / parts;
+        for (unsigned long long i = std::max(from, 1ULL); i < to; ++i)
+            if (cmp->compare(getRec(i), getRec(i - 1), recSize))
+                throw std::invalid_argument("Keys must be sorted to build a B-tree");
+    });
+}
+
+
+void ParallelBTreeBuilder::planSubtrees()
+{
+    UInt height = getHeight();
+    _firstChild.assign(height, std::vector<UInt>());
+    _subtreeKeys.assign(height, std::vector<unsigned long long>());
+
+    // снизу вверх: дети узла идут на следующем уровне подряд
+    for (UInt l = height; l-- > 0; )
+    {
+        const std::vector<UShort> &keys = _levelKeys[l];
+        std::vector<unsigned long long> &sub = _subtreeKeys[l];
+        sub.resize(keys.size());
+
+        bool isLeaf = (l + 1 == height);
+        if (!isLeaf)
+            _firstChild[l].resize(keys.size());
+
+        UInt child = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            sub[i] = keys[i];
+            if (isLeaf)
+                continue;
+
+            _firstChild[l][i] = child;
+            for (UInt c = 0; c <= keys[i]; ++c)
+                sub[i] += _subtreeKeys[l + 1][child + c];
+            child += keys[i] + 1;
+        }
+    }
+
+    // делим самый верхний уровень, где каждому потоку достанется хотя бы один узел
+    _splitLevel = height;
+    if (_threadsNum > 1)
+    {
+        for (UInt l = 0; l < height; ++l)
+            if (_levelKeys[l].size() >= _threadsNum)
+            {
+                _splitLevel = l;
+                break;
+            }
+    }
+}
+
+
+UInt ParallelBTreeBuilder::fillSubtree(UInt level, UInt idx, unsigned long long &pos, UInt builtLevel, Worker &w)
+{
+    UInt pnum = _levelBase[level] + idx;
+    if (level == builtLevel)
+    {
+        pos += _subtreeKeys[level][idx];
+        return pnum;
+    }
+
+    UShort keysNum = _levelKeys[level][idx];
+    bool isLeaf = (level + 1 == _levelKeys.size());
+    UShort recSize = _tree->getRecSize();
+
+    BaseBTree::PageWrapper &pw = *w.pages[level];
+    pw.clear();
+    pw.setKeyNumLeaf(keysNum, level == 0, isLeaf);
+
+    // симметричный обход, как в fillNode(), но записи берутся по номеру
+    for (UShort i = 0; i <= keysNum; ++i)
+    {
+        if (!isLeaf)
+            pw.setCursor(i, fillSubtree(level + 1, _firstChild[level][idx] + i, pos, builtLevel, w));
+
+        if (i < keysNum)
+            memcpy(pw.getKey(i), getRec(pos++), recSize);
+    }
+
+    putPage(w, pnum, pw.getData());
+
+    return pnum;
+}
+
+
+void ParallelBTreeBuilder::putPage(Worker &w, UInt pnum, const Byte *data)
+{
+    w.batch.insert(w.batch.end(), data, data + _tree->getNodePageSize());
+    w.batchNums.push_back(pnum);
+
+    if (w.batchNums.size() == WRITE_BATCH)
+        flushPages(w);
+}
+
+
+void ParallelBTreeBuilder::flushPages(Worker &w)
+{
+    if (w.batchNums.empty())
+        return;
+
+    UInt pageSize = _tree->getNodePageSize();
+    if (w.fd >= 0)
+    {
+#ifndef _WIN32
+        // пачка — собственный буфер потока, поэтому контрольную сумму ставим прямо в нем
+        for (size_t i = 0; i < w.batchNums.size(); ++i)
+        {
+            Byte *page = &w.batch[i * pageSize];
+            if (_tree->hasPageChecksums())
+                _tree->stampPageCrc(w.batchNums[i], page);
+
+            off_t ofs = (off_t) _tree->getPageOffset(w.batchNums[i]);
+            for (UInt done = 0; done < pageSize; )
+            {
+                ssize_t res = ::pwrite(w.fd, page + done, pageSize - done, ofs + done);
+                if (res < 0 && errno == EINTR)
+                    continue;
+                if (res <= 0)
+                    throw std::runtime_error("Can't write a B-tree page");
+                done += (UInt) res;
+            }
+        }
+        w.written += w.batchNums.size();
+#endif
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        for (size_t i = 0; i < w.batchNums.size(); ++i)
+            _tree->writePage(w.batchNums[i], &w.batch[i * pageSize]);
+    }
+
+    w.batch.clear();
+    w.batchNums.clear();
+}
+
+
+void ParallelBTreeBuilder::openFile(Worker &w)
+{
+#ifndef _WIN32
+    const std::string &fileName = static_cast<FileBaseBTree *>(_tree)->getFileName();
+    w.fd = ::open(fileName.c_str(), O_WRONLY);
+    if (w.fd < 0)
+        throw std::runtime_error("Can't open the B-tree file for writing");
+#else
+    (void) w;
+#endif
+}
+
+
+void ParallelBTreeBuilder::closeFile(int fd)
+{
+#ifndef _WIN32
+    if (fd >= 0)
+        ::close(fd);
+#else
+    (void) fd;
+#endif
+}
+
+
+void ParallelBTreeBuilder::initWorker(Worker &w)
+{
+    while (w.pages.size() < getHeight())
+        w.pages.push_back(new BaseBTree::PageWrapper(_tree));
+
+    w.batch.reserve((size_t) WRITE_BATCH * _tree->getNodePageSize());
+}
+
+
+} // namespace xi
@@ -0,0 +1,331 @@
+﻿
+/// \file
+/// \brief     Построение B-дерева снизу вверх и перекладка его страниц
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле btree_builder.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_BTREE_BUILDER_H_
+#define BTREE_BTREE_BUILDER_H_
+
+
+#include <vector>
+#include <mutex>
+
+#include "btree.h"
+
+
+
+namespace xi {
+
+
+/** \brief Строитель B-дерева из заранее упорядоченной последовательности ключей.
+ *
+ *  Дерево строится в новом (пустом) дереве целиком: сначала по числу ключей рассчитывается
+ *  форма дерева — число ключей в каждом узле при заданном коэффициенте заполнения
+ *  с соблюдением ограничений порядка, — затем ключи раскладываются по узлам за один
+ *  упорядоченный проход, и каждая страница записывается ровно один раз.
+ *
+ *  Страницы располагаются в файле так: сначала внутренние узлы в порядке обхода в ширину
+ *  (корень — первая страница), затем листья в порядке ключей. Поэтому упорядоченный
+ *  просмотр построенного дерева читает листья последовательно.
+ *
+ *  Кроме того, строитель умеет переложить страницы существующего дерева в другом порядке,
+ *  не меняя его формы (см. exportLayout()).
+ */
+class BTreeBuilder {
+public:
+    /** \brief Порядок страниц при перекладке дерева. */
+    enum PageOrder {
+        poBreadthFirst,         ///< Обход в ширину: уровень за уровнем, слева направо.
+        poVanEmdeBoas           ///< Рекурсивная раскладка ван Эмде Боаса (cache-oblivious).
+    };
+
+    /** \brief Источник упорядоченных ключей. */
+    class IKeySource {
+    public:
+        /** \brief Записывает в \c dst (размером getRecSize() дерева) очередной ключ и
+         *  возвращает истину; если ключи закончились, возвращает ложь.
+         */
+        virtual bool next(Byte* dst) = 0;
+    protected:
+        ~IKeySource() {}
+    }; // class IKeySource
+
+public:
+    /** \brief Создает строителя для дерева \c tree с коэффициентом заполнения узлов
+     *  \c fillFactor из (0, 1].
+     *
+     *  Коэффициент задает целевое число ключей в узле как долю максимального, но не меньше
+     *  минимального. Если коэффициент неправильный, кидает std::invalid_argument.
+     */
+    BTreeBuilder(BaseBTree* tree, double fillFactor = 1.0);
+
+    ~BTreeBuilder();
+
+protected:
+    BTreeBuilder(const BTreeBuilder&);                      ///< КК не доступен.
+    BTreeBuilder& operator= (BTreeBuilder&);                ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Строит дерево из \c n ключей, получаемых от \c src в неубывающем порядке.
+     *
+     *  Дерево должно быть открыто и пусто (только что создано). Если у дерева задан компаратор,
+     *  порядок ключей проверяется. Если источник дал меньше \c n ключей, ключи не упорядочены
+     *  или дерево не пусто, кидает исключение.
+     */
+    void build(unsigned long long n, IKeySource& src);
+
+    /** \brief Возвращает высоту построенного дерева (1 — дерево из одного корня-листа). */
+    UInt getHeight() const { return (UInt) _levelKeys.size(); }
+
+    /** \brief Возвращает число узлов на уровне \c level (0 — корень). */
+    UInt getLevelSize(UInt level) const { return (UInt) _levelKeys[level].size(); }
+
+    /** \brief Переписывает все ключи открытого дерева \c src в пустое открытое дерево \c dst
+     *  с коэффициентом заполнения \c fillFactor.
+     *
+     *  Размеры записей деревьев должны совпадать, порядок \c dst может отличаться.
+     *  Ключи читаются курсором (BaseBTree::RangeCursor) дважды: сначала подсчитываются,
+     *  затем переписываются.
+     */
+    static void compact(BaseBTree& src, BaseBTree& dst, double fillFactor = 1.0);
+
+    /** \brief Дефрагментирует файловое дерево \c tree на месте.
+     *
+     *  Дерево переписывается в новый файл рядом с исходным с той же геометрией страниц и тем же
+     *  классом хранения (см. FileBaseBTree::createEmptyLike(), compact()), который вместе со
+     *  вспомогательными файлами (FileBaseBTree::getAuxFileSuffixes()) затем замещает исходный,
+     *  после чего дерево открывается снова. Компаратор дерева сохраняется.
+     *
+     *  Файлы замещаются все вместе: если заместить хотя бы один не удалось, прежние файлы
+     *  возвращаются на место, дерево открывается прежним и кидается std::runtime_error.
+     */
+    static void compactFile(FileBaseBTree& tree, double fillFactor = 1.0);
+
+    /** \brief Переписывает дерево \c src в пустое открытое дерево \c dst, сохраняя форму
+     *  (узлы те же), но располагая страницы в порядке \c order.
+     *
+     *  В раскладке ван Эмде Боаса дерево высоты h делится на верхнее поддерево высоты h/2
+     *  и нижние поддеревья, которые раскладываются рекурсивно друг за другом. Поэтому любой
+     *  путь от корня к листу проходит O(log_B N) блоков памяти любого размера B: раскладка
+     *  предназначена для деревьев, целиком загружаемых в память (см. readImage()).
+     *
+     *  Порядок и размер записи деревьев должны совпадать, иначе кидается std::invalid_argument.
+     */
+    static void exportLayout(BaseBTree& src, BaseBTree& dst, PageOrder order);
+
+    /** \brief Для дерева \c tree записывает в \c pages номера страниц в порядке \c order. */
+    static void calcPageOrder(BaseBTree& tree, PageOrder order, std::vector<UInt>& pages);
+
+    /** \brief Читает все страницы дерева \c tree подряд в один непрерывный буфер \c image:
+     *  страница номер p располагается со смещения (p - 1) * getNodePageSize().
+     */
+    static void readImage(BaseBTree& tree, std::vector<Byte>& image);
+
+protected:
+    /** \brief Рассчитывает форму дерева для \c n ключей. */
+    void planShape(unsigned long long n);
+
+    /** \brief Нумерует страницы узлов рассчитанной формы (уровни подряд, корень — первая
+     *  страница) и распределяет их в дереве все сразу.
+     */
+    void allocPages();
+
+    /** \brief Делает корнем дерева первую страницу после того, как записаны все узлы. */
+    void finishBuild();
+
+    /** \brief Возвращает число детей узла высоты \c h (1 — лист) с \c n ключами в поддереве. */
+    UInt calcChildrenNum(unsigned long long n, UInt h, bool isRoot) const;
+
+    /** \brief Возвращает истину, если корень высоты \c h может вместить ровно \c n ключей. */
+    bool isRootFeasible(unsigned long long n, UInt h) const;
+
+    /** \brief Возвращает (<tt>keysPerNode + 1</tt>)^h - 1 — число ключей в поддереве высоты
+     *  \c h с \c keysPerNode ключами в каждом узле (с насыщением).
+     */
+    static unsigned long long calcSubtreeKeys(UInt keysPerNode, UInt h);
+
+    /** \brief Заполняет и записывает очередной узел уровня \c level вместе с его поддеревом,
+     *  возвращает номер его страницы.
+     */
+    UInt fillNode(UInt level);
+
+    /** \brief Читает очередной ключ в \c dst с проверкой порядка. */
+    void nextKey(Byte* dst);
+
+    /** \brief Форма дерева в порядке обхода в ширину: номера страниц узлов, индексы их первых
+     *  детей (дети узла идут в обходе в ширину подряд) и число детей.
+     */
+    struct Shape {
+        std::vector<UInt> pages;
+        std::vector<UInt> firstChild;
+        std::vector<UShort> childNum;
+        UInt height;
+    };
+
+    /** \brief Собирает форму дерева \c tree. */
+    static void collectShape(BaseBTree& tree, Shape& shape);
+
+    /** \brief Добавляет в \c order индексы (в обходе в ширину) узлов поддерева \c node высоты \c h
+     *  в порядке ван Эмде Боаса.
+     */
+    static void vanEmdeBoasOrder(const Shape& shape, UInt node, UInt h, std::vector<UInt>& order);
+
+    /** \brief Проверяет, что дерево \c dst открыто и пусто. */
+    static void checkEmpty(BaseBTree& dst);
+
+protected:
+    BaseBTree* _tree;
+    UInt _targetKeys;                                   ///< Целевое число ключей в узле.
+
+    std::vector<std::vector<UShort> > _levelKeys;       ///< Число ключей в узлах по уровням.
+    std::vector<UInt> _levelBase;                       ///< Номер страницы первого узла уровня.
+    std::vector<UInt> _levelNext;                       ///< Следующий заполняемый узел уровня.
+    std::vector<BaseBTree::PageWrapper*> _pages;        ///< Заполняемая страница каждого уровня.
+
+    IKeySource* _src;
+    Byte* _prevKey;                                     ///< Предыдущий ключ (для проверки порядка).
+    bool _hasPrev;
+}; // class BTreeBuilder
+
+
+/** \brief Многопоточный строитель B-дерева из массива записей в памяти.
+ *
+ *  Форма дерева и номера всех страниц рассчитываются заранее (как у BTreeBuilder), поэтому
+ *  по форме известно, с какой по счету записи начинается поддерево любого узла. Уровень,
+ *  на котором узлов не меньше, чем потоков, делится на непрерывные отрезки; каждый поток
+ *  строит поддеревья своего отрезка — его страницы на каждом уровне образуют отдельный
+ *  непрерывный диапазон файла. Затем узлы верхних уровней, ключи которых разделяют
+ *  поддеревья потоков, достраиваются в вызывающем потоке.
+ *
+ *  Узлы заполняются параллельно. Если страницы дерева лежат в файле как есть
+ *  (BaseBTree::canAccessPagesDirectly()), каждый поток пишет страницы своих диапазонов
+ *  через собственный дескриптор файла (pwrite()), минуя дерево, его кэш страниц
+ *  и трассировщик; после этого кэш дерева сбрасывается. Для прочих
+ *  деревьев готовые страницы пишутся в дерево пачками под общей блокировкой: само дерево
+ *  однопоточное. Неупорядоченный массив сначала сортируется параллельно (по частям, затем
+ *  попарными слияниями).
+ */
+class ParallelBTreeBuilder : public BTreeBuilder {
+public:
+    /** \brief Создает строителя для дерева \c tree с коэффициентом заполнения \c fillFactor,
+     *  использующего \c threadsNum потоков (0 — по числу ядер).
+     */
+    ParallelBTreeBuilder(BaseBTree* tree, double fillFactor = 1.0, UInt threadsNum = 0);
+
+public:
+    /** \brief Строит дерево из \c n записей, лежащих подряд в \c recs (по getRecSize() байт).
+     *
+     *  Если \c sorted, записи должны идти в неубывающем порядке (при заданном компараторе
+     *  порядок проверяется), иначе они предварительно сортируются; для этого дереву нужен
+     *  компаратор. Массив \c recs не изменяется. Дерево должно быть открыто и пусто.
+     *
+     *  Компаратор дерева вызывается из нескольких потоков сразу. Дерево получается тем же,
+     *  что и у BTreeBuilder::build() с тем же коэффициентом заполнения.
+     */
+    void build(unsigned long long n, const Byte* recs, bool sorted = true);
+
+    /** \brief Возвращает число потоков строителя. */
+    UInt getThreadsNum() const { return _threadsNum; }
+
+    /** \brief Возвращает уровень, поддеревья узлов которого строились параллельно
+     *  (getHeight() — дерево построено в одном потоке).
+     */
+    UInt getSplitLevel() const { return _splitLevel; }
+
+protected:
+    /** \brief Рабочие страницы потока, пачка готовых страниц для записи и собственный
+     *  дескриптор файла дерева (см. _ownFiles).
+     */
+    struct Worker {
+        Worker() : fd(-1), written(0) {}
+
+        ~Worker()
+        {
+            for (BaseBTree::PageWrapper* pw : pages)
+                delete pw;
+            closeFile(fd);
+        }
+
+        std::vector<BaseBTree::PageWrapper*> pages;     ///< Рабочая страница каждого уровня.
+        std::vector<Byte> batch;                        ///< Готовые страницы подряд.
+        std::vector<UInt> batchNums;                    ///< Номера страниц пачки.
+        int fd;                                         ///< Дескриптор файла или -1.
+        unsigned long long written;                     ///< Записано страниц через \c fd.
+    };
+
+    /** \brief Число страниц в пачке записи. */
+    static const UInt WRITE_BATCH = 64;
+
+    /** \brief Выполняет \c fn(t) для t от 0 до \c n - 1 в отдельных потоках и пробрасывает
+     *  первое исключение.
+     */
+    template<typename F>
+    static void runThreads(UInt n, F fn);
+
+    /** \brief Упорядочивает указатели на \c n записей в _order по ключам в _threadsNum потоков. */
+    void sortRecs(unsigned long long n);
+
+    /** \brief Проверяет в _threadsNum потоках, что \c n записей упорядочены. */
+    void checkSorted(unsigned long long n);
+
+    /** \brief Для каждого узла рассчитывает индекс первого ребенка и число ключей поддерева,
+     *  выбирает уровень разделения.
+     */
+    void planSubtrees();
+
+    /** \brief Заполняет и записывает узел \c idx уровня \c level с поддеревом, начиная с записи
+     *  номер \c pos (продвигается), и возвращает его страницу. Узлы уровня \c builtLevel уже
+     *  записаны: для них только пропускаются записи поддерева.
+     */
+    UInt fillSubtree(UInt level, UInt idx, unsigned long long& pos, UInt builtLevel, Worker& w);
+
+    /** \brief Возвращает запись номер \c i в порядке ключей. */
+    const Byte* getRec(unsigned long long i) const
+    {
+        return _order.empty() ? _recs + i * _tree->getRecSize() : _order[(size_t) i];
+    }
+
+    /** \brief Кладет страницу \c pnum в пачку потока, при заполнении пачки пишет ее. */
+    void putPage(Worker& w, UInt pnum, const Byte* data);
+
+    /** \brief Пишет пачку страниц потока: через его дескриптор, если он открыт, иначе в дерево. */
+    void flushPages(Worker& w);
+
+    /** \brief Открывает потоку \c w собственный дескриптор файла дерева для записи. */
+    void openFile(Worker& w);
+
+    /** \brief Закрывает дескриптор \c fd, если он открыт. */
+    static void closeFile(int fd);
+
+    /** \brief Распределяет рабочие страницы потока. */
+    void initWorker(Worker& w);
+
+protected:
+    UInt _threadsNum;
+    UInt _splitLevel;
+
+    const Byte* _recs;
+    std::vector<const Byte*> _order;                    ///< Записи в порядке ключей (если сортировались).
+
+    std::vector<std::vector<UInt> > _firstChild;        ///< Индекс первого ребенка узла на следующем уровне.
+    std::vector<std::vector<unsigned long long> > _subtreeKeys; ///< Число ключей поддерева узла.
+
+    /** \brief Истина, если потоки пишут свои страницы через собственные дескрипторы файла. */
+    bool _ownFiles;
+
+    std::mutex _writeMutex;                             ///< Запись страниц в дерево.
+}; // class ParallelBTreeBuilder
+
+
+} // namespace xi
+
+
+#endif // BTREE_BTREE_BUILDER_H_
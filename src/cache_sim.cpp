@@ -0,0 +1,335 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  cache_sim.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "cache_sim.h"
+
+#include <list>
+#include <unordered_map>
+#include <stdexcept>        // std::invalid_argument
+#include <algorithm>        // std::min, std::max
+
+
+namespace xi
+{
+
+
+/** \brief Упорядоченный список номеров страниц (голова — самая свежая) с поиском по номеру. */
+class PageList {
+public:
+    bool contains(UInt pnum) const { return _pos.count(pnum) != 0; }
+
+    UInt size() const { return (UInt) _pos.size(); }
+
+    bool empty() const { return _pos.empty(); }
+
+    /** \brief Возвращает самую старую страницу (хвост). */
+    UInt back() const { return _list.back(); }
+
+    void pushFront(UInt pnum)
+    {
+        _list.push_front(pnum);
+        _pos[pnum] = _list.begin();
+    }
+
+    void moveToFront(UInt pnum)
+    {
+        _list.splice(_list.begin(), _list, _pos[pnum]);
+    }
+
+    void remove(UInt pnum)
+    {
+        auto it = _pos.find(pnum);
+        _list.erase(it->second);
+        _pos.erase(it);
+    }
+
+    /** \brief Удаляет и возвращает самую старую страницу. */
+    UInt popBack()
+    {
+        UInt pnum = _list.back();
+        remove(pnum);
+        return pnum;
+    }
+
+protected:
+    std::list<UInt> _list;
+    std::unordered_map<UInt, std::list<UInt>::iterator> _pos;
+}; // class PageList
+
+
+/** \brief LRU: вытесняется страница, к которой давнее всех обращались. */
+class LruSimulator : public CacheSimulator {
+public:
+    LruSimulator(UInt capacity) : CacheSimulator(capacity) {}
+
+protected:
+    virtual bool lookup(UInt pnum) override
+    {
+        if (_pages.contains(pnum))
+        {
+            _pages.moveToFront(pnum);
+            return true;
+        }
+
+        if (_pages.size() == _capacity)
+            _pages.popBack();
+        _pages.pushFront(pnum);
+        return false;
+    }
+
+protected:
+    PageList _pages;
+}; // class LruSimulator
+
+
+/** \brief CLOCK: кадры обходятся по кругу, страница с битом обращения получает второй шанс. */
+class ClockSimulator : public CacheSimulator {
+public:
+    ClockSimulator(UInt capacity) : CacheSimulator(capacity), _hand(0) {}
+
+protected:
+    virtual bool lookup(UInt pnum) override
+    {
+        auto it = _slots.find(pnum);
+        if (it != _slots.end())
+        {
+            _ref[it->second] = true;
+            return true;
+        }
+
+        if (_frames.size() < _capacity)
+        {
+            _slots[pnum] = (UInt) _frames.size();
+            _frames.push_back(pnum);
+            _ref.push_back(true);
+            return false;
+        }
+
+        while (_ref[_hand])
+        {
+            _ref[_hand] = false;
+            _hand = (_hand + 1) % _capacity;
+        }
+
+        _slots.erase(_frames[_hand]);
+        _slots[pnum] = _hand;
+        _frames[_hand] = pnum;
+        _ref[_hand] = true;
+        _hand = (_hand + 1) % _capacity;
+        return false;
+    }
+
+protected:
+    std::vector<UInt> _frames;                      ///< Страница в каждом кадре.
+    std::vector<bool> _ref;                         ///< Биты обращения кадров.
+    std::unordered_map<UInt, UInt> _slots;          ///< Кадр каждой страницы.
+    UInt _hand;
+}; // class ClockSimulator
+
+
+/** \brief 2Q (Johnson, Shasha): страница, к которой обратились впервые, попадает в очередь
+ *  FIFO A1in (четверть кэша); вытесненная оттуда запоминается «призраком» в A1out (номера
+ *  половины емкости кэша), и только повторное обращение к призраку переводит страницу
+ *  в основную LRU-очередь Am. Так однократные просмотры не вытесняют горячие страницы.
+ */
+class TwoQueueSimulator : public CacheSimulator {
+public:
+    TwoQueueSimulator(UInt capacity)
+            : CacheSimulator(capacity),
+              _kin(std::max(1u, capacity / 4)),
+              _kout(std::max(1u, capacity / 2))
+    {
+    }
+
+protected:
+    virtual bool lookup(UInt pnum) override
+    {
+        if (_am.contains(pnum))
+        {
+            _am.moveToFront(pnum);
+            return true;
+        }
+
+        if (_a1in.contains(pnum))                   // в FIFO порядок не меняется
+            return true;
+
+        if (_a1out.contains(pnum))
+        {
+            _a1out.remove(pnum);
+            reclaim();
+            _am.pushFront(pnum);
+        }
+        else
+        {
+            reclaim();
+            _a1in.pushFront(pnum);
+        }
+
+        return false;
+    }
+
+    /** \brief Освобождает кадр, если кэш заполнен. */
+    void reclaim()
+    {
+        if (_a1in.size() + _am.size() < _capacity)
+            return;
+
+        if (_a1in.size() > _kin || _am.empty())
+        {
+            _a1out.pushFront(_a1in.popBack());
+            if (_a1out.size() > _kout)
+                _a1out.popBack();
+        }
+        else
+            _am.popBack();
+    }
+
+protected:
+    UInt _kin;                                      ///< Порог длины A1in.
+    UInt _kout;                                     ///< Наибольшая длина A1out.
+    PageList _a1in;
+    PageList _a1out;
+    PageList _am;
+}; // class TwoQueueSimulator
+
+
+/** \brief ARC (Megiddo, Modha): кэш делится между списком T1 страниц, к которым обращались
+ *  однажды, и T2 — обращались повторно; призраки B1 и B2 помнят вытесненные из них страницы.
+ *  Попадание в призрака сдвигает целевой размер T1 (_p) в его пользу.
+ */
+class ArcSimulator : public CacheSimulator {
+public:
+    ArcSimulator(UInt capacity) : CacheSimulator(capacity), _p(0) {}
+
+protected:
+    virtual bool lookup(UInt pnum) override
+    {
+        if (_t1.contains(pnum))
+        {
+            _t1.remove(pnum);
+            _t2.pushFront(pnum);
+            return true;
+        }
+
+        if (_t2.contains(pnum))
+        {
+            _t2.moveToFront(pnum);
+            return true;
+        }
+
+        if (_b1.contains(pnum))
+        {
+            _p = std::min((double) _capacity, _p + std::max((double) _b2.size() / _b1.size(), 1.0));
+            replace(false);
+            _b1.remove(pnum);
+            _t2.pushFront(pnum);
+            return false;
+        }
+
+        if (_b2.contains(pnum))
+        {
+            _p = std::max(0.0, _p - std::max((double) _b1.size() / _b2.size(), 1.0));
+            replace(true);
+            _b2.remove(pnum);
+            _t2.pushFront(pnum);
+            return false;
+        }
+
+        // совсем новая страница
+        UInt l1 = _t1.size() + _b1.size();
+        UInt total = l1 + _t2.size() + _b2.size();
+        if (l1 == _capacity)
+        {
+            if (_t1.size() < _capacity)
+            {
+                _b1.popBack();
+                replace(false);
+            }
+            else
+                _t1.popBack();
+        }
+        else if (total >= _capacity)
+        {
+            if (total == 2 * _capacity)
+                _b2.popBack();
+            replace(false);
+        }
+
+        _t1.pushFront(pnum);
+        return false;
+    }
+
+    /** \brief Вытесняет страницу из T1 или T2 в соответствующий список призраков;
+     *  \c inB2 — запрошенная страница найдена в B2.
+     */
+    void replace(bool inB2)
+    {
+        if (!_t1.empty() && ((inB2 && _t1.size() == (UInt) _p) || _t1.size() > _p))
+            _b1.pushFront(_t1.popBack());
+        else if (!_t2.empty())
+            _b2.pushFront(_t2.popBack());
+        else
+            _b1.pushFront(_t1.popBack());
+    }
+
+protected:
+    double _p;                                      ///< Целевой размер T1.
+    PageList _t1;
+    PageList _t2;
+    PageList _b1;
+    PageList _b2;
+}; // class ArcSimulator
+
+
+CacheSimulator *CacheSimulator::create(Policy policy, UInt capacity)
+{
+    if (capacity == 0)
+        throw std::invalid_argument("Cache capacity must be positive");
+
+    switch (policy)
+    {
+    case cpLru:
+        return new LruSimulator(capacity);
+    case cpClock:
+        return new ClockSimulator(capacity);
+    case cp2Q:
+        return new TwoQueueSimulator(capacity);
+    case cpArc:
+        return new ArcSimulator(capacity);
+    default:
+        throw std::invalid_argument("Unknown cache policy");
+    }
+}
+
+
+const char *CacheSimulator::getPolicyName(Policy policy)
+{
+    static const char* NAMES[POLICIES_NUM] = { "LRU", "CLOCK", "2Q", "ARC" };
+    return (policy >= 0 && policy < POLICIES_NUM) ? NAMES[policy] : "?";
+}
+
+
+void CacheSimulator::calcMissRatioCurve(Policy policy, const std::vector<UInt> &refs,
+                                        const std::vector<UInt> &capacities, std::vector<double> &missRatios)
+{
+    missRatios.clear();
+    for (UInt cap : capacities)
+    {
+        CacheSimulator* sim = create(policy, cap);
+        for (UInt pnum : refs)
+            sim->access(pnum);
+
+        missRatios.push_back(sim->getMissRatio());
+        delete sim;
+    }
+}
+
+
+} // namespace xi
@@ -0,0 +1,110 @@
+﻿
+/// \file
+/// \brief     Моделирование кэша страниц по трассе обращений
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле cache_sim.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_CACHE_SIM_H_
+#define BTREE_CACHE_SIM_H_
+
+
+#include <vector>
+
+#include "utils.h"
+
+
+
+namespace xi {
+
+
+/** \brief Модель кэша страниц с одной из политик вытеснения.
+ *
+ *  Модель хранит только номера страниц: обращение к странице либо попадает в кэш, либо
+ *  промахивается, и тогда страница загружается, вытесняя другую по правилам политики.
+ *  Запись считается таким же обращением, как чтение (кэш с размещением при записи).
+ *
+ *  Прогон одной трассы по моделям разной емкости дает кривую доли промахов (см.
+ *  calcMissRatioCurve()), по которой выбирается размер кэша (BaseBTree::setCacheSize()).
+ */
+class CacheSimulator {
+public:
+    /** \brief Политика вытеснения. */
+    enum Policy {
+        cpLru,                  ///< Вытесняется давнее всех использованная (как в PageCache).
+        cpClock,                ///< Второй шанс: стрелка обходит кадры, сбрасывая биты обращения.
+        cp2Q,                   ///< 2Q: новые страницы проходят через очередь FIFO и «призраков».
+        cpArc,                  ///< ARC: адаптивный баланс между недавними и частыми страницами.
+        POLICIES_NUM
+    };
+
+public:
+    /** \brief Создает модель политики \c policy емкостью \c capacity страниц (не меньше 1),
+     *  распределенную через new.
+     */
+    static CacheSimulator* create(Policy policy, UInt capacity);
+
+    /** \brief Возвращает название политики \c policy. */
+    static const char* getPolicyName(Policy policy);
+
+    /** \brief Прогоняет обращения \c refs через модели политики \c policy емкостей
+     *  \c capacities и записывает в \c missRatios долю промахов каждой.
+     */
+    static void calcMissRatioCurve(Policy policy, const std::vector<UInt>& refs,
+                                   const std::vector<UInt>& capacities, std::vector<double>& missRatios);
+
+public:
+    virtual ~CacheSimulator() {}
+
+public:
+    /** \brief Обращается к странице \c pnum; возвращает истину при попадании. */
+    bool access(UInt pnum)
+    {
+        bool hit = lookup(pnum);
+        if (hit)
+            ++_hits;
+        else
+            ++_misses;
+
+        return hit;
+    }
+
+    /** \brief Возвращает емкость кэша в страницах. */
+    UInt getCapacity() const { return _capacity; }
+
+    /** \brief Возвращает число попаданий. */
+    unsigned long long getHits() const { return _hits; }
+
+    /** \brief Возвращает число промахов. */
+    unsigned long long getMisses() const { return _misses; }
+
+    /** \brief Возвращает долю промахов (0, если обращений не было). */
+    double getMissRatio() const
+    {
+        unsigned long long n = _hits + _misses;
+        return n ? (double) _misses / n : 0.0;
+    }
+
+protected:
+    CacheSimulator(UInt capacity) : _capacity(capacity), _hits(0), _misses(0) {}
+
+    /** \brief Обращение к странице \c pnum по правилам политики; возвращает истину при попадании. */
+    virtual bool lookup(UInt pnum) = 0;
+
+protected:
+    UInt _capacity;
+    unsigned long long _hits;
+    unsigned long long _misses;
+}; // class CacheSimulator
+
+
+} // namespace xi
+
+
+#endif // BTREE_CACHE_SIM_H_
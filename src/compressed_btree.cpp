@@ -0,0 +1,315 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  compressed_btree.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "compressed_btree.h"
+#include "page_codec.h"
+
+#include <stdexcept>        // std::runtime_error
+#include <cstring>          // memcpy
+#include <algorithm>        // std::sort
+
+
+namespace xi
+{
+
+
+const char* CompressedFileBaseBTree::DATA_FILE_SUFFIX = ".pages";
+
+
+CompressedFileBaseBTree::CompressedFileBaseBTree()
+        : FileBaseBTree(),
+          _leafCompression(lcIntegral),
+          _dataEnd(0)
+{
+}
+
+
+CompressedFileBaseBTree::CompressedFileBaseBTree(UInt pageSize, UShort recSize, IComparator *comparator,
+                                                 const std::string &fileName)
+        : CompressedFileBaseBTree()
+{
+    setComparator(comparator);
+    createForPageSize(pageSize, recSize, fileName);
+}
+
+
+CompressedFileBaseBTree::CompressedFileBaseBTree(const std::string &fileName, IComparator *comparator)
+        : CompressedFileBaseBTree()
+{
+    setComparator(comparator);
+    open(fileName);
+}
+
+
+CompressedFileBaseBTree::~CompressedFileBaseBTree()
+{
+    closeNoThrow();     // пока объект еще полноценный, чтобы закрылся и файл данных
+}
+
+
+FileBaseBTree *CompressedFileBaseBTree::createEmptyLike() const
+{
+    CompressedFileBaseBTree *tree = new CompressedFileBaseBTree;
+    tree->setLeafCompression(_leafCompression);
+    return tree;
+}
+
+
+const CompressedFileBaseBTree::PageMapEntry &CompressedFileBaseBTree::getPageMapEntry(UInt pnum) const
+{
+    if (pnum == 0 || pnum > _pageMap.size())
+        throw std::invalid_argument("Can't get a map entry of a non-existing page");
+
+    return _pageMap[pnum - 1];
+}
+
+
+unsigned long long CompressedFileBaseBTree::getStoredSize() const
+{
+    unsigned long long size = 0;
+    for (const PageMapEntry &e : _pageMap)
+        size += e.size;
+
+    return size;
+}
+
+
+void CompressedFileBaseBTree::preparePageStorage(bool create)
+{
+    closeDataFile();                // после неудачного открытия мог остаться открытым
+
+    _dataFileName = _fileName + DATA_FILE_SUFFIX;
+    std::ios_base::openmode mode = std::fstream::in | std::fstream::out | std::fstream::binary;
+    if (create)
+        mode |= std::fstream::trunc;
+    _dataStream.open(_dataFileName, mode);
+    if (_dataStream.fail())
+    {
+        _dataStream.close();
+        throw std::runtime_error("Can't open B-tree data file");
+    }
+
+    if (create)
+        return;
+
+    // таблица отображения лежит в основном файле на месте страниц
+    _pageMap.resize(getLastPageNum());
+    if (!_pageMap.empty())
+    {
+        _stream->seekg(getFirstPageOfs(), std::ios_base::beg);
+        _stream->read((char *) _pageMap.data(), (std::streamsize) _pageMap.size() * PAGE_MAP_ENTRY_SZ);
+        if (_stream->fail())
+            throw std::runtime_error("Can't read B-tree page map. File corrupted");
+    }
+
+    collectFreeSlots();
+}
+
+
+void CompressedFileBaseBTree::collectFreeSlots()
+{
+    // места страниц по возрастанию смещений, промежутки между ними свободны
+    std::vector<std::pair<unsigned long long, UInt> > slots;
+    for (const PageMapEntry &e : _pageMap)
+        if (e.capacity)
+            slots.push_back(std::make_pair(e.offset, e.capacity));
+    std::sort(slots.begin(), slots.end());
+
+    _freeSlots.clear();
+    _dataEnd = 0;
+    for (const std::pair<unsigned long long, UInt> &s : slots)
+    {
+        if (s.first > _dataEnd)
+            _freeSlots.insert(std::make_pair((UInt) (s.first - _dataEnd), _dataEnd));
+        _dataEnd = s.first + s.second;
+    }
+}
+
+
+void CompressedFileBaseBTree::allocSlot(PageMapEntry &e, UInt size)
+{
+    // старое место освобождается
+    if (e.capacity)
+        _freeSlots.insert(std::make_pair(e.capacity, e.offset));
+
+    UInt capacity = (size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+
+    // наименьшее подходящее свободное место, но не вдвое больше нужного
+    std::multimap<UInt, unsigned long long>::iterator it = _freeSlots.lower_bound(capacity);
+    if (it != _freeSlots.end() && it->first < 2 * capacity)
+    {
+        e.offset = it->second;
+        e.capacity = it->first;
+        _freeSlots.erase(it);
+        return;
+    }
+
+    e.offset = _dataEnd;
+    e.capacity = capacity;
+    _dataEnd += capacity;
+}
+
+
+void CompressedFileBaseBTree::closeInternal()
+{
+    closeDataFile();
+    FileBaseBTree::closeInternal();
+}
+
+
+void CompressedFileBaseBTree::closeDataFile()
+{
+    if (_dataStream.is_open())
+        _dataStream.close();
+    _dataStream.clear();
+
+    _pageMap.clear();
+    _freeSlots.clear();
+    _dataEnd = 0;
+}
+
+
+void CompressedFileBaseBTree::readPageInternal(UInt pnum, Byte *dst)
+{
+    const PageMapEntry &e = getPageMapEntry(pnum);
+    if (e.size == 0)
+        throw std::runtime_error("B-tree page is not written");
+
+    if (e.codec == pcRaw)
+    {
+        _dataStream.seekg((std::streamoff) e.offset, std::ios_base::beg);
+        _dataStream.read((char *) dst, getNodePageSize());
+        if (_dataStream.fail())
+            throw std::runtime_error("Can't read B-tree page");
+        return;
+    }
+
+    _lzBuf.resize(e.size);
+    _dataStream.seekg((std::streamoff) e.offset, std::ios_base::beg);
+    _dataStream.read((char *) _lzBuf.data(), e.size);
+    if (_dataStream.fail())
+        throw std::runtime_error("Can't read B-tree page");
+
+    decodePage(_lzBuf.data(), e.size, e.codec, dst);
+}
+
+
+void CompressedFileBaseBTree::writePageInternal(UInt pnum, const Byte *dst)
+{
+    // страница getLastPageNum() + 1 — новая
+    if (pnum > _pageMap.size())
+        _pageMap.resize(pnum);
+
+    UInt size;
+    Byte codec;
+    const Byte *image = encodePage(dst, size, codec);
+
+    // не помещается на старое место — переезжает
+    PageMapEntry &e = _pageMap[pnum - 1];
+    if (size > e.capacity)
+        allocSlot(e, size);
+    e.size = size;
+    e.codec = codec;
+
+    _dataStream.seekp((std::streamoff) e.offset, std::ios_base::beg);
+    _dataStream.write((const char *) image, size);
+    if (_dataStream.fail())
+        throw std::runtime_error("Can't write B-tree page");
+
+    writePageMapEntry(pnum);
+}
+
+
+void CompressedFileBaseBTree::writePageMapEntry(UInt pnum)
+{
+    _stream->seekg(getFirstPageOfs() + (std::streamoff) PAGE_MAP_ENTRY_SZ * (pnum - 1), std::ios_base::beg);
+    _stream->write((const char *) &_pageMap[pnum - 1], PAGE_MAP_ENTRY_SZ);
+}
+
+
+const Byte *CompressedFileBaseBTree::encodePage(const Byte *page, UInt &size, Byte &codec)
+{
+    UInt pageSize = getNodePageSize();
+    size = pageSize;
+    codec = pcRaw;
+
+    UShort info = *((const UShort *) (page + NODE_INFO_OFS));
+    if (!(info & LEAF_NODE_MASK) || _leafCompression == lcNone)
+        return page;                // внутренние узлы горячие и немногочисленные
+
+    const Byte *image = page;
+
+    // ключи целыми: годится, только если за ключами до хвоста страницы одни нули
+    UShort keysNum = (UShort) (info & ~LEAF_NODE_MASK);
+    UInt keysEnd = KEYS_OFS + getRecSize() * keysNum;
+    UInt tailOfs = pageSize - INT_TAIL_SZ;
+    if (_leafCompression == lcIntegral && getRecSize() <= 8 && keysEnd <= tailOfs)
+    {
+        bool zeroGap = true;
+        for (UInt i = keysEnd; i < tailOfs && zeroGap; ++i)
+            zeroGap = (page[i] == 0);
+
+        if (zeroGap)
+        {
+            _intBuf.resize(pageSize);
+            UInt cap = pageSize - NODE_INFO_SZ - INT_TAIL_SZ;
+            size_t n = encodeIntKeys(page + KEYS_OFS, keysNum, getRecSize(), _intBuf.data() + NODE_INFO_SZ, cap);
+            if (n && n + NODE_INFO_SZ + INT_TAIL_SZ < size)
+            {
+                memcpy(_intBuf.data(), page + NODE_INFO_OFS, NODE_INFO_SZ);
+                memcpy(_intBuf.data() + NODE_INFO_SZ + n, page + tailOfs, INT_TAIL_SZ);
+                size = (UInt) n + NODE_INFO_SZ + INT_TAIL_SZ;
+                codec = pcIntKeys;
+                image = _intBuf.data();
+            }
+        }
+    }
+
+    // общий кодек — если выходит еще меньше
+    _lzBuf.resize(pageSize);
+    size_t n = lzCompress(page, pageSize, _lzBuf.data(), size - 1);
+    if (n)
+    {
+        size = (UInt) n;
+        codec = pcLz;
+        image = _lzBuf.data();
+    }
+
+    return image;
+}
+
+
+void CompressedFileBaseBTree::decodePage(const Byte *src, UInt size, Byte codec, Byte *dst)
+{
+    UInt pageSize = getNodePageSize();
+    bool ok = false;
+
+    if (codec == pcLz)
+        ok = lzDecompress(src, size, dst, pageSize);
+    else if (codec == pcIntKeys && size >= NODE_INFO_SZ + INT_TAIL_SZ)
+    {
+        memset(dst, 0, pageSize);
+        memcpy(dst + NODE_INFO_OFS, src, NODE_INFO_SZ);
+
+        UShort info = *((const UShort *) (dst + NODE_INFO_OFS));
+        UShort keysNum = (UShort) (info & ~LEAF_NODE_MASK);
+        ok = KEYS_OFS + getRecSize() * keysNum <= pageSize - INT_TAIL_SZ
+             && decodeIntKeys(src + NODE_INFO_SZ, size - NODE_INFO_SZ - INT_TAIL_SZ,
+                              dst + KEYS_OFS, keysNum, getRecSize());
+
+        memcpy(dst + pageSize - INT_TAIL_SZ, src + size - INT_TAIL_SZ, INT_TAIL_SZ);
+    }
+
+    if (!ok)
+        throw std::runtime_error("Can't decode B-tree page. File corrupted");
+}
+
+
+} // namespace xi
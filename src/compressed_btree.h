@@ -0,0 +1,204 @@
+﻿
+/// \file
+/// \brief     B-дерево со сжатыми листовыми страницами
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле compressed_btree.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_COMPRESSED_BTREE_H_
+#define BTREE_COMPRESSED_BTREE_H_
+
+
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "btree.h"
+
+
+namespace xi {
+
+
+/** \brief Файловое B-дерево, хранящее листовые страницы в сжатом виде.
+ *
+ *  Листья составляют подавляющую часть страниц дерева и при сканированиях читаются один раз
+ *  (холодные страницы), поэтому при записи они сжимаются: для целочисленных ключей — кодеком
+ *  encodeIntKeys() (frame of reference/разности с упаковкой бит), для прочих — lzCompress().
+ *  Из двух вариантов сохраняется меньший; страница, которая не сжалась, и внутренние узлы
+ *  хранятся как есть. При чтении страница распаковывается в буфер PageWrapper, так что
+ *  остальная часть дерева, включая кэш страниц и контрольные суммы, работает с обычными
+ *  страницами.
+ *
+ *  Сжатые страницы имеют переменный размер, поэтому лежат в отдельном файле данных
+ *  (имя файла дерева с суффиксом DATA_FILE_SUFFIX), а основной файл после заголовка хранит
+ *  таблицу отображения страниц: для каждой страницы — смещение, размер и кодек (PageMapEntry).
+ *  Страница, которая после перезаписи не помещается на свое место, переезжает на подходящее
+ *  освободившееся место или в конец файла данных; места выделяются с запасом (SLOT_ALIGN),
+ *  чтобы так бывало реже. Освободившиеся места при открытии восстанавливаются по таблице.
+ *
+ *  Дерево требует выровненной геометрии страниц: его необходимо создавать методом
+ *  createForPageSize(), размер страницы задает размер несжатого узла.
+ */
+class CompressedFileBaseBTree : public FileBaseBTree {
+public:
+    /** \brief Способ сжатия листовых страниц. */
+    enum LeafCompression {
+        lcNone,             ///< листья не сжимаются
+        lcGeneric,          ///< только lzCompress()
+        lcIntegral          ///< encodeIntKeys() (для записей не длиннее 8 байт) или lzCompress()
+    };
+
+    /** \brief Кодек, которым записана страница (поле PageMapEntry::codec). */
+    enum PageCodec {
+        pcRaw = 0,          ///< страница как есть
+        pcIntKeys = 1,      ///< поле информации, ключи через encodeIntKeys() и хвост страницы
+        pcLz = 2            ///< вся страница через lzCompress()
+    };
+
+#pragma pack(push, 1)
+    /** \brief Запись таблицы отображения страниц. */
+    struct PageMapEntry {
+        PageMapEntry() : offset(0), size(0), capacity(0), codec(pcRaw) { memset(reserved, 0, sizeof(reserved)); }
+
+        unsigned long long offset;  ///< смещение в файле данных
+        UInt size;                  ///< размер сжатой страницы, 0 — страница не записана
+        UInt capacity;              ///< выделенное под страницу место
+        Byte codec;                 ///< PageCodec
+        Byte reserved[3];
+    }; // struct PageMapEntry
+#pragma pack(pop)
+
+    /** \brief Размер записи таблицы отображения страниц. */
+    static const UInt PAGE_MAP_ENTRY_SZ = sizeof(PageMapEntry);
+
+    /** \brief Гранулярность выделения мест в файле данных. */
+    static const UInt SLOT_ALIGN = 64;
+
+    /** \brief Суффикс имени файла данных. */
+    static const char* DATA_FILE_SUFFIX;
+
+    /** \brief Размер хвоста страницы, который кодек pcIntKeys хранит как есть: там лежит
+     *  контрольная сумма страницы (см. BaseBTree::setPageChecksums()).
+     */
+    static const UInt INT_TAIL_SZ = PAGE_CRC_SZ;
+
+public:
+    /** \brief Конструктор по умолчанию.
+     *
+     *  Для "открытия" дерева необходимо использовать метод open() или createForPageSize().
+     */
+    CompressedFileBaseBTree();
+
+    /** \brief Создает новое дерево со страницами размером \c pageSize в файле \c fileName
+     *  (см. FileBaseBTree::createForPageSize()).
+     */
+    CompressedFileBaseBTree(UInt pageSize, UShort recSize, IComparator* comparator, const std::string& fileName);
+
+    /** \brief Конструирует дерево на основе существующего файла B-дерева. */
+    CompressedFileBaseBTree(const std::string& fileName, IComparator* comparator);
+
+    /** \brief Деструктор. */
+    ~CompressedFileBaseBTree();
+
+protected:
+    CompressedFileBaseBTree(const CompressedFileBaseBTree&);            ///< КК не доступен.
+    CompressedFileBaseBTree& operator= (CompressedFileBaseBTree&);      ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Задает способ сжатия листьев для последующих записей страниц (по умолчанию
+     *  lcIntegral). Уже записанные страницы остаются как есть.
+     */
+    void setLeafCompression(LeafCompression lc) { _leafCompression = lc; }
+
+    /** \brief Возвращает способ сжатия листьев. */
+    LeafCompression getLeafCompression() const { return _leafCompression; }
+
+    /** \brief Возвращает имя файла данных открытого дерева. */
+    const std::string& getDataFileName() const { return _dataFileName; }
+
+    /** \brief Возвращает запись таблицы отображения страницы \c pnum. */
+    const PageMapEntry& getPageMapEntry(UInt pnum) const;
+
+    /** \brief Возвращает суммарный размер записанных страниц в файле данных. */
+    unsigned long long getStoredSize() const;
+
+    /** \brief Возвращает размер файла данных, включая запас мест и свободные места. */
+    unsigned long long getDataSize() const { return _dataEnd; }
+
+    /** \brief Создает сжатое дерево с тем же способом сжатия листьев. */
+    virtual FileBaseBTree* createEmptyLike() const override;
+
+    /** \brief Ложь: страницы переменного размера лежат в файле данных. */
+    virtual bool canAccessPagesDirectly() const override { return false; }
+
+    /** \brief Добавляет суффикс файла данных DATA_FILE_SUFFIX. */
+    virtual void getAuxFileSuffixes(std::vector<std::string>& suffixes) const override
+    {
+        suffixes.push_back(DATA_FILE_SUFFIX);
+    }
+
+protected:
+    virtual void readPageInternal(UInt pnum, Byte* dst) override;
+    virtual void writePageInternal(UInt pnum, const Byte* dst) override;
+    virtual UInt getStorageFlags() const override { return HeaderExt::FLAG_COMPRESSED_PAGES; }
+    virtual void preparePageStorage(bool create) override;
+    virtual void closeInternal() override;
+
+    /** \brief Страницы переменного размера лежат в файле данных, резервировать их нечем. */
+    virtual void growStorage(UInt /*lastPnum*/) override {}
+
+    /** \brief Сжимает страницу \c page и возвращает сжатый образ (или саму страницу),
+     *  его размер \c size и кодек \c codec.
+     */
+    const Byte* encodePage(const Byte* page, UInt& size, Byte& codec);
+
+    /** \brief Распаковывает в \c dst образ \c src размером \c size, сжатый кодеком \c codec. */
+    void decodePage(const Byte* src, UInt size, Byte codec, Byte* dst);
+
+    /** \brief Выделяет в файле данных место не меньше \c size байт для записи \c e. */
+    void allocSlot(PageMapEntry& e, UInt size);
+
+    /** \brief Восстанавливает список свободных мест по таблице отображения. */
+    void collectFreeSlots();
+
+    /** \brief Записывает в основной файл запись таблицы отображения страницы \c pnum. */
+    void writePageMapEntry(UInt pnum);
+
+    /** \brief Закрывает файл данных и сбрасывает таблицу отображения. */
+    void closeDataFile();
+
+protected:
+    /** \brief Способ сжатия листьев. */
+    LeafCompression _leafCompression;
+
+    /** \brief Файл данных со сжатыми страницами. */
+    std::fstream _dataStream;
+
+    /** \brief Имя файла данных. */
+    std::string _dataFileName;
+
+    /** \brief Таблица отображения страниц (элемент i — страница i + 1). */
+    std::vector<PageMapEntry> _pageMap;
+
+    /** \brief Конец занятой области файла данных. */
+    unsigned long long _dataEnd;
+
+    /** \brief Свободные места файла данных: емкость — смещение. */
+    std::multimap<UInt, unsigned long long> _freeSlots;
+
+    /** \brief Буферы для сжатых образов страниц. */
+    std::vector<Byte> _intBuf;
+    std::vector<Byte> _lzBuf;
+}; // class CompressedFileBaseBTree
+
+
+} // namespace xi
+
+
+#endif // BTREE_COMPRESSED_BTREE_H_
@@ -0,0 +1,236 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  crc32c.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "crc32c.h"
+
+#include <cstring>          // memcpy
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XI_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define XI_CRC32C_SLICE8
+#endif
+
+
+namespace xi {
+
+
+namespace {
+
+/** \brief Отраженный полином Castagnoli. */
+const UInt CRC32C_POLY = 0x82F63B78;
+
+/** \brief Таблицы для подсчета суммы по 8 байт за шаг (slicing-by-8). */
+struct Crc32cTable {
+    UInt t[8][256];
+
+    Crc32cTable()
+    {
+        for (UInt n = 0; n < 256; ++n)
+        {
+            UInt c = n;
+            for (int j = 0; j < 8; ++j)
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+            t[0][n] = c;
+        }
+
+        for (UInt n = 0; n < 256; ++n)
+            for (int k = 1; k < 8; ++k)
+                t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF];
+    }
+}; // struct Crc32cTable
+
+const Crc32cTable crcTable;
+
+
+#ifdef XI_CRC32C_SSE42
+
+/** \brief Длины полос, которые аппаратная реализация считает тремя независимыми цепочками,
+ *  чтобы скрыть задержку инструкции crc32 (3 такта при пропускной способности 1 за такт).
+ */
+const size_t CRC_LONG = 8192;
+const size_t CRC_SHORT = 256;
+
+/** \brief Возвращает произведение многочленов \c a и \c b по модулю полинома (в отраженном виде). */
+UInt multModP(UInt a, UInt b)
+{
+    UInt m = (UInt) 1 << 31;
+    UInt p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+/** \brief Таблица сдвига состояния crc на \c len нулевых байт: позволяет склеить сумму
+ *  полосы с суммой следующей за ней полосы.
+ */
+struct Crc32cShift {
+    UInt t[4][256];
+
+    explicit Crc32cShift(size_t len)
+    {
+        // x^(8 * len) по модулю полинома, через x^(2^k)
+        UInt x2n = (UInt) 1 << 30;              // x^1
+        UInt op = (UInt) 1 << 31;               // x^0
+        for (size_t n = len * 8; n; n >>= 1)
+        {
+            if (n & 1)
+                op = multModP(x2n, op);
+            x2n = multModP(x2n, x2n);
+        }
+
+        for (UInt n = 0; n < 256; ++n)
+            for (int k = 0; k < 4; ++k)
+                t[k][n] = multModP(op, n << (8 * k));
+    }
+
+    UInt apply(UInt crc) const
+    {
+        return t[0][crc & 0xFF] ^ t[1][(crc >> 8) & 0xFF] ^ t[2][(crc >> 16) & 0xFF] ^ t[3][crc >> 24];
+    }
+}; // struct Crc32cShift
+
+const Crc32cShift crcShiftLong(CRC_LONG);
+const Crc32cShift crcShiftShort(CRC_SHORT);
+
+
+/** \brief Продвигает состояние трех полос длиной \c lane байт от \c data и склеивает их. */
+__attribute__((target("sse4.2")))
+inline UInt crc32cLanes(UInt crc0, const Byte* data, size_t lane, const Crc32cShift& shift)
+{
+#ifdef __x86_64__
+    unsigned long long c0 = crc0, c1 = 0, c2 = 0;
+    for (const Byte* end = data + lane; data < end; data += 8)
+    {
+        unsigned long long v0, v1, v2;
+        memcpy(&v0, data, 8);
+        memcpy(&v1, data + lane, 8);
+        memcpy(&v2, data + 2 * lane, 8);
+        c0 = _mm_crc32_u64(c0, v0);
+        c1 = _mm_crc32_u64(c1, v1);
+        c2 = _mm_crc32_u64(c2, v2);
+    }
+#else
+    UInt c0 = crc0, c1 = 0, c2 = 0;
+    for (const Byte* end = data + lane; data < end; data += 4)
+    {
+        UInt v0, v1, v2;
+        memcpy(&v0, data, 4);
+        memcpy(&v1, data + lane, 4);
+        memcpy(&v2, data + 2 * lane, 4);
+        c0 = _mm_crc32_u32(c0, v0);
+        c1 = _mm_crc32_u32(c1, v1);
+        c2 = _mm_crc32_u32(c2, v2);
+    }
+#endif
+    UInt crc = shift.apply((UInt) c0) ^ (UInt) c1;
+    return shift.apply(crc) ^ (UInt) c2;
+}
+
+
+__attribute__((target("sse4.2")))
+UInt crc32cHardware(const Byte* data, size_t len, UInt crc)
+{
+    crc = ~crc;
+
+    for (; len >= 3 * CRC_LONG; data += 3 * CRC_LONG, len -= 3 * CRC_LONG)
+        crc = crc32cLanes(crc, data, CRC_LONG, crcShiftLong);
+    for (; len >= 3 * CRC_SHORT; data += 3 * CRC_SHORT, len -= 3 * CRC_SHORT)
+        crc = crc32cLanes(crc, data, CRC_SHORT, crcShiftShort);
+
+#ifdef __x86_64__
+    unsigned long long c = crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        unsigned long long v;
+        memcpy(&v, data, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (UInt) c;
+#endif
+    for (; len >= 4; data += 4, len -= 4)
+    {
+        UInt v;
+        memcpy(&v, data, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+    for (; len; ++data, --len)
+        crc = _mm_crc32_u8(crc, *data);
+
+    return ~crc;
+}
+
+#endif // XI_CRC32C_SSE42
+
+
+typedef UInt (*Crc32cFunc)(const Byte*, size_t, UInt);
+
+Crc32cFunc selectCrc32c()
+{
+#ifdef XI_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32cHardware;
+#endif
+    return crc32cSoftware;
+}
+
+} // namespace
+
+
+UInt crc32cSoftware(const Byte* data, size_t len, UInt crc)
+{
+    const UInt (*t)[256] = crcTable.t;
+    crc = ~crc;
+
+#ifdef XI_CRC32C_SLICE8
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        UInt lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+#endif
+    for (; len; ++data, --len)
+        crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+
+UInt crc32c(const Byte* data, size_t len, UInt crc)
+{
+    static const Crc32cFunc impl = selectCrc32c();
+    return impl(data, len, crc);
+}
+
+
+bool crc32cIsHardware()
+{
+    return selectCrc32c() != crc32cSoftware;
+}
+
+
+} // namespace xi
@@ -0,0 +1,43 @@
+﻿
+/// \file
+/// \brief     Контрольная сумма CRC32C (Castagnoli) для страниц B-дерева
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих функций располагается в файле crc32c.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_CRC32C_H_
+#define BTREE_CRC32C_H_
+
+
+#include <cstddef>
+
+#include "utils.h"
+
+
+namespace xi {
+
+
+/** \brief Считает CRC32C блока \c data длиной \c len байт, продолжая сумму \c crc.
+ *
+ *  На x86 с SSE4.2 использует аппаратную инструкцию crc32, иначе — табличный алгоритм.
+ *  Выбор делается один раз, при первом вызове. Сумма пустого блока с \c crc = 0 равна 0.
+ */
+UInt crc32c(const Byte* data, size_t len, UInt crc = 0);
+
+/** \brief Табличная реализация crc32c(), доступная и там, где есть аппаратная. */
+UInt crc32cSoftware(const Byte* data, size_t len, UInt crc = 0);
+
+/** \brief Возвращает истину, если crc32c() считается аппаратно (SSE4.2). */
+bool crc32cIsHardware();
+
+
+} // namespace xi
+
+
+#endif // BTREE_CRC32C_H_
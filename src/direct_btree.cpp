@@ -0,0 +1,385 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  direct_btree.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "direct_btree.h"
+
+#include <stdexcept>        // std::runtime_error
+#include <cstring>          // memcpy
+#include <cerrno>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>          // open, O_DIRECT
+#include <unistd.h>         // pread, pwrite, close
+#include <sys/uio.h>        // pwritev
+#endif
+
+
+namespace xi
+{
+
+
+DirectFileBaseBTree::DirectFileBaseBTree()
+        : FileBaseBTree(),
+          _fd(-1),
+          _direct(false),
+          _bounce(nullptr),
+          _asyncIO(nullptr),
+          _asyncBounce(nullptr)
+{
+    setCacheSize(DEFAULT_CACHE_SIZE);
+}
+
+
+DirectFileBaseBTree::DirectFileBaseBTree(UInt pageSize, UShort recSize, IComparator *comparator,
+                                         const std::string &fileName)
+        : DirectFileBaseBTree()
+{
+    setComparator(comparator);
+    createForPageSize(pageSize, recSize, fileName);
+}
+
+
+DirectFileBaseBTree::DirectFileBaseBTree(const std::string &fileName, IComparator *comparator)
+        : DirectFileBaseBTree()
+{
+    setComparator(comparator);
+    open(fileName);
+}
+
+
+DirectFileBaseBTree::~DirectFileBaseBTree()
+{
+    closeNoThrow();     // пока объект еще полноценный, чтобы закрылся и дескриптор страниц
+}
+
+
+void DirectFileBaseBTree::openPageStorage()
+{
+#ifndef _WIN32
+    // без выровненной геометрии O_DIRECT невозможен, страницы обслуживает поток
+    if (!isPageAligned())
+        return;
+
+    // все, что успело попасть в поток (корневая страница нового дерева), — на диск
+    _fileStream.flush();
+
+#ifdef O_DIRECT
+    _fd = ::open(_fileName.c_str(), O_RDWR | O_DIRECT);
+    _direct = (_fd >= 0);
+#endif
+    // файловая система не поддерживает O_DIRECT — обычный дескриптор
+    if (_fd < 0)
+        _fd = ::open(_fileName.c_str(), O_RDWR);
+
+    if (_fd < 0)
+        throw std::runtime_error("Can't open file for page I/O");
+
+    _bounce = allocAligned(getNodePageSize(), getPageBufAlign());
+    _asyncIO = IAsyncPageIO::create(_fd, ASYNC_QUEUE_DEPTH, ASYNC_THREADS);
+#endif
+}
+
+
+void DirectFileBaseBTree::closeInternal()
+{
+    closePageFile();
+    FileBaseBTree::closeInternal();
+}
+
+
+void DirectFileBaseBTree::closePageFile()
+{
+    // отправленная пачка пишет в кадры кэша: дожидаемся ее, ошибки уже никому не нужны
+    try
+    {
+        endReadPagesInternal();
+    }
+    catch (...)
+    {
+    }
+
+    delete _asyncIO;            // до закрытия дескриптора, которым он пользуется
+    _asyncIO = nullptr;
+
+#ifndef _WIN32
+    if (_fd >= 0)
+        ::close(_fd);
+#endif
+    _fd = -1;
+    _direct = false;
+
+    if (_bounce)
+        freeAligned(_bounce);
+    _bounce = nullptr;
+}
+
+
+void DirectFileBaseBTree::disableDirect()
+{
+#if !defined(_WIN32) && defined(O_DIRECT)
+    int flags = fcntl(_fd, F_GETFL);
+    if (flags == -1 || fcntl(_fd, F_SETFL, flags & ~O_DIRECT) == -1)
+        throw std::runtime_error("Can't switch page I/O to buffered mode");
+#endif
+    _direct = false;
+}
+
+
+void DirectFileBaseBTree::readPageInternal(UInt pnum, Byte *dst)
+{
+    if (_fd < 0)
+    {
+        FileBaseBTree::readPageInternal(pnum, dst);
+        return;
+    }
+
+    // невыровненный буфер не годится для O_DIRECT, читаем через промежуточный
+    if ((size_t) dst % getPageBufAlign() != 0)
+    {
+        pageIO(pnum, _bounce, false);
+        memcpy(dst, _bounce, getNodePageSize());
+        return;
+    }
+
+    pageIO(pnum, dst, false);
+}
+
+
+void DirectFileBaseBTree::writePageInternal(UInt pnum, const Byte *dst)
+{
+    if (_fd < 0)
+    {
+        FileBaseBTree::writePageInternal(pnum, dst);
+        return;
+    }
+
+    if ((size_t) dst % getPageBufAlign() != 0)
+    {
+        memcpy(_bounce, dst, getNodePageSize());
+        pageIO(pnum, _bounce, true);
+        return;
+    }
+
+    pageIO(pnum, const_cast<Byte *>(dst), true);
+}
+
+
+void DirectFileBaseBTree::readPagesInternal(UInt n, const UInt *pnums, Byte *const *dsts)
+{
+    if (n < 2 || !beginReadPagesInternal(n, pnums, dsts))
+    {
+        FileBaseBTree::readPagesInternal(n, pnums, dsts);
+        return;
+    }
+
+    endReadPagesInternal();
+}
+
+
+bool DirectFileBaseBTree::beginReadPagesInternal(UInt n, const UInt *pnums, Byte *const *dsts)
+{
+    if (!_asyncIO || n == 0 || !_asyncReqs.empty())
+        return false;
+
+    const UInt sz = getNodePageSize();
+    const UInt align = getPageBufAlign();
+
+    // невыровненные буферы читаем через выровненный промежуточный буфер пачки
+    UInt unaligned = 0;
+    for (UInt i = 0; i < n; ++i)
+        if ((size_t) dsts[i] % align != 0)
+            ++unaligned;
+
+    _asyncBounce = unaligned ? allocAligned((size_t) sz * unaligned, align) : nullptr;
+    _asyncPnums.assign(pnums, pnums + n);
+    _asyncDsts.assign(dsts, dsts + n);
+    _asyncReqs.resize(n);
+    for (UInt i = 0, b = 0; i < n; ++i)
+    {
+        PageIORequest &r = _asyncReqs[i];
+        r.buf = ((size_t) dsts[i] % align != 0) ? _asyncBounce + (size_t) sz * b++ : dsts[i];
+        r.size = sz;
+        r.offset = getPageOffset(pnums[i]);
+        r.isWrite = false;
+        r.result = 0;
+    }
+
+    try
+    {
+        _asyncIO->submit(_asyncReqs.data(), n);
+    }
+    catch (...)
+    {
+        endReadPagesInternal();         // дожидаемся того, что движок успел принять
+        throw;
+    }
+
+    return true;
+}
+
+
+void DirectFileBaseBTree::endReadPagesInternal()
+{
+    if (_asyncReqs.empty())
+        return;
+
+    const UInt sz = getNodePageSize();
+    std::vector<PageIORequest> reqs;
+    reqs.swap(_asyncReqs);
+    Byte *bounce = _asyncBounce;
+    _asyncBounce = nullptr;
+
+    try
+    {
+        _asyncIO->waitAll();
+
+        for (size_t i = 0; i < reqs.size(); ++i)
+        {
+            PageIORequest &r = reqs[i];
+            if (r.result == -EINVAL && _direct)
+                disableDirect();            // отказ в O_DIRECT: дальше буферизованно
+
+            if (r.result == -EINVAL && !_direct)
+                pageIO(_asyncPnums[i], r.buf, false);
+            else if (r.result < 0)
+                throw std::runtime_error("Can't read a page");
+            else if ((UInt) r.result < sz)  // за концом файла: страница еще не дописана
+                memset(r.buf + r.result, 0, sz - (UInt) r.result);
+
+            if (r.buf != _asyncDsts[i])
+                memcpy(_asyncDsts[i], r.buf, sz);
+        }
+    }
+    catch (...)
+    {
+        if (bounce)
+            freeAligned(bounce);
+        throw;
+    }
+
+    if (bounce)
+        freeAligned(bounce);
+}
+
+
+void DirectFileBaseBTree::writePagesInternal(UInt n, const UInt *pnums, const Byte *const *srcs)
+{
+    if (_fd < 0)
+    {
+        FileBaseBTree::writePagesInternal(n, pnums, srcs);
+        return;
+    }
+
+    const UInt align = getPageBufAlign();
+    UInt i = 0;
+    while (i < n)
+    {
+        // невыровненный буфер пишем сам по себе, через промежуточный
+        if ((size_t) srcs[i] % align != 0)
+        {
+            writePageInternal(pnums[i], srcs[i]);
+            ++i;
+            continue;
+        }
+
+        // серия выровненных страниц с номерами подряд
+        UInt len = 1;
+        while (i + len < n && len < MAX_WRITE_RUN && pnums[i + len] == pnums[i] + len
+               && (size_t) srcs[i + len] % align == 0)
+            ++len;
+
+        writeRun(pnums[i], len, srcs + i);
+        i += len;
+    }
+}
+
+
+void DirectFileBaseBTree::writeRun(UInt pnum, UInt n, const Byte *const *srcs)
+{
+#ifndef _WIN32
+    const size_t sz = getNodePageSize();
+    std::vector<iovec> iov(n);
+    for (UInt i = 0; i < n; ++i)
+    {
+        iov[i].iov_base = const_cast<Byte *>(srcs[i]);
+        iov[i].iov_len = sz;
+    }
+
+    ssize_t res;
+    for (;;)
+    {
+        res = ::pwritev(_fd, iov.data(), (int) n, (off_t) getPageOffset(pnum));
+        if (res >= 0)
+            break;
+        if (errno == EINTR)
+            continue;
+
+        // отказ в O_DIRECT: дальше буферизованно
+        if (errno == EINVAL && _direct)
+        {
+            disableDirect();
+            continue;
+        }
+
+        throw std::runtime_error("Can't write pages");
+    }
+
+    // короткая запись: начиная со страницы, на которой остановились, пишем по одной
+    for (UInt i = (UInt) ((size_t) res / sz); i < n; ++i)
+        pageIO(pnum + i, const_cast<Byte *>(srcs[i]), true);
+#else
+    for (UInt i = 0; i < n; ++i)
+        writePageInternal(pnum + i, srcs[i]);
+#endif
+}
+
+
+void DirectFileBaseBTree::pageIO(UInt pnum, Byte *buf, bool isWrite)
+{
+#ifndef _WIN32
+    // смещение считаем в 64 битах, чтобы не переполниться на больших файлах
+    off_t ofs = (off_t) getPageOffset(pnum);
+    size_t done = 0;
+    size_t sz = getNodePageSize();
+
+    while (done < sz)
+    {
+        ssize_t res = isWrite ? ::pwrite(_fd, buf + done, sz - done, ofs + done)
+                              : ::pread(_fd, buf + done, sz - done, ofs + done);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // файловая система приняла O_DIRECT при открытии, но отказывает в операции
+            if (errno == EINVAL && _direct)
+            {
+                disableDirect();
+                continue;
+            }
+
+            throw std::runtime_error(isWrite ? "Can't write a page" : "Can't read a page");
+        }
+
+        // чтение за концом файла: страница еще не дописана, считаем ее нулевой
+        if (res == 0 && !isWrite)
+        {
+            memset(buf + done, 0, sz - done);
+            break;
+        }
+
+        done += (size_t) res;
+    }
+#endif
+}
+
+
+} // namespace xi
@@ -0,0 +1,151 @@
+﻿
+/// \file
+/// \brief     B-дерево с небуферизованным (O_DIRECT) вводом-выводом страниц
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле direct_btree.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_DIRECT_BTREE_H_
+#define BTREE_DIRECT_BTREE_H_
+
+
+#include "btree.h"
+#include "async_io.h"
+
+
+namespace xi {
+
+
+/** \brief Файловое B-дерево, читающее и пишущее страницы в обход кэша страниц ОС.
+ *
+ *  Страницы читаются и пишутся отдельным дескриптором файла, открытым с флагом O_DIRECT,
+ *  поэтому единственным кэшем страниц остается собственный кэш дерева (см.
+ *  BaseBTree::setCacheSize()), включенный по умолчанию. Заголовок по-прежнему
+ *  обслуживается файловым потоком: он лежит в отдельной (первой) странице файла.
+ *
+ *  Небуферизованный ввод-вывод требует выровненной геометрии страниц, поэтому дерево
+ *  необходимо создавать методом createForPageSize(). Для файлов с обычной геометрией,
+ *  а также если файловая система отказывает в O_DIRECT (при открытии или при первой
+ *  операции), дерево молча переходит на обычный буферизованный ввод-вывод;
+ *  узнать фактический режим можно методом isDirectIO().
+ *
+ *  Пакетные чтения (BaseBTree::readPages(), BaseBTree::prefetchPages()) выполняются
+ *  асинхронным движком (io_uring или пул потоков, см. IAsyncPageIO), что позволяет держать
+ *  в полете сразу много запросов к накопителю.
+ */
+class DirectFileBaseBTree : public FileBaseBTree {
+public:
+    /** \brief Емкость кэша страниц по умолчанию. */
+    static const UInt DEFAULT_CACHE_SIZE = 1024;
+
+    /** \brief Число запросов в полете для асинхронного движка. */
+    static const UInt ASYNC_QUEUE_DEPTH = 32;
+
+    /** \brief Число потоков запасного движка на основе пула потоков. */
+    static const UInt ASYNC_THREADS = 4;
+
+    /** \brief Наибольшее число соседних страниц, записываемых одним вызовом pwritev(). */
+    static const UInt MAX_WRITE_RUN = 64;
+
+public:
+    /** \brief Конструктор по умолчанию.
+     *
+     *  Для "открытия" дерева необходимо использовать метод open() или createForPageSize().
+     */
+    DirectFileBaseBTree();
+
+    /** \brief Создает новое дерево с выровненными страницами размером \c pageSize в файле
+     *  \c fileName (см. FileBaseBTree::createForPageSize()).
+     */
+    DirectFileBaseBTree(UInt pageSize, UShort recSize, IComparator* comparator, const std::string& fileName);
+
+    /** \brief Конструирует дерево на основе существующего файла B-дерева. */
+    DirectFileBaseBTree(const std::string& fileName, IComparator* comparator);
+
+    /** \brief Деструктор. */
+    ~DirectFileBaseBTree();
+
+protected:
+    DirectFileBaseBTree(const DirectFileBaseBTree&);                ///< КК не доступен.
+    DirectFileBaseBTree& operator= (DirectFileBaseBTree&);          ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Возвращает истину, если страницы действительно читаются и пишутся в обход кэша ОС. */
+    bool isDirectIO() const { return _direct; }
+
+    /** \brief Возвращает имя асинхронного движка пакетных чтений или nullptr, если его нет. */
+    const char* getAsyncIOName() const { return _asyncIO ? _asyncIO->getName() : nullptr; }
+
+    /** \brief Создает дерево с прямым вводом-выводом. */
+    virtual FileBaseBTree* createEmptyLike() const override { return new DirectFileBaseBTree; }
+
+    /** \brief Ложь: буферизованные дескрипторы других потоков не согласованы с прямым
+     *  вводом-выводом дерева и его асинхронными чтениями.
+     */
+    virtual bool canAccessPagesDirectly() const override { return false; }
+
+protected:
+    virtual void readPageInternal(UInt pnum, Byte* dst) override;
+    virtual void writePageInternal(UInt pnum, const Byte* dst) override;
+    virtual void readPagesInternal(UInt n, const UInt* pnums, Byte* const* dsts) override;
+
+    /** \brief Отправляет пачку чтений асинхронному движку, если он есть. */
+    virtual bool beginReadPagesInternal(UInt n, const UInt* pnums, Byte* const* dsts) override;
+    virtual void endReadPagesInternal() override;
+
+    /** \brief Пишет страницы сериями соседних номеров, каждую серию — одним pwritev(). */
+    virtual void writePagesInternal(UInt n, const UInt* pnums, const Byte* const* srcs) override;
+    virtual void closeInternal() override;
+    virtual void openPageStorage() override;
+
+    /** \brief Закрывает дескриптор страниц и освобождает промежуточный буфер. */
+    void closePageFile();
+
+    /** \brief Переключает дескриптор страниц на обычный буферизованный ввод-вывод. */
+    void disableDirect();
+
+    /** \brief Выполняет операцию ввода-вывода страницы \c pnum с буфером \c buf (запись, если
+     *  \c isWrite), с переходом на буферизованный режим, если ОС отказывает в O_DIRECT.
+     */
+    void pageIO(UInt pnum, Byte* buf, bool isWrite);
+
+    /** \brief Пишет \c n страниц с номерами подряд от \c pnum из выровненных буферов \c srcs
+     *  одним вызовом pwritev(). Недописанный остаток дописывает постранично.
+     */
+    void writeRun(UInt pnum, UInt n, const Byte* const* srcs);
+
+protected:
+    /** \brief Дескриптор файла для страниц или -1, если страницы обслуживает поток. */
+    int _fd;
+
+    /** \brief Истина, если дескриптор открыт с O_DIRECT. */
+    bool _direct;
+
+    /** \brief Выровненный промежуточный буфер для невыровненных пользовательских буферов. */
+    Byte* _bounce;
+
+    /** \brief Асинхронный движок пакетных чтений (при открытом дескрипторе страниц). */
+    IAsyncPageIO* _asyncIO;
+
+    /** \brief Запросы пачки, отправленной beginReadPagesInternal() (пусто, если ее нет). */
+    std::vector<PageIORequest> _asyncReqs;
+
+    /** \brief Номера страниц и буферы назначения отправленной пачки. */
+    std::vector<UInt> _asyncPnums;
+    std::vector<Byte*> _asyncDsts;
+
+    /** \brief Выровненный буфер пачки для невыровненных буферов назначения. */
+    Byte* _asyncBounce;
+}; // class DirectFileBaseBTree
+
+
+} // namespace xi
+
+
+#endif // BTREE_DIRECT_BTREE_H_
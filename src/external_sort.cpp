@@ -0,0 +1,346 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  external_sort.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "external_sort.h"
+
+#include <stdexcept>        // std::invalid_argument
+#include <algorithm>        // std::sort
+#include <cstdio>           // std::remove
+
+
+namespace xi
+{
+
+
+ExternalSorter::ExternalSorter(UShort recSize, BaseBTree::IComparator *comparator, size_t memoryBudget,
+                               const std::string &tmpPrefix)
+        : _recSize(recSize), _comparator(comparator), _memoryBudget(memoryBudget), _tmpPrefix(tmpPrefix),
+          _bufRecs(0), _count(0), _memPos(0), _runsNum(0), _runCounter(0), _mergePasses(0), _finished(false)
+{
+    if (!_comparator)
+        throw std::invalid_argument("Comparator not set. Can't sort keys");
+    if (_recSize == 0)
+        throw std::invalid_argument("Record size must be positive");
+
+    // на каждую запись буфера приходится еще указатель в _sorted
+    _bufRecs = _memoryBudget / (_recSize + sizeof(const Byte*));
+    if (_bufRecs < 2)
+        throw std::invalid_argument("Memory budget is too small for external sort");
+
+    _buf.reserve(_bufRecs * _recSize);
+}
+
+
+ExternalSorter::~ExternalSorter()
+{
+    closeMerge();
+    for (const std::string &f : _runFiles)
+        std::remove(f.c_str());
+}
+
+
+void ExternalSorter::add(const Byte *rec)
+{
+    if (_finished)
+        throw std::runtime_error("Can't add records to a finished sorter");
+
+    _buf.insert(_buf.end(), rec, rec + _recSize);
+    ++_count;
+
+    if (_buf.size() == _bufRecs * _recSize)
+        spillBuffer();
+}
+
+
+void ExternalSorter::finish()
+{
+    if (_finished)
+        return;
+    _finished = true;
+
+    // все поместилось в память: выдаем прямо из буфера
+    if (_runFiles.empty())
+    {
+        sortBuffer();
+        _memPos = 0;
+        return;
+    }
+
+    spillBuffer();
+    std::vector<Byte>().swap(_buf);
+    std::vector<const Byte*>().swap(_sorted);
+
+    // память делится между сливаемыми сериями и выходной серией
+    size_t fanIn = _memoryBudget / MIN_RUN_BUF;
+    fanIn = fanIn > 1 ? fanIn - 1 : 0;
+    if (fanIn < 2)
+        fanIn = 2;
+    if (fanIn > MAX_FAN_IN)
+        fanIn = MAX_FAN_IN;
+
+    size_t bufSize = _memoryBudget / (fanIn + 1) / _recSize * _recSize;
+    if (bufSize < _recSize)
+        bufSize = _recSize;
+
+    // предварительные слияния: первые fanIn серий в одну новую в конце очереди
+    while (_runFiles.size() > fanIn)
+    {
+        // открытые серии удаляет closeMerge(), остальные — деструктор
+        std::vector<std::string> group(_runFiles.begin(), _runFiles.begin() + fanIn);
+        startMerge(group, bufSize);
+        _runFiles.erase(_runFiles.begin(), _runFiles.begin() + fanIn);
+
+        std::string outName = makeRunName();
+        _runFiles.push_back(outName);
+        std::ofstream out(outName, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+        if (!out.is_open())
+            throw std::runtime_error("Can't create sort run " + outName);
+
+        std::vector<Byte> outBuf(bufSize);
+        size_t outLen = 0;
+        while (popMerge(&outBuf[outLen]))
+        {
+            outLen += _recSize;
+            if (outLen == bufSize)
+            {
+                out.write((const char*) outBuf.data(), outLen);
+                outLen = 0;
+            }
+        }
+        out.write((const char*) outBuf.data(), outLen);
+        if (!out)
+            throw std::runtime_error("Can't write sort run " + outName);
+
+        closeMerge();
+        ++_mergePasses;
+    }
+
+    startMerge(_runFiles, bufSize);
+    _runFiles.clear();
+}
+
+
+bool ExternalSorter::next(Byte *dst)
+{
+    if (!_finished)
+        throw std::runtime_error("Sorter is not finished");
+
+    if (_runsNum == 0)
+    {
+        if (_memPos == _sorted.size())
+            return false;
+
+        memcpy(dst, _sorted[_memPos++], _recSize);
+        return true;
+    }
+
+    if (popMerge(dst))
+        return true;
+
+    closeMerge();
+    return false;
+}
+
+
+unsigned long long ExternalSorter::ingestFile(const std::string &recsFile, FileBaseBTree &dst,
+                                              size_t memoryBudget, double fillFactor)
+{
+    std::ifstream in(recsFile, std::fstream::in | std::fstream::binary);
+    if (!in.is_open())
+        throw std::runtime_error("Can't open records file " + recsFile);
+
+    UShort recSize = dst.getRecSize();
+    ExternalSorter sorter(recSize, dst.getComparator(), memoryBudget, dst.getFileName());
+
+    // входной файл читаем блоками по целому числу записей
+    std::vector<Byte> chunk((MIN_RUN_BUF / recSize + 1) * recSize);
+    while (in)
+    {
+        in.read((char*) chunk.data(), chunk.size());
+        size_t got = (size_t) in.gcount();
+        if (got % recSize)
+            throw std::runtime_error("Records file size is not a multiple of the record size");
+
+        for (size_t ofs = 0; ofs < got; ofs += recSize)
+            sorter.add(&chunk[ofs]);
+    }
+
+    sorter.finish();
+
+    BTreeBuilder builder(&dst, fillFactor);
+    builder.build(sorter.getCount(), sorter);
+
+    return sorter.getCount();
+}
+
+
+void ExternalSorter::sortBuffer()
+{
+    size_t n = _buf.size() / _recSize;
+    _sorted.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        _sorted[i] = &_buf[i * _recSize];
+
+    BaseBTree::IComparator *cmp = _comparator;
+    UShort recSize = _recSize;
+    std::sort(_sorted.begin(), _sorted.end(),
+              [cmp, recSize](const Byte *a, const Byte *b) { return cmp->compare(a, b, recSize); });
+}
+
+
+void ExternalSorter::spillBuffer()
+{
+    if (_buf.empty())
+        return;
+
+    sortBuffer();
+
+    std::string name = makeRunName();
+    _runFiles.push_back(name);
+    std::ofstream out(name, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+    if (!out.is_open())
+        throw std::runtime_error("Can't create sort run " + name);
+
+    for (const Byte *rec : _sorted)
+        out.write((const char*) rec, _recSize);
+    if (!out)
+        throw std::runtime_error("Can't write sort run " + name);
+
+    ++_runsNum;
+    _buf.clear();
+    _sorted.clear();
+}
+
+
+std::string ExternalSorter::makeRunName()
+{
+    return _tmpPrefix + ".run" + std::to_string(_runCounter++);
+}
+
+
+ExternalSorter::Run *ExternalSorter::openRun(const std::string &fileName, size_t bufSize)
+{
+    Run *run = new Run();
+    run->fileName = fileName;
+    run->file.open(fileName, std::fstream::in | std::fstream::binary);
+    if (!run->file.is_open())
+    {
+        delete run;
+        throw std::runtime_error("Can't open sort run " + fileName);
+    }
+
+    run->buf.resize(bufSize);
+    run->pos = 0;
+    run->len = 0;
+
+    return run;
+}
+
+
+bool ExternalSorter::fillRun(Run &run)
+{
+    run.file.read((char*) run.buf.data(), run.buf.size());
+    run.len = (size_t) run.file.gcount();
+    run.pos = 0;
+
+    if (run.len % _recSize)
+        throw std::runtime_error("Sort run " + run.fileName + " is corrupted");
+
+    return run.len > 0;
+}
+
+
+void ExternalSorter::startMerge(const std::vector<std::string> &files, size_t bufSize)
+{
+    closeMerge();
+
+    for (const std::string &f : files)
+    {
+        _runs.push_back(openRun(f, bufSize));
+        if (fillRun(*_runs.back()))
+            _heap.push_back((UInt) _runs.size() - 1);
+    }
+
+    for (size_t i = _heap.size() / 2; i-- > 0; )
+        siftDown(i);
+}
+
+
+bool ExternalSorter::popMerge(Byte *dst)
+{
+    if (_heap.empty())
+        return false;
+
+    Run &run = *_runs[_heap[0]];
+    memcpy(dst, &run.buf[run.pos], _recSize);
+    run.pos += _recSize;
+
+    if (run.pos == run.len && !fillRun(run))
+    {
+        _heap[0] = _heap.back();
+        _heap.pop_back();
+    }
+
+    if (!_heap.empty())
+        siftDown(0);
+
+    return true;
+}
+
+
+void ExternalSorter::closeMerge()
+{
+    for (Run *run : _runs)
+    {
+        run->file.close();
+        std::remove(run->fileName.c_str());
+        delete run;
+    }
+
+    _runs.clear();
+    _heap.clear();
+}
+
+
+bool ExternalSorter::isRunGreater(UInt a, UInt b) const
+{
+    const Byte *ra = &_runs[a]->buf[_runs[a]->pos];
+    const Byte *rb = &_runs[b]->buf[_runs[b]->pos];
+
+    if (_comparator->compare(rb, ra, _recSize))
+        return true;
+    if (_comparator->compare(ra, rb, _recSize))
+        return false;
+
+    // равные записи — в порядке серий, так сортировка устойчива между сериями
+    return a > b;
+}
+
+
+void ExternalSorter::siftDown(size_t i)
+{
+    size_t n = _heap.size();
+    while (true)
+    {
+        size_t l = 2 * i + 1;
+        if (l >= n)
+            return;
+
+        size_t m = (l + 1 < n && isRunGreater(_heap[l], _heap[l + 1])) ? l + 1 : l;
+        if (!isRunGreater(_heap[i], _heap[m]))
+            return;
+
+        std::swap(_heap[i], _heap[m]);
+        i = m;
+    }
+}
+
+
+} // namespace xi
@@ -0,0 +1,163 @@
+﻿
+/// \file
+/// \brief     Внешняя сортировка слиянием для загрузки B-дерева из неупорядоченных данных
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле external_sort.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_EXTERNAL_SORT_H_
+#define BTREE_EXTERNAL_SORT_H_
+
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "btree.h"
+#include "btree_builder.h"
+
+
+
+namespace xi {
+
+
+/** \brief Внешняя сортировка записей фиксированного размера с ограниченным бюджетом памяти.
+ *
+ *  Записи добавляются методом add() в буфер; заполненный буфер сортируется и сбрасывается
+ *  во временный файл-серию. После finish() отсортированные записи выдаются методом next()
+ *  слиянием серий (куча по текущим записям серий). Если серий больше, чем позволяет
+ *  память на буферы чтения, они предварительно сливаются группами в более длинные серии.
+ *  Все файлы читаются и пишутся последовательно, большими блоками.
+ *
+ *  Если все записи поместились в буфер, на диск ничего не пишется.
+ *
+ *  Сортировщик — источник ключей для BTreeBuilder: дерево из неупорядоченных данных,
+ *  не помещающихся в память, строится за два последовательных прохода (см. ingestFile()).
+ */
+class ExternalSorter : public BTreeBuilder::IKeySource {
+public:
+    /** \brief Наименьший размер буфера чтения одной серии при слиянии. */
+    static const size_t MIN_RUN_BUF = 4096;
+
+    /** \brief Наибольшее число серий, сливаемых за раз. */
+    static const UInt MAX_FAN_IN = 64;
+
+public:
+    /** \brief Создает сортировщик записей длиной \c recSize с порядком \c comparator.
+     *
+     *  \c memoryBudget — память в байтах под буфер записей и буферы слияния (не меньше, чем
+     *  на две записи); временные серии называются \c tmpPrefix.run<номер>.
+     */
+    ExternalSorter(UShort recSize, BaseBTree::IComparator* comparator, size_t memoryBudget,
+                   const std::string& tmpPrefix);
+
+    virtual ~ExternalSorter();
+
+protected:
+    ExternalSorter(const ExternalSorter&);                  ///< КК не доступен.
+    ExternalSorter& operator= (ExternalSorter&);            ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Добавляет запись \c rec (до finish()). */
+    void add(const Byte* rec);
+
+    /** \brief Завершает добавление: сбрасывает последнюю серию и готовит слияние. */
+    void finish();
+
+    /** \brief Записывает в \c dst очередную запись в порядке компаратора (после finish()). */
+    virtual bool next(Byte* dst) override;
+
+    /** \brief Возвращает число добавленных записей. */
+    unsigned long long getCount() const { return _count; }
+
+    /** \brief Возвращает число серий, сброшенных на диск при добавлении. */
+    UInt getRunsNum() const { return _runsNum; }
+
+    /** \brief Возвращает число предварительных слияний групп серий. */
+    UInt getMergePasses() const { return _mergePasses; }
+
+    /** \brief Строит в открытом пустом дереве \c dst дерево из неупорядоченных записей файла
+     *  \c recsFile (подряд по dst.getRecSize() байт), сортируя их внешней сортировкой
+     *  в памяти \c memoryBudget байт; серии пишутся рядом с файлом дерева. Возвращает
+     *  число записей.
+     */
+    static unsigned long long ingestFile(const std::string& recsFile, FileBaseBTree& dst,
+                                         size_t memoryBudget, double fillFactor = 1.0);
+
+protected:
+    /** \brief Серия на диске с буфером чтения. */
+    struct Run {
+        std::string fileName;
+        std::ifstream file;
+        std::vector<Byte> buf;
+        size_t pos;                         ///< Смещение текущей записи в буфере.
+        size_t len;                         ///< Число прочитанных в буфер байт.
+    };
+
+    /** \brief Сортирует буфер записей: упорядочивает _sorted. */
+    void sortBuffer();
+
+    /** \brief Сортирует буфер и сбрасывает его в новую серию. */
+    void spillBuffer();
+
+    /** \brief Возвращает имя новой временной серии. */
+    std::string makeRunName();
+
+    /** \brief Открывает серию \c fileName для чтения с буфером \c bufSize байт. */
+    Run* openRun(const std::string& fileName, size_t bufSize);
+
+    /** \brief Дочитывает буфер серии; возвращает ложь, если серия кончилась. */
+    bool fillRun(Run& run);
+
+    /** \brief Начинает слияние серий \c files с буферами чтения по \c bufSize байт:
+     *  открывает их и строит кучу.
+     */
+    void startMerge(const std::vector<std::string>& files, size_t bufSize);
+
+    /** \brief Извлекает из кучи наименьшую запись в \c dst; возвращает ложь, если серии кончились. */
+    bool popMerge(Byte* dst);
+
+    /** \brief Закрывает и удаляет серии текущего слияния. */
+    void closeMerge();
+
+    /** \brief Возвращает истину, если текущая запись серии \c a больше, чем серии \c b
+     *  (порядок кучи: наверху наименьшая).
+     */
+    bool isRunGreater(UInt a, UInt b) const;
+
+    /** \brief Просеивает вниз элемент кучи номер \c i. */
+    void siftDown(size_t i);
+
+protected:
+    UShort _recSize;
+    BaseBTree::IComparator* _comparator;
+    size_t _memoryBudget;
+    std::string _tmpPrefix;
+
+    std::vector<Byte> _buf;                         ///< Неотсортированные записи.
+    std::vector<const Byte*> _sorted;               ///< Указатели на записи буфера в порядке ключей.
+    size_t _bufRecs;                                ///< Емкость буфера в записях.
+
+    std::vector<std::string> _runFiles;             ///< Серии, ожидающие слияния.
+    std::vector<Run*> _runs;                        ///< Серии текущего слияния.
+    std::vector<UInt> _heap;                        ///< Куча номеров серий по текущим записям.
+
+    unsigned long long _count;
+    size_t _memPos;                                 ///< Следующая запись буфера, если серий нет.
+    UInt _runsNum;
+    UInt _runCounter;                               ///< Счетчик имен серий.
+    UInt _mergePasses;
+    bool _finished;
+}; // class ExternalSorter
+
+
+} // namespace xi
+
+
+#endif // BTREE_EXTERNAL_SORT_H_
@@ -0,0 +1,195 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  latency_histogram.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "latency_histogram.h"
+
+#include <cmath>            // ceil
+#include <algorithm>        // std::fill
+
+
+namespace xi
+{
+
+
+/** \brief Половина корзин точного диапазона — число корзин на каждый следующий. */
+static const UInt HALF_BUCKETS = LatencyHistogram::SUB_BUCKETS / 2;
+
+/** \brief Двоичный логарифм SUB_BUCKETS. */
+static const UInt SUB_BUCKET_BITS = 7;
+
+/** \brief Всего корзин: точный диапазон и по HALF_BUCKETS на каждую старшую степень двойки. */
+static const UInt BUCKETS_NUM = LatencyHistogram::SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * HALF_BUCKETS;
+
+
+/** \brief Возвращает номер старшего единичного бита \c v (v != 0). */
+static UInt highestBit(unsigned long long v)
+{
+#if defined(__GNUC__)
+    return 63 - (UInt) __builtin_clzll(v);
+#else
+    UInt b = 0;
+    while (v >>= 1)
+        ++b;
+    return b;
+#endif
+}
+
+
+LatencyHistogram::LatencyHistogram()
+        : _counts(BUCKETS_NUM, 0)
+{
+    static_assert((1u << SUB_BUCKET_BITS) == SUB_BUCKETS, "SUB_BUCKET_BITS must match SUB_BUCKETS");
+    reset();
+}
+
+
+UInt LatencyHistogram::getIndex(unsigned long long v)
+{
+    if (v < SUB_BUCKETS)
+        return (UInt) v;
+
+    // сдвиг, при котором от значения остаются старшие SUB_BUCKET_BITS бит
+    UInt shift = highestBit(v) - (SUB_BUCKET_BITS - 1);
+    UInt sub = (UInt) (v >> shift);                 // в [HALF_BUCKETS, SUB_BUCKETS)
+
+    return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (sub - HALF_BUCKETS);
+}
+
+
+unsigned long long LatencyHistogram::getLowerBound(UInt idx)
+{
+    if (idx < SUB_BUCKETS)
+        return idx;
+
+    UInt j = idx - SUB_BUCKETS;
+    UInt shift = j / HALF_BUCKETS + 1;
+    unsigned long long sub = j % HALF_BUCKETS + HALF_BUCKETS;
+
+    return sub << shift;
+}
+
+
+unsigned long long LatencyHistogram::getUpperBound(UInt idx)
+{
+    if (idx + 1 >= BUCKETS_NUM)
+        return ~0ULL;
+
+    return getLowerBound(idx + 1) - 1;
+}
+
+
+void LatencyHistogram::record(unsigned long long v, unsigned long long n)
+{
+    if (!n)
+        return;
+
+    _counts[getIndex(v)] += n;
+    _count += n;
+    _sum += v * n;
+    if (v < _min)
+        _min = v;
+    if (v > _max)
+        _max = v;
+}
+
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (!other._count)
+        return;
+
+    for (UInt i = 0; i < BUCKETS_NUM; ++i)
+        _counts[i] += other._counts[i];
+
+    _count += other._count;
+    _sum += other._sum;
+    if (other._min < _min)
+        _min = other._min;
+    if (other._max > _max)
+        _max = other._max;
+}
+
+
+void LatencyHistogram::reset()
+{
+    std::fill(_counts.begin(), _counts.end(), 0);
+    _count = 0;
+    _sum = 0;
+    _min = ~0ULL;
+    _max = 0;
+}
+
+
+unsigned long long LatencyHistogram::percentile(double p) const
+{
+    if (!_count)
+        return 0;
+
+    // ранг искомого значения среди упорядоченных, от 1
+    unsigned long long rank = (unsigned long long) ceil(p / 100.0 * _count);
+    if (rank == 0)
+        return getMin();
+
+    unsigned long long seen = 0;
+    for (UInt i = 0; i < BUCKETS_NUM; ++i)
+    {
+        seen += _counts[i];
+        if (seen >= rank)
+        {
+            unsigned long long v = getUpperBound(i);
+            return v < _max ? v : _max;
+        }
+    }
+
+    return _max;
+}
+
+
+void LatencyHistogram::printText(std::ostream &os, const char *name) const
+{
+    os << name << ": count=" << _count
+       << " mean=" << getMean() / 1000 << "us"
+       << " min=" << getMin() / 1000.0 << "us"
+       << " p50=" << percentile(50) / 1000.0 << "us"
+       << " p90=" << percentile(90) / 1000.0 << "us"
+       << " p99=" << percentile(99) / 1000.0 << "us"
+       << " p99.9=" << percentile(99.9) / 1000.0 << "us"
+       << " max=" << getMax() / 1000.0 << "us" << std::endl;
+}
+
+
+void LatencyHistogram::printJson(std::ostream &os) const
+{
+    os << "{\"count\": " << _count
+       << ", \"mean_ns\": " << getMean()
+       << ", \"min_ns\": " << getMin()
+       << ", \"p50_ns\": " << percentile(50)
+       << ", \"p90_ns\": " << percentile(90)
+       << ", \"p99_ns\": " << percentile(99)
+       << ", \"p999_ns\": " << percentile(99.9)
+       << ", \"max_ns\": " << getMax()
+       << ", \"buckets\": [";
+
+    // непустые корзины: [нижняя граница, число значений]
+    bool first = true;
+    for (UInt i = 0; i < BUCKETS_NUM; ++i)
+    {
+        if (!_counts[i])
+            continue;
+
+        os << (first ? "" : ", ") << "[" << getLowerBound(i) << ", " << _counts[i] << "]";
+        first = false;
+    }
+
+    os << "]}";
+}
+
+
+} // namespace xi
@@ -0,0 +1,154 @@
+﻿
+/// \file
+/// \brief     Гистограммы задержек с лог-линейными корзинами (в духе HdrHistogram)
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле latency_histogram.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_LATENCY_HISTOGRAM_H_
+#define BTREE_LATENCY_HISTOGRAM_H_
+
+
+#include <vector>
+#include <ostream>
+#include <chrono>
+
+#include "utils.h"
+
+
+namespace xi {
+
+
+/** \brief Гистограмма задержек (в наносекундах) с лог-линейными корзинами.
+ *
+ *  Значения до SUB_BUCKETS хранятся точно, дальше каждый диапазон [2^k, 2^(k+1)) делится
+ *  на SUB_BUCKETS / 2 равных корзин, так что относительная погрешность процентилей не
+ *  превышает 2 / SUB_BUCKETS (меньше 1.6%) во всем диапазоне 64-битных значений.
+ *
+ *  Запись — несколько целочисленных операций без распределения памяти. Гистограмма не
+ *  синхронизирована: каждый поток копит свою, а для отчета они сливаются методом merge().
+ */
+class LatencyHistogram {
+public:
+    /** \brief Число корзин на первый (точный) диапазон; степень двойки. */
+    static const UInt SUB_BUCKETS = 128;
+
+    LatencyHistogram();
+
+    /** \brief Учитывает значение \c v. */
+    void record(unsigned long long v)
+    {
+        ++_counts[getIndex(v)];
+        ++_count;
+        _sum += v;
+        if (v < _min)
+            _min = v;
+        if (v > _max)
+            _max = v;
+    }
+
+    /** \brief Учитывает значение \c v \c n раз. */
+    void record(unsigned long long v, unsigned long long n);
+
+    /** \brief Добавляет значения гистограммы \c other. */
+    void merge(const LatencyHistogram& other);
+
+    /** \brief Удаляет все значения. */
+    void reset();
+
+    /** \brief Возвращает число значений. */
+    unsigned long long getCount() const { return _count; }
+
+    /** \brief Возвращает наименьшее значение (0, если значений нет). */
+    unsigned long long getMin() const { return _count ? _min : 0; }
+
+    /** \brief Возвращает наибольшее значение. */
+    unsigned long long getMax() const { return _max; }
+
+    /** \brief Возвращает среднее значение. */
+    double getMean() const { return _count ? (double) _sum / _count : 0; }
+
+    /** \brief Возвращает \c p-й процентиль (0...100): верхнюю границу корзины, в которую он
+     *  попал, но не больше getMax().
+     */
+    unsigned long long percentile(double p) const;
+
+    /** \brief Выводит сводку (число, среднее, процентили в микросекундах) одной строкой. */
+    void printText(std::ostream& os, const char* name) const;
+
+    /** \brief Выводит сводку и непустые корзины JSON-объектом. */
+    void printJson(std::ostream& os) const;
+
+    /** \brief Возвращает номер корзины значения \c v. */
+    static UInt getIndex(unsigned long long v);
+
+    /** \brief Возвращает наименьшее значение корзины \c idx. */
+    static unsigned long long getLowerBound(UInt idx);
+
+    /** \brief Возвращает наибольшее значение корзины \c idx. */
+    static unsigned long long getUpperBound(UInt idx);
+
+protected:
+    std::vector<unsigned long long> _counts;
+    unsigned long long _count;
+    unsigned long long _sum;
+    unsigned long long _min;
+    unsigned long long _max;
+}; // class LatencyHistogram
+
+
+/** \brief Замеряет время жизни объекта и учитывает его в гистограмме.
+ *
+ *  Если гистограмма не задана (nullptr), часы не опрашиваются вовсе, поэтому выключенный
+ *  замер стоит одной проверки указателя.
+ */
+class LatencyTimer {
+public:
+    LatencyTimer(LatencyHistogram* h) : _h(h)
+    {
+        if (_h)
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~LatencyTimer()
+    {
+        if (_h)
+            _h->record(getElapsed());
+    }
+
+    /** \brief Возвращает время в наносекундах с момента создания (0, если замер выключен). */
+    unsigned long long getElapsed() const
+    {
+        if (!_h)
+            return 0;
+
+        return (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+    }
+
+    /** \brief Возвращает гистограмму замера (nullptr, если замер выключен). */
+    LatencyHistogram* getHistogram() const { return _h; }
+
+    /** \brief Отменяет запись замера, например, если операция учитывается по-другому. */
+    void cancel() { _h = nullptr; }
+
+protected:
+    LatencyTimer(const LatencyTimer&);                  ///< КК не доступен.
+    LatencyTimer& operator= (LatencyTimer&);            ///< Оператор присваивания недоступен.
+
+protected:
+    LatencyHistogram* _h;
+    std::chrono::steady_clock::time_point _start;
+}; // class LatencyTimer
+
+
+} // namespace xi
+
+
+#endif // BTREE_LATENCY_HISTOGRAM_H_
@@ -12,12 +12,27 @@
 #include <iostream>
 #include <assert.h>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 
 
 //#include "int_stack.h"
 //#include "stack_machine.h"
 
 #include "btree.h"
+#include "btree_adapters.h"
+#include "btree_builder.h"
+#include "compressed_btree.h"
+#include "external_sort.h"
+#include "crc32c.h"
+#include "cache_sim.h"
+#include "tree_analyzer.h"
+#include "ycsb.h"
 
 
 using namespace std;
@@ -40,8 +55,449 @@ void stOpenFileBTree()
 
 
 
-int main()
+/** \brief Ищет ключ \c k в непрерывном образе \c image дерева \c tree (см.
+ *  BTreeBuilder::readImage()), используя страницы образа без копирования.
+ */
+bool searchImage(xi::BaseBTree& tree, xi::BaseBTree::PageWrapper& pw,
+                 std::vector<xi::Byte>& image, const xi::Byte* k)
 {
+    using namespace xi;
+
+    UInt pnum = tree.getRootPageNum();
+    while (true)
+    {
+        pw.attachData(&image[(size_t) (pnum - 1) * tree.getNodePageSize()], pnum);
+
+        UShort i = pw.lowerBound(k);
+        if (i < pw.getKeysNum() && memcmp(k, pw.getKey(i), tree.getRecSize()) == 0)
+            return true;
+
+        if (pw.isLeaf())
+            return false;
+
+        pnum = pw.getCursor(i);
+    }
+}
+
+
+/** \brief Возвращает путь к файлу \c name в каталоге \c dir. */
+string makePath(const string& dir, const char* name)
+{
+    if (dir.empty())
+        return name;
+
+    char last = dir[dir.size() - 1];
+    return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+}
+
+
+/** \brief Сравнивает время поиска в дереве, загруженном в память целиком, для раскладок
+ *  страниц: в порядке распределения при вставках, в ширину и ван Эмде Боаса.
+ *
+ *  Параметры: число ключей \c keysNum, порядок дерева \c order, число поисков \c lookups,
+ *  каталог \c outDir для рабочих файлов деревьев.
+ */
+void layoutBench(xi::UInt keysNum, xi::UShort order, xi::UInt lookups, const string& outDir)
+{
+    using namespace xi;
+    typedef OrderedKeyCodec<UInt> Codec;
+
+    BTreeLexComparator comparator;
+    std::mt19937 rnd(2017);
+
+    std::vector<UInt> keys(keysNum);
+    for (UInt i = 0; i < keysNum; ++i)
+        keys[i] = (UInt) rnd();
+
+    FileBaseBTree src(order, Codec::SIZE, &comparator, makePath(outDir, "layout_append.xibt"));
+    Byte k[Codec::SIZE];
+    for (UInt key : keys)
+    {
+        Codec::encode(k, key);
+        src.insert(k);
+    }
+
+    FileBaseBTree bfs(order, Codec::SIZE, &comparator, makePath(outDir, "layout_bfs.xibt"));
+    BTreeBuilder::exportLayout(src, bfs, BTreeBuilder::poBreadthFirst);
+    FileBaseBTree veb(order, Codec::SIZE, &comparator, makePath(outDir, "layout_veb.xibt"));
+    BTreeBuilder::exportLayout(src, veb, BTreeBuilder::poVanEmdeBoas);
+
+    // одна и та же случайная последовательность поисков для всех раскладок
+    std::vector<Byte> probes((size_t) lookups * Codec::SIZE);
+    for (UInt i = 0; i < lookups; ++i)
+        Codec::encode(&probes[(size_t) i * Codec::SIZE], keys[rnd() % keysNum]);
+
+    cout << "keys: " << keysNum << ", order: " << order << ", page: " << src.getNodePageSize()
+         << " B, pages: " << src.getLastPageNum() << ", lookups: " << lookups << endl;
+
+    FileBaseBTree* trees[] = { &src, &bfs, &veb };
+    const char* names[] = { "append", "bfs", "veb" };
+    for (int t = 0; t < 3; ++t)
+    {
+        std::vector<Byte> image;
+        BTreeBuilder::readImage(*trees[t], image);
+
+        BaseBTree::PageWrapper pw(trees[t]);
+        UInt found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (UInt i = 0; i < lookups; ++i)
+            found += searchImage(*trees[t], pw, image, &probes[(size_t) i * Codec::SIZE]);
+        auto finish = std::chrono::steady_clock::now();
+        pw.reallocData(0);
+
+        double ns = std::chrono::duration<double, std::nano>(finish - start).count() / lookups;
+        cout << "  " << names[t] << ": " << ns << " ns/lookup (found " << found << ")" << endl;
+    }
+}
+
+
+/** \brief Возвращает время выполнения \c f в наносекундах. */
+template<typename F>
+double timeNs(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(finish - start).count();
+}
+
+
+/** \brief Оценивает накладные расходы контрольных сумм страниц: скорость подсчета CRC32C
+ *  и время чтения с перезаписью \c pages страниц размером \c pageSize без сумм и с ними.
+ *  Рабочие файлы деревьев создаются в каталоге \c outDir.
+ */
+void crcBench(xi::UInt pages, xi::UInt pageSize, const string& outDir)
+{
+    using namespace xi;
+
+    std::mt19937 rnd(2017);
+    std::vector<Byte> page(pageSize);
+    for (Byte& b : page)
+        b = (Byte) rnd();
+
+    const UInt reps = 100000;
+    volatile UInt sink = 0;
+    double hwNs = timeNs([&]() { for (UInt i = 0; i < reps; ++i) sink = sink + crc32c(page.data(), pageSize, i); });
+    double swNs = timeNs([&]() { for (UInt i = 0; i < reps; ++i) sink = sink + crc32cSoftware(page.data(), pageSize, i); });
+
+    cout << "page: " << pageSize << " B, pages: " << pages << endl
+         << "  crc32c (" << (crc32cIsHardware() ? "sse4.2" : "table") << "): "
+         << hwNs / reps << " ns/page, " << pageSize * (double) reps / hwNs << " GB/s" << endl
+         << "  crc32c (table): " << swNs / reps << " ns/page, " << pageSize * (double) reps / swNs << " GB/s" << endl;
+
+    double ioNs[2];
+    for (int withCrc = 0; withCrc < 2; ++withCrc)
+    {
+        FileBaseBTree bt;
+        bt.setPageChecksums(withCrc != 0);
+        bt.createForPageSize(pageSize, 8, makePath(outDir, withCrc ? "crc_on.xibt" : "crc_off.xibt"));
+
+        BaseBTree::PageWrapper pw(&bt);
+        for (UInt p = 0; p < pages; ++p)
+            bt.allocPage(pw, (UShort) (2 * bt.getOrder() - 1), true);
+
+        // чтение с проверкой суммы и запись с ее пересчетом по всем страницам, кроме корня
+        ioNs[withCrc] = timeNs([&]()
+        {
+            for (UInt p = 2; p <= bt.getLastPageNum(); ++p)
+            {
+                pw.readPage(p);
+                pw.writePage();
+            }
+        }) / pages;
+    }
+
+    cout << "  page read+write: " << ioNs[0] << " ns without checksums, " << ioNs[1] << " ns with, overhead "
+         << (ioNs[1] - ioNs[0]) * 100.0 / ioNs[0] << "%" << endl;
+}
+
+
+/** \brief Проверяет контрольные суммы всех страниц дерева в файле \c fileName и выводит
+ *  номера поврежденных. Возвращает число поврежденных страниц.
+ */
+xi::UInt verifyFile(const std::string& fileName)
+{
+    using namespace xi;
+
+    FileBaseBTree bt(fileName, nullptr);                // для чтения страниц компаратор не нужен
+    std::vector<UInt> bad;
+    UInt badNum = bt.verifyPages(&bad);
+
+    cout << fileName << ": " << bt.getLastPageNum() << " pages, " << badNum << " corrupted" << endl;
+    for (UInt p : bad)
+        cout << "  page " << p << endl;
+
+    return badNum;
+}
+
+
+/** \brief Строит дерево порядка \c order в файле \c treeFile из неупорядоченных записей длиной
+ *  \c recSize файла \c recsFile внешней сортировкой в \c memMb МиБ памяти.
+ */
+void ingestRecords(const std::string& recsFile, const std::string& treeFile, xi::UShort recSize,
+                   xi::UShort order, size_t memMb)
+{
+    using namespace xi;
+
+    BTreeLexComparator comparator;
+    FileBaseBTree bt(order, recSize, &comparator, treeFile);
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long n = ExternalSorter::ingestFile(recsFile, bt, memMb << 20);
+    auto finish = std::chrono::steady_clock::now();
+
+    cout << treeFile << ": " << n << " records, " << bt.getLastPageNum() << " pages, "
+         << std::chrono::duration<double>(finish - start).count() << " s" << endl;
+}
+
+
+/** \brief Дефрагментирует B-дерево в файле \c fileName на месте с коэффициентом заполнения
+ *  \c fill (см. BTreeBuilder::compactFile()).
+ *
+ *  Ключи должны быть упорядочены побайтно, как их записывают ingest и адаптеры
+ *  с OrderedKeyCodec: построитель проверяет порядок и при нарушении файл не трогает.
+ */
+void compactTree(const std::string& fileName, double fill)
+{
+    using namespace xi;
+
+    BTreeLexComparator comparator;
+    FileBaseBTree plain;
+    CompressedFileBaseBTree compressed;
+    FileBaseBTree* bt = &plain;
+
+    // класс хранения страниц записан в заголовке: обычное дерево сжатый файл не примет
+    try
+    {
+        plain.open(fileName);
+    }
+    catch (std::runtime_error&)
+    {
+        compressed.open(fileName);
+        bt = &compressed;
+    }
+    bt->setComparator(&comparator);
+
+    UInt pagesBefore = bt->getLastPageNum();
+    auto start = std::chrono::steady_clock::now();
+    BTreeBuilder::compactFile(*bt, fill);
+    auto finish = std::chrono::steady_clock::now();
+
+    cout << fileName << ": " << pagesBefore << " -> " << bt->getLastPageNum() << " pages, "
+         << std::chrono::duration<double>(finish - start).count() << " s" << endl;
+}
+
+
+/** \brief Выводит отчет о форме B-дерева из файла \c fileName (см. BTreeAnalyzer),
+ *  при \c json — в виде JSON.
+ */
+void analyzeFile(const std::string& fileName, bool json)
+{
+    using namespace xi;
+
+    FileBaseBTree bt(fileName, nullptr);                // для чтения страниц компаратор не нужен
+    BTreeAnalyzer analyzer;
+    analyzer.analyze(bt);
+
+    if (json)
+    {
+        analyzer.printJson(cout);
+        cout << endl;
+        return;
+    }
+
+    cout << fileName << ": order " << bt.getOrder() << ", record " << bt.getRecSize()
+         << "B, page " << bt.getNodePageSize() << "B" << endl;
+    analyzer.printText(cout);
+}
+
+
+/** \brief Моделирует по трассе \c fileName (см. PageTracer) кэши страниц всех политик
+ *  емкостей \c capacities и выводит кривые доли промахов. Если емкости не заданы, берутся
+ *  степени двойки от 8 до первой, вмещающей все страницы трассы.
+ */
+void traceReplay(const std::string& fileName, std::vector<xi::UInt> capacities)
+{
+    using namespace xi;
+
+    PageTraceReader reader(fileName);
+    PageTraceRecord rec;
+    std::vector<UInt> refs;
+    unsigned long long writes = 0;
+    UInt ops = 0;
+    while (reader.next(rec))
+    {
+        refs.push_back(rec.pnum);
+        writes += rec.write;
+        ops = rec.opId;
+    }
+
+    std::vector<UInt> distinct(refs);
+    std::sort(distinct.begin(), distinct.end());
+    UInt pages = (UInt) (std::unique(distinct.begin(), distinct.end()) - distinct.begin());
+
+    cout << fileName << ": " << refs.size() << " references (" << writes << " writes), "
+         << ops << " operations, " << pages << " distinct pages" << endl;
+
+    if (capacities.empty())
+    {
+        for (UInt c = 8; ; c *= 2)
+        {
+            capacities.push_back(c);
+            if (c >= pages)
+                break;
+        }
+    }
+
+    std::vector<std::vector<double> > curves(CacheSimulator::POLICIES_NUM);
+    for (int p = 0; p < CacheSimulator::POLICIES_NUM; ++p)
+        CacheSimulator::calcMissRatioCurve((CacheSimulator::Policy) p, refs, capacities, curves[p]);
+
+    cout << "capacity";
+    for (int p = 0; p < CacheSimulator::POLICIES_NUM; ++p)
+        cout << "\t" << CacheSimulator::getPolicyName((CacheSimulator::Policy) p);
+    cout << endl;
+
+    for (size_t i = 0; i < capacities.size(); ++i)
+    {
+        cout << capacities[i];
+        for (int p = 0; p < CacheSimulator::POLICIES_NUM; ++p)
+            cout << "\t" << curves[p][i];
+        cout << endl;
+    }
+}
+
+
+/** \brief Прогоняет YCSB-нагрузку: \c spec — пресет (a...e) или файл свойств, \c props —
+ *  дополнительные параметры вида имя=значение (см. YcsbWorkload) и, возможно,
+ *  --json=<file> для выгрузки гистограмм задержек.
+ */
+void ycsbRun(const std::string& spec, const std::vector<std::string>& props)
+{
+    using namespace xi;
+
+    YcsbWorkload w;
+    if (spec.size() == 1)
+        w.setPreset(spec[0]);
+    else
+        w.loadFile(spec);
+
+    std::string jsonFile;
+    for (const std::string& p : props)
+    {
+        if (p.compare(0, 7, "--json=") == 0)
+            jsonFile = p.substr(7);
+        else
+            w.parse(p);
+    }
+
+    YcsbDriver driver(w);
+    driver.load();
+    driver.run();
+    driver.report(cout);
+
+    if (!jsonFile.empty())
+    {
+        std::ofstream json(jsonFile);
+        driver.reportJson(json);
+        if (!json)
+            throw std::runtime_error("Can't write " + jsonFile);
+    }
+}
+
+
+/** \brief Выводит справку по режимам запуска. */
+void printUsage()
+{
+    cout << "usage: btree_main [mode [args]]" << endl
+         << "  layout-bench [keys] [order] [lookups]   lookup latency for page layouts; tree files" << endl
+         << "       [dir]                              go to dir (current directory by default)" << endl
+         << "  crc-bench [pages] [pageSize] [dir]      page checksum overhead, tree files go to dir" << endl
+         << "  verify <file>                           check page checksums of a B-tree file" << endl
+         << "  ingest <records> <file> <recSize>       build a packed B-tree from unsorted raw records" << endl
+         << "       [order] [memMB]                    with an external merge sort" << endl
+         << "  compact <file> [fill]                   rebuild a B-tree file in place with packed nodes" << endl
+         << "  analyze <file> [--json]                 height, node fill and page locality report" << endl
+         << "  trace-replay <trace> [capacity ...]     miss-ratio curves of LRU/CLOCK/2Q/ARC for a page" << endl
+         << "                                          trace (record one with ycsb btree.trace=<trace>)" << endl
+         << "  ycsb <a-e|spec> [name=value ...]        YCSB-style workload (e.g. threadcount=4" << endl
+         << "       [--json=<file>]                    requestdistribution=uniform btree.store=adapter" << endl
+         << "                                          btree.file=<file>, ycsb.xibt by default)" << endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        string mode = argv[1];
+        try
+        {
+            if (mode == "layout-bench")
+            {
+                layoutBench(argc > 2 ? (xi::UInt) atol(argv[2]) : 1000000,
+                            argc > 3 ? (xi::UShort) atoi(argv[3]) : 8,
+                            argc > 4 ? (xi::UInt) atol(argv[4]) : 1000000,
+                            argc > 5 ? argv[5] : ".");
+                return 0;
+            }
+
+            if (mode == "crc-bench")
+            {
+                crcBench(argc > 2 ? (xi::UInt) atol(argv[2]) : 10000,
+                         argc > 3 ? (xi::UInt) atol(argv[3]) : 4096,
+                         argc > 4 ? argv[4] : ".");
+                return 0;
+            }
+
+            if (mode == "verify" && argc > 2)
+                return verifyFile(argv[2]) ? 2 : 0;
+
+            if (mode == "ingest" && argc > 4)
+            {
+                ingestRecords(argv[2], argv[3], (xi::UShort) atoi(argv[4]),
+                              argc > 5 ? (xi::UShort) atoi(argv[5]) : 32,
+                              argc > 6 ? (size_t) atol(argv[6]) : 64);
+                return 0;
+            }
+
+            if (mode == "compact" && argc > 2)
+            {
+                compactTree(argv[2], argc > 3 ? atof(argv[3]) : 1.0);
+                return 0;
+            }
+
+            if (mode == "analyze" && argc > 2)
+            {
+                analyzeFile(argv[2], argc > 3 && string(argv[3]) == "--json");
+                return 0;
+            }
+
+            if (mode == "trace-replay" && argc > 2)
+            {
+                std::vector<xi::UInt> capacities;
+                for (int i = 3; i < argc; ++i)
+                    capacities.push_back((xi::UInt) atol(argv[i]));
+                traceReplay(argv[2], capacities);
+                return 0;
+            }
+
+            if (mode == "ycsb" && argc > 2)
+            {
+                ycsbRun(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+                return 0;
+            }
+        }
+        catch (std::exception& e)
+        {
+            cerr << "error: " << e.what() << endl;
+            return 1;
+        }
+
+        printUsage();
+        return 1;
+    }
+
     stOpenFileBTree();
 
 
@@ -0,0 +1,244 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  memory_btree.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "memory_btree.h"
+
+#include <stdexcept>        // std::invalid_argument
+#include <cstring>          // memcpy
+#include <fstream>
+
+
+namespace xi
+{
+
+
+MemoryBaseBTree::MemoryBaseBTree()
+        : BaseBTree(nullptr, nullptr),
+          _chunkPages(0),
+          _open(false)
+{
+}
+
+
+MemoryBaseBTree::MemoryBaseBTree(UShort order, UShort recSize, IComparator *comparator)
+        : MemoryBaseBTree()
+{
+    setComparator(comparator);
+    create(order, recSize);
+}
+
+
+MemoryBaseBTree::MemoryBaseBTree(const std::string &fileName, IComparator *comparator)
+        : MemoryBaseBTree()
+{
+    setComparator(comparator);
+    loadSnapshot(fileName);
+}
+
+
+MemoryBaseBTree::~MemoryBaseBTree()
+{
+    close();
+}
+
+
+void MemoryBaseBTree::create(UShort order, UShort recSize)
+{
+    if (isOpen())
+        throw std::runtime_error("B-tree is already open");
+
+    if (order < 1 || recSize == 0)
+        throw std::invalid_argument("B-tree order can't be less than 1 and record siaze can't be 0");
+
+    _open = true;
+    try
+    {
+        setOrder(order, recSize);
+        initArena();
+        createTree(order, recSize);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+
+void MemoryBaseBTree::createForPageSize(UInt pageSize, UShort recSize)
+{
+    if (isOpen())
+        throw std::runtime_error("B-tree is already open");
+
+    checkPageSize(pageSize, recSize);
+
+    _open = true;
+    try
+    {
+        setOrder(calcOrderForPageSize(recSize, pageSize), recSize, pageSize);
+        initArena();
+        createAlignedTree(pageSize, recSize);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+
+void MemoryBaseBTree::loadSnapshot(const std::string &fileName)
+{
+    if (isOpen())
+        throw std::runtime_error("B-tree is already open");
+
+    std::fstream file(fileName, std::fstream::in | std::fstream::binary);
+    if (file.fail())
+        throw std::runtime_error("Can't open file for reading");
+
+    _open = true;
+    _stream = &file;
+    try
+    {
+        loadHeader();
+        initArena();
+
+        // страницы — прямо в арену
+        for (UInt p = 1; p <= getLastPageNum(); ++p)
+        {
+            gotoPage(p);
+            file.read((char *) getPageAddr(p), getNodePageSize());
+        }
+        if (file.fail())
+            throw std::runtime_error("Can't read B-tree pages. File corrupted");
+
+        _stream = nullptr;
+        loadRootPage();
+    }
+    catch (...)
+    {
+        _stream = nullptr;
+        close();
+        throw;
+    }
+}
+
+
+void MemoryBaseBTree::saveSnapshot(const std::string &fileName)
+{
+    checkForOpenStream();
+
+    std::fstream file(fileName, std::fstream::in | std::fstream::out |
+                                std::fstream::trunc | std::fstream::binary);
+    if (file.fail())
+        throw std::runtime_error("Can't open file for writing");
+
+    // поток подставляем на время записи: заголовок пишут методы базового дерева
+    _stream = &file;
+    try
+    {
+        writeHeader();
+        writePageCounter();
+        writeRootPageNum();
+
+        for (UInt p = 1; p <= getLastPageNum(); ++p)
+        {
+            gotoPage(p);
+            file.write((const char *) getPageAddr(p), getNodePageSize());
+        }
+
+        file.flush();
+        if (file.fail())
+            throw std::runtime_error("Can't write B-tree snapshot");
+    }
+    catch (...)
+    {
+        _stream = nullptr;
+        throw;
+    }
+
+    _stream = nullptr;
+}
+
+
+void MemoryBaseBTree::close()
+{
+    if (!_open)
+        return;
+
+    _rootPage.reallocData(0);       // корень может быть представлением страницы арены
+    freeArena();
+    _lastPageNum = 0;
+    _rootPageNum = 0;
+    _open = false;
+
+    resetBTree();
+}
+
+
+void MemoryBaseBTree::initArena()
+{
+    freeArena();
+
+    _chunkPages = CHUNK_SIZE / getNodePageSize();
+    if (_chunkPages == 0)
+        _chunkPages = 1;
+}
+
+
+void MemoryBaseBTree::freeArena()
+{
+    for (Byte *chunk : _chunks)
+        freeAligned(chunk);
+    _chunks.clear();
+}
+
+
+Byte *MemoryBaseBTree::getPageAddr(UInt pnum)
+{
+    UInt chunk = (pnum - 1) / _chunkPages;
+    while (chunk >= _chunks.size())
+    {
+        Byte *data = allocAligned((size_t) _chunkPages * getNodePageSize(), getPageBufAlign());
+        _chunks.push_back(data);
+    }
+
+    return _chunks[chunk] + (size_t) ((pnum - 1) % _chunkPages) * getNodePageSize();
+}
+
+
+Byte *MemoryBaseBTree::getResidentPage(UInt pnum)
+{
+    checkForOpenStream();
+    if (pnum == 0 || pnum > getLastPageNum())
+        throw std::invalid_argument("Can't read a non-existing page");
+
+    return getPageAddr(pnum);
+}
+
+
+void MemoryBaseBTree::readPageInternal(UInt pnum, Byte *dst)
+{
+    const Byte *src = getPageAddr(pnum);
+    if (src != dst)
+        memcpy(dst, src, getNodePageSize());
+}
+
+
+void MemoryBaseBTree::writePageInternal(UInt pnum, const Byte *dst)
+{
+    // страница, измененная через представление, уже на месте
+    Byte *addr = getPageAddr(pnum);
+    if (addr != dst)
+        memcpy(addr, dst, getNodePageSize());
+}
+
+
+} // namespace xi
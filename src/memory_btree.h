@@ -0,0 +1,119 @@
+﻿
+/// \file
+/// \brief     B-дерево, страницы которого хранятся в оперативной памяти
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле memory_btree.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_MEMORY_BTREE_H_
+#define BTREE_MEMORY_BTREE_H_
+
+
+#include <vector>
+
+#include "btree.h"
+
+
+namespace xi {
+
+
+/** \brief B-дерево в оперативной памяти, без потока.
+ *
+ *  Страницы хранятся в арене из блоков (чанков) по нескольку страниц; блоки никогда
+ *  не перемещаются, поэтому адрес страницы постоянен, и PageWrapper::readPage() не копирует
+ *  страницу, а только перенастраивает указатель обертки (см. BaseBTree::getResidentPage()).
+ *  Заголовок, число страниц и номер корня хранятся только в полях дерева.
+ *
+ *  Дерево можно сохранить в файл стандартного формата (saveSnapshot()), который открывается
+ *  FileBaseBTree, и загрузить обратно (loadSnapshot()).
+ */
+class MemoryBaseBTree : public BaseBTree {
+public:
+    /** \brief Примерный размер блока арены в байтах. */
+    static const UInt CHUNK_SIZE = 1 << 20;
+
+public:
+    /** \brief Конструктор по умолчанию.
+     *
+     *  Для "открытия" дерева необходимо использовать метод create(), createForPageSize()
+     *  или loadSnapshot().
+     */
+    MemoryBaseBTree();
+
+    /** \brief Создает новое пустое дерево порядка \c order с размером записи \c recSize. */
+    MemoryBaseBTree(UShort order, UShort recSize, IComparator* comparator);
+
+    /** \brief Загружает дерево из файла \c fileName (см. loadSnapshot()). */
+    MemoryBaseBTree(const std::string& fileName, IComparator* comparator);
+
+    /** \brief Деструктор. */
+    ~MemoryBaseBTree();
+
+protected:
+    MemoryBaseBTree(const MemoryBaseBTree&);                    ///< КК не доступен.
+    MemoryBaseBTree& operator= (MemoryBaseBTree&);              ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Создает новое пустое дерево. Если дерево уже открыто, кидает исключение. */
+    void create(UShort order, UShort recSize);
+
+    /** \brief Создает новое пустое дерево с выровненными страницами размером \c pageSize
+     *  (см. FileBaseBTree::createForPageSize()).
+     */
+    void createForPageSize(UInt pageSize, UShort recSize);
+
+    /** \brief Загружает дерево целиком из файла B-дерева \c fileName.
+     *
+     *  Если дерево уже открыто, файл не может быть прочитан или содержит неверную структуру,
+     *  кидает исключение.
+     */
+    void loadSnapshot(const std::string& fileName);
+
+    /** \brief Сохраняет дерево в файл \c fileName в стандартном формате B-дерева.
+     *
+     *  Если файл существует, он перезаписывается.
+     */
+    void saveSnapshot(const std::string& fileName);
+
+    /** \brief Закрывает дерево и освобождает память страниц. */
+    void close();
+
+    virtual bool isOpen() const override { return _open; }
+
+    /** \brief Страницы лежат в памяти, а не в файле. */
+    virtual bool canAccessPagesDirectly() const override { return false; }
+
+    /** \brief Возвращает объем памяти, распределенной под страницы, в байтах. */
+    size_t getArenaSize() const { return _chunks.size() * (size_t) _chunkPages * getNodePageSize(); }
+
+protected:
+    virtual void readPageInternal(UInt pnum, Byte* dst) override;
+    virtual void writePageInternal(UInt pnum, const Byte* dst) override;
+    virtual Byte* getResidentPage(UInt pnum) override;
+
+    /** \brief Возвращает адрес страницы \c pnum в арене, при необходимости распределяя блок. */
+    Byte* getPageAddr(UInt pnum);
+
+    /** \brief Подготавливает арену под текущий размер страницы. */
+    void initArena();
+
+    /** \brief Освобождает все блоки арены. */
+    void freeArena();
+
+protected:
+    std::vector<Byte*> _chunks;         ///< Блоки арены.
+    UInt _chunkPages;                   ///< Число страниц в блоке.
+    bool _open;
+}; // class MemoryBaseBTree
+
+
+} // namespace xi
+
+
+#endif // BTREE_MEMORY_BTREE_H_
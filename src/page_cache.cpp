@@ -0,0 +1,187 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  page_cache.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "page_cache.h"
+
+#include <algorithm>        // std::sort
+
+
+namespace xi
+{
+
+
+PageCache::PageCache()
+        : _capacity(0),
+          _pageSize(0),
+          _dirtyCount(0)
+{
+}
+
+
+PageCache::~PageCache()
+{
+    freeFrames();
+}
+
+
+void PageCache::reset(UInt capacity, UInt pageSize, UInt align)
+{
+    freeFrames();
+
+    _capacity = capacity;
+    _pageSize = pageSize;
+
+    if (!capacity || !pageSize)
+    {
+        _capacity = 0;
+        return;
+    }
+
+    _frames.reserve(capacity);
+    for (UInt i = 0; i < capacity; ++i)
+        _frames.push_back(allocAligned(pageSize, align));
+
+    clear();
+}
+
+
+void PageCache::clear()
+{
+    _lru.clear();
+    _index.clear();
+    _dirtyCount = 0;
+
+    _freeFrames.clear();
+    for (UInt i = (UInt)_frames.size(); i > 0; --i)
+        _freeFrames.push_back(i - 1);
+}
+
+
+Byte *PageCache::find(UInt pnum)
+{
+    auto it = _index.find(pnum);
+    if (it == _index.end())
+        return nullptr;
+
+    // делаем самой свежей
+    _lru.splice(_lru.begin(), _lru, it->second);
+
+    return _frames[it->second->frame];
+}
+
+
+Byte *PageCache::insert(UInt pnum)
+{
+    Byte *frame = find(pnum);
+    if (frame)
+        return frame;
+
+    UInt fnum;
+    if (!_freeFrames.empty())
+    {
+        fnum = _freeFrames.back();
+        _freeFrames.pop_back();
+    }
+    else
+    {
+        // вытесняем самую давнюю; грязную дерево должно было записать заранее
+        Entry &victim = _lru.back();
+        fnum = victim.frame;
+        if (victim.dirty)
+            --_dirtyCount;
+        _index.erase(victim.pnum);
+        _lru.pop_back();
+    }
+
+    Entry e = { pnum, fnum, false };
+    _lru.push_front(e);
+    _index[pnum] = _lru.begin();
+
+    return _frames[fnum];
+}
+
+
+void PageCache::invalidate(UInt pnum)
+{
+    auto it = _index.find(pnum);
+    if (it == _index.end())
+        return;
+
+    _freeFrames.push_back(it->second->frame);
+    if (it->second->dirty)
+        --_dirtyCount;
+    _lru.erase(it->second);
+    _index.erase(it);
+}
+
+
+Byte *PageCache::peek(UInt pnum) const
+{
+    auto it = _index.find(pnum);
+    return (it == _index.end()) ? nullptr : _frames[it->second->frame];
+}
+
+
+void PageCache::setDirty(UInt pnum, bool dirty)
+{
+    auto it = _index.find(pnum);
+    if (it == _index.end() || it->second->dirty == dirty)
+        return;
+
+    it->second->dirty = dirty;
+    if (dirty)
+        ++_dirtyCount;
+    else
+        --_dirtyCount;
+}
+
+
+bool PageCache::isDirty(UInt pnum) const
+{
+    auto it = _index.find(pnum);
+    return it != _index.end() && it->second->dirty;
+}
+
+
+bool PageCache::isVictimDirty() const
+{
+    return _freeFrames.empty() && !_lru.empty() && _lru.back().dirty;
+}
+
+
+void PageCache::getDirtyPages(std::vector<UInt> &pnums) const
+{
+    pnums.clear();
+    if (!_dirtyCount)
+        return;
+
+    pnums.reserve(_dirtyCount);
+    for (const Entry &e : _lru)
+        if (e.dirty)
+            pnums.push_back(e.pnum);
+
+    std::sort(pnums.begin(), pnums.end());
+}
+
+
+void PageCache::freeFrames()
+{
+    _lru.clear();
+    _index.clear();
+    _dirtyCount = 0;
+    _freeFrames.clear();
+
+    for (Byte *f : _frames)
+        freeAligned(f);
+    _frames.clear();
+}
+
+
+} // namespace xi
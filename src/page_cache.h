@@ -0,0 +1,138 @@
+﻿
+/// \file
+/// \brief     Кэш (буферный пул) страниц B-дерева
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле page_cache.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_PAGE_CACHE_H_
+#define BTREE_PAGE_CACHE_H_
+
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+#include "utils.h"
+
+
+
+namespace xi {
+
+
+/** \brief Кэш страниц фиксированной емкости с вытеснением давно не использовавшихся (LRU).
+ *
+ *  Хранит копии страниц дерева в заранее распределенных выровненных кадрах (frames) одного
+ *  размера. Кэш ничего не знает о вводе-выводе: за чтение страницы в кадр и запись изменений
+ *  на диск отвечает дерево. Для отложенной записи кэш помечает измененные (грязные) страницы;
+ *  прежде чем вытеснять грязную страницу, дерево должно ее записать (см. isVictimDirty()).
+ *
+ *  Емкость 0 означает, что кэш выключен.
+ */
+class PageCache {
+public:
+    PageCache();
+    ~PageCache();
+
+protected:
+    PageCache(const PageCache&);                        ///< КК не доступен.
+    PageCache& operator= (PageCache&);                  ///< Оператор присваивания недоступен.
+
+public:
+
+    /** \brief Перераспределяет кэш под \c capacity страниц размера \c pageSize, выровненных
+     *  по \c align. Все закэшированные страницы отбрасываются.
+     */
+    void reset(UInt capacity, UInt pageSize, UInt align);
+
+    /** \brief Отбрасывает все закэшированные страницы, сохраняя распределенные кадры. */
+    void clear();
+
+    /** \brief Возвращает истину, если кэш включен (ненулевая емкость). */
+    bool isEnabled() const { return _capacity != 0; }
+
+    /** \brief Возвращает емкость кэша в страницах. */
+    UInt getCapacity() const { return _capacity; }
+
+    /** \brief Возвращает число закэшированных страниц. */
+    UInt getSize() const { return (UInt)_index.size(); }
+
+    /** \brief Возвращает кадр со страницей \c pnum и делает ее самой свежей,
+     *  или nullptr, если страницы в кэше нет.
+     */
+    Byte* find(UInt pnum);
+
+    /** \brief Возвращает истину, если страница \c pnum в кэше. Порядок вытеснения не меняет. */
+    bool contains(UInt pnum) const { return _index.find(pnum) != _index.end(); }
+
+    /** \brief Распределяет кадр под страницу \c pnum (если ее нет в кэше, вытесняя самую
+     *  давнюю) и возвращает его. Содержимое кадра заполняет вызывающий.
+     */
+    Byte* insert(UInt pnum);
+
+    /** \brief Убирает страницу \c pnum из кэша, если она там есть (даже грязную). */
+    void invalidate(UInt pnum);
+
+    /** \brief Возвращает кадр со страницей \c pnum, не меняя порядок вытеснения,
+     *  или nullptr, если страницы в кэше нет.
+     */
+    Byte* peek(UInt pnum) const;
+
+    /** \brief Помечает закэшированную страницу \c pnum грязной (\c dirty) или чистой. */
+    void setDirty(UInt pnum, bool dirty);
+
+    /** \brief Возвращает истину, если страница \c pnum в кэше и она грязная. */
+    bool isDirty(UInt pnum) const;
+
+    /** \brief Возвращает число грязных страниц. */
+    UInt getDirtyCount() const { return _dirtyCount; }
+
+    /** \brief Возвращает истину, если вставка новой страницы вытеснит грязную. */
+    bool isVictimDirty() const;
+
+    /** \brief Заполняет \c pnums номерами грязных страниц в порядке возрастания. */
+    void getDirtyPages(std::vector<UInt>& pnums) const;
+
+protected:
+
+    /** \brief Элемент списка LRU: номер страницы и номер кадра. */
+    struct Entry {
+        UInt pnum;
+        UInt frame;
+        bool dirty;
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    /** \brief Освобождает память кадров. */
+    void freeFrames();
+
+protected:
+    UInt _capacity;                                     ///< Емкость в страницах.
+    UInt _pageSize;                                     ///< Размер кадра.
+
+    std::vector<Byte*> _frames;                         ///< Кадры.
+    std::vector<UInt> _freeFrames;                      ///< Свободные кадры.
+
+    /** \brief Закэшированные страницы, от самой свежей к самой давней. */
+    EntryList _lru;
+
+    /** \brief Индекс: номер страницы -> элемент списка LRU. */
+    std::unordered_map<UInt, EntryList::iterator> _index;
+
+    /** \brief Число грязных страниц. */
+    UInt _dirtyCount;
+
+}; // class PageCache
+
+
+} // namespace xi
+
+
+#endif // BTREE_PAGE_CACHE_H_
@@ -0,0 +1,329 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  page_codec.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "page_codec.h"
+
+#include <cstring>          // memcpy, memcmp
+
+
+namespace xi {
+
+
+namespace {
+
+typedef unsigned long long ULong;
+
+/** \brief Режимы encodeIntKeys(). */
+enum IntMode {
+    imFrame = 0,            ///< значение минус минимум
+    imDelta = 1             ///< разность с предыдущим значением
+};
+
+/** \brief Размер заголовка encodeIntKeys(): режим, число бит и опорное значение. */
+const size_t INT_HEADER_SZ = 2 + sizeof(ULong);
+
+ULong readBigEndian(const Byte* p, UShort sz)
+{
+    ULong v = 0;
+    for (UShort i = 0; i < sz; ++i)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+void writeBigEndian(Byte* p, UShort sz, ULong v)
+{
+    for (UShort i = sz; i > 0; --i)
+    {
+        p[i - 1] = (Byte) v;
+        v >>= 8;
+    }
+}
+
+Byte bitWidth(ULong v)
+{
+    Byte bits = 0;
+    for (; v; v >>= 1)
+        ++bits;
+
+    return bits;
+}
+
+
+/** \brief Минимальная длина совпадения для lzCompress(). */
+const size_t LZ_MIN_MATCH = 4;
+
+/** \brief Наибольшее расстояние ссылки назад. */
+const size_t LZ_MAX_OFFSET = 0xFFFF;
+
+/** \brief Разрядность хеша четырех байт для поиска совпадений. */
+const int LZ_HASH_BITS = 12;
+
+/** \brief Дописывает длину \c len сверх 15, уже учтенных в токене, байтами по 255. */
+bool putLength(Byte* dst, size_t cap, size_t& op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= cap)
+            return false;
+        dst[op++] = 255;
+    }
+    if (op >= cap)
+        return false;
+    dst[op++] = (Byte) len;
+
+    return true;
+}
+
+/** \brief Дочитывает длину, продолженную putLength(). */
+bool getLength(const Byte* src, size_t size, size_t& ip, size_t& len)
+{
+    Byte b;
+    do
+    {
+        if (ip >= size)
+            return false;
+        b = src[ip++];
+        len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+/** \brief Пишет последовательность: \c litLen литералов из \c lit и, если \c matchLen не 0,
+ *  ссылку на \c matchLen байт на расстоянии \c offset назад.
+ */
+bool putSequence(Byte* dst, size_t cap, size_t& op, const Byte* lit, size_t litLen,
+                 size_t offset, size_t matchLen)
+{
+    if (op >= cap)
+        return false;
+
+    size_t matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    Byte& token = dst[op++];
+    token = (Byte) (((litLen < 15 ? litLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (litLen >= 15 && !putLength(dst, cap, op, litLen - 15))
+        return false;
+    if (litLen > cap - op)
+        return false;
+    memcpy(dst + op, lit, litLen);
+    op += litLen;
+
+    if (!matchLen)
+        return true;
+
+    if (cap - op < 2)
+        return false;
+    dst[op++] = (Byte) offset;
+    dst[op++] = (Byte) (offset >> 8);
+
+    return matchCode < 15 || putLength(dst, cap, op, matchCode - 15);
+}
+
+} // namespace
+
+
+size_t encodeIntKeys(const Byte* keys, UShort num, UShort recSize, Byte* dst, size_t cap)
+{
+    if (recSize == 0 || recSize > sizeof(ULong) || cap < INT_HEADER_SZ)
+        return 0;
+
+    // ищем минимум, максимум и заодно проверяем упорядоченность
+    ULong minV = ~0ULL, maxV = 0, maxDelta = 0, prev = 0;
+    bool sorted = true;
+    for (UShort i = 0; i < num; ++i)
+    {
+        ULong v = readBigEndian(keys + (size_t) recSize * i, recSize);
+        if (v < minV)
+            minV = v;
+        if (v > maxV)
+            maxV = v;
+        if (i && v < prev)
+            sorted = false;
+        if (i && v - prev > maxDelta)
+            maxDelta = v - prev;
+        prev = v;
+    }
+    if (num == 0)
+        minV = 0;
+
+    Byte frameBits = bitWidth(maxV - minV);
+    Byte deltaBits = bitWidth(maxDelta);
+    IntMode mode = (sorted && deltaBits < frameBits) ? imDelta : imFrame;
+    Byte bits = (mode == imDelta) ? deltaBits : frameBits;
+    ULong base = (mode == imDelta && num) ? readBigEndian(keys, recSize) : minV;
+
+    // в режиме разностей первое значение — само опорное
+    size_t packed = (mode == imDelta) ? (size_t) (num ? num - 1 : 0) : num;
+    size_t size = INT_HEADER_SZ + (packed * bits + 7) / 8;
+    if (size > cap)
+        return 0;
+
+    dst[0] = (Byte) mode;
+    dst[1] = bits;
+    memcpy(dst + 2, &base, sizeof(base));
+    memset(dst + INT_HEADER_SZ, 0, size - INT_HEADER_SZ);
+
+    // упаковка младшими битами вперед
+    size_t bitPos = 0;
+    Byte* out = dst + INT_HEADER_SZ;
+    prev = base;
+    for (UShort i = (mode == imDelta) ? 1 : 0; i < num && bits; ++i)
+    {
+        ULong v = readBigEndian(keys + (size_t) recSize * i, recSize);
+        ULong code = (mode == imDelta) ? v - prev : v - minV;
+        prev = v;
+
+        for (Byte b = 0; b < bits; )
+        {
+            size_t byte = bitPos / 8, shift = bitPos % 8;
+            Byte chunk = (Byte) (8 - shift) < (Byte) (bits - b) ? (Byte) (8 - shift) : (Byte) (bits - b);
+            out[byte] |= (Byte) (((code >> b) & ((1u << chunk) - 1)) << shift);
+            b += chunk;
+            bitPos += chunk;
+        }
+    }
+
+    return size;
+}
+
+
+bool decodeIntKeys(const Byte* src, size_t size, Byte* keys, UShort num, UShort recSize)
+{
+    if (recSize == 0 || recSize > sizeof(ULong) || size < INT_HEADER_SZ)
+        return false;
+
+    IntMode mode = (IntMode) src[0];
+    Byte bits = src[1];
+    ULong base;
+    memcpy(&base, src + 2, sizeof(base));
+    if ((mode != imFrame && mode != imDelta) || bits > 64)
+        return false;
+
+    size_t packed = (mode == imDelta) ? (size_t) (num ? num - 1 : 0) : num;
+    if (size != INT_HEADER_SZ + (packed * bits + 7) / 8)
+        return false;
+
+    const Byte* in = src + INT_HEADER_SZ;
+    size_t bitPos = 0;
+    ULong prev = base;
+    for (UShort i = 0; i < num; ++i)
+    {
+        if (mode == imDelta && i == 0)
+        {
+            writeBigEndian(keys, recSize, base);
+            continue;
+        }
+
+        ULong code = 0;
+        for (Byte b = 0; b < bits; )
+        {
+            size_t byte = bitPos / 8, shift = bitPos % 8;
+            Byte chunk = (Byte) (8 - shift) < (Byte) (bits - b) ? (Byte) (8 - shift) : (Byte) (bits - b);
+            code |= (ULong) ((in[byte] >> shift) & ((1u << chunk) - 1)) << b;
+            b += chunk;
+            bitPos += chunk;
+        }
+
+        ULong v = (mode == imDelta) ? prev + code : base + code;
+        prev = v;
+        writeBigEndian(keys + (size_t) recSize * i, recSize, v);
+    }
+
+    return true;
+}
+
+
+size_t lzCompress(const Byte* src, size_t size, Byte* dst, size_t cap)
+{
+    // позиция + 1 последнего вхождения четверки байт с данным хешем, 0 — не встречалась
+    size_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    size_t ip = 0, anchor = 0, op = 0;
+    while (ip + LZ_MIN_MATCH <= size)
+    {
+        UInt seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        UInt h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = ip + 1;
+
+        if (!cand || ip - (cand - 1) > LZ_MAX_OFFSET || memcmp(src + cand - 1, src + ip, LZ_MIN_MATCH) != 0)
+        {
+            ++ip;
+            continue;
+        }
+
+        size_t ref = cand - 1;
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < size && src[ref + len] == src[ip + len])
+            ++len;
+
+        if (!putSequence(dst, cap, op, src + anchor, ip - anchor, ip - ref, len))
+            return 0;
+
+        ip += len;
+        anchor = ip;
+    }
+
+    // хвост — одними литералами
+    if (!putSequence(dst, cap, op, src + anchor, size - anchor, 0, 0))
+        return 0;
+
+    return op;
+}
+
+
+bool lzDecompress(const Byte* src, size_t size, Byte* dst, size_t dstSize)
+{
+    size_t ip = 0, op = 0;
+    while (ip < size)
+    {
+        Byte token = src[ip++];
+
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !getLength(src, size, ip, litLen))
+            return false;
+        if (litLen > size - ip || litLen > dstSize - op)
+            return false;
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        // последняя последовательность состоит из одних литералов
+        if (ip == size)
+            break;
+
+        if (size - ip < 2)
+            return false;
+        size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !getLength(src, size, ip, matchLen))
+            return false;
+        matchLen += LZ_MIN_MATCH;
+        if (matchLen > dstSize - op)
+            return false;
+
+        // ссылка может перекрываться с выводом, поэтому копируем побайтно
+        for (size_t i = 0; i < matchLen; ++i, ++op)
+            dst[op] = dst[op - offset];
+    }
+
+    return op == dstSize;
+}
+
+
+} // namespace xi
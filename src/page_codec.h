@@ -0,0 +1,57 @@
+﻿
+/// \file
+/// \brief     Кодеки сжатия страниц B-дерева
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих функций располагается в файле page_codec.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_PAGE_CODEC_H_
+#define BTREE_PAGE_CODEC_H_
+
+
+#include <cstddef>
+
+#include "utils.h"
+
+
+namespace xi {
+
+
+/** \brief Сжимает \c num записей длиной \c recSize байт (не более 8) из \c keys, считая каждую
+ *  беззнаковым целым в порядке big-endian (так их кодирует OrderedKeyCodec).
+ *
+ *  Значения кодируются относительно минимума (frame of reference) или, если записи идут по
+ *  неубыванию и так выходит плотнее, разностями соседних; результат упаковывается в
+ *  минимально необходимое число бит на значение.
+ *  Возвращает размер результата в \c dst или 0, если он не поместился в \c cap байт.
+ */
+size_t encodeIntKeys(const Byte* keys, UShort num, UShort recSize, Byte* dst, size_t cap);
+
+/** \brief Восстанавливает в \c keys \c num записей, сжатых encodeIntKeys() в \c src
+ *  длиной \c size байт. Возвращает ложь, если данные повреждены.
+ */
+bool decodeIntKeys(const Byte* src, size_t size, Byte* keys, UShort num, UShort recSize);
+
+/** \brief Сжимает \c size байт из \c src словарным методом семейства LZ77 (формат блока в
+ *  духе LZ4: литералы и ссылки назад не дальше 64 КиБ).
+ *
+ *  Возвращает размер результата в \c dst или 0, если он не поместился в \c cap байт.
+ */
+size_t lzCompress(const Byte* src, size_t size, Byte* dst, size_t cap);
+
+/** \brief Распаковывает в \c dst ровно \c dstSize байт, сжатых lzCompress() в \c src
+ *  длиной \c size байт. Возвращает ложь, если данные повреждены.
+ */
+bool lzDecompress(const Byte* src, size_t size, Byte* dst, size_t dstSize);
+
+
+} // namespace xi
+
+
+#endif // BTREE_PAGE_CODEC_H_
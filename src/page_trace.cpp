@@ -0,0 +1,155 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  page_trace.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "page_trace.h"
+
+#include <stdexcept>        // std::runtime_error
+
+
+namespace xi
+{
+
+
+PageTracer::PageTracer()
+        : _lastTime(0), _opId(0), _lastOpId(0), _records(0), _bufLen(0)
+{
+}
+
+
+PageTracer::~PageTracer()
+{
+    close();
+}
+
+
+void PageTracer::open(const std::string &fileName)
+{
+    close();
+
+    _file.open(fileName, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+    if (!_file.is_open())
+        throw std::runtime_error("Can't create trace file " + fileName);
+
+    UInt sign = FILE_SIGN;
+    UShort ver = FORMAT_VERSION;
+    UShort reserved = 0;
+    _file.write((const char*) &sign, sizeof(sign));
+    _file.write((const char*) &ver, sizeof(ver));
+    _file.write((const char*) &reserved, sizeof(reserved));
+
+    _start = std::chrono::steady_clock::now();
+    _lastTime = 0;
+    _opId = 0;
+    _lastOpId = 0;
+    _records = 0;
+}
+
+
+void PageTracer::close()
+{
+    if (_file.is_open())
+        _file.close();
+}
+
+
+void PageTracer::record(UInt pnum, bool write)
+{
+    if (!_file.is_open())
+        return;
+
+    unsigned long long now = (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+
+    _bufLen = 0;
+    putVarint(now - _lastTime);
+    putVarint(((unsigned long long) pnum << 1) | (write ? 1 : 0));
+    putVarint(_opId - _lastOpId);
+    _file.write((const char*) _buf, _bufLen);
+
+    _lastTime = now;
+    _lastOpId = _opId;
+    ++_records;
+}
+
+
+void PageTracer::putVarint(unsigned long long v)
+{
+    while (v >= 0x80)
+    {
+        _buf[_bufLen++] = (Byte) (v | 0x80);
+        v >>= 7;
+    }
+    _buf[_bufLen++] = (Byte) v;
+}
+
+
+PageTraceReader::PageTraceReader(const std::string &fileName)
+        : _time(0), _opId(0)
+{
+    _file.open(fileName, std::fstream::in | std::fstream::binary);
+    if (!_file.is_open())
+        throw std::runtime_error("Can't open trace file " + fileName);
+
+    UInt sign = 0;
+    UShort ver = 0;
+    UShort reserved = 0;
+    _file.read((char*) &sign, sizeof(sign));
+    _file.read((char*) &ver, sizeof(ver));
+    _file.read((char*) &reserved, sizeof(reserved));
+    if (!_file || sign != PageTracer::FILE_SIGN)
+        throw std::runtime_error("Not a page trace file " + fileName);
+    if (ver != PageTracer::FORMAT_VERSION)
+        throw std::runtime_error("Unsupported page trace version");
+}
+
+
+bool PageTraceReader::next(PageTraceRecord &rec)
+{
+    unsigned long long dt, page, dop;
+    if (!getVarint(dt))
+        return false;
+    if (!getVarint(page) || !getVarint(dop))
+        throw std::runtime_error("Truncated page trace record");
+
+    _time += dt;
+    _opId += (UInt) dop;
+
+    rec.time = _time;
+    rec.pnum = (UInt) (page >> 1);
+    rec.write = (page & 1) != 0;
+    rec.opId = _opId;
+
+    return true;
+}
+
+
+bool PageTraceReader::getVarint(unsigned long long &v)
+{
+    v = 0;
+    for (UInt shift = 0; shift < 64; shift += 7)
+    {
+        int c = _file.get();
+        if (c == std::char_traits<char>::eof())
+        {
+            if (shift == 0)
+                return false;
+            throw std::runtime_error("Truncated page trace record");
+        }
+
+        v |= (unsigned long long) (c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+
+    throw std::runtime_error("Corrupted page trace record");
+}
+
+
+} // namespace xi
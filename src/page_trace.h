@@ -0,0 +1,129 @@
+﻿
+/// \file
+/// \brief     Запись и чтение трассы обращений к страницам B-дерева
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле page_trace.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_PAGE_TRACE_H_
+#define BTREE_PAGE_TRACE_H_
+
+
+#include <string>
+#include <fstream>
+#include <chrono>
+
+#include "utils.h"
+
+
+
+namespace xi {
+
+
+/** \brief Одно обращение к странице в трассе. */
+struct PageTraceRecord {
+    unsigned long long time;                ///< Время от начала трассы, нс.
+    UInt pnum;                              ///< Номер страницы.
+    UInt opId;                              ///< Номер операции дерева (0 — вне операций).
+    bool write;                             ///< Истина для записи, ложь для чтения.
+}; // struct PageTraceRecord
+
+
+/** \brief Запись трассы обращений к страницам в компактный двоичный файл.
+ *
+ *  Файл начинается с сигнатуры FILE_SIGN и версии формата, за которыми идут записи
+ *  переменной длины: приращение времени, номер страницы со сдвинутым влево на 1 признаком
+ *  записи и приращение номера операции — каждое беззнаковым varint (по 7 бит в байте,
+ *  старший бит — признак продолжения). Типичная запись занимает 4–6 байт.
+ *
+ *  Номера операций раздает дереву beginOp(); обращения вне операций (например, при
+ *  открытии дерева) относятся к последней начатой.
+ */
+class PageTracer {
+public:
+    /** \brief Сигнатура файла трассы. */
+    static const UInt FILE_SIGN = 0x54504958;       // "XIPT" в little-endian
+
+    /** \brief Версия формата трассы. */
+    static const UShort FORMAT_VERSION = 1;
+
+public:
+    PageTracer();
+    ~PageTracer();
+
+protected:
+    PageTracer(const PageTracer&);                      ///< КК не доступен.
+    PageTracer& operator= (PageTracer&);                ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Создает файл трассы \c fileName (существующий перезаписывается) и начинает
+     *  отсчет времени. Если файл не удается создать, кидает std::runtime_error.
+     */
+    void open(const std::string& fileName);
+
+    /** \brief Дописывает буферизованные записи и закрывает файл. */
+    void close();
+
+    /** \brief Возвращает истину, если трасса открыта. */
+    bool isOpen() const { return _file.is_open(); }
+
+    /** \brief Начинает новую операцию и возвращает ее номер. */
+    UInt beginOp() { return ++_opId; }
+
+    /** \brief Записывает обращение к странице \c pnum: запись (\c write) или чтение. */
+    void record(UInt pnum, bool write);
+
+    /** \brief Возвращает число записанных обращений. */
+    unsigned long long getRecordsNum() const { return _records; }
+
+protected:
+    /** \brief Дописывает в буфер \c v в виде varint. */
+    void putVarint(unsigned long long v);
+
+protected:
+    std::ofstream _file;
+    std::chrono::steady_clock::time_point _start;
+    unsigned long long _lastTime;           ///< Время предыдущей записи, нс.
+    UInt _opId;                             ///< Номер текущей операции.
+    UInt _lastOpId;                         ///< Номер операции предыдущей записи.
+    unsigned long long _records;
+    Byte _buf[32];                          ///< Буфер кодирования одной записи.
+    UInt _bufLen;
+}; // class PageTracer
+
+
+/** \brief Последовательное чтение трассы, записанной PageTracer. */
+class PageTraceReader {
+public:
+    /** \brief Открывает трассу \c fileName; если файл не открывается или это не трасса,
+     *  кидает std::runtime_error.
+     */
+    PageTraceReader(const std::string& fileName);
+
+public:
+    /** \brief Читает очередное обращение в \c rec и возвращает истину; в конце трассы
+     *  возвращает ложь. Если запись обрывается, кидает std::runtime_error.
+     */
+    bool next(PageTraceRecord& rec);
+
+protected:
+    /** \brief Читает varint в \c v; возвращает ложь, если файл кончился до первого байта. */
+    bool getVarint(unsigned long long& v);
+
+protected:
+    std::ifstream _file;
+    unsigned long long _time;
+    UInt _opId;
+}; // class PageTraceReader
+
+
+} // namespace xi
+
+
+#endif // BTREE_PAGE_TRACE_H_
@@ -0,0 +1,330 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  parallel_scan.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "parallel_scan.h"
+
+#include <stdexcept>        // std::runtime_error
+#include <thread>
+#include <exception>        // std::exception_ptr
+
+
+namespace xi
+{
+
+
+//==============================================================================
+// class ParallelRangeScanner
+//==============================================================================
+
+ParallelRangeScanner::Worker::~Worker()
+{
+    // страницы ссылаются на дескриптор, поэтому удаляются раньше него
+    for (BaseBTree::PageWrapper *pw : pages)
+        delete pw;
+    delete agg;
+}
+
+
+ParallelRangeScanner::ParallelRangeScanner(BaseBTree *tree, UInt threadsNum)
+        : _tree(tree), _threadsNum(threadsNum), _taskHeight(DEFAULT_TASK_HEIGHT),
+          _from(nullptr), _to(nullptr), _ownHandles(false), _pending(0), _abort(false),
+          _tasksNum(0), _stealsNum(0)
+{
+    if (_threadsNum == 0)
+        _threadsNum = std::thread::hardware_concurrency();
+    if (_threadsNum == 0)
+        _threadsNum = 1;
+}
+
+
+void ParallelRangeScanner::scan(const Byte *from, const Byte *to, IAggregator &agg)
+{
+    if (!_tree->getComparator())
+        throw std::runtime_error("Comparator not set. Can't search");
+
+    _tasksNum = 0;
+    _stealsNum = 0;
+    if (_tree->getRootPageNum() == 0)
+        return;
+
+    _from = from;
+    _to = to;
+
+    // собственные дескрипторы читают файл в обход кэша дерева
+    _ownHandles = _tree->canAccessPagesDirectly();
+    if (_ownHandles)
+        _tree->checkpoint();
+
+    // все листья B-дерева на одной глубине: высоту дает крайний левый путь
+    UInt height = 0;
+    {
+        BaseBTree::PageWrapper pw(_tree);
+        UInt pnum = _tree->getRootPageNum();
+        while (true)
+        {
+            pw.readPage(pnum);
+            ++height;
+            if (pw.isLeaf())
+                break;
+            pnum = pw.getCursor(0);
+        }
+    }
+
+    for (UInt t = 0; t < _threadsNum; ++t)
+    {
+        _workers.push_back(new Worker);
+        _workers.back()->src = _ownHandles ? &_workers.back()->handle : _tree;
+        _workers.back()->agg = agg.clone();
+    }
+
+    Task root = { _tree->getRootPageNum(), height };
+    _workers[0]->tasks.push_back(root);
+    _pending = 1;
+    _abort = false;
+
+    try
+    {
+        runThreads(_threadsNum, [this](UInt t) { runWorker(t); });
+    }
+    catch (...)
+    {
+        clearWorkers();
+        throw;
+    }
+
+    for (Worker *w : _workers)
+    {
+        agg.merge(*w->agg);
+        _tasksNum += w->tasksNum;
+        _stealsNum += w->stealsNum;
+    }
+    clearWorkers();
+}
+
+
+template<typename F>
+void ParallelRangeScanner::runThreads(UInt n, F fn)
+{
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto body = [&](UInt t)
+    {
+        try
+        {
+            fn(t);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    try
+    {
+        // последнюю часть выполняет вызывающий поток
+        for (UInt t = 0; t + 1 < n; ++t)
+            threads.push_back(std::thread(body, t));
+        if (n)
+            body(n - 1);
+    }
+    catch (...)
+    {
+        for (std::thread &th : threads)
+            th.join();
+        throw;
+    }
+
+    for (std::thread &th : threads)
+        th.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+void ParallelRangeScanner::clearWorkers()
+{
+    for (Worker *w : _workers)
+        delete w;
+    _workers.clear();
+}
+
+
+void ParallelRangeScanner::runWorker(UInt t)
+{
+    Worker &w = *_workers[t];
+    try
+    {
+        if (_ownHandles)
+        {
+            w.handle.setComparator(_tree->getComparator());
+            w.handle.open(static_cast<FileBaseBTree *>(_tree)->getFileName());
+        }
+
+        Task task;
+        while (!_abort)
+        {
+            if (popTask(w, task) || stealTask(t, task))
+            {
+                runTask(w, task);
+                --_pending;         // задачи детей уже учтены в runTask()
+                continue;
+            }
+
+            if (_pending == 0)
+                break;
+            std::this_thread::yield();
+        }
+    }
+    catch (...)
+    {
+        _abort = true;
+        throw;
+    }
+}
+
+
+bool ParallelRangeScanner::popTask(Worker &w, Task &task)
+{
+    std::lock_guard<std::mutex> lock(w.tasksMutex);
+    if (w.tasks.empty())
+        return false;
+
+    task = w.tasks.back();
+    w.tasks.pop_back();
+    return true;
+}
+
+
+bool ParallelRangeScanner::stealTask(UInt t, Task &task)
+{
+    for (UInt k = 1; k < _threadsNum; ++k)
+    {
+        Worker &victim = *_workers[(t + k) % _threadsNum];
+        std::lock_guard<std::mutex> lock(victim.tasksMutex);
+        if (victim.tasks.empty())
+            continue;
+
+        // в голове очереди — задачи, порожденные раньше всех, т.е. самые высокие поддеревья
+        task = victim.tasks.front();
+        victim.tasks.pop_front();
+        ++_workers[t]->stealsNum;
+        return true;
+    }
+
+    return false;
+}
+
+
+void ParallelRangeScanner::runTask(Worker &w, const Task &task)
+{
+    ++w.tasksNum;
+    if (task.height <= _taskHeight)
+    {
+        scanSubtree(w, task.pnum, 0);
+        return;
+    }
+
+    BaseBTree::PageWrapper &pw = readPage(w, task.pnum, 0);
+    UShort n = pw.getKeysNum();
+
+    // сначала выставляем детей, чтобы свободные потоки забирали их, пока обрабатываются ключи узла
+    {
+        std::lock_guard<std::mutex> lock(w.tasksMutex);
+        for (UShort i = 0; i <= n; ++i)
+        {
+            if (!isChildInRange(pw, i))
+                continue;
+
+            Task child = { pw.getCursor(i), task.height - 1 };
+            w.tasks.push_back(child);
+            ++_pending;
+        }
+    }
+
+    for (UShort i = 0; i < n; ++i)
+        if (isKeyInRange(pw.getKey(i)))
+            w.agg->add(pw.getKey(i));
+}
+
+
+void ParallelRangeScanner::scanSubtree(Worker &w, UInt pnum, UInt depth)
+{
+    BaseBTree::PageWrapper &pw = readPage(w, pnum, depth);
+    UShort n = pw.getKeysNum();
+    bool leaf = pw.isLeaf();
+
+    // рабочая страница следующей глубины переиспользуется детьми, pw при этом не меняется
+    for (UShort i = 0; i <= n; ++i)
+    {
+        if (!leaf && isChildInRange(pw, i))
+            scanSubtree(w, pw.getCursor(i), depth + 1);
+
+        if (i < n && isKeyInRange(pw.getKey(i)))
+            w.agg->add(pw.getKey(i));
+    }
+}
+
+
+BaseBTree::PageWrapper &ParallelRangeScanner::readPage(Worker &w, UInt pnum, UInt depth)
+{
+    while (w.pages.size() <= depth)
+        w.pages.push_back(new BaseBTree::PageWrapper(w.src));
+
+    BaseBTree::PageWrapper &pw = *w.pages[depth];
+    if (_ownHandles)
+    {
+        pw.readPage(pnum);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(_readMutex);
+        pw.readPage(pnum);
+    }
+
+    return pw;
+}
+
+
+bool ParallelRangeScanner::isChildInRange(BaseBTree::PageWrapper &pw, UShort i) const
+{
+    // ребенок i лежит между ключами i - 1 и i узла (эквивалентные им ключи могут быть и в нем)
+    UShort n = pw.getKeysNum();
+    UShort sz = _tree->getRecSize();
+    BaseBTree::IComparator *cmp = _tree->getComparator();
+
+    if (_from && i < n && cmp->compare(pw.getKey(i), _from, sz))
+        return false;
+    if (_to && i > 0 && cmp->compare(_to, pw.getKey(i - 1), sz))
+        return false;
+
+    return true;
+}
+
+
+bool ParallelRangeScanner::isKeyInRange(const Byte *k) const
+{
+    UShort sz = _tree->getRecSize();
+    BaseBTree::IComparator *cmp = _tree->getComparator();
+
+    if (_from && cmp->compare(k, _from, sz))
+        return false;
+    if (_to && cmp->compare(_to, k, sz))
+        return false;
+
+    return true;
+}
+
+
+} // namespace xi
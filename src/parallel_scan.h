@@ -0,0 +1,264 @@
+﻿
+/// \file
+/// \brief     Параллельный просмотр диапазона ключей B-дерева с агрегацией
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле parallel_scan.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_PARALLEL_SCAN_H_
+#define BTREE_PARALLEL_SCAN_H_
+
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#include "btree.h"
+#include "btree_adapters.h"
+
+
+
+namespace xi {
+
+
+/** \brief Параллельный просмотр диапазона ключей [from, to] с агрегацией.
+ *
+ *  Диапазон делится на поддеревья по курсорам внутренних узлов: задача — поддерево;
+ *  задача над высоким поддеревом выдает ключи своего узла и порождает задачи для детей,
+ *  пересекающихся с диапазоном, а поддерево высотой не больше getTaskHeight() просматривается
+ *  целиком одним потоком. Задачи распределяются с перехватом (work stealing): поток берет
+ *  новые задачи с хвоста своей очереди, а закончив их, забирает самые старые (т.е. самые
+ *  крупные) задачи из головы чужих очередей.
+ *
+ *  Ключи передаются агрегатору потока (IAggregator::clone()), результаты потоков в конце
+ *  сливаются в агрегатор вызывающего (IAggregator::merge()); порядок выдачи ключей не определен.
+ *
+ *  Если страницы дерева лежат в файле как есть (BaseBTree::canAccessPagesDirectly()),
+ *  каждый поток открывает файл дерева собственным потоком ввода-вывода и читает страницы
+ *  независимо (грязные страницы кэша перед просмотром сбрасываются, см.
+ *  BaseBTree::checkpoint()). Прочие деревья (в памяти, со сжатием страниц
+ *  и т.д.) читаются через само дерево под блокировкой, параллельна только обработка ключей.
+ *  Во время просмотра дерево изменять нельзя; компаратор вызывается из нескольких потоков сразу.
+ */
+class ParallelRangeScanner {
+public:
+    /** \brief Агрегатор ключей диапазона. */
+    class IAggregator {
+    public:
+        /** \brief Возвращает новый пустой агрегатор того же вида (распределенный через new). */
+        virtual IAggregator* clone() const = 0;
+
+        /** \brief Учитывает запись \c rec. */
+        virtual void add(const Byte* rec) = 0;
+
+        /** \brief Добавляет к себе результат агрегатора \c other того же вида. */
+        virtual void merge(const IAggregator& other) = 0;
+
+        virtual ~IAggregator() {}
+    }; // class IAggregator
+
+    /** \brief Высота поддерева, просматриваемого одной задачей, по умолчанию. */
+    static const UInt DEFAULT_TASK_HEIGHT = 2;
+
+public:
+    /** \brief Конструктор; \c threadsNum == 0 — по числу аппаратных потоков. */
+    ParallelRangeScanner(BaseBTree* tree, UInt threadsNum = 0);
+
+protected:
+    ParallelRangeScanner(const ParallelRangeScanner&);                  ///< КК не доступен.
+    ParallelRangeScanner& operator= (ParallelRangeScanner&);            ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Передает все записи из [\c from, \c to] в агрегатор \c agg.
+     *
+     *  nullptr для \c from или \c to означает отсутствие соответствующей границы.
+     *  Если компаратор дерева не задан, кидает исключение; исключение любого из потоков
+     *  прерывает просмотр и передается вызывающему.
+     */
+    void scan(const Byte* from, const Byte* to, IAggregator& agg);
+
+    /** \brief Задает высоту поддерева \c h (не меньше 1), просматриваемого одной задачей. */
+    void setTaskHeight(UInt h) { _taskHeight = h ? h : 1; }
+
+    /** \brief Возвращает высоту поддерева, просматриваемого одной задачей. */
+    UInt getTaskHeight() const { return _taskHeight; }
+
+    /** \brief Возвращает число потоков. */
+    UInt getThreadsNum() const { return _threadsNum; }
+
+    /** \brief Возвращает число задач последнего просмотра. */
+    unsigned long long getTasksNum() const { return _tasksNum; }
+
+    /** \brief Возвращает число задач, перехваченных из чужих очередей в последнем просмотре. */
+    unsigned long long getStealsNum() const { return _stealsNum; }
+
+protected:
+    /** \brief Задача: поддерево страницы \c pnum высотой \c height. */
+    struct Task {
+        UInt pnum;
+        UInt height;
+    };
+
+    /** \brief Состояние потока. */
+    struct Worker {
+        Worker() : src(nullptr), agg(nullptr), tasksNum(0), stealsNum(0) {}
+        ~Worker();
+
+        FileBaseBTree handle;                           ///< Собственный дескриптор файла дерева.
+        BaseBTree* src;                                 ///< Откуда читаются страницы.
+        std::vector<BaseBTree::PageWrapper*> pages;     ///< Рабочие страницы по глубине.
+        std::deque<Task> tasks;
+        std::mutex tasksMutex;
+        IAggregator* agg;
+        unsigned long long tasksNum;
+        unsigned long long stealsNum;
+    };
+
+    /** \brief Выполняет fn(t) для t из [0, n) в n потоках, последнюю часть — в вызывающем. */
+    template<typename F>
+    static void runThreads(UInt n, F fn);
+
+    /** \brief Освобождает состояния потоков. */
+    void clearWorkers();
+
+    /** \brief Цикл потока \c t: свои задачи, затем перехват чужих, пока задачи не кончатся. */
+    void runWorker(UInt t);
+
+    /** \brief Берет задачу с хвоста своей очереди. */
+    bool popTask(Worker& w, Task& task);
+
+    /** \brief Забирает задачу из головы очереди другого потока. */
+    bool stealTask(UInt t, Task& task);
+
+    /** \brief Выполняет задачу \c task. */
+    void runTask(Worker& w, const Task& task);
+
+    /** \brief Просматривает поддерево страницы \c pnum целиком; \c depth — глубина от корня задачи. */
+    void scanSubtree(Worker& w, UInt pnum, UInt depth);
+
+    /** \brief Читает страницу \c pnum в рабочую страницу потока глубины \c depth. */
+    BaseBTree::PageWrapper& readPage(Worker& w, UInt pnum, UInt depth);
+
+    /** \brief Возвращает истину, если ребенок \c i узла \c pw может содержать ключи диапазона. */
+    bool isChildInRange(BaseBTree::PageWrapper& pw, UShort i) const;
+
+    /** \brief Возвращает истину, если ключ \c k лежит в диапазоне. */
+    bool isKeyInRange(const Byte* k) const;
+
+protected:
+    BaseBTree* _tree;
+    UInt _threadsNum;
+    UInt _taskHeight;
+
+    const Byte* _from;
+    const Byte* _to;
+    bool _ownHandles;                               ///< Потоки читают через собственные дескрипторы.
+    std::mutex _readMutex;                          ///< Чтение страниц через общее дерево.
+
+    std::vector<Worker*> _workers;
+    std::atomic<unsigned long long> _pending;       ///< Задачи в очередях и в работе.
+    std::atomic<bool> _abort;
+
+    unsigned long long _tasksNum;
+    unsigned long long _stealsNum;
+}; // class ParallelRangeScanner
+
+
+
+/** \brief Агрегатор, подсчитывающий записи. */
+class CountAggregator : public ParallelRangeScanner::IAggregator {
+public:
+    CountAggregator() : _count(0) {}
+
+    virtual IAggregator* clone() const override { return new CountAggregator; }
+
+    virtual void add(const Byte*) override { ++_count; }
+
+    virtual void merge(const IAggregator& other) override
+    {
+        _count += static_cast<const CountAggregator&>(other)._count;
+    }
+
+    /** \brief Возвращает число записей. */
+    unsigned long long getCount() const { return _count; }
+
+protected:
+    unsigned long long _count;
+}; // class CountAggregator
+
+
+
+/** \brief Агрегатор типизированных ключей: число, сумма, минимум и максимум.
+ *
+ *  Ключ получается из записи методом Traits::raw2keyRes(), как в BTreeAdapter; сумма
+ *  накапливается в типе \c TSum.
+ */
+template <
+    typename T,
+    typename Traits = BTreeAdapterTraits<T>,
+    typename TSum = T
+>
+class TypedAggregator : public ParallelRangeScanner::IAggregator {
+public:
+    TypedAggregator() : _count(0), _sum() {}
+
+    virtual IAggregator* clone() const override { return new TypedAggregator; }
+
+    virtual void add(const Byte* rec) override
+    {
+        T key;
+        Traits::raw2keyRes(rec, key);
+
+        if (_count == 0 || key < _min)
+            _min = key;
+        if (_count == 0 || _max < key)
+            _max = key;
+        _sum += key;
+        ++_count;
+    }
+
+    virtual void merge(const IAggregator& other) override
+    {
+        const TypedAggregator& o = static_cast<const TypedAggregator&>(other);
+        if (o._count == 0)
+            return;
+
+        if (_count == 0 || o._min < _min)
+            _min = o._min;
+        if (_count == 0 || _max < o._max)
+            _max = o._max;
+        _sum += o._sum;
+        _count += o._count;
+    }
+
+    /** \brief Возвращает число записей. */
+    unsigned long long getCount() const { return _count; }
+
+    /** \brief Возвращает сумму ключей. */
+    TSum getSum() const { return _sum; }
+
+    /** \brief Возвращает наименьший ключ (если записей нет — значение не определено). */
+    T getMin() const { return _min; }
+
+    /** \brief Возвращает наибольший ключ (если записей нет — значение не определено). */
+    T getMax() const { return _max; }
+
+protected:
+    unsigned long long _count;
+    TSum _sum;
+    T _min;
+    T _max;
+}; // class TypedAggregator
+
+
+} // namespace xi
+
+
+#endif // BTREE_PARALLEL_SCAN_H_
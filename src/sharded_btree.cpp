@@ -0,0 +1,408 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  sharded_btree.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "sharded_btree.h"
+
+#include <stdexcept>        // std::invalid_argument
+#include <algorithm>        // std::sort, std::push_heap
+#include <fstream>
+#include <cstring>          // memcpy
+
+
+namespace xi
+{
+
+
+//==============================================================================
+// class ShardedBTree
+//==============================================================================
+
+ShardedBTree::ShardedBTree()
+        : _comparator(nullptr), _part(ptHash), _recSize(0), _keySize(0)
+{
+}
+
+
+ShardedBTree::~ShardedBTree()
+{
+    close();
+}
+
+
+void ShardedBTree::create(UShort order, UShort recSize, IComparator *comparator, const std::string &fileName,
+                          UInt shardsNum, Partitioning part, const Byte *splitKeys, UShort keySize)
+{
+    if (isOpen())
+        throw std::runtime_error("Tree is already open");
+    if (!comparator)
+        throw std::invalid_argument("Comparator not set. Can't route keys");
+    if (shardsNum == 0)
+        throw std::invalid_argument("Number of shards must be positive");
+    if (keySize > recSize)
+        throw std::invalid_argument("Key size can't exceed record size");
+    if (part == ptRange && shardsNum > 1)
+    {
+        if (!splitKeys)
+            throw std::invalid_argument("Range partitioning requires split keys");
+        for (UInt i = 1; i + 1 < shardsNum; ++i)
+            if (comparator->compare(splitKeys + (size_t) i * recSize, splitKeys + (size_t) (i - 1) * recSize,
+                                    recSize))
+                throw std::invalid_argument("Split keys are not ordered");
+    }
+
+    _fileName = fileName;
+    _comparator = comparator;
+    _part = part;
+    _recSize = recSize;
+    _keySize = keySize ? keySize : recSize;
+    _splitKeys.clear();
+    if (part == ptRange && shardsNum > 1)
+        _splitKeys.assign(splitKeys, splitKeys + (size_t) (shardsNum - 1) * recSize);
+
+    std::fstream file(fileName, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+    if (!file)
+        throw std::runtime_error("Can't create sharded tree file " + fileName);
+
+    UInt sign = FILE_SIGN;
+    UShort ver = FORMAT_VERSION;
+    UShort partNum = (UShort) _part;
+    file.write((const char*) &sign, sizeof(sign));
+    file.write((const char*) &ver, sizeof(ver));
+    file.write((const char*) &partNum, sizeof(partNum));
+    file.write((const char*) &shardsNum, sizeof(shardsNum));
+    file.write((const char*) &_recSize, sizeof(_recSize));
+    file.write((const char*) &_keySize, sizeof(_keySize));
+    if (!_splitKeys.empty())
+        file.write((const char*) _splitKeys.data(), _splitKeys.size());
+    if (!file)
+        throw std::runtime_error("Can't write sharded tree file " + fileName);
+    file.close();
+
+    try
+    {
+        for (UInt i = 0; i < shardsNum; ++i)
+        {
+            _shards.push_back(new Shard);
+            _shards.back()->tree.setComparator(comparator);
+            _shards.back()->tree.create(order, recSize, getShardFileName(i));
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+
+void ShardedBTree::open(const std::string &fileName, IComparator *comparator)
+{
+    if (isOpen())
+        throw std::runtime_error("Tree is already open");
+    if (!comparator)
+        throw std::invalid_argument("Comparator not set. Can't route keys");
+
+    std::fstream file(fileName, std::fstream::in | std::fstream::binary);
+    if (!file)
+        throw std::runtime_error("Can't open sharded tree file " + fileName);
+
+    UInt sign = 0;
+    UShort ver = 0;
+    UShort partNum = 0;
+    UInt shardsNum = 0;
+    UShort recSize = 0;
+    UShort keySize = 0;
+    file.read((char*) &sign, sizeof(sign));
+    file.read((char*) &ver, sizeof(ver));
+    file.read((char*) &partNum, sizeof(partNum));
+    file.read((char*) &shardsNum, sizeof(shardsNum));
+    file.read((char*) &recSize, sizeof(recSize));
+    file.read((char*) &keySize, sizeof(keySize));
+    if (!file || sign != FILE_SIGN)
+        throw std::runtime_error("Not a sharded tree file " + fileName);
+    if (ver != FORMAT_VERSION)
+        throw std::runtime_error("Unsupported sharded tree version");
+    if (shardsNum == 0 || partNum > ptRange || keySize == 0 || keySize > recSize)
+        throw std::runtime_error("Corrupted sharded tree file " + fileName);
+
+    _splitKeys.clear();
+    if (partNum == ptRange && shardsNum > 1)
+    {
+        _splitKeys.resize((size_t) (shardsNum - 1) * recSize);
+        file.read((char*) _splitKeys.data(), _splitKeys.size());
+        if (!file)
+            throw std::runtime_error("Corrupted sharded tree file " + fileName);
+    }
+
+    _fileName = fileName;
+    _comparator = comparator;
+    _part = (Partitioning) partNum;
+    _recSize = recSize;
+    _keySize = keySize;
+
+    try
+    {
+        for (UInt i = 0; i < shardsNum; ++i)
+        {
+            _shards.push_back(new Shard);
+            _shards.back()->tree.setComparator(comparator);
+            _shards.back()->tree.open(getShardFileName(i));
+            if (_shards.back()->tree.getRecSize() != _recSize)
+                throw std::runtime_error("Shard record size doesn't match " + fileName);
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+
+void ShardedBTree::close()
+{
+    for (Shard *sh : _shards)
+        delete sh;                  // дерево закрывается деструктором
+    _shards.clear();
+}
+
+
+void ShardedBTree::insert(const Byte *k)
+{
+    checkOpen();
+
+    Shard *sh = _shards[getShardFor(k)];
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    sh->tree.insert(k);
+}
+
+
+Byte *ShardedBTree::search(const Byte *k)
+{
+    checkOpen();
+
+    Shard *sh = _shards[getShardFor(k)];
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    return sh->tree.search(k);
+}
+
+
+int ShardedBTree::searchAll(const Byte *k, std::list<Byte *> &keys)
+{
+    checkOpen();
+
+    Shard *sh = _shards[getShardFor(k)];
+    std::lock_guard<std::mutex> lock(sh->mutex);
+    return sh->tree.searchAll(k, keys);
+}
+
+
+int ShardedBTree::searchRange(const Byte *from, const Byte *to, std::list<Byte *> &keys)
+{
+    RangeCursor cur(this);
+    cur.seek(from, to);
+
+    int num = 0;
+    while (cur.next())
+    {
+        Byte *copy = new Byte[_recSize];
+        memcpy(copy, cur.getKey(), _recSize);
+        keys.push_back(copy);
+        ++num;
+    }
+
+    return num;
+}
+
+
+void ShardedBTree::setCacheSize(UInt pages)
+{
+    checkOpen();
+
+    for (Shard *sh : _shards)
+    {
+        std::lock_guard<std::mutex> lock(sh->mutex);
+        sh->tree.setCacheSize(pages);
+    }
+}
+
+
+UInt ShardedBTree::getShardFor(const Byte *k) const
+{
+    UInt n = getShardsNum();
+    if (n <= 1)
+        return 0;
+
+    if (_part == ptRange)
+    {
+        // первая граница, строго большая k: шард i хранит [граница i - 1, граница i)
+        UInt lo = 0;
+        UInt hi = n - 1;
+        while (lo < hi)
+        {
+            UInt mid = (lo + hi) / 2;
+            if (_comparator->compare(k, getSplitKey(mid), _recSize))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+
+    // FNV-1a
+    UInt h = 2166136261u;
+    for (UShort i = 0; i < _keySize; ++i)
+    {
+        h ^= k[i];
+        h *= 16777619u;
+    }
+    return h % n;
+}
+
+
+void ShardedBTree::calcSplitKeys(const Byte *sample, size_t n, UShort recSize, IComparator *comparator,
+                                 UInt shardsNum, std::vector<Byte> &splitKeys)
+{
+    if (!comparator)
+        throw std::invalid_argument("Comparator not set. Can't sort sample");
+    if (shardsNum == 0 || n < shardsNum)
+        throw std::invalid_argument("Sample is too small for the number of shards");
+
+    std::vector<const Byte*> recs(n);
+    for (size_t i = 0; i < n; ++i)
+        recs[i] = sample + i * recSize;
+    std::sort(recs.begin(), recs.end(),
+              [comparator, recSize](const Byte *a, const Byte *b) { return comparator->compare(a, b, recSize); });
+
+    splitKeys.resize((size_t) (shardsNum - 1) * recSize);
+    for (UInt i = 1; i < shardsNum; ++i)
+        memcpy(&splitKeys[(size_t) (i - 1) * recSize], recs[n * i / shardsNum], recSize);
+}
+
+
+std::string ShardedBTree::getShardFileName(UInt i) const
+{
+    return _fileName + "." + std::to_string(i);
+}
+
+
+void ShardedBTree::checkOpen() const
+{
+    if (!isOpen())
+        throw std::runtime_error("Tree is not open");
+}
+
+
+//==============================================================================
+// class ShardedBTree::RangeCursor
+//==============================================================================
+
+ShardedBTree::RangeCursor::RangeCursor(ShardedBTree *tr)
+        : _tree(tr), _cur(0), _hasCur(false)
+{
+}
+
+
+ShardedBTree::RangeCursor::~RangeCursor()
+{
+    finish();
+}
+
+
+void ShardedBTree::RangeCursor::seek(const Byte *from, const Byte *to)
+{
+    _tree->checkOpen();
+    finish();
+
+    // при разделении по диапазонам ключи [from, to] лежат в шардах [first, last]
+    UInt first = 0;
+    UInt last = _tree->getShardsNum() - 1;
+    if (_tree->_part == ptRange)
+    {
+        if (from)
+            first = _tree->getShardFor(from);
+        if (to)
+            last = _tree->getShardFor(to);
+    }
+
+    // блокируем шарды по возрастанию номеров, чтобы курсоры не взаимоблокировались
+    _cursors.assign(_tree->getShardsNum(), nullptr);
+    for (UInt i = first; i <= last; ++i)
+    {
+        _tree->_shards[i]->mutex.lock();
+        _locked.push_back(i);
+
+        _cursors[i] = new BaseBTree::RangeCursor(&_tree->_shards[i]->tree);
+        _cursors[i]->seek(from, to);
+        if (_cursors[i]->next())
+            _heap.push_back(i);
+    }
+
+    std::make_heap(_heap.begin(), _heap.end(),
+                   [this](UInt a, UInt b) { return isGreater(a, b); });
+}
+
+
+bool ShardedBTree::RangeCursor::next()
+{
+    auto greater = [this](UInt a, UInt b) { return isGreater(a, b); };
+
+    // ключ, выданный в прошлый раз, уже не нужен: продвигаем его курсор
+    if (_hasCur)
+    {
+        _hasCur = false;
+        if (_cursors[_cur]->next())
+        {
+            _heap.push_back(_cur);
+            std::push_heap(_heap.begin(), _heap.end(), greater);
+        }
+    }
+
+    if (_heap.empty())
+        return false;
+
+    std::pop_heap(_heap.begin(), _heap.end(), greater);
+    _cur = _heap.back();
+    _heap.pop_back();
+    _hasCur = true;
+
+    return true;
+}
+
+
+void ShardedBTree::RangeCursor::finish()
+{
+    for (BaseBTree::RangeCursor *c : _cursors)
+        delete c;
+    _cursors.clear();
+    _heap.clear();
+    _hasCur = false;
+
+    for (UInt i : _locked)
+        _tree->_shards[i]->mutex.unlock();
+    _locked.clear();
+}
+
+
+bool ShardedBTree::RangeCursor::isGreater(UInt a, UInt b) const
+{
+    const Byte *ka = _cursors[a]->getKey();
+    const Byte *kb = _cursors[b]->getKey();
+    UShort sz = _tree->_recSize;
+
+    if (_tree->_comparator->compare(kb, ka, sz))
+        return true;
+    if (_tree->_comparator->compare(ka, kb, sz))
+        return false;
+    return a > b;
+}
+
+
+} // namespace xi
@@ -0,0 +1,216 @@
+﻿
+/// \file
+/// \brief     B-дерево, разделенное на несколько независимых файловых деревьев
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле sharded_btree.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_SHARDED_BTREE_H_
+#define BTREE_SHARDED_BTREE_H_
+
+
+#include <vector>
+#include <list>
+#include <string>
+#include <mutex>
+
+#include "btree.h"
+
+
+
+namespace xi {
+
+
+/** \brief Разделенное (sharded) B-дерево.
+ *
+ *  Ключи распределяются между N независимыми деревьями FileBaseBTree (шардами), у каждого
+ *  из которых свой файл, свой кэш и своя блокировка, поэтому вставки в разные шарды идут
+ *  из разных потоков параллельно. Шард ключа определяется:
+ *  - при хеш-разделении — хешем первых getKeySize() байт записи по модулю N;
+ *  - при разделении по диапазонам — таблицей из N - 1 упорядоченных ключей-границ:
+ *    шард i хранит ключи k, для которых граница i - 1 <= k < граница i.
+ *
+ *  Эквивалентные ключи всегда попадают в один шард (при хеш-разделении для этого
+ *  эквивалентные записи должны совпадать в первых getKeySize() байтах), поэтому
+ *  search() и searchAll() обращаются к одному шарду. Упорядоченный просмотр
+ *  (RangeCursor) сливает курсоры шардов; при разделении по диапазонам просматриваются
+ *  только шарды, пересекающиеся с диапазоном.
+ *
+ *  Параметры разделения хранятся в файле-описателе, шарды — в файлах
+ *  <описатель>.0, <описатель>.1 и т.д. Компаратор вызывается из нескольких потоков сразу.
+ */
+class ShardedBTree {
+public:
+    typedef BaseBTree::IComparator IComparator;
+
+    /** \brief Способ разделения ключей. */
+    enum Partitioning {
+        ptHash = 0,             ///< По хешу ключа.
+        ptRange = 1             ///< По диапазонам ключей (таблица границ).
+    };
+
+    /** \brief Сигнатура файла-описателя. */
+    static const UInt FILE_SIGN = 0x48534958;       // "XISH" в little-endian
+
+    /** \brief Версия формата описателя. */
+    static const UShort FORMAT_VERSION = 1;
+
+public:
+    /** \brief Упорядоченный просмотр диапазона ключей по всем шардам.
+     *
+     *  На время просмотра (от seek() до finish() или разрушения курсора) держит блокировки
+     *  просматриваемых шардов — вставки в них ждут. Поэтому поток, владеющий курсором,
+     *  не должен вставлять ключи в то же дерево.
+     */
+    class RangeCursor {
+    public:
+        RangeCursor(ShardedBTree* tr);
+
+        ~RangeCursor();
+
+    protected:
+        RangeCursor(const RangeCursor&);                        ///< КК не доступен.
+        RangeCursor& operator= (RangeCursor&);                  ///< Оператор присваивания недоступен.
+
+    public:
+        /** \brief Устанавливает курсор перед первым ключем, не меньшим \c from, с верхней
+         *  границей \c to (включительно); nullptr — без границы (см. BaseBTree::RangeCursor).
+         */
+        void seek(const Byte* from, const Byte* to = nullptr);
+
+        /** \brief Переходит к следующему ключу; возвращает ложь, если диапазон исчерпан. */
+        bool next();
+
+        /** \brief Возвращает текущий ключ (действителен до следующего вызова next()). */
+        const Byte* getKey() const { return _cursors[_cur]->getKey(); }
+
+        /** \brief Возвращает номер шарда текущего ключа. */
+        UInt getShard() const { return _cur; }
+
+        /** \brief Завершает просмотр и снимает блокировки шардов. */
+        void finish();
+
+    protected:
+        /** \brief Возвращает истину, если текущий ключ шарда \c a больше, чем шарда \c b
+         *  (порядок кучи: наверху наименьший, равные — по номерам шардов).
+         */
+        bool isGreater(UInt a, UInt b) const;
+
+    protected:
+        ShardedBTree* _tree;
+        std::vector<BaseBTree::RangeCursor*> _cursors;  ///< Курсоры просматриваемых шардов.
+        std::vector<UInt> _locked;                      ///< Заблокированные шарды.
+        std::vector<UInt> _heap;                        ///< Шарды с невыданным текущим ключом.
+        UInt _cur;                                      ///< Шард текущего ключа.
+        bool _hasCur;
+    }; // class RangeCursor
+
+    friend class RangeCursor;
+
+public:
+    ShardedBTree();
+    ~ShardedBTree();
+
+protected:
+    ShardedBTree(const ShardedBTree&);                      ///< КК не доступен.
+    ShardedBTree& operator= (ShardedBTree&);                ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Создает дерево из \c shardsNum шардов порядка \c order с записями длиной
+     *  \c recSize с описателем \c fileName.
+     *
+     *  Для ptRange \c splitKeys — (shardsNum - 1) упорядоченных записей подряд (см.
+     *  calcSplitKeys()); для ptHash не используется. \c keySize — число первых байт записи,
+     *  по которым считается хеш (0 — вся запись). Если параметры неверны, кидает
+     *  std::invalid_argument.
+     */
+    void create(UShort order, UShort recSize, IComparator* comparator, const std::string& fileName,
+                UInt shardsNum, Partitioning part, const Byte* splitKeys = nullptr, UShort keySize = 0);
+
+    /** \brief Открывает дерево с описателем \c fileName. */
+    void open(const std::string& fileName, IComparator* comparator);
+
+    /** \brief Закрывает все шарды. */
+    void close();
+
+    /** \brief Возвращает истину, если дерево открыто. */
+    bool isOpen() const { return !_shards.empty(); }
+
+    /** \brief Вставляет запись \c k в ее шард (под блокировкой шарда). */
+    void insert(const Byte* k);
+
+    /** \brief Ищет запись, эквивалентную \c k (см. BaseBTree::search()). */
+    Byte* search(const Byte* k);
+
+    /** \brief Ищет все записи, эквивалентные \c k (см. BaseBTree::searchAll()). */
+    int searchAll(const Byte* k, std::list<Byte*>& keys);
+
+    /** \brief Добавляет в \c keys копии записей из [\c from, \c to] по возрастанию
+     *  (см. BaseBTree::searchRange()).
+     */
+    int searchRange(const Byte* from, const Byte* to, std::list<Byte*>& keys);
+
+    /** \brief Задает емкость кэша страниц каждого шарда. */
+    void setCacheSize(UInt pages);
+
+    /** \brief Возвращает номер шарда записи \c k. */
+    UInt getShardFor(const Byte* k) const;
+
+    /** \brief Возвращает число шардов. */
+    UInt getShardsNum() const { return (UInt) _shards.size(); }
+
+    /** \brief Возвращает дерево шарда \c i (для статистики и обслуживания; вставлять в него
+     *  напрямую можно только ключи этого шарда и без параллельной работы с ним).
+     */
+    FileBaseBTree& getShard(UInt i) { return _shards[i]->tree; }
+
+    /** \brief Возвращает способ разделения. */
+    Partitioning getPartitioning() const { return _part; }
+
+    /** \brief Возвращает число байт записи, по которым считается хеш. */
+    UShort getKeySize() const { return _keySize; }
+
+    /** \brief Выбирает \c shardsNum - 1 границ для разделения по диапазонам из выборки
+     *  \c n записей \c sample (подряд по \c recSize байт): квантили упорядоченной выборки.
+     *  Результат — записи подряд в \c splitKeys.
+     */
+    static void calcSplitKeys(const Byte* sample, size_t n, UShort recSize, IComparator* comparator,
+                              UInt shardsNum, std::vector<Byte>& splitKeys);
+
+protected:
+    /** \brief Шард: дерево и его блокировка. */
+    struct Shard {
+        FileBaseBTree tree;
+        std::mutex mutex;
+    };
+
+    /** \brief Возвращает имя файла шарда \c i. */
+    std::string getShardFileName(UInt i) const;
+
+    /** \brief Возвращает границу номер \c i. */
+    const Byte* getSplitKey(UInt i) const { return &_splitKeys[(size_t) i * _recSize]; }
+
+    /** \brief Проверяет, что дерево открыто. */
+    void checkOpen() const;
+
+protected:
+    std::vector<Shard*> _shards;
+    std::string _fileName;
+    IComparator* _comparator;
+    Partitioning _part;
+    UShort _recSize;
+    UShort _keySize;
+    std::vector<Byte> _splitKeys;                   ///< Границы шардов подряд (для ptRange).
+}; // class ShardedBTree
+
+
+} // namespace xi
+
+
+#endif // BTREE_SHARDED_BTREE_H_
@@ -0,0 +1,246 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  tree_analyzer.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "tree_analyzer.h"
+
+#include <stdexcept>        // std::runtime_error
+
+
+namespace xi
+{
+
+
+BTreeAnalyzer::BTreeAnalyzer()
+        : _maxKeys(0), _minKeys(0), _recSize(0), _pageSize(0), _overhead(0), _lastPageNum(0)
+{
+}
+
+
+void BTreeAnalyzer::analyze(BaseBTree &tree)
+{
+    _levels.clear();
+    _maxKeys = tree.getMaxKeys();
+    _minKeys = tree.getMinKeys();
+    _recSize = tree.getRecSize();
+    _pageSize = tree.getNodePageSize();
+    _overhead = BaseBTree::KEYS_OFS + (tree.hasPageChecksums() ? BaseBTree::PAGE_CRC_SZ : 0);
+    _lastPageNum = tree.getLastPageNum();
+
+    if (tree.getRootPageNum() == 0)
+        return;
+
+    // обход в ширину по уровням: в памяти только номера страниц текущего и следующего уровней
+    BaseBTree::PageWrapper pw(&tree);
+    std::vector<UInt> level(1, tree.getRootPageNum());
+    std::vector<UInt> next;
+    UInt visited = 0;
+    while (!level.empty())
+    {
+        // в исправном дереве каждая страница встречается не более одного раза
+        visited += (UInt) level.size();
+        if (visited > _lastPageNum)
+            throw std::runtime_error("B-tree nodes form a cycle");
+
+        _levels.push_back(Level());
+        Level& lv = _levels.back();
+        lv.nodes = 0;
+        lv.keys = 0;
+        lv.minKeys = (UShort) _maxKeys;
+        lv.maxKeys = 0;
+        lv.keysHist.assign(_maxKeys + 1, 0);
+        lv.usedBytes = 0;
+        lv.wastedBytes = 0;
+        lv.seqSiblings = 0;
+        lv.siblingGap = 0;
+
+        next.clear();
+        UInt prevPnum = 0;
+        for (UInt pnum : level)
+        {
+            pw.readPage(pnum);
+            UShort keysNum = pw.getKeysNum();
+            if (keysNum > _maxKeys)
+                throw std::runtime_error("B-tree node has too many keys");
+
+            bool isLeaf = pw.isLeaf();
+            addNode(lv, pnum, prevPnum, keysNum, isLeaf);
+            prevPnum = pnum;
+
+            if (!isLeaf)
+                for (UShort c = 0; c <= keysNum; ++c)
+                    next.push_back(pw.getCursor(c));
+        }
+
+        level.swap(next);
+    }
+}
+
+
+void BTreeAnalyzer::addNode(Level &lv, UInt pnum, UInt prevPnum, UShort keysNum, bool isLeaf)
+{
+    ++lv.nodes;
+    lv.keys += keysNum;
+    if (keysNum < lv.minKeys)
+        lv.minKeys = keysNum;
+    if (keysNum > lv.maxKeys)
+        lv.maxKeys = keysNum;
+    ++lv.keysHist[keysNum];
+
+    // у листа курсоры не используются, но место под них в странице все равно отведено
+    UInt used = _overhead + keysNum * _recSize + (isLeaf ? 0 : (keysNum + 1) * BaseBTree::CURSOR_SZ);
+    lv.usedBytes += used;
+    lv.wastedBytes += _pageSize - used;
+
+    if (prevPnum)
+    {
+        if (pnum == prevPnum + 1)
+            ++lv.seqSiblings;
+        lv.siblingGap += pnum > prevPnum ? pnum - prevPnum : prevPnum - pnum;
+    }
+}
+
+
+UInt BTreeAnalyzer::getNodesNum() const
+{
+    UInt n = 0;
+    for (const Level& lv : _levels)
+        n += lv.nodes;
+
+    return n;
+}
+
+
+unsigned long long BTreeAnalyzer::getKeysNum() const
+{
+    unsigned long long n = 0;
+    for (const Level& lv : _levels)
+        n += lv.keys;
+
+    return n;
+}
+
+
+double BTreeAnalyzer::getFillFactor(UInt level) const
+{
+    const Level& lv = _levels[level];
+    return lv.nodes ? (double) lv.keys / ((double) lv.nodes * _maxKeys) : 0.0;
+}
+
+
+double BTreeAnalyzer::getFillFactor() const
+{
+    UInt nodes = getNodesNum();
+    return nodes ? (double) getKeysNum() / ((double) nodes * _maxKeys) : 0.0;
+}
+
+
+unsigned long long BTreeAnalyzer::getWastedBytes() const
+{
+    unsigned long long n = 0;
+    for (const Level& lv : _levels)
+        n += lv.wastedBytes;
+
+    return n;
+}
+
+
+double BTreeAnalyzer::getSiblingLocality() const
+{
+    unsigned long long pairs = 0;
+    unsigned long long seq = 0;
+    for (const Level& lv : _levels)
+    {
+        pairs += lv.getSiblingPairs();
+        seq += lv.seqSiblings;
+    }
+
+    return pairs ? (double) seq / pairs : 1.0;
+}
+
+
+void BTreeAnalyzer::printText(std::ostream &os) const
+{
+    UInt nodes = getNodesNum();
+    os << "height=" << getHeight()
+       << " nodes=" << nodes
+       << " keys=" << getKeysNum()
+       << " pages=" << _lastPageNum
+       << " orphan=" << getOrphanPages() << std::endl
+       << "fill=" << getFillFactor() * 100 << "%"
+       << " wasted=" << getWastedBytes() << "B"
+       << " (" << (nodes ? getWastedBytes() * 100.0 / ((double) nodes * _pageSize) : 0.0) << "% of "
+       << (unsigned long long) nodes * _pageSize << "B)"
+       << " sequential siblings=" << getSiblingLocality() * 100 << "%" << std::endl;
+
+    for (UInt l = 0; l < getHeight(); ++l)
+    {
+        const Level& lv = _levels[l];
+        UInt pairs = lv.getSiblingPairs();
+        os << "level " << l << (l + 1 == getHeight() ? " (leaves)" : "")
+           << ": nodes=" << lv.nodes
+           << " keys=" << lv.keys
+           << " min=" << lv.minKeys
+           << " max=" << lv.maxKeys
+           << " fill=" << getFillFactor(l) * 100 << "%"
+           << " wasted=" << lv.wastedBytes << "B"
+           << " sequential=" << lv.seqSiblings << "/" << pairs
+           << " gap=" << (pairs ? (double) lv.siblingGap / pairs : 0.0) << std::endl;
+
+        // гистограмма: только встречающиеся числа ключей
+        os << "  keys/node:";
+        for (UInt k = 0; k <= _maxKeys; ++k)
+            if (lv.keysHist[k])
+                os << " " << k << "x" << lv.keysHist[k];
+        os << std::endl;
+    }
+}
+
+
+void BTreeAnalyzer::printJson(std::ostream &os) const
+{
+    os << "{\"height\": " << getHeight()
+       << ", \"nodes\": " << getNodesNum()
+       << ", \"keys\": " << getKeysNum()
+       << ", \"pages\": " << _lastPageNum
+       << ", \"orphan_pages\": " << getOrphanPages()
+       << ", \"max_keys\": " << _maxKeys
+       << ", \"page_size\": " << _pageSize
+       << ", \"fill_factor\": " << getFillFactor()
+       << ", \"wasted_bytes\": " << getWastedBytes()
+       << ", \"sibling_locality\": " << getSiblingLocality()
+       << ", \"levels\": [";
+
+    for (UInt l = 0; l < getHeight(); ++l)
+    {
+        const Level& lv = _levels[l];
+        os << (l ? ", " : "")
+           << "{\"nodes\": " << lv.nodes
+           << ", \"keys\": " << lv.keys
+           << ", \"min_keys\": " << lv.minKeys
+           << ", \"max_keys\": " << lv.maxKeys
+           << ", \"fill_factor\": " << getFillFactor(l)
+           << ", \"used_bytes\": " << lv.usedBytes
+           << ", \"wasted_bytes\": " << lv.wastedBytes
+           << ", \"sequential_siblings\": " << lv.seqSiblings
+           << ", \"sibling_pairs\": " << lv.getSiblingPairs()
+           << ", \"sibling_gap\": " << lv.siblingGap
+           << ", \"keys_hist\": [";
+
+        // гистограмма целиком: индекс — число ключей в узле
+        for (UInt k = 0; k <= _maxKeys; ++k)
+            os << (k ? ", " : "") << lv.keysHist[k];
+        os << "]}";
+    }
+
+    os << "]}";
+}
+
+
+} // namespace xi
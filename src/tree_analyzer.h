@@ -0,0 +1,126 @@
+﻿
+/// \file
+/// \brief     Анализ формы B-дерева: высота, заполнение узлов и расположение страниц
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле tree_analyzer.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_TREE_ANALYZER_H_
+#define BTREE_TREE_ANALYZER_H_
+
+
+#include <vector>
+#include <ostream>
+
+#include "btree.h"
+
+
+
+namespace xi {
+
+
+/** \brief Анализатор формы B-дерева.
+ *
+ *  Обходит дерево в ширину, уровень за уровнем, и собирает по каждому уровню (0 — корень):
+ *  число узлов и ключей, гистограмму числа ключей в узле, коэффициент заполнения, число
+ *  байт страниц, не занятых данными, и расположение соседних узлов уровня на диске.
+ *
+ *  Соседние узлы уровня (слева направо, т.е. в порядке ключей) считаются лежащими
+ *  последовательно, если страница правого следует сразу за страницей левого. Доля таких
+ *  пар показывает, насколько упорядоченный просмотр уровня сводится к последовательному
+ *  чтению файла: у дерева, построенного BTreeBuilder, она для листьев равна 1, у дерева,
+ *  наполненного вставками, обычно близка к 0.
+ *
+ *  Для чтения страниц компаратор не нужен, поэтому анализировать можно дерево,
+ *  открытое без компаратора.
+ */
+class BTreeAnalyzer {
+public:
+    /** \brief Статистика одного уровня дерева. */
+    struct Level {
+        UInt nodes;                         ///< Число узлов.
+        unsigned long long keys;            ///< Число ключей во всех узлах.
+        UShort minKeys;                     ///< Наименьшее число ключей в узле.
+        UShort maxKeys;                     ///< Наибольшее число ключей в узле.
+        std::vector<UInt> keysHist;         ///< Число узлов с i ключами (i от 0 до getMaxKeys()).
+        unsigned long long usedBytes;       ///< Байт страниц, занятых заголовками, ключами и курсорами.
+        unsigned long long wastedBytes;     ///< Байт страниц, не занятых ничем.
+        UInt seqSiblings;                   ///< Число пар соседей, лежащих последовательно.
+        unsigned long long siblingGap;      ///< Сумма |разности номеров страниц| соседей.
+
+        /** \brief Возвращает число пар соседних узлов уровня. */
+        UInt getSiblingPairs() const { return nodes ? nodes - 1 : 0; }
+    }; // struct Level
+
+public:
+    BTreeAnalyzer();
+
+public:
+    /** \brief Анализирует открытое дерево \c tree; результаты предыдущего анализа сбрасываются. */
+    void analyze(BaseBTree& tree);
+
+    /** \brief Возвращает высоту дерева (0 — пустое дерево, 1 — один корень-лист). */
+    UInt getHeight() const { return (UInt) _levels.size(); }
+
+    /** \brief Возвращает статистику уровня \c level (0 — корень, getHeight() - 1 — листья). */
+    const Level& getLevel(UInt level) const { return _levels[level]; }
+
+    /** \brief Возвращает число узлов дерева. */
+    UInt getNodesNum() const;
+
+    /** \brief Возвращает число ключей дерева. */
+    unsigned long long getKeysNum() const;
+
+    /** \brief Возвращает коэффициент заполнения уровня \c level: долю занятых мест под ключи. */
+    double getFillFactor(UInt level) const;
+
+    /** \brief Возвращает коэффициент заполнения всего дерева. */
+    double getFillFactor() const;
+
+    /** \brief Возвращает число байт страниц дерева, не занятых ничем. */
+    unsigned long long getWastedBytes() const;
+
+    /** \brief Возвращает долю пар соседних узлов всех уровней, лежащих последовательно
+     *  (1, если пар нет).
+     */
+    double getSiblingLocality() const;
+
+    /** \brief Возвращает число страниц файла, не достижимых из корня. */
+    UInt getOrphanPages() const { return _lastPageNum - getNodesNum(); }
+
+    /** \brief Возвращает максимальное число ключей в узле проанализированного дерева. */
+    UInt getMaxKeys() const { return _maxKeys; }
+
+    /** \brief Выводит отчет в текстовом виде. */
+    void printText(std::ostream& os) const;
+
+    /** \brief Выводит отчет в виде объекта JSON. */
+    void printJson(std::ostream& os) const;
+
+protected:
+    /** \brief Учитывает узел уровня \c lv с \c keysNum ключами в странице \c pnum;
+     *  \c prevPnum — страница левого соседа (0, если узел на уровне первый).
+     */
+    void addNode(Level& lv, UInt pnum, UInt prevPnum, UShort keysNum, bool isLeaf);
+
+protected:
+    std::vector<Level> _levels;
+    UInt _maxKeys;
+    UInt _minKeys;
+    UShort _recSize;
+    UInt _pageSize;                         ///< Размер страницы узла (см. BaseBTree::getNodePageSize()).
+    UInt _overhead;                         ///< Служебные байты страницы: заголовок узла, CRC.
+    UInt _lastPageNum;
+}; // class BTreeAnalyzer
+
+
+} // namespace xi
+
+
+#endif // BTREE_TREE_ANALYZER_H_
@@ -15,6 +15,14 @@
 #define BTREE_UTILS_H_
 
 
+#include <cstdlib>          // posix_memalign, free
+#include <new>              // std::bad_alloc
+
+#ifdef _WIN32
+#include <malloc.h>         // _aligned_malloc
+#endif
+
+
 // чтобы отметить метод нежелательным
 #ifdef __GNUC__
 #define DEPRECATED __attribute__((deprecated))
@@ -37,6 +45,52 @@ typedef unsigned short UShort;
 typedef unsigned int UInt;
 
 
+//==============================================================================
+// Память
+//==============================================================================
+
+/** \brief Подсказывает процессору заранее загрузить в кэш строку памяти по адресу \c p для чтения. */
+inline void prefetchRead(const void* p)
+{
+#ifdef __GNUC__
+    __builtin_prefetch(p, 0, 3);
+#else
+    (void) p;
+#endif
+}
+
+/** \brief Распределяет \c sz байт, выровненных по границе \c align (степень двойки,
+ *  кратная sizeof(void*)).
+ *
+ *  Если память распределить не удалось, кидает std::bad_alloc.
+ *  Освобождать память необходимо функцией freeAligned().
+ */
+inline Byte* allocAligned(size_t sz, size_t align)
+{
+    void* p = nullptr;
+#ifdef _WIN32
+    p = _aligned_malloc(sz, align);
+#else
+    if (posix_memalign(&p, align, sz) != 0)
+        p = nullptr;
+#endif
+    if (!p)
+        throw std::bad_alloc();
+
+    return (Byte*)p;
+}
+
+/** \brief Освобождает память, распределенную allocAligned(). */
+inline void freeAligned(Byte* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+
 
 } // namespace xi
 
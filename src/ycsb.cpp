@@ -0,0 +1,730 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+// Module Name:  ycsb.h/cpp
+// Version:      0.1.0
+//
+// This is a part of the course "Algorithms and Data Structures" 
+// provided by  the School of Software Engineering of the Faculty 
+// of Computer Science at the Higher School of Economics.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "ycsb.h"
+#include "btree.h"
+#include "btree_adapters.h"
+
+#include <stdexcept>        // std::invalid_argument
+#include <fstream>
+#include <algorithm>        // std::sort
+#include <thread>
+#include <exception>        // std::exception_ptr
+#include <mutex>
+#include <chrono>
+#include <cmath>            // pow
+#include <cstdlib>          // strtod
+#include <cstring>          // memcmp
+
+
+namespace xi
+{
+
+
+//==============================================================================
+// struct YcsbWorkload
+//==============================================================================
+
+YcsbWorkload::YcsbWorkload()
+        : recordCount(100000),
+          operationCount(100000),
+          maxExecutionTime(0),
+          threadCount(1),
+          requestDistribution(dsZipfian),
+          maxScanLength(100),
+          hashedInsertOrder(true),
+          store(stFile),
+          fileName("ycsb.xibt"),
+          order(32),
+          pageSize(0),
+          recSize(100),
+          cacheSize(0)
+{
+    setPreset('a');
+}
+
+
+void YcsbWorkload::setPreset(char w)
+{
+    for (double& p : proportions)
+        p = 0;
+    requestDistribution = dsZipfian;
+
+    switch (w)
+    {
+    case 'a': case 'A':                 // интенсивные обновления
+        proportions[opRead] = 0.5;
+        proportions[opUpdate] = 0.5;
+        break;
+    case 'b': case 'B':                 // в основном чтения
+        proportions[opRead] = 0.95;
+        proportions[opUpdate] = 0.05;
+        break;
+    case 'c': case 'C':                 // только чтения
+        proportions[opRead] = 1;
+        break;
+    case 'd': case 'D':                 // чтения свежих записей
+        proportions[opRead] = 0.95;
+        proportions[opInsert] = 0.05;
+        requestDistribution = dsLatest;
+        break;
+    case 'e': case 'E':                 // короткие диапазоны
+        proportions[opScan] = 0.95;
+        proportions[opInsert] = 0.05;
+        break;
+    default:
+        throw std::invalid_argument("Unknown workload preset");
+    }
+}
+
+
+/** \brief Разбирает неотрицательное число \c value параметра \c name. */
+static double parseNumber(const std::string& name, const std::string& value)
+{
+    char* end = nullptr;
+    double res = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || res < 0)
+        throw std::invalid_argument("Invalid value of workload property " + name);
+
+    return res;
+}
+
+
+void YcsbWorkload::set(const std::string &name, const std::string &value)
+{
+    if (name == "workload")
+    {
+        if (value.size() != 1)
+            throw std::invalid_argument("Unknown workload preset");
+        setPreset(value[0]);
+    }
+    else if (name == "recordcount")
+        recordCount = (unsigned long long) parseNumber(name, value);
+    else if (name == "operationcount")
+        operationCount = (unsigned long long) parseNumber(name, value);
+    else if (name == "maxexecutiontime")
+        maxExecutionTime = parseNumber(name, value);
+    else if (name == "threadcount")
+        threadCount = (UInt) parseNumber(name, value);
+    else if (name == "readproportion")
+        proportions[opRead] = parseNumber(name, value);
+    else if (name == "updateproportion")
+        proportions[opUpdate] = parseNumber(name, value);
+    else if (name == "insertproportion")
+        proportions[opInsert] = parseNumber(name, value);
+    else if (name == "scanproportion")
+        proportions[opScan] = parseNumber(name, value);
+    else if (name == "maxscanlength")
+        maxScanLength = (UInt) parseNumber(name, value);
+    else if (name == "requestdistribution")
+    {
+        if (value == "uniform")
+            requestDistribution = dsUniform;
+        else if (value == "zipfian")
+            requestDistribution = dsZipfian;
+        else if (value == "latest")
+            requestDistribution = dsLatest;
+        else
+            throw std::invalid_argument("Unknown request distribution " + value);
+    }
+    else if (name == "insertorder")
+    {
+        if (value != "hashed" && value != "ordered")
+            throw std::invalid_argument("Unknown insert order " + value);
+        hashedInsertOrder = (value == "hashed");
+    }
+    else if (name == "btree.store")
+    {
+        if (value != "file" && value != "adapter")
+            throw std::invalid_argument("Unknown B-tree store " + value);
+        store = (value == "file") ? stFile : stAdapter;
+    }
+    else if (name == "btree.file")
+        fileName = value;
+    else if (name == "btree.order")
+        order = (UShort) parseNumber(name, value);
+    else if (name == "btree.pagesize")
+        pageSize = (UInt) parseNumber(name, value);
+    else if (name == "btree.recsize")
+        recSize = (UShort) parseNumber(name, value);
+    else if (name == "btree.cache")
+        cacheSize = (UInt) parseNumber(name, value);
+    else if (name == "btree.trace")
+        traceFile = value;
+    else
+        throw std::invalid_argument("Unknown workload property " + name);
+}
+
+
+void YcsbWorkload::parse(const std::string &prop)
+{
+    size_t eq = prop.find('=');
+    if (eq == std::string::npos)
+        throw std::invalid_argument("Workload property must look like name=value: " + prop);
+
+    set(prop.substr(0, eq), prop.substr(eq + 1));
+}
+
+
+void YcsbWorkload::loadFile(const std::string &fileName)
+{
+    std::ifstream f(fileName);
+    if (!f)
+        throw std::runtime_error("Can't open workload file " + fileName);
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        // без пробелов по краям и концов строк в стиле Windows
+        size_t b = line.find_first_not_of(" \t\r");
+        size_t e = line.find_last_not_of(" \t\r");
+        if (b == std::string::npos || line[b] == '#')
+            continue;
+
+        parse(line.substr(b, e - b + 1));
+    }
+}
+
+
+void YcsbWorkload::validate() const
+{
+    double total = 0;
+    for (double p : proportions)
+        total += p;
+
+    if (total <= 0)
+        throw std::invalid_argument("Workload has no operations");
+    if (recordCount == 0 && (proportions[opRead] > 0 || proportions[opUpdate] > 0 || proportions[opScan] > 0))
+        throw std::invalid_argument("Workload reads an empty tree");
+    if (operationCount == 0 && maxExecutionTime <= 0)
+        throw std::invalid_argument("Either operationcount or maxexecutiontime must be set");
+    if (threadCount == 0)
+        throw std::invalid_argument("Thread count can't be 0");
+    if (store == stFile && recSize < KEY_SIZE)
+        throw std::invalid_argument("Record can't be shorter than the key");
+}
+
+
+const char* YcsbWorkload::getOpName(Operation op)
+{
+    static const char* names[OPS_NUM] = { "READ", "UPDATE", "INSERT", "SCAN" };
+    return names[op];
+}
+
+
+//==============================================================================
+// class ZipfianGenerator
+//==============================================================================
+
+const double ZipfianGenerator::ZIPFIAN_CONSTANT = 0.99;
+
+
+ZipfianGenerator::ZipfianGenerator(unsigned long long n, double theta /*= ZIPFIAN_CONSTANT*/)
+        : _n(n ? n : 1),
+          _theta(theta),
+          _zetan(0),
+          _uniform(0.0, 1.0)
+{
+    for (unsigned long long i = 1; i <= _n; ++i)
+        _zetan += 1.0 / pow((double) i, _theta);
+
+    double zeta2 = 1.0 + 1.0 / pow(2.0, _theta);
+    _alpha = 1.0 / (1.0 - _theta);
+    _eta = (1.0 - pow(2.0 / _n, 1.0 - _theta)) / (1.0 - zeta2 / _zetan);
+}
+
+
+unsigned long long ZipfianGenerator::next(std::mt19937_64 &rng)
+{
+    double u = _uniform(rng);
+    double uz = u * _zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, _theta))
+        return 1;
+
+    unsigned long long res = (unsigned long long) (_n * pow(_eta * u - _eta + 1.0, _alpha));
+    return res < _n ? res : _n - 1;
+}
+
+
+//==============================================================================
+// class YcsbDriver::Store
+//==============================================================================
+
+typedef OrderedKeyCodec<unsigned long long> YcsbKeyCodec;
+
+
+/** \brief Сравнивает записи stFile только по ключу (данные записи в сравнении не участвуют). */
+struct YcsbKeyComparator : public BaseBTree::IComparator {
+
+    virtual bool compare(const Byte* lhv, const Byte* rhv, UInt) override
+    {
+        return memcmp(lhv, rhv, YcsbWorkload::KEY_SIZE) < 0;
+    }
+
+    virtual bool isEqual(const Byte* lhv, const Byte* rhv, UInt) override
+    {
+        return memcmp(lhv, rhv, YcsbWorkload::KEY_SIZE) == 0;
+    }
+}; // struct YcsbKeyComparator
+
+
+/** \brief Дерево, над которым идет нагрузка: FileBaseBTree либо BTreeAdapter. */
+class YcsbDriver::Store {
+public:
+    Store() : _pw(nullptr) {}
+    virtual ~Store() { delete _pw; }
+
+    /** \brief Вставляет запись с ключом \c key. */
+    virtual void insert(unsigned long long key) = 0;
+
+    /** \brief Читает запись с ключом \c key; возвращает ложь, если ее нет. */
+    virtual bool read(unsigned long long key) = 0;
+
+    /** \brief Обновляет данные записи с ключом \c key; возвращает ложь, если ее нет. */
+    virtual bool update(unsigned long long key) = 0;
+
+    /** \brief Читает до \c len записей, начиная с ключа \c key; возвращает число прочитанных. */
+    virtual UInt scan(unsigned long long key, UInt len)
+    {
+        Byte raw[YcsbKeyCodec::SIZE];
+        YcsbKeyCodec::encode(raw, key);
+
+        BaseBTree::RangeCursor cur(&getTree());
+        cur.seek(getSeekRec(raw));
+
+        UInt n = 0;
+        while (n < len && cur.next())
+            ++n;
+
+        return n;
+    }
+
+    /** \brief Возвращает подлежащее дерево. */
+    virtual FileBaseBTree& getTree() = 0;
+
+protected:
+    /** \brief Возвращает запись для поиска по коду ключа \c raw. */
+    virtual const Byte* getSeekRec(const Byte* raw) = 0;
+
+    /** \brief Находит первую запись, эквивалентную \c rec, и переписывает ее на месте записью
+     *  \c rec (удаления у дерева нет, а ключ при обновлении не меняется). Возвращает ложь,
+     *  если записи нет.
+     */
+    bool rewrite(const Byte* rec)
+    {
+        FileBaseBTree& tree = getTree();
+        if (!_pw)
+            _pw = new BaseBTree::PageWrapper(&tree);
+
+        UInt pnum = tree.getRootPageNum();
+        while (true)
+        {
+            // корень дерево держит в памяти: меняем его собственную копию
+            BaseBTree::PageWrapper& pw = (pnum == tree.getRootPageNum()) ? tree.getRootPage() : *_pw;
+            if (&pw == _pw)
+                pw.readPage(pnum);
+
+            UShort i = pw.lowerBound(rec);
+            if (i < pw.getKeysNum() && tree.getComparator()->isEqual(rec, pw.getKey(i), tree.getRecSize()))
+            {
+                memcpy(pw.getKey(i), rec, tree.getRecSize());
+                pw.writePage();
+                return true;
+            }
+
+            if (pw.isLeaf())
+                return false;
+
+            pnum = pw.getCursor(i);
+        }
+    }
+
+protected:
+    BaseBTree::PageWrapper* _pw;                ///< Рабочая страница rewrite().
+}; // class YcsbDriver::Store
+
+
+/** \brief FileBaseBTree с записями из ключа и данных, сравниваемыми по ключу. */
+class YcsbFileStore : public YcsbDriver::Store {
+public:
+    YcsbFileStore(const YcsbWorkload& w)
+        : _rec(w.recSize), _version(0)
+    {
+        _tree.setCacheSize(w.cacheSize);
+        _tree.setComparator(&_comparator);
+        if (w.pageSize)
+            _tree.createForPageSize(w.pageSize, w.recSize, w.fileName);
+        else
+            _tree.create(w.order, w.recSize, w.fileName);
+    }
+
+    virtual void insert(unsigned long long key) override
+    {
+        _tree.insert(makeRec(key));
+    }
+
+    virtual bool read(unsigned long long key) override
+    {
+        Byte* res = _tree.search(makeRec(key));
+        delete[] res;
+        return res != nullptr;
+    }
+
+    virtual bool update(unsigned long long key) override
+    {
+        ++_version;
+        return rewrite(makeRec(key));
+    }
+
+    virtual FileBaseBTree& getTree() override { return _tree; }
+
+protected:
+    virtual const Byte* getSeekRec(const Byte* raw) override
+    {
+        memcpy(_rec.data(), raw, YcsbWorkload::KEY_SIZE);
+        return _rec.data();
+    }
+
+    /** \brief Заполняет запись с ключом \c key: данные зависят от ключа и номера обновления. */
+    Byte* makeRec(unsigned long long key)
+    {
+        YcsbKeyCodec::encode(_rec.data(), key);
+        for (size_t i = YcsbWorkload::KEY_SIZE; i < _rec.size(); ++i)
+            _rec[i] = (Byte) (key + i + _version);
+
+        return _rec.data();
+    }
+
+protected:
+    FileBaseBTree _tree;
+    YcsbKeyComparator _comparator;
+    std::vector<Byte> _rec;
+    Byte _version;
+}; // class YcsbFileStore
+
+
+/** \brief BTreeAdapter над 64-битными ключами (записи — только ключи). */
+class YcsbAdapterStore : public YcsbDriver::Store {
+public:
+    typedef BTreeAdapter<unsigned long long, BTreeOrderedTraits<unsigned long long>,
+                         BTreeLexComparator> Adapter;
+
+    YcsbAdapterStore(const YcsbWorkload& w)
+    {
+        _bt.getTree().setCacheSize(w.cacheSize);
+        if (w.pageSize)
+            _bt.createForPageSize(w.pageSize, w.fileName);
+        else
+            _bt.create(w.order, w.fileName);
+    }
+
+    virtual void insert(unsigned long long key) override
+    {
+        _bt.insert(key);
+    }
+
+    virtual bool read(unsigned long long key) override
+    {
+        unsigned long long res;
+        return _bt.search(key, res);
+    }
+
+    virtual bool update(unsigned long long key) override
+    {
+        // данных у записи нет: обновление переписывает тот же ключ
+        Byte raw[YcsbKeyCodec::SIZE];
+        YcsbKeyCodec::encode(raw, key);
+        return rewrite(raw);
+    }
+
+    virtual FileBaseBTree& getTree() override { return _bt.getTree(); }
+
+protected:
+    virtual const Byte* getSeekRec(const Byte* raw) override { return raw; }
+
+protected:
+    Adapter _bt;
+}; // class YcsbAdapterStore
+
+
+//==============================================================================
+// class YcsbDriver
+//==============================================================================
+
+/** \brief Возвращает время от \c start до текущего момента в секундах. */
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+YcsbDriver::YcsbDriver(const YcsbWorkload &w)
+        : _w(w),
+          _store(nullptr),
+          _nextId(0),
+          _inserted(0),
+          _opsLeft(0),
+          _loadTime(0),
+          _runTime(0)
+{
+    _w.validate();
+}
+
+
+YcsbDriver::~YcsbDriver()
+{
+    delete _store;
+}
+
+
+/** \brief Хеш FNV-1a по байтам числа \c v, как в YCSB. */
+static unsigned long long fnvHash64(unsigned long long v)
+{
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; ++i)
+    {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+
+unsigned long long YcsbDriver::makeKey(unsigned long long id) const
+{
+    // хеш разбрасывает соседние номера по пространству ключей
+    return _w.hashedInsertOrder ? fnvHash64(id) : id;
+}
+
+
+void YcsbDriver::load()
+{
+    delete _store;
+    _store = nullptr;
+    if (_w.store == YcsbWorkload::stFile)
+        _store = new YcsbFileStore(_w);
+    else
+        _store = new YcsbAdapterStore(_w);
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long long id = 0; id < _w.recordCount; ++id)
+        _store->insert(makeKey(id));
+    _loadTime = secondsSince(start);
+
+    _nextId = _w.recordCount;
+    _inserted = _w.recordCount;
+}
+
+
+unsigned long long YcsbDriver::nextKeyId(std::mt19937_64 &rng, ZipfianGenerator &zipf)
+{
+    unsigned long long n = _inserted.load();
+    switch (_w.requestDistribution)
+    {
+    case YcsbWorkload::dsUniform:
+        return std::uniform_int_distribution<unsigned long long>(0, n - 1)(rng);
+
+    case YcsbWorkload::dsLatest:
+        // самый популярный — последний вставленный
+        return n - 1 - zipf.next(rng) % n;
+
+    default:
+        // популярность рангов Зипфа разбрасываем хешем, чтобы горячие ключи не шли подряд
+        return fnvHash64(zipf.next(rng)) % n;
+    }
+}
+
+
+void YcsbDriver::run()
+{
+    if (!_store)
+        throw std::runtime_error("Workload is not loaded");
+
+    _opsLeft = _w.operationCount ? _w.operationCount : ~0ULL;
+    ZipfianGenerator zipf(_w.recordCount ? _w.recordCount : 1);
+
+    std::vector<YcsbOpStats> stats((size_t) _w.threadCount * YcsbWorkload::OPS_NUM);
+    std::vector<std::thread> clients;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    // трасса пишется только для прогона: загрузка — отдельная, заранее известная нагрузка
+    PageTracer tracer;
+    if (!_w.traceFile.empty())
+    {
+        tracer.open(_w.traceFile);
+        _store->getTree().setPageTracer(&tracer);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (UInt t = 0; t < _w.threadCount; ++t)
+        clients.push_back(std::thread([&, t]()
+        {
+            try
+            {
+                runClient(t, zipf, &stats[(size_t) t * YcsbWorkload::OPS_NUM]);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                error = std::current_exception();
+                _opsLeft = 0;               // останавливаем остальных
+            }
+        }));
+    for (std::thread& c : clients)
+        c.join();
+    _runTime = secondsSince(start);
+    _store->getTree().setPageTracer(nullptr);
+
+    if (error)
+        std::rethrow_exception(error);
+
+    for (int op = 0; op < YcsbWorkload::OPS_NUM; ++op)
+    {
+        _stats[op] = YcsbOpStats();
+        for (UInt t = 0; t < _w.threadCount; ++t)
+            _stats[op].merge(stats[(size_t) t * YcsbWorkload::OPS_NUM + op]);
+    }
+}
+
+
+void YcsbDriver::runClient(UInt tnum, ZipfianGenerator zipf, YcsbOpStats *stats)
+{
+    std::mt19937_64 rng(2017 + tnum);
+
+    double total = 0;
+    for (double p : _w.proportions)
+        total += p;
+    std::uniform_real_distribution<double> opDist(0, total);
+    std::uniform_int_distribution<UInt> scanDist(1, _w.maxScanLength ? _w.maxScanLength : 1);
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long long done = 0; ; ++done)
+    {
+        // время проверяем до того, как занять операцию из лимита: иначе остановившийся
+        // клиент унес бы из общего лимита операцию, которую так и не выполнил
+        if (_w.maxExecutionTime > 0 && (done & 63) == 0 && secondsSince(start) >= _w.maxExecutionTime)
+            return;
+
+        // лимит операций общий для всех потоков
+        unsigned long long left = _opsLeft.load();
+        do
+        {
+            if (left == 0)
+                return;
+        } while (!_opsLeft.compare_exchange_weak(left, left - 1));
+
+        // выбираем операцию по долям
+        double r = opDist(rng);
+        int op = 0;
+        while (op < YcsbWorkload::OPS_NUM - 1 && r >= _w.proportions[op])
+            r -= _w.proportions[op++];
+
+        // ключ выбираем до начала замера
+        unsigned long long key = 0;
+        UInt scanLen = 0;
+        if (op == YcsbWorkload::opInsert)
+            key = makeKey(_nextId++);
+        else
+            key = makeKey(nextKeyId(rng, zipf));
+        if (op == YcsbWorkload::opScan)
+            scanLen = scanDist(rng);
+
+        auto opStart = std::chrono::steady_clock::now();
+        bool ok = true;
+        {
+            std::lock_guard<std::mutex> lock(_treeMutex);
+            switch (op)
+            {
+            case YcsbWorkload::opRead:
+                ok = _store->read(key);
+                break;
+            case YcsbWorkload::opUpdate:
+                ok = _store->update(key);
+                break;
+            case YcsbWorkload::opInsert:
+                _store->insert(key);
+                ++_inserted;
+                break;
+            default:
+                _store->scan(key, scanLen);
+                break;
+            }
+        }
+        auto opFinish = std::chrono::steady_clock::now();
+
+        YcsbOpStats& s = stats[op];
+        s.latencies.record((unsigned long long)
+                std::chrono::duration_cast<std::chrono::nanoseconds>(opFinish - opStart).count());
+        if (!ok)
+            ++s.failed;
+    }
+}
+
+
+unsigned long long YcsbDriver::getRunOps() const
+{
+    unsigned long long n = 0;
+    for (const YcsbOpStats& s : _stats)
+        n += s.getCount();
+
+    return n;
+}
+
+
+void YcsbDriver::report(std::ostream &os) const
+{
+    os << "[LOAD], RunTime(ms), " << _loadTime * 1000 << std::endl
+       << "[LOAD], Throughput(ops/sec), " << (_loadTime > 0 ? _w.recordCount / _loadTime : 0) << std::endl
+       << "[OVERALL], RunTime(ms), " << _runTime * 1000 << std::endl
+       << "[OVERALL], Throughput(ops/sec), " << (_runTime > 0 ? getRunOps() / _runTime : 0) << std::endl;
+
+    for (int op = 0; op < YcsbWorkload::OPS_NUM; ++op)
+    {
+        const YcsbOpStats& s = _stats[op];
+        if (!s.getCount())
+            continue;
+
+        std::string tag = std::string("[") + YcsbWorkload::getOpName((YcsbWorkload::Operation) op) + "], ";
+        os << tag << "Operations, " << s.getCount() << std::endl
+           << tag << "AverageLatency(us), " << s.average() / 1000 << std::endl
+           << tag << "MinLatency(us), " << s.latencies.getMin() / 1000.0 << std::endl
+           << tag << "MaxLatency(us), " << s.latencies.getMax() / 1000.0 << std::endl
+           << tag << "50thPercentileLatency(us), " << s.percentile(50) / 1000.0 << std::endl
+           << tag << "95thPercentileLatency(us), " << s.percentile(95) / 1000.0 << std::endl
+           << tag << "99thPercentileLatency(us), " << s.percentile(99) / 1000.0 << std::endl
+           << tag << "99.9thPercentileLatency(us), " << s.percentile(99.9) / 1000.0 << std::endl
+           << tag << "NotFound, " << s.failed << std::endl;
+    }
+}
+
+
+void YcsbDriver::reportJson(std::ostream &os) const
+{
+    os << "{";
+    bool first = true;
+    for (int op = 0; op < YcsbWorkload::OPS_NUM; ++op)
+    {
+        if (!_stats[op].getCount())
+            continue;
+
+        os << (first ? "" : ", ") << "\"" << YcsbWorkload::getOpName((YcsbWorkload::Operation) op) << "\": ";
+        _stats[op].latencies.printJson(os);
+        first = false;
+    }
+    os << "}" << std::endl;
+}
+
+
+} // namespace xi
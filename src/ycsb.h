@@ -0,0 +1,235 @@
+﻿
+/// \file
+/// \brief     Генератор нагрузки в духе YCSB для B-деревьев
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Реализация соответствующих методов располагается в файле ycsb.cpp.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BTREE_YCSB_H_
+#define BTREE_YCSB_H_
+
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <random>
+#include <atomic>
+#include <mutex>
+
+#include "utils.h"
+#include "latency_histogram.h"
+
+
+namespace xi {
+
+
+/** \brief Описание нагрузки: смесь операций, распределение ключей и параметры дерева.
+ *
+ *  Имена параметров совпадают с core workload YCSB (recordcount, operationcount,
+ *  readproportion и т.д.); параметры дерева имеют префикс \c btree. Задаются
+ *  пресетом (workload A–E), файлом свойств вида \c имя=значение и отдельными парами.
+ */
+struct YcsbWorkload {
+
+    /** \brief Распределение ключей запросов. */
+    enum Distribution {
+        dsUniform,          ///< Равномерное по загруженным ключам.
+        dsZipfian,          ///< Зипфово, популярные ключи разбросаны по пространству ключей.
+        dsLatest,           ///< Зипфово, популярнее всего недавно вставленные.
+    };
+
+    /** \brief Вид дерева. */
+    enum Store {
+        stFile,             ///< FileBaseBTree с записями ключ + данные.
+        stAdapter,          ///< BTreeAdapter над 64-битными ключами.
+    };
+
+    /** \brief Операция нагрузки. */
+    enum Operation {
+        opRead,
+        opUpdate,
+        opInsert,
+        opScan,
+        OPS_NUM             ///< Число видов операций.
+    };
+
+    /** \brief Длина ключа в записи (64-битный ключ в порядкосохраняющей кодировке). */
+    static const UShort KEY_SIZE = 8;
+
+    /** \brief Создает нагрузку по умолчанию (workload A). */
+    YcsbWorkload();
+
+    /** \brief Задает пресет нагрузки \c w ('a'...'e'), как в YCSB; кидает std::invalid_argument
+     *  для неизвестного.
+     */
+    void setPreset(char w);
+
+    /** \brief Задает параметр \c name значением \c value; кидает std::invalid_argument, если
+     *  параметр неизвестен или значение некорректно.
+     */
+    void set(const std::string& name, const std::string& value);
+
+    /** \brief Разбирает пару вида \c имя=значение (см. set()). */
+    void parse(const std::string& prop);
+
+    /** \brief Загружает параметры из файла свойств (строки \c имя=значение, \c # — комментарий). */
+    void loadFile(const std::string& fileName);
+
+    /** \brief Проверяет параметры и кидает std::invalid_argument, если они несовместимы. */
+    void validate() const;
+
+    /** \brief Возвращает имя операции \c op в стиле YCSB (READ, UPDATE, ...). */
+    static const char* getOpName(Operation op);
+
+    unsigned long long recordCount;         ///< Число ключей, загружаемых перед прогоном.
+    unsigned long long operationCount;      ///< Число операций прогона (0 — не ограничено).
+    double maxExecutionTime;                ///< Ограничение прогона в секундах (0 — нет).
+    UInt threadCount;                       ///< Число клиентских потоков.
+
+    double proportions[OPS_NUM];            ///< Доли операций.
+    Distribution requestDistribution;       ///< Распределение ключей запросов.
+    UInt maxScanLength;                     ///< Наибольшая длина сканирования.
+    bool hashedInsertOrder;                 ///< Ключи — хеши порядковых номеров (иначе сами номера).
+
+    Store store;                            ///< Вид дерева.
+    std::string fileName;                   ///< Файл дерева (по умолчанию ycsb.xibt в текущем каталоге).
+    UShort order;                           ///< Порядок дерева (если не задан размер страницы).
+    UInt pageSize;                          ///< Размер выровненной страницы (0 — по порядку).
+    UShort recSize;                         ///< Размер записи для stFile (ключ + данные).
+    UInt cacheSize;                         ///< Емкость кэша страниц дерева.
+    std::string traceFile;                  ///< Файл трассы обращений к страницам прогона (пусто — без трассы).
+}; // struct YcsbWorkload
+
+
+/** \brief Генератор номеров [0, n) по закону Зипфа (алгоритм Грея и др., как в YCSB).
+ *
+ *  Номер 0 — самый популярный. Константы распределения считаются в конструкторе за O(n).
+ */
+class ZipfianGenerator {
+public:
+    /** \brief Параметр распределения YCSB по умолчанию. */
+    static const double ZIPFIAN_CONSTANT;
+
+    ZipfianGenerator(unsigned long long n, double theta = ZIPFIAN_CONSTANT);
+
+    /** \brief Возвращает следующий номер, используя генератор \c rng. */
+    unsigned long long next(std::mt19937_64& rng);
+
+    /** \brief Возвращает мощность множества номеров. */
+    unsigned long long getItems() const { return _n; }
+
+protected:
+    unsigned long long _n;
+    double _theta;
+    double _zetan;
+    double _alpha;
+    double _eta;
+    std::uniform_real_distribution<double> _uniform;
+}; // class ZipfianGenerator
+
+
+/** \brief Накопленные задержки одного вида операций. */
+struct YcsbOpStats {
+    unsigned long long failed;                          ///< Неудачные (ключ не найден).
+    LatencyHistogram latencies;                         ///< Задержки в наносекундах.
+
+    YcsbOpStats() : failed(0) {}
+
+    /** \brief Число операций. */
+    unsigned long long getCount() const { return latencies.getCount(); }
+
+    /** \brief Возвращает \c p-й процентиль задержки в наносекундах. */
+    unsigned long long percentile(double p) const { return latencies.percentile(p); }
+
+    /** \brief Возвращает среднюю задержку в наносекундах. */
+    double average() const { return latencies.getMean(); }
+
+    /** \brief Добавляет задержки из \c other. */
+    void merge(const YcsbOpStats& other)
+    {
+        failed += other.failed;
+        latencies.merge(other.latencies);
+    }
+}; // struct YcsbOpStats
+
+
+/** \brief Прогоняет нагрузку YcsbWorkload: загружает дерево и выполняет смесь операций
+ *  в нескольких клиентских потоках.
+ *
+ *  Дерево не рассчитано на конкурентный доступ, поэтому потоки обращаются к нему под общим
+ *  мьютексом; задержка операции включает ожидание мьютекса, как у клиента реальной СУБД.
+ */
+class YcsbDriver {
+public:
+    YcsbDriver(const YcsbWorkload& w);
+    ~YcsbDriver();
+
+protected:
+    YcsbDriver(const YcsbDriver&);                      ///< КК не доступен.
+    YcsbDriver& operator= (YcsbDriver&);                ///< Оператор присваивания недоступен.
+
+public:
+    /** \brief Создает дерево и загружает в него recordCount записей. */
+    void load();
+
+    /** \brief Выполняет прогон нагрузки (после load()). */
+    void run();
+
+    /** \brief Выводит результаты загрузки и прогона в формате отчета YCSB. */
+    void report(std::ostream& os) const;
+
+    /** \brief Выводит гистограммы задержек прогона по видам операций JSON-объектом. */
+    void reportJson(std::ostream& os) const;
+
+    /** \brief Возвращает статистику операций вида \c op (после run()). */
+    const YcsbOpStats& getStats(YcsbWorkload::Operation op) const { return _stats[op]; }
+
+    /** \brief Возвращает длительность загрузки в секундах. */
+    double getLoadTime() const { return _loadTime; }
+
+    /** \brief Возвращает длительность прогона в секундах. */
+    double getRunTime() const { return _runTime; }
+
+    /** \brief Возвращает число выполненных операций прогона. */
+    unsigned long long getRunOps() const;
+
+public:
+    class Store;                                        ///< Дерево, над которым идет нагрузка.
+
+protected:
+    /** \brief Клиентский поток номер \c tnum: выполняет операции, пока не исчерпан их лимит
+     *  или время, и копит задержки в \c stats; \c zipf — копия общего генератора рангов.
+     */
+    void runClient(UInt tnum, ZipfianGenerator zipf, YcsbOpStats* stats);
+
+    /** \brief Возвращает ключ записи с порядковым номером \c id. */
+    unsigned long long makeKey(unsigned long long id) const;
+
+    /** \brief Выбирает порядковый номер существующей записи для запроса. */
+    unsigned long long nextKeyId(std::mt19937_64& rng, ZipfianGenerator& zipf);
+
+protected:
+    YcsbWorkload _w;
+    Store* _store;
+    std::mutex _treeMutex;                              ///< Доступ к однопоточному дереву.
+
+    std::atomic<unsigned long long> _nextId;            ///< Номер следующей вставляемой записи.
+    std::atomic<unsigned long long> _inserted;          ///< Число вставленных записей.
+    std::atomic<unsigned long long> _opsLeft;           ///< Оставшийся лимит операций.
+
+    double _loadTime;
+    double _runTime;
+    YcsbOpStats _stats[YcsbWorkload::OPS_NUM];
+}; // class YcsbDriver
+
+
+} // namespace xi
+
+
+#endif // BTREE_YCSB_H_
@@ -20,6 +20,8 @@
 
 #include <gtest/gtest.h>
 
+#include <climits>
+
 #include "btree_adapters.h"
 
 
@@ -174,6 +176,162 @@ TEST_F(AdaptersTest, Reopen1)
 }
 
 
+// ключи с длинным общим префиксом, лексикографический компаратор
+TEST_F(AdaptersTest, LexPrefixSearch1)
+{
+    std::string& fn = getFn("LexPrefixSearch1.xibt");
+
+    const UShort REC_SZ = 24;
+    BTreeLexComparator comparator;
+    FileBaseBTree bt(3, REC_SZ, &comparator, fn);
+
+    // вставляем вразброс ключи вида "http://host/item/00042"
+    const int KEYS_NUM = 200;
+    Byte k[REC_SZ];
+    for (int i = 0; i < KEYS_NUM; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "http://host/item/%05d", (i * 37) % KEYS_NUM);
+        bt.insert(k);
+    }
+
+    // и пару дубликатов
+    memset(k, 0, REC_SZ);
+    sprintf((char*)k, "http://host/item/%05d", 42);
+    bt.insert(k);
+    bt.insert(k);
+
+    FileBaseBTree::PageWrapper wp(&bt);
+    wp.readPage(bt.getRootPageNum());
+    EXPECT_FALSE(wp.isLeaf());
+    EXPECT_EQ(0, memcmp(wp.getKey(0), wp.getKey((UShort) (wp.getKeysNum() - 1)), 16));  // "http://host/item"
+
+    for (int i = 0; i < KEYS_NUM; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "http://host/item/%05d", i);
+        Byte* res = bt.search(k);
+        ASSERT_NE(nullptr, res);
+        EXPECT_EQ(0, memcmp(k, res, REC_SZ));
+        delete[] res;
+    }
+
+    std::list<Byte*> found;
+    memset(k, 0, REC_SZ);
+    sprintf((char*)k, "http://host/item/%05d", 42);
+    EXPECT_EQ(3, bt.searchAll(k, found));
+    EXPECT_EQ(3u, found.size());
+    for (Byte* f : found)
+    {
+        EXPECT_EQ(0, memcmp(k, f, REC_SZ));
+        delete[] f;
+    }
+
+    // отсутствующие ключи: до, между и после имеющихся
+    const char* missing[] = { "a", "http://host/item/00042a", "http://host/item/1", "z" };
+    for (const char* m : missing)
+    {
+        memset(k, 0, REC_SZ);
+        strcpy((char*)k, m);
+        EXPECT_EQ(nullptr, bt.search(k));
+    }
+}
+
+
+// порядок кодов кодеков должен совпадать с естественным порядком ключей
+TEST_F(AdaptersTest, OrderedCodecs1)
+{
+    // знаковые целые
+    const int ints[] = { INT_MIN, -100000, -1, 0, 1, 255, 256, 100000, INT_MAX };
+    const int INTS_NUM = sizeof(ints) / sizeof(ints[0]);
+    Byte a[8], b[8];
+    for (int i = 0; i + 1 < INTS_NUM; ++i)
+    {
+        OrderedKeyCodec<int>::encode(a, ints[i]);
+        OrderedKeyCodec<int>::encode(b, ints[i + 1]);
+        EXPECT_LT(memcmp(a, b, sizeof(int)), 0);
+
+        int res;
+        OrderedKeyCodec<int>::decode(a, res);
+        EXPECT_EQ(ints[i], res);
+    }
+
+    // беззнаковые целые
+    OrderedKeyCodec<unsigned short>::encode(a, 0x00FF);
+    OrderedKeyCodec<unsigned short>::encode(b, 0x0100);
+    EXPECT_LT(memcmp(a, b, 2), 0);
+
+    // числа с плавающей точкой
+    const double dbls[] = { -1e300, -2.5, -1e-300, 0.0, 1e-300, 2.5, 1e300 };
+    const int DBLS_NUM = sizeof(dbls) / sizeof(dbls[0]);
+    for (int i = 0; i + 1 < DBLS_NUM; ++i)
+    {
+        OrderedKeyCodec<double>::encode(a, dbls[i]);
+        OrderedKeyCodec<double>::encode(b, dbls[i + 1]);
+        EXPECT_LT(memcmp(a, b, sizeof(double)), 0);
+
+        double res;
+        OrderedKeyCodec<double>::decode(a, res);
+        EXPECT_EQ(dbls[i], res);
+    }
 
+    // кортежи: порядок по первому элементу, затем по второму
+    typedef std::tuple<short, float> TPair;
+    typedef OrderedKeyCodec<TPair> TPairCodec;
+    EXPECT_EQ(6, (int)TPairCodec::SIZE);
+    TPairCodec::encode(a, TPair(-1, 100.0f));
+    TPairCodec::encode(b, TPair(0, -100.0f));
+    EXPECT_LT(memcmp(a, b, TPairCodec::SIZE), 0);
+    TPairCodec::encode(b, TPair(-1, 100.5f));
+    EXPECT_LT(memcmp(a, b, TPairCodec::SIZE), 0);
+
+    TPair p;
+    TPairCodec::decode(b, p);
+    EXPECT_EQ(-1, std::get<0>(p));
+    EXPECT_EQ(100.5f, std::get<1>(p));
+
+    // строки
+    typedef OrderedStringCodec<8> TStrCodec;
+    TStrCodec::encode(a, "ab");
+    TStrCodec::encode(b, "abc");
+    EXPECT_LT(memcmp(a, b, TStrCodec::SIZE), 0);
+
+    std::string str;
+    TStrCodec::decode(b, str);
+    EXPECT_EQ("abc", str);
+    ASSERT_THROW(TStrCodec::encode(a, "too long key"), std::invalid_argument);
+}
 
 
+TEST_F(AdaptersTest, OrderedIntAdapter1)
+{
+    std::string& fn = getFn("OrderedIntAdapter1.xibt");
+
+    BTreeOrderedIntAdapter bt(3, fn);
+    EXPECT_TRUE(bt.getTree().getComparator()->isLexicographic());
+
+    for (int i = -50; i <= 50; ++i)
+        bt.insert(i * 7919 % 1000);              // отрицательные вперемешку с положительными
+    bt.insert(-919);                             // дубликат ключа для i == -1
+
+    FileBaseBTree::PageWrapper wp(&bt.getTree());
+    wp.readPage(bt.getTree().getRootPageNum());
+    EXPECT_FALSE(wp.isLeaf());
+    for (UShort i = 0; i + 1 < wp.getKeysNum(); ++i)
+        EXPECT_LT(bt.getKey(wp, i), bt.getKey(wp, i + 1));
+
+    int res = 0;
+    EXPECT_TRUE(bt.search(-919, res));
+    EXPECT_EQ(-919, res);
+    EXPECT_FALSE(bt.search(1, res));
+
+    std::list<int> keys;
+    EXPECT_EQ(2, bt.searchAll(-919, keys));
+    EXPECT_EQ(2u, keys.size());
+    EXPECT_EQ(-919, keys.front());
+
+    std::list<int> range;
+    EXPECT_EQ(3, bt.searchRange(-930, -900, range));    // -922, -919, -919
+    EXPECT_EQ(-922, range.front());
+    EXPECT_EQ(-919, range.back());
+}
@@ -20,8 +20,16 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <vector>
+#include <sstream>
+
 
 #include "btree.h"
+#include "crc32c.h"
+#include "cache_sim.h"
+#include "parallel_scan.h"
+#include "memory_btree.h"
 
 /** \brief Путь к каталогу с рабочими тестовыми файлами. */
 static const char* TEST_FILES_PATH = "../../out/";
@@ -694,7 +702,7 @@ TEST_F(BTreeTest, Insert3)
 
 
     Byte els[] = { 0x01, 0x11, 0x09, 0x05, 0x07, 0x03, 0x03 };
-    for (int i = 0; i < sizeof(els) / sizeof(els[0]); ++i)
+    for (size_t i = 0; i < sizeof(els) / sizeof(els[0]); ++i)
     {
         Byte& el = els[i];
         bt.insert(&el);
@@ -713,3 +721,733 @@ TEST_F(BTreeTest, Insert3)
     //k = 0x04;
     //bt.insert(&k);
 }
+
+
+TEST_F(BTreeTest, Search1)
+{
+    std::string& fn = getFn("Search1.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, fn);
+
+
+    Byte els[] = { 0x01, 0x11, 0x09, 0x05, 0x07, 0x03, 0x03, 0x0B, 0x03, 0x0D, 0x0F };
+    for (size_t i = 0; i < sizeof(els) / sizeof(els[0]); ++i)
+        bt.insert(&els[i]);
+
+    for (size_t i = 0; i < sizeof(els) / sizeof(els[0]); ++i)
+    {
+        Byte* res = bt.search(&els[i]);
+        ASSERT_NE(nullptr, res);
+        EXPECT_EQ(els[i], *res);
+        delete[] res;
+    }
+
+    Byte k = 0x04;
+    EXPECT_EQ(nullptr, bt.search(&k));
+
+    std::list<Byte*> keys;
+    k = 0x03;
+    EXPECT_EQ(3, bt.searchAll(&k, keys));
+    EXPECT_EQ(3u, keys.size());
+    for (Byte* key : keys)
+    {
+        EXPECT_EQ(0x03, *key);
+        delete[] key;
+    }
+}
+
+
+TEST_F(BTreeTest, AlignedGeometry1)
+{
+    std::string& fn = getFn("AlignedGeometry1.xibt");
+
+    // 2 + 10 * 291 + 4 * 292 = 4080 <= 4096, а для порядка 147 уже 4108
+    EXPECT_EQ(146, BaseBTree::calcOrderForPageSize(10, 4096));
+    EXPECT_EQ(0, BaseBTree::calcOrderForPageSize(1000, 512));
+
+    FileBaseBTree bt;
+    ASSERT_THROW(bt.createForPageSize(1000, 10, fn), std::invalid_argument);     // не степень двойки
+    EXPECT_FALSE(bt.isOpen());
+
+    bt.createForPageSize(4096, 10, fn);
+    EXPECT_TRUE(bt.isPageAligned());
+    EXPECT_EQ(146, bt.getOrder());
+    EXPECT_EQ(4096u, bt.getNodePageSize());
+    EXPECT_EQ(4096u, bt.getFirstPageOfs());
+    EXPECT_EQ(4096u, bt.getPageBufAlign());
+
+    FileBaseBTree::PageWrapper wp(&bt);
+    EXPECT_EQ(0u, (size_t)wp.getData() % 4096);
+    bt.allocPage(wp, 145, true);
+    bt.allocPage(wp, 291, false);
+    EXPECT_EQ(3u, bt.getLastPageNum());
+
+    wp.readPage(3);
+    *(wp.getKey(290)) = 'Z';
+    wp.writePage();
+    bt.close();
+
+    // размер файла — ровно заголовок-страница плюс три страницы
+    std::ifstream f(fn, std::ios::binary | std::ios::ate);
+    EXPECT_EQ(4 * 4096, (int)f.tellg());
+    f.close();
+
+    FileBaseBTree bt2(fn, nullptr);
+    EXPECT_TRUE(bt2.isPageAligned());
+    EXPECT_EQ(146, bt2.getOrder());
+    EXPECT_EQ(4096u, bt2.getNodePageSize());
+    EXPECT_EQ(3u, bt2.getLastPageNum());
+
+    FileBaseBTree::PageWrapper wp2(&bt2);
+    wp2.readPage(2);
+    EXPECT_TRUE(wp2.isLeaf());
+    EXPECT_EQ(145, wp2.getKeysNum());
+    wp2.readPage(3);
+    EXPECT_FALSE(wp2.isLeaf());
+    EXPECT_EQ('Z', *(wp2.getKey(290)));
+}
+
+
+TEST_F(BTreeTest, AlignedGeometry2)
+{
+    std::string& fn = getFn("AlignedGeometry2.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.createForPageSize(512, 1, fn);
+    EXPECT_EQ(51, bt.getOrder());                   // 2 + 101 + 4 * 102 = 511 <= 512
+
+    for (int i = 0; i < 600; ++i)
+    {
+        Byte k = (Byte)(i * 7);
+        bt.insert(&k);
+    }
+    EXPECT_LT(3u, bt.getLastPageNum());               // были сплиты, в т.ч. корня
+
+    for (int i = 0; i < 256; ++i)
+    {
+        Byte k = (Byte)i;
+        Byte* res = bt.search(&k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+    }
+
+    // обычная геометрия: буферы выровнены по строке кэша
+    FileBaseBTree bt2(2, 10, nullptr, getFn("AlignedGeometry2a.xibt"));
+    EXPECT_FALSE(bt2.isPageAligned());
+    EXPECT_EQ(16u, bt2.getFirstPageOfs());
+    FileBaseBTree::PageWrapper wp(&bt2);
+    EXPECT_EQ(0u, (size_t)wp.getData() % 64);
+}
+
+
+TEST_F(BTreeTest, FormatVersion1)
+{
+    std::string& fn = getFn("FormatVersion1.xibt");
+
+    // смещения страниц считаются в 64 битах: страница 70000 по 64 КиБ лежит за 4 ГиБ
+    FileBaseBTree bt;
+    bt.createForPageSize(65536, 10, getFn("FormatVersion1a.xibt"));
+    EXPECT_EQ(65536LL * 70001, bt.getPageOffset(70001));   // плюс страница заголовка
+    EXPECT_EQ(1, bt.getFormatVersion());
+    bt.setFormatVersion(2);
+    bt.close();
+
+    // выровненная геометрия в v2 — своя сигнатура с расширенным заголовком
+    bt.open(getFn("FormatVersion1a.xibt"));
+    EXPECT_EQ(2, bt.getFormatVersion());
+    EXPECT_TRUE(bt.isPageAligned());
+    EXPECT_EQ(65536u, bt.getFirstPageOfs());
+    bt.close();
+
+    ByteComparator comparator;
+    FileBaseBTree bt1(2, 1, &comparator, fn);
+    EXPECT_EQ(1, bt1.getFormatVersion());
+    for (int i = 0; i < 50; ++i)
+    {
+        Byte k = (Byte)(i * 3);
+        bt1.insert(&k);
+    }
+
+    EXPECT_THROW(bt1.setFormatVersion(0), std::invalid_argument);
+    EXPECT_THROW(bt1.setFormatVersion(3), std::invalid_argument);
+    bt1.setFormatVersion(2);
+    bt1.close();
+
+    // v2 отличается сигнатурой, так что прежние читатели файл не примут
+    BaseBTree::Header hdr;
+    std::ifstream f(fn, std::ios::binary);
+    f.read((char*)&hdr, sizeof(hdr));
+    f.close();
+    EXPECT_EQ((UInt)BaseBTree::Header::V2_SIGN, hdr.sign);
+    EXPECT_EQ(2, hdr.getVersion());
+
+    FileBaseBTree bt2(fn, &comparator);
+    EXPECT_EQ(2, bt2.getFormatVersion());
+    for (int i = 0; i < 50; ++i)
+    {
+        Byte k = (Byte)(i * 3);
+        Byte* res = bt2.search(&k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+    }
+
+    // вставка в v2 сохраняет версию, а вернуть v1 можно, пока файл меньше 4 ГиБ
+    Byte k = 1;
+    bt2.insert(&k);
+    bt2.close();
+    bt2.open(fn);
+    EXPECT_EQ(2, bt2.getFormatVersion());
+    bt2.setFormatVersion(1);
+    bt2.close();
+
+    FileBaseBTree bt3(fn, &comparator);
+    EXPECT_EQ(1, bt3.getFormatVersion());
+    Byte* res = bt3.search(&k);
+    ASSERT_NE(nullptr, res);
+    delete[] res;
+}
+
+
+TEST_F(BTreeTest, PageChecksum1)
+{
+    std::string& fn = getFn("PageChecksum1.xibt");
+
+    // контрольное значение CRC32C для "123456789"
+    const Byte check[] = "123456789";
+    EXPECT_EQ(0xE3069283u, crc32c(check, 9));
+    EXPECT_EQ(0xE3069283u, crc32cSoftware(check, 9));
+    EXPECT_EQ(crc32cSoftware(check, 9, 7), crc32c(check, 9, 7));
+
+    // аппаратная реализация склеивает полосы, сверяем ее с табличной на разных длинах
+    std::vector<Byte> buf(60001);
+    for (size_t i = 0; i < buf.size(); ++i)
+        buf[i] = (Byte)(i * 131 + (i >> 7));
+    const size_t lens[] = { 0, 1, 7, 255, 767, 768, 1000, 4092, 24576, 24577, 60000 };
+    for (size_t len : lens)
+        EXPECT_EQ(crc32cSoftware(buf.data() + 1, len, 5), crc32c(buf.data() + 1, len, 5));   // невыровненный адрес
+
+    ByteComparator comparator;
+    FileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setPageChecksums(true);
+    EXPECT_THROW(bt.create(2, 1, fn), std::invalid_argument);      // только выровненная геометрия
+
+    bt.createForPageSize(512, 1, fn);
+    EXPECT_TRUE(bt.hasPageChecksums());
+    EXPECT_EQ(50, bt.getOrder());                   // 2 + 99 + 4 * 100 = 501 <= 512 - 4
+    for (int i = 0; i < 600; ++i)
+    {
+        Byte k = (Byte)(i * 7);
+        bt.insert(&k);
+    }
+    EXPECT_EQ(0u, bt.verifyPages());
+    UInt pages = bt.getLastPageNum();
+    UInt victim = (bt.getRootPageNum() == 2) ? 3 : 2;   // корень читается при открытии
+    bt.close();
+
+    // портим байт ключа в некорневой странице
+    {
+        std::fstream f(fn, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(512 * victim + 10);
+        f.put('!');
+    }
+
+    FileBaseBTree bt2(fn, &comparator);
+    EXPECT_TRUE(bt2.hasPageChecksums());
+    EXPECT_EQ(pages, bt2.getLastPageNum());
+    std::vector<UInt> bad;
+    EXPECT_EQ(1u, bt2.verifyPages(&bad));
+    ASSERT_EQ(1u, bad.size());
+    EXPECT_EQ(victim, bad[0]);
+
+    FileBaseBTree::PageWrapper wp(&bt2);
+    EXPECT_THROW(wp.readPage(victim), std::runtime_error);
+    wp.readPage(1);
+
+    // перезапись исправной страницы сумму пересчитывает
+    wp.writePage();
+    EXPECT_EQ(1u, bt2.verifyPages());
+    bt2.close();
+
+    // без контрольных сумм проверять нечего
+    FileBaseBTree bt3;
+    bt3.createForPageSize(512, 1, getFn("PageChecksum1a.xibt"));
+    EXPECT_FALSE(bt3.hasPageChecksums());
+    EXPECT_EQ(51, bt3.getOrder());
+    EXPECT_THROW(bt3.verifyPages(), std::runtime_error);
+}
+
+
+TEST_F(BTreeTest, GrowthExtent1)
+{
+    std::string& fn = getFn("GrowthExtent1.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setGrowthExtent(16);
+    EXPECT_EQ(16u, bt.getGrowthExtent());           // шаг роста переживает закрытие дерева
+
+    bt.createForPageSize(512, 1, fn);
+    EXPECT_EQ(16u, bt.getReservedPages());          // корень сразу зарезервировал экстент
+    for (int i = 0; i < 600; ++i)
+    {
+        Byte k = (Byte)(i * 7);
+        bt.insert(&k);
+    }
+    UInt pages = bt.getLastPageNum();
+    UInt reserved = bt.getReservedPages();
+    EXPECT_GE(reserved, pages);
+    EXPECT_LT(reserved - pages, 16u);
+    EXPECT_EQ(0u, reserved % 16);
+    bt.close();
+    EXPECT_EQ(0u, bt.getReservedPages());
+
+    // файл — заголовок-страница плюс зарезервированные страницы, а не только занятые
+    {
+        std::ifstream f(fn, std::ios::binary | std::ios::ate);
+        EXPECT_EQ(512 * (reserved + 1), (UInt)f.tellg());
+    }
+
+    // число страниц берется из заголовка, хвост остается резервом
+    bt.setComparator(&comparator);
+    bt.open(fn);
+    EXPECT_EQ(pages, bt.getLastPageNum());
+    EXPECT_EQ(reserved, bt.getReservedPages());
+    for (int i = 0; i < 600; ++i)
+    {
+        Byte k = (Byte)(i * 7);
+        Byte* res = bt.search(&k);
+        ASSERT_NE(nullptr, res);
+        EXPECT_EQ(k, *res);
+        delete[] res;
+    }
+
+    // новые страницы сначала занимают резерв
+    for (int i = 0; i < 2000; ++i)
+    {
+        Byte k = (Byte)(i * 3);
+        bt.insert(&k);
+    }
+    EXPECT_GT(bt.getLastPageNum(), pages);
+    EXPECT_GE(bt.getReservedPages(), bt.getLastPageNum());
+}
+
+TEST_F(BTreeTest, Stats1)
+{
+    std::string& fn = getFn("Stats1.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, fn);
+    EXPECT_EQ(0u, bt.getStats().pageReads);
+    EXPECT_EQ(1u, bt.getStats().pageAllocs);        // корень
+    EXPECT_EQ(0u, bt.getStats().splits);
+
+    // порядок 2: в узле не больше 3 ключей, четвертый расщепляет корень
+    BaseBTree::Stats inserts;
+    for (Byte k = 1; k <= 4; ++k)
+    {
+        BaseBTree::StatsScope scope(&bt, &inserts);
+        bt.insert(&k);
+        if (k < 4)
+            EXPECT_EQ(0u, scope.get().splits);
+        else
+        {
+            EXPECT_EQ(1u, scope.get().splits);
+            EXPECT_EQ(2u, scope.get().pageAllocs);  // правый брат и новый корень
+        }
+    }
+    EXPECT_EQ(1u, inserts.splits);
+    EXPECT_LT(0u, inserts.keyCompares);
+    EXPECT_LT(0u, inserts.pageWrites);
+    EXPECT_EQ(inserts.pageWrites * bt.getNodePageSize(), inserts.bytesWritten);
+
+    // поиск читает корень и лист
+    bt.resetStats();
+    Byte k = 4;
+    {
+        BaseBTree::StatsScope scope(&bt);
+        Byte* res = bt.search(&k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+
+        EXPECT_EQ(2u, scope.get().pageReads);
+        EXPECT_EQ(0u, scope.get().pageWrites);
+        EXPECT_LT(0u, scope.get().keyCompares);
+    }
+
+    // с кэшем повторное чтение — попадание
+    bt.setCacheSize(8);
+    bt.resetStats();
+    for (int i = 0; i < 2; ++i)
+    {
+        Byte* res = bt.search(&k);
+        delete[] res;
+    }
+    EXPECT_EQ(2u, bt.getStats().cacheMisses);
+    EXPECT_EQ(2u, bt.getStats().cacheHits);
+    EXPECT_EQ(2u, bt.getStats().pageReads);
+}
+
+TEST_F(BTreeTest, LatencyHistogram1)
+{
+    // точный диапазон и лог-линейные корзины: значение лежит в границах своей корзины
+    EXPECT_EQ(5u, LatencyHistogram::getIndex(5));
+    const unsigned long long vals[] = { 127, 128, 129, 255, 256, 1000, 123456789, ~0ULL };
+    for (unsigned long long v : vals)
+    {
+        UInt idx = LatencyHistogram::getIndex(v);
+        EXPECT_LE(LatencyHistogram::getLowerBound(idx), v);
+        EXPECT_GE(LatencyHistogram::getUpperBound(idx), v);
+        EXPECT_LE(LatencyHistogram::getUpperBound(idx) - LatencyHistogram::getLowerBound(idx),
+                  LatencyHistogram::getLowerBound(idx) / 64);
+    }
+
+    LatencyHistogram h;
+    for (unsigned long long v = 1; v <= 10000; ++v)
+        h.record(v * 1000);
+    EXPECT_EQ(10000u, h.getCount());
+    EXPECT_EQ(1000u, h.getMin());
+    EXPECT_EQ(10000000u, h.getMax());
+    EXPECT_NEAR(5000000.0, (double)h.percentile(50), 5000000.0 * 0.016);
+    EXPECT_NEAR(9900000.0, (double)h.percentile(99), 9900000.0 * 0.016);
+    EXPECT_EQ(h.getMax(), h.percentile(100));
+
+    LatencyHistogram h2;
+    h2.record(20000000, 10);
+    h.merge(h2);
+    EXPECT_EQ(10010u, h.getCount());
+    EXPECT_EQ(20000000u, h.getMax());
+
+    std::ostringstream json;
+    h2.printJson(json);
+    EXPECT_NE(std::string::npos, json.str().find("\"count\": 10"));
+
+    // гистограммы дерева
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, getFn("LatencyHistogram1.xibt"));
+    EXPECT_EQ(nullptr, bt.getLatencies());
+    bt.setLatencyTracking(true);
+    ASSERT_NE(nullptr, bt.getLatencies());
+    bt.resetStats();                                // корень записан до включения
+
+    for (int i = 0; i < 100; ++i)
+    {
+        Byte k = (Byte)i;
+        bt.insert(&k);
+    }
+    Byte k = 50;
+    delete[] bt.search(&k);
+    std::list<Byte*> found;
+    bt.searchAll(&k, found);
+    for (Byte* f : found)
+        delete[] f;
+
+    const BaseBTree::Latencies& lat = *bt.getLatencies();
+    EXPECT_EQ(100u, lat.insert.getCount());
+    EXPECT_EQ(1u, lat.search.getCount());
+    EXPECT_EQ(1u, lat.searchAll.getCount());
+    EXPECT_EQ(bt.getStats().pageReads, lat.pageRead.getCount());
+    EXPECT_EQ(bt.getStats().pageWrites, lat.pageWrite.getCount());
+
+    bt.setLatencyTracking(false);
+    EXPECT_EQ(nullptr, bt.getLatencies());
+}
+
+TEST_F(BTreeTest, PageTrace1)
+{
+    std::string fn = getFn("PageTrace1.xibt");          // getFn() возвращает общий буфер
+    std::string traceFn = getFn("PageTrace1.xipt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, fn);
+
+    PageTracer tracer;
+    tracer.open(traceFn);
+    bt.setPageTracer(&tracer);
+    bt.resetStats();
+
+    // без кэша каждое обращение — это ввод-вывод страницы
+    for (Byte k = 1; k <= 20; ++k)
+        bt.insert(&k);
+    Byte k = 7;
+    Byte* res = bt.search(&k);
+    ASSERT_NE(nullptr, res);
+    delete[] res;
+
+    bt.setPageTracer(nullptr);
+    tracer.close();
+    EXPECT_EQ(bt.getStats().pageReads + bt.getStats().pageWrites, tracer.getRecordsNum());
+
+    PageTraceReader reader(traceFn);
+    PageTraceRecord rec;
+    unsigned long long reads = 0, writes = 0, lastTime = 0;
+    UInt lastOp = 0;
+    while (reader.next(rec))
+    {
+        EXPECT_GE(rec.time, lastTime);
+        EXPECT_GE(rec.opId, lastOp);
+        EXPECT_GE(rec.pnum, 1u);
+        EXPECT_LE(rec.pnum, bt.getLastPageNum());
+        lastTime = rec.time;
+        lastOp = rec.opId;
+        (rec.write ? writes : reads)++;
+    }
+    EXPECT_EQ(bt.getStats().pageReads, reads);
+    EXPECT_EQ(bt.getStats().pageWrites, writes);
+    EXPECT_EQ(21u, lastOp);                         // 20 вставок и поиск
+
+    // с кэшем в трассу попадают и попадания
+    bt.setCacheSize(16);
+    tracer.open(traceFn);
+    bt.setPageTracer(&tracer);
+    bt.resetStats();
+    for (int i = 0; i < 3; ++i)
+    {
+        res = bt.search(&k);
+        delete[] res;
+    }
+    bt.setPageTracer(nullptr);
+    tracer.close();
+    EXPECT_EQ(bt.getStats().cacheHits + bt.getStats().cacheMisses, tracer.getRecordsNum());
+
+    EXPECT_THROW(PageTraceReader reader2(fn), std::runtime_error);      // не трасса
+}
+
+
+TEST_F(BTreeTest, CacheSim1)
+{
+    // циклический просмотр на одну страницу больше емкости: LRU и CLOCK промахиваются всегда,
+    // 2Q удерживает часть страниц в основной очереди
+    std::vector<UInt> loop;
+    for (int i = 0; i < 50; ++i)
+        for (UInt p = 1; p <= 9; ++p)
+            loop.push_back(p);
+
+    std::vector<UInt> caps = { 8, 9 };
+    std::vector<double> lru, clock, twoQ, arc;
+    CacheSimulator::calcMissRatioCurve(CacheSimulator::cpLru, loop, caps, lru);
+    CacheSimulator::calcMissRatioCurve(CacheSimulator::cpClock, loop, caps, clock);
+    CacheSimulator::calcMissRatioCurve(CacheSimulator::cp2Q, loop, caps, twoQ);
+    CacheSimulator::calcMissRatioCurve(CacheSimulator::cpArc, loop, caps, arc);
+    EXPECT_DOUBLE_EQ(1.0, lru[0]);
+    EXPECT_DOUBLE_EQ(1.0, clock[0]);
+    EXPECT_LT(twoQ[0], 1.0);
+
+    // все страницы помещаются: промахи только первые
+    for (const std::vector<double>* c : { &lru, &clock, &twoQ, &arc })
+        EXPECT_DOUBLE_EQ(9.0 / loop.size(), (*c)[1]);
+
+    // LRU вытесняет давнее всех использованную
+    CacheSimulator* sim = CacheSimulator::create(CacheSimulator::cpLru, 2);
+    EXPECT_FALSE(sim->access(1));
+    EXPECT_FALSE(sim->access(2));
+    EXPECT_TRUE(sim->access(1));
+    EXPECT_FALSE(sim->access(3));                   // вытесняет 2
+    EXPECT_TRUE(sim->access(1));
+    EXPECT_FALSE(sim->access(2));
+    EXPECT_EQ(2u, sim->getHits());
+    EXPECT_EQ(4u, sim->getMisses());
+    delete sim;
+
+    // повторно использованные страницы переживают однократный просмотр в ARC, но не в LRU
+    // (в 2Q повторы внутри A1in не в счет: страница должна вернуться из «призраков»)
+    for (CacheSimulator::Policy p : { CacheSimulator::cpLru, CacheSimulator::cpArc })
+    {
+        sim = CacheSimulator::create(p, 8);
+        for (int i = 0; i < 3; ++i)
+            for (UInt hot = 1; hot <= 4; ++hot)
+                sim->access(hot);
+        for (UInt scan = 100; scan < 120; ++scan)
+            sim->access(scan);
+
+        bool hotHit = sim->access(1);
+        EXPECT_EQ(p != CacheSimulator::cpLru, hotHit) << CacheSimulator::getPolicyName(p);
+        delete sim;
+    }
+
+    EXPECT_THROW(CacheSimulator::create(CacheSimulator::cpArc, 0), std::invalid_argument);
+}
+
+TEST_F(BTreeTest, ParallelScan1)
+{
+    std::string& fn = getFn("ParallelScan1.xibt");
+
+    typedef OrderedKeyCodec<UInt> Codec;
+    typedef TypedAggregator<UInt, BTreeOrderedTraits<UInt>, unsigned long long> UIntAggregator;
+
+    BTreeLexComparator comparator;
+    FileBaseBTree bt(3, sizeof(UInt), &comparator, fn);
+    MemoryBaseBTree mt(3, sizeof(UInt), &comparator);
+
+    // каждый ключ по четыре раза, чтобы дубликаты расходились по соседним поддеревьям
+    Byte k[sizeof(UInt)];
+    for (UInt i = 0; i < 20000; ++i)
+    {
+        Codec::encode(k, (i * 7919) % 5000);
+        bt.insert(k);
+        mt.insert(k);
+    }
+
+    // файловое дерево читается собственными дескрипторами потоков, дерево в памяти — под блокировкой
+    EXPECT_TRUE(bt.canAccessPagesDirectly());
+    EXPECT_FALSE(mt.canAccessPagesDirectly());
+    BaseBTree* trees[] = { &bt, &mt };
+    for (BaseBTree* tree : trees)
+    {
+        ParallelRangeScanner scanner(tree, 4);
+        scanner.setTaskHeight(1);
+        EXPECT_EQ(4u, scanner.getThreadsNum());
+
+        UIntAggregator all;
+        scanner.scan(nullptr, nullptr, all);
+        EXPECT_EQ(20000u, all.getCount());
+        EXPECT_EQ(4ull * 4999 * 5000 / 2, all.getSum());
+        EXPECT_EQ(0u, all.getMin());
+        EXPECT_EQ(4999u, all.getMax());
+        EXPECT_LT(1u, scanner.getTasksNum());
+
+        // границы включаются
+        Byte from[sizeof(UInt)], to[sizeof(UInt)];
+        Codec::encode(from, 1000);
+        Codec::encode(to, 1999);
+        UIntAggregator range;
+        scanner.scan(from, to, range);
+        EXPECT_EQ(4000u, range.getCount());
+        EXPECT_EQ(4ull * (1000 + 1999) * 1000 / 2, range.getSum());
+        EXPECT_EQ(1000u, range.getMin());
+        EXPECT_EQ(1999u, range.getMax());
+
+        // то же, что дает последовательный курсор
+        CountAggregator count;
+        scanner.setTaskHeight(ParallelRangeScanner::DEFAULT_TASK_HEIGHT);
+        scanner.scan(from, nullptr, count);
+        std::list<Byte*> keys;
+        EXPECT_EQ((int) count.getCount(), tree->searchRange(from, nullptr, keys));
+        for (Byte* key : keys)
+            delete[] key;
+
+        // пустой диапазон
+        CountAggregator none;
+        scanner.scan(to, from, none);
+        EXPECT_EQ(0u, none.getCount());
+    }
+
+    // дерево без компаратора
+    FileBaseBTree noCmp;
+    noCmp.open(fn);
+    ParallelRangeScanner scanner(&noCmp, 2);
+    CountAggregator count;
+    EXPECT_THROW(scanner.scan(nullptr, nullptr, count), std::runtime_error);
+}
+
+
+TEST_F(BTreeTest, RangeScan1)
+{
+    std::string& fn = getFn("RangeScan1.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, fn);
+
+    // много дубликатов, чтобы они расходились по разным узлам
+    std::vector<Byte> ref;
+    for (int i = 0; i < 300; ++i)
+    {
+        Byte k = (Byte) ((i * 37) % 64);
+        bt.insert(&k);
+        ref.push_back(k);
+    }
+    std::sort(ref.begin(), ref.end());
+
+    // весь диапазон — отсортированная последовательность
+    std::list<Byte*> keys;
+    EXPECT_EQ(300, bt.searchRange(nullptr, nullptr, keys));
+    std::vector<Byte> all;
+    for (Byte* key : keys)
+    {
+        all.push_back(*key);
+        delete[] key;
+    }
+    EXPECT_EQ(ref, all);
+
+    // границы включаются
+    Byte from = 0x10, to = 0x12;
+    keys.clear();
+    int expected = (int) std::count_if(ref.begin(), ref.end(),
+                                       [](Byte b) { return b >= 0x10 && b <= 0x12; });
+    EXPECT_EQ(expected, bt.searchRange(&from, &to, keys));
+    for (Byte* key : keys)
+    {
+        EXPECT_TRUE(*key >= from && *key <= to);
+        delete[] key;
+    }
+
+    // пустой диапазон
+    from = 0x50;
+    keys.clear();
+    EXPECT_EQ(0, bt.searchRange(&from, nullptr, keys));
+
+    // курсор с упреждающим чтением через кэш дает то же самое
+    bt.setCacheSize(4);
+    BaseBTree::RangeCursor cur(&bt);
+    cur.setReadAhead(3);
+    cur.seek(nullptr);
+    std::vector<Byte> scanned;
+    while (cur.next())
+        scanned.push_back(*cur.getKey());
+    EXPECT_EQ(ref, scanned);
+    EXPECT_FALSE(cur.next());
+}
+
+
+TEST_F(BTreeTest, SearchBatch1)
+{
+    std::string& fn = getFn("SearchBatch1.xibt");
+
+    ByteComparator comparator;
+    FileBaseBTree bt(2, 1, &comparator, fn);
+
+    for (int i = 0; i < 200; ++i)
+    {
+        Byte k = (Byte) ((i * 37) % 128) * 2;   // только четные
+        bt.insert(&k);
+    }
+
+    // все значения байта вперемешку: четные есть в дереве, нечетных нет
+    Byte vals[256];
+    const Byte* keys[257];
+    for (int i = 0; i < 256; ++i)
+    {
+        vals[i] = (Byte) (i * 101);
+        keys[i] = &vals[i];
+    }
+    keys[256] = nullptr;                        // пропускается
+
+    // без кэша и с кэшем, в который помещаются не все страницы уровня
+    for (UInt cacheSize : { 0u, 3u })
+    {
+        bt.setCacheSize(cacheSize);
+
+        Byte* results[257];
+        bt.searchBatch(257, keys, results);
+        for (int i = 0; i < 256; ++i)
+        {
+            Byte* single = bt.search(keys[i]);
+            if (vals[i] % 2 == 0)
+            {
+                ASSERT_NE(nullptr, results[i]);
+                EXPECT_EQ(vals[i], *results[i]);
+            }
+            else
+                EXPECT_EQ(nullptr, results[i]);
+            EXPECT_EQ(single == nullptr, results[i] == nullptr);
+
+            delete[] single;
+            delete[] results[i];
+        }
+        EXPECT_EQ(nullptr, results[256]);
+    }
+}
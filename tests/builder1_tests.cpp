@@ -0,0 +1,555 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для построения и дефрагментации B-деревьев
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+
+#include "btree_builder.h"
+#include "btree_adapters.h"
+#include "tree_analyzer.h"
+#include "external_sort.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+typedef OrderedKeyCodec<UInt> UIntCodec;
+
+
+/** \brief Возвращает число, закодированное в ключе \c raw. */
+static UInt decodeKey(const Byte* raw)
+{
+    UInt v;
+    UIntCodec::decode(raw, v);
+    return v;
+}
+
+
+/** \brief Источник ключей из вектора чисел. */
+class VectorKeySource : public BTreeBuilder::IKeySource {
+public:
+    VectorKeySource(const std::vector<UInt>& keys) : _keys(keys), _pos(0) {}
+
+    virtual bool next(Byte* dst) override
+    {
+        if (_pos == _keys.size())
+            return false;
+
+        UIntCodec::encode(dst, _keys[_pos++]);
+        return true;
+    }
+
+protected:
+    const std::vector<UInt>& _keys;
+    size_t _pos;
+}; // class VectorKeySource
+
+
+/** \brief Тестовый класс для тестирования построителя B-деревьев. */
+class BuilderTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+    /** \brief Проверяет инварианты поддерева страницы \c pnum на глубине \c depth: число ключей
+     *  в узлах, одинаковую глубину листьев; ключи поддерева добавляет в \c keys.
+     */
+    void checkSubtree(BaseBTree& bt, UInt pnum, UInt depth, UInt& leafDepth, std::vector<UInt>& keys)
+    {
+        BaseBTree::PageWrapper pw(&bt);
+        pw.readPage(pnum);
+
+        UShort n = pw.getKeysNum();
+        if (pnum != bt.getRootPageNum())
+        {
+            EXPECT_GE(n, bt.getMinKeys());
+        }
+        EXPECT_LE(n, bt.getMaxKeys());
+
+        if (pw.isLeaf())
+        {
+            if (leafDepth == 0)
+                leafDepth = depth;
+            EXPECT_EQ(leafDepth, depth);
+        }
+
+        for (UShort i = 0; i <= n; ++i)
+        {
+            if (!pw.isLeaf())
+                checkSubtree(bt, pw.getCursor(i), depth + 1, leafDepth, keys);
+            if (i < n)
+                keys.push_back(decodeKey(pw.getKey(i)));
+        }
+    }
+
+    /** \brief Проверяет дерево целиком и возвращает его ключи в порядке обхода. */
+    std::vector<UInt> checkTree(BaseBTree& bt)
+    {
+        std::vector<UInt> keys;
+        UInt leafDepth = 0;
+        checkSubtree(bt, bt.getRootPageNum(), 1, leafDepth, keys);
+        return keys;
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class BuilderTest
+
+
+
+TEST_F(BuilderTest, Build1)
+{
+    std::string& fn = getFn("Build1.xibt");
+    BTreeLexComparator comparator;
+
+    for (UShort order : { 1, 2, 5 })
+    {
+        for (double fill : { 1.0, 0.7, 0.1 })
+        {
+            for (UInt n : { 0u, 1u, 7u, 100u, 2500u })
+            {
+                std::vector<UInt> src;
+                for (UInt i = 0; i < n; ++i)
+                    src.push_back(i * 3 / 2);       // с дубликатами
+
+                FileBaseBTree bt(order, UIntCodec::SIZE, &comparator, fn);
+                VectorKeySource keys(src);
+                BTreeBuilder builder(&bt, fill);
+                builder.build(n, keys);
+
+                ASSERT_EQ(src, checkTree(bt)) << order << " " << fill << " " << n;
+                EXPECT_EQ(1u, bt.getRootPageNum());
+
+                UInt pages = 0;
+                for (UInt l = 0; l < builder.getHeight(); ++l)
+                    pages += builder.getLevelSize(l);
+                EXPECT_EQ(pages, bt.getLastPageNum());
+
+                // дерево пригодно для поиска и вставки (вставка в дерево порядка 1
+                // не поддерживается и обычным деревом)
+                if (n > 0)
+                {
+                    Byte k[UIntCodec::SIZE];
+                    UIntCodec::encode(k, src[n / 2]);
+                    Byte* res = bt.search(k);
+                    ASSERT_NE(nullptr, res);
+                    delete[] res;
+                }
+
+                if (n > 0 && order > 1)
+                {
+                    Byte k[UIntCodec::SIZE];
+                    UIntCodec::encode(k, 1);
+                    bt.insert(k);
+                    src.insert(std::upper_bound(src.begin(), src.end(), 1u), 1u);
+                    EXPECT_EQ(src, checkTree(bt));
+                }
+            }
+        }
+    }
+}
+
+
+TEST_F(BuilderTest, BuildErrors1)
+{
+    std::string& fn = getFn("BuildErrors1.xibt");
+    BTreeLexComparator comparator;
+
+    FileBaseBTree bt(2, UIntCodec::SIZE, &comparator, fn);
+    EXPECT_THROW(BTreeBuilder(&bt, 0.0), std::invalid_argument);
+    EXPECT_THROW(BTreeBuilder(&bt, 1.5), std::invalid_argument);
+
+    // неупорядоченные ключи
+    std::vector<UInt> src = { 1, 2, 5, 3 };
+    {
+        VectorKeySource keys(src);
+        BTreeBuilder builder(&bt);
+        EXPECT_THROW(builder.build(src.size(), keys), std::invalid_argument);
+    }
+
+    // непустое дерево
+    FileBaseBTree bt2(2, UIntCodec::SIZE, &comparator, getFn("BuildErrors1a.xibt"));
+    Byte k[UIntCodec::SIZE];
+    UIntCodec::encode(k, 10);
+    bt2.insert(k);
+    std::vector<UInt> src2 = { 1 };
+    VectorKeySource keys(src2);
+    BTreeBuilder builder(&bt2);
+    EXPECT_THROW(builder.build(1, keys), std::invalid_argument);
+}
+
+
+TEST_F(BuilderTest, Compact1)
+{
+    std::string& fn = getFn("Compact1.xibt");
+    BTreeLexComparator comparator;
+
+    std::vector<UInt> src;
+    {
+        FileBaseBTree bt(3, UIntCodec::SIZE, &comparator, fn);
+        Byte k[UIntCodec::SIZE];
+        for (UInt i = 0; i < 3000; ++i)
+        {
+            UInt v = (i * 7919) % 3001;
+            UIntCodec::encode(k, v);
+            bt.insert(k);
+            src.push_back(v);
+        }
+    }
+    std::sort(src.begin(), src.end());
+
+    FileBaseBTree bt(fn, &comparator);
+    UInt oldPages = bt.getLastPageNum();
+    BTreeBuilder::compactFile(bt, 1.0);
+
+    ASSERT_TRUE(bt.isOpen());
+    EXPECT_EQ(&comparator, bt.getComparator());
+    EXPECT_LT(bt.getLastPageNum(), oldPages);
+    EXPECT_EQ(src, checkTree(bt));
+
+    // листья лежат в файле подряд в порядке ключей
+    std::vector<UInt> leaves;
+    BaseBTree::PageWrapper pw(&bt);
+    for (UInt p = 1; p <= bt.getLastPageNum(); ++p)
+    {
+        pw.readPage(p);
+        if (pw.isLeaf())
+            leaves.push_back(p);
+    }
+    ASSERT_FALSE(leaves.empty());
+    EXPECT_EQ(bt.getLastPageNum(), leaves.back());
+    EXPECT_EQ(leaves.size(), leaves.back() - leaves.front() + 1);
+
+    UInt prevLast = 0;
+    for (UInt p : leaves)
+    {
+        pw.readPage(p);
+        EXPECT_LE(prevLast, decodeKey(pw.getKey(0)));
+        prevLast = decodeKey(pw.getKey(pw.getKeysNum() - 1));
+    }
+
+    // после переоткрытия все на месте
+    bt.close();
+    FileBaseBTree bt2(fn, &comparator);
+    EXPECT_EQ(src, checkTree(bt2));
+}
+
+
+TEST_F(BuilderTest, Layout1)
+{
+    BTreeLexComparator comparator;
+
+    std::vector<UInt> src;
+    FileBaseBTree bt(2, UIntCodec::SIZE, &comparator, getFn("Layout1.xibt"));
+    Byte k[UIntCodec::SIZE];
+    for (UInt i = 0; i < 1000; ++i)
+    {
+        UInt v = (i * 7919) % 1009;
+        UIntCodec::encode(k, v);
+        bt.insert(k);
+        src.push_back(v);
+    }
+    std::sort(src.begin(), src.end());
+
+    for (BTreeBuilder::PageOrder order : { BTreeBuilder::poBreadthFirst, BTreeBuilder::poVanEmdeBoas })
+    {
+        FileBaseBTree dst(2, UIntCodec::SIZE, &comparator,
+                          getFn(order == BTreeBuilder::poVanEmdeBoas ? "Layout1veb.xibt" : "Layout1bfs.xibt"));
+        BTreeBuilder::exportLayout(bt, dst, order);
+
+        EXPECT_EQ(src, checkTree(dst));
+        EXPECT_EQ(bt.getLastPageNum(), dst.getLastPageNum());
+        EXPECT_EQ(1u, dst.getRootPageNum());
+
+        // в переложенном дереве страницы в заданном порядке идут подряд
+        std::vector<UInt> pages;
+        BTreeBuilder::calcPageOrder(dst, order, pages);
+        ASSERT_EQ(dst.getLastPageNum(), pages.size());
+        for (UInt i = 0; i < pages.size(); ++i)
+            EXPECT_EQ(i + 1, pages[i]);
+
+        // непрерывный образ дерева
+        std::vector<Byte> image;
+        BTreeBuilder::readImage(dst, image);
+        EXPECT_EQ((size_t) dst.getNodePageSize() * dst.getLastPageNum(), image.size());
+        EXPECT_EQ(0, memcmp(&image[0], dst.getRootPage().getData(), dst.getNodePageSize()));
+    }
+
+    // ван Эмде Боас для дерева высоты 3: корень, затем каждый ребенок со своими листьями
+    FileBaseBTree small(2, UIntCodec::SIZE, &comparator, getFn("Layout1small.xibt"));
+    std::vector<UInt> keys;
+    for (UInt i = 0; i < 30; ++i)
+        keys.push_back(i);
+    VectorKeySource ks(keys);
+    BTreeBuilder builder(&small, 1.0);
+    builder.build(keys.size(), ks);
+    ASSERT_EQ(3u, builder.getHeight());
+
+    std::vector<UInt> veb;
+    BTreeBuilder::calcPageOrder(small, BTreeBuilder::poVanEmdeBoas, veb);
+    BaseBTree::PageWrapper root(&small);
+    root.readPage(small.getRootPageNum());
+    BaseBTree::PageWrapper child(&small);
+    child.readPage(root.getCursor(0));
+
+    ASSERT_GE(veb.size(), 3u);
+    EXPECT_EQ(small.getRootPageNum(), veb[0]);
+    EXPECT_EQ(root.getCursor(0), veb[1]);
+    EXPECT_EQ(child.getCursor(0), veb[2]);
+}
+
+
+TEST_F(BuilderTest, ParallelBuild1)
+{
+    BTreeLexComparator comparator;
+
+    for (UShort order : { 2, 5 })
+    {
+        for (UInt n : { 0u, 1u, 7u, 100u, 5000u })
+        {
+            std::vector<UInt> src;
+            for (UInt i = 0; i < n; ++i)
+                src.push_back(i * 3 / 2);       // с дубликатами
+
+            // образец — последовательный строитель
+            FileBaseBTree seq(order, UIntCodec::SIZE, &comparator, getFn("ParallelBuild1seq.xibt"));
+            VectorKeySource keys(src);
+            BTreeBuilder builder(&seq, 0.7);
+            builder.build(n, keys);
+            std::vector<Byte> seqImage;
+            BTreeBuilder::readImage(seq, seqImage);
+
+            std::vector<Byte> recs(n * UIntCodec::SIZE + 1);
+            for (UInt i = 0; i < n; ++i)
+                UIntCodec::encode(&recs[i * UIntCodec::SIZE], src[i]);
+
+            std::vector<Byte> shuffled(recs);
+            for (UInt i = 0; i < n; ++i)
+                UIntCodec::encode(&shuffled[i * UIntCodec::SIZE], src[(i * 7919) % n]);
+
+            for (UInt threads : { 1u, 2u, 4u, 7u })
+            {
+                for (bool sorted : { true, false })
+                {
+                    FileBaseBTree bt(order, UIntCodec::SIZE, &comparator, getFn("ParallelBuild1.xibt"));
+                    ParallelBTreeBuilder pb(&bt, 0.7, threads);
+                    pb.build(n, sorted ? recs.data() : shuffled.data(), sorted);
+
+                    ASSERT_EQ(src, checkTree(bt)) << order << " " << n << " " << threads << " " << sorted;
+                    EXPECT_EQ(builder.getHeight(), pb.getHeight());
+
+                    // та же форма и та же раскладка страниц
+                    std::vector<Byte> image;
+                    BTreeBuilder::readImage(bt, image);
+                    EXPECT_EQ(seqImage, image) << order << " " << n << " " << threads;
+                }
+            }
+        }
+    }
+
+    // неупорядоченные записи без сортировки и сортировка без компаратора
+    FileBaseBTree bt(2, UIntCodec::SIZE, &comparator, getFn("ParallelBuild1.xibt"));
+    std::vector<Byte> recs(3 * UIntCodec::SIZE);
+    UIntCodec::encode(&recs[0], 1);
+    UIntCodec::encode(&recs[UIntCodec::SIZE], 3);
+    UIntCodec::encode(&recs[2 * UIntCodec::SIZE], 2);
+    ParallelBTreeBuilder pb(&bt, 1.0, 2);
+    EXPECT_THROW(pb.build(3, recs.data(), true), std::invalid_argument);
+
+    FileBaseBTree noCmp(2, UIntCodec::SIZE, nullptr, getFn("ParallelBuild1a.xibt"));
+    ParallelBTreeBuilder pb2(&noCmp, 1.0, 2);
+    EXPECT_THROW(pb2.build(3, recs.data(), false), std::runtime_error);
+}
+
+
+// потоки пишут страницы через собственные дескрипторы в обход кэша дерева
+TEST_F(BuilderTest, ParallelBuild2)
+{
+    std::string fn = getFn("ParallelBuild2.xibt");
+    BTreeLexComparator comparator;
+
+    const UInt n = 20000;
+    std::vector<UInt> src;
+    std::vector<Byte> recs(n * UIntCodec::SIZE);
+    for (UInt i = 0; i < n; ++i)
+    {
+        src.push_back(i);
+        UIntCodec::encode(&recs[i * UIntCodec::SIZE], i);
+    }
+
+    FileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setPageChecksums(true);
+    bt.setCacheSize(8);
+    bt.setWriteBack(true);
+    bt.createForPageSize(512, UIntCodec::SIZE, fn);
+    ASSERT_TRUE(bt.canAccessPagesDirectly());          // потоки пишут сами
+
+    ParallelBTreeBuilder pb(&bt, 1.0, 4);
+    pb.build(n, recs.data());
+    EXPECT_LT(pb.getSplitLevel(), pb.getHeight());
+    EXPECT_LE(bt.getLastPageNum() - 1, bt.getStats().pageWrites);  // все, кроме отложенного корня
+    ASSERT_EQ(src, checkTree(bt));
+    bt.close();
+
+    bt.open(fn);
+    EXPECT_EQ(0u, bt.verifyPages());
+    EXPECT_EQ(src, checkTree(bt));
+}
+
+
+TEST_F(BuilderTest, ExternalSort1)
+{
+    BTreeLexComparator comparator;
+
+    std::vector<UInt> src;
+    for (UInt i = 0; i < 20000; ++i)
+        src.push_back((i * 7919) % 10007);          // с дубликатами
+    std::vector<UInt> expected(src);
+    std::sort(expected.begin(), expected.end());
+
+    // все в памяти, одно слияние и многоступенчатое слияние
+    for (size_t budget : { (size_t) 1 << 20, (size_t) 64 << 10, (size_t) 8 << 10 })
+    {
+        ExternalSorter sorter(UIntCodec::SIZE, &comparator, budget, getFn("ExternalSort1"));
+        Byte k[UIntCodec::SIZE];
+        for (UInt v : src)
+        {
+            UIntCodec::encode(k, v);
+            sorter.add(k);
+        }
+        sorter.finish();
+        EXPECT_EQ(src.size(), sorter.getCount());
+
+        std::vector<UInt> sorted;
+        while (sorter.next(k))
+            sorted.push_back(decodeKey(k));
+        EXPECT_EQ(expected, sorted) << budget;
+
+        if (budget == (size_t) 1 << 20)
+        {
+            EXPECT_EQ(0u, sorter.getRunsNum());
+        }
+        else
+        {
+            EXPECT_LT(1u, sorter.getRunsNum());
+        }
+        if (budget == (size_t) 8 << 10)
+        {
+            EXPECT_LT(0u, sorter.getMergePasses());
+        }
+    }
+
+    // загрузка дерева из файла неупорядоченных записей
+    std::string recsFn = getFn("ExternalSort1.bin");
+    {
+        std::ofstream recs(recsFn, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+        Byte k[UIntCodec::SIZE];
+        for (UInt v : src)
+        {
+            UIntCodec::encode(k, v);
+            recs.write((const char*) k, UIntCodec::SIZE);
+        }
+    }
+
+    FileBaseBTree bt(3, UIntCodec::SIZE, &comparator, getFn("ExternalSort1.xibt"));
+    EXPECT_EQ(src.size(), ExternalSorter::ingestFile(recsFn, bt, 16 << 10));
+    EXPECT_EQ(expected, checkTree(bt));
+
+    // серии за собой удалены
+    EXPECT_FALSE(std::ifstream(bt.getFileName() + ".run0").is_open());
+
+    EXPECT_THROW(ExternalSorter(UIntCodec::SIZE, &comparator, 8, "x"), std::invalid_argument);
+}
+
+
+TEST_F(BuilderTest, Analyze1)
+{
+    BTreeLexComparator comparator;
+    BTreeAnalyzer analyzer;
+
+    FileBaseBTree bt(2, UIntCodec::SIZE, &comparator, getFn("Analyze1.xibt"));
+    analyzer.analyze(bt);
+    EXPECT_EQ(1u, analyzer.getHeight());                 // новое дерево — пустой корень-лист
+    EXPECT_EQ(0u, analyzer.getKeysNum());
+
+    std::vector<UInt> src;
+    Byte k[UIntCodec::SIZE];
+    for (UInt i = 0; i < 1000; ++i)
+    {
+        UInt v = (i * 7919) % 1009;
+        UIntCodec::encode(k, v);
+        bt.insert(k);
+        src.push_back(v);
+    }
+    std::sort(src.begin(), src.end());
+
+    analyzer.analyze(bt);
+    ASSERT_GT(analyzer.getHeight(), 1u);
+    EXPECT_EQ(1000u, analyzer.getKeysNum());
+    EXPECT_EQ(bt.getLastPageNum(), analyzer.getNodesNum());
+    EXPECT_EQ(0u, analyzer.getOrphanPages());
+    EXPECT_EQ(1u, analyzer.getLevel(0).nodes);
+
+    // гистограммы и байты страниц согласованы со счетчиками уровней
+    for (UInt l = 0; l < analyzer.getHeight(); ++l)
+    {
+        const BTreeAnalyzer::Level& lv = analyzer.getLevel(l);
+        UInt nodes = 0;
+        unsigned long long keys = 0;
+        for (UInt n = 0; n < lv.keysHist.size(); ++n)
+        {
+            nodes += lv.keysHist[n];
+            keys += (unsigned long long) n * lv.keysHist[n];
+        }
+        EXPECT_EQ(lv.nodes, nodes);
+        EXPECT_EQ(lv.keys, keys);
+        EXPECT_EQ((unsigned long long) lv.nodes * bt.getNodePageSize(), lv.usedBytes + lv.wastedBytes);
+        if (l > 0)
+        {
+            EXPECT_GE(lv.minKeys, bt.getMinKeys());
+        }
+    }
+
+    // построенное дерево заполнено плотнее, а его листья лежат в файле подряд
+    FileBaseBTree built(2, UIntCodec::SIZE, &comparator, getFn("Analyze1built.xibt"));
+    VectorKeySource ks(src);
+    BTreeBuilder builder(&built, 1.0);
+    builder.build(src.size(), ks);
+
+    BTreeAnalyzer builtAnalyzer;
+    builtAnalyzer.analyze(built);
+    EXPECT_EQ(1000u, builtAnalyzer.getKeysNum());
+    EXPECT_EQ(builder.getHeight(), builtAnalyzer.getHeight());
+    EXPECT_GT(builtAnalyzer.getFillFactor(), analyzer.getFillFactor());
+    EXPECT_LT(builtAnalyzer.getWastedBytes(), analyzer.getWastedBytes());
+
+    const BTreeAnalyzer::Level& leaves = builtAnalyzer.getLevel(builtAnalyzer.getHeight() - 1);
+    EXPECT_EQ(leaves.getSiblingPairs(), leaves.seqSiblings);
+    EXPECT_DOUBLE_EQ(1.0, builtAnalyzer.getSiblingLocality());
+    EXPECT_LT(analyzer.getSiblingLocality(), 1.0);
+}
@@ -0,0 +1,323 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для B-деревьев со сжатыми страницами
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <random>
+#include <fstream>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/stat.h>         // mkdir
+#endif
+
+#include "compressed_btree.h"
+#include "btree_builder.h"
+#include "page_codec.h"
+#include "btree_adapters.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+typedef OrderedKeyCodec<UInt> UIntCodec;
+
+
+/** \brief Тестовый класс для тестирования деревьев со сжатыми страницами. */
+class CompressedTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+    /** \brief Вставляет в дерево \c bt ключи 0, step, 2 * step, ... (всего n) вперемешку. */
+    static void fill(BaseBTree& bt, UInt n, UInt step)
+    {
+        Byte k[UIntCodec::SIZE];
+        for (UInt i = 0; i < n; ++i)
+        {
+            UIntCodec::encode(k, ((i * 7919) % n) * step);
+            bt.insert(k);
+        }
+    }
+
+    /** \brief Проверяет, что в дереве \c bt есть все ключи, вставленные fill(), и нет лишних. */
+    static void checkAll(BaseBTree& bt, UInt n, UInt step)
+    {
+        Byte k[UIntCodec::SIZE];
+        for (UInt i = 0; i < n; ++i)
+        {
+            UIntCodec::encode(k, i * step);
+            Byte* res = bt.search(k);
+            ASSERT_NE(nullptr, res) << i;
+            EXPECT_EQ(0, memcmp(k, res, UIntCodec::SIZE));
+            delete[] res;
+        }
+
+        UIntCodec::encode(k, n * step);
+        EXPECT_EQ(nullptr, bt.search(k));
+    }
+
+    /** \brief Возвращает число листьев дерева \c bt, записанных кодеком \c codec. */
+    static UInt countCodec(CompressedFileBaseBTree& bt, Byte codec)
+    {
+        UInt num = 0;
+        for (UInt p = 1; p <= bt.getLastPageNum(); ++p)
+            num += (bt.getPageMapEntry(p).codec == codec);
+
+        return num;
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class CompressedTest
+
+
+
+TEST_F(CompressedTest, IntKeysCodec1)
+{
+    std::mt19937 rnd(2017);
+    std::vector<Byte> keys(8 * 300), out(8 * 300), buf(8 * 300 + 64);
+
+    for (UShort recSize = 1; recSize <= 8; ++recSize)
+    {
+        // по неубыванию — разности, вперемешку — от минимума
+        for (int sorted = 0; sorted < 2; ++sorted)
+        {
+            unsigned long long v = rnd();
+            for (UShort i = 0; i < 300; ++i)
+            {
+                v = sorted ? v + rnd() % 5 : (unsigned long long) rnd() * rnd();
+                for (UShort b = 0; b < recSize; ++b)
+                    keys[i * recSize + b] = (Byte) (v >> (8 * (recSize - 1 - b)));
+            }
+
+            size_t n = encodeIntKeys(keys.data(), 300, recSize, buf.data(), buf.size());
+            ASSERT_NE(0u, n);
+            if (sorted && recSize >= 2)
+            {
+                EXPECT_GT((size_t) 300 * recSize / 2, n);
+            }
+
+            std::fill(out.begin(), out.end(), 0xAA);
+            ASSERT_TRUE(decodeIntKeys(buf.data(), n, out.data(), 300, recSize));
+            EXPECT_EQ(0, memcmp(keys.data(), out.data(), (size_t) 300 * recSize)) << recSize;
+
+            EXPECT_FALSE(decodeIntKeys(buf.data(), n - 1, out.data(), 300, recSize));
+        }
+    }
+
+    // пустой набор и нехватка места
+    EXPECT_NE(0u, encodeIntKeys(keys.data(), 0, 4, buf.data(), buf.size()));
+    EXPECT_EQ(0u, encodeIntKeys(keys.data(), 300, 8, buf.data(), 16));
+    EXPECT_EQ(0u, encodeIntKeys(keys.data(), 10, 9, buf.data(), buf.size()));
+}
+
+
+TEST_F(CompressedTest, LzCodec1)
+{
+    std::mt19937 rnd(2017);
+    std::vector<Byte> src(10000), out(10000), buf(11000);
+
+    // повторяющиеся данные с длинными совпадениями и литералами
+    for (size_t i = 0; i < src.size(); ++i)
+        src[i] = (i % 1000 < 700) ? (Byte) (i % 13) : (Byte) rnd();
+
+    size_t n = lzCompress(src.data(), src.size(), buf.data(), buf.size());
+    ASSERT_NE(0u, n);
+    EXPECT_GT(src.size() / 2, n);
+    ASSERT_TRUE(lzDecompress(buf.data(), n, out.data(), out.size()));
+    EXPECT_TRUE(src == out);
+
+    // неверный размер результата и обрезанные данные
+    EXPECT_FALSE(lzDecompress(buf.data(), n, out.data(), out.size() - 1));
+    EXPECT_FALSE(lzDecompress(buf.data(), n / 2, out.data(), out.size()));
+
+    // случайные данные не сжимаются
+    for (Byte& b : src)
+        b = (Byte) rnd();
+    EXPECT_EQ(0u, lzCompress(src.data(), src.size(), buf.data(), src.size()));
+
+    n = lzCompress(src.data(), 3, buf.data(), buf.size());
+    ASSERT_TRUE(lzDecompress(buf.data(), n, out.data(), 3));
+    EXPECT_EQ(0, memcmp(src.data(), out.data(), 3));
+}
+
+
+TEST_F(CompressedTest, CompressedTree1)
+{
+    std::string& fn = getFn("CompressedTree1.xibt");
+    BTreeLexComparator comparator;
+    unsigned long long dataSize;
+
+    {
+        CompressedFileBaseBTree bt(4096, UIntCodec::SIZE, &comparator, fn);
+        EXPECT_EQ(fn + CompressedFileBaseBTree::DATA_FILE_SUFFIX, bt.getDataFileName());
+        fill(bt, 20000, 3);
+        checkAll(bt, 20000, 3);
+
+        // листья с близкими целыми ключами жмутся в разы
+        EXPECT_LT(0u, countCodec(bt, CompressedFileBaseBTree::pcIntKeys));
+        EXPECT_GT((unsigned long long) bt.getLastPageNum() * 4096 / 3, bt.getStoredSize());
+        EXPECT_LE(bt.getStoredSize(), bt.getDataSize());
+        dataSize = bt.getDataSize();
+    }
+
+    // чтение с диска; свободные места восстанавливаются по таблице и переиспользуются
+    CompressedFileBaseBTree bt2(fn, &comparator);
+    EXPECT_EQ(dataSize, bt2.getDataSize());
+    checkAll(bt2, 20000, 3);
+    fill(bt2, 1000, 60);
+    EXPECT_GT(dataSize * 2, bt2.getDataSize());
+
+    // обычное дерево такой файл не примет, а сжатое — обычный
+    FileBaseBTree plain;
+    EXPECT_THROW(plain.open(fn), std::runtime_error);
+    EXPECT_FALSE(plain.isOpen());
+
+    FileBaseBTree plain2;
+    plain2.createForPageSize(4096, UIntCodec::SIZE, getFn("CompressedTree1a.xibt"));
+    plain2.close();
+    CompressedFileBaseBTree bt3;
+    EXPECT_THROW(bt3.open(getFn("CompressedTree1a.xibt")), std::runtime_error);
+
+    // только выровненная геометрия
+    EXPECT_THROW(bt3.create(2, 4, getFn("CompressedTree1b.xibt")), std::invalid_argument);
+    EXPECT_FALSE(bt3.isOpen());
+}
+
+
+TEST_F(CompressedTest, CompressedTree2)
+{
+    std::string& fn = getFn("CompressedTree2.xibt");
+    BTreeLexComparator comparator;
+
+    // общий кодек, кэш и контрольные суммы страниц поверх сжатия
+    CompressedFileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setLeafCompression(CompressedFileBaseBTree::lcGeneric);
+    bt.setPageChecksums(true);
+    bt.setCacheSize(16);
+    bt.createForPageSize(1024, UIntCodec::SIZE, fn);
+    fill(bt, 5000, 1000);
+    EXPECT_EQ(0u, countCodec(bt, CompressedFileBaseBTree::pcIntKeys));
+    EXPECT_LT(0u, countCodec(bt, CompressedFileBaseBTree::pcLz));
+    EXPECT_EQ(0u, bt.verifyPages());
+    bt.close();
+
+    bt.open(fn);
+    bt.setComparator(&comparator);                  // close() сбрасывает компаратор
+    EXPECT_TRUE(bt.hasPageChecksums());
+    checkAll(bt, 5000, 1000);
+
+    // без сжатия страницы просто отображаются в файл данных
+    bt.close();
+    bt.setLeafCompression(CompressedFileBaseBTree::lcNone);
+    bt.setPageChecksums(false);
+    bt.setComparator(&comparator);
+    bt.createForPageSize(1024, UIntCodec::SIZE, fn);
+    fill(bt, 2000, 1);
+    EXPECT_EQ(bt.getLastPageNum(), countCodec(bt, CompressedFileBaseBTree::pcRaw));
+    EXPECT_EQ((unsigned long long) bt.getLastPageNum() * 1024, bt.getStoredSize());
+    checkAll(bt, 2000, 1);
+}
+
+
+TEST_F(CompressedTest, CompactFile1)
+{
+    std::string fn = getFn("CompactFile1.xibt");
+    BTreeLexComparator comparator;
+
+    CompressedFileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setLeafCompression(CompressedFileBaseBTree::lcGeneric);
+    bt.createForPageSize(1024, UIntCodec::SIZE, fn);
+    fill(bt, 5000, 7);
+    UInt pagesBefore = bt.getLastPageNum();
+
+    // дерево пересобирается сжатым вместе с файлом данных
+    BTreeBuilder::compactFile(bt);
+    ASSERT_TRUE(bt.isOpen());
+    EXPECT_EQ(CompressedFileBaseBTree::lcGeneric, bt.getLeafCompression());
+    EXPECT_GT(pagesBefore, bt.getLastPageNum());
+    EXPECT_LT(0u, countCodec(bt, CompressedFileBaseBTree::pcLz));
+    checkAll(bt, 5000, 7);
+    bt.close();
+
+    // временные файлы не остаются
+    EXPECT_FALSE(std::ifstream(fn + ".compact").good());
+    EXPECT_FALSE(std::ifstream(fn + ".compact" + CompressedFileBaseBTree::DATA_FILE_SUFFIX).good());
+
+    CompressedFileBaseBTree bt2(fn, &comparator);
+    checkAll(bt2, 5000, 7);
+}
+
+
+#ifndef _WIN32
+// не удалось заместить второй файл (файл данных): дерево остается прежним и целым
+TEST_F(CompressedTest, CompactFile2)
+{
+    std::string fn = getFn("CompactFile2.xibt");
+    BTreeLexComparator comparator;
+
+    CompressedFileBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.setLeafCompression(CompressedFileBaseBTree::lcGeneric);
+    bt.createForPageSize(1024, UIntCodec::SIZE, fn);
+    fill(bt, 3000, 7);
+    UInt pagesBefore = bt.getLastPageNum();
+
+    // на месте резервной копии файла данных — непустой каталог: отложить файл данных нельзя
+    std::string dataFile = fn + CompressedFileBaseBTree::DATA_FILE_SUFFIX;
+    std::string blocker = dataFile + ".bak";
+    std::string blockerFile = blocker + "/keep";
+    ASSERT_EQ(0, mkdir(blocker.c_str(), 0700));
+    std::ofstream(blockerFile.c_str()) << "x";
+
+    EXPECT_THROW(BTreeBuilder::compactFile(bt), std::runtime_error);
+    std::remove(blockerFile.c_str());
+    std::remove(blocker.c_str());
+
+    ASSERT_TRUE(bt.isOpen());
+    EXPECT_EQ(pagesBefore, bt.getLastPageNum());
+    checkAll(bt, 3000, 7);
+    bt.close();
+
+    // ни временных файлов, ни резервной копии основного файла
+    EXPECT_FALSE(std::ifstream(fn + ".compact").good());
+    EXPECT_FALSE(std::ifstream(fn + ".compact" + CompressedFileBaseBTree::DATA_FILE_SUFFIX).good());
+    EXPECT_FALSE(std::ifstream(fn + ".bak").good());
+
+    CompressedFileBaseBTree bt2(fn, &comparator);
+    EXPECT_EQ(pagesBefore, bt2.getLastPageNum());
+    checkAll(bt2, 3000, 7);
+
+    // без помехи то же дерево уплотняется
+    BTreeBuilder::compactFile(bt2);
+    EXPECT_GT(pagesBefore, bt2.getLastPageNum());
+    checkAll(bt2, 3000, 7);
+    EXPECT_FALSE(std::ifstream(fn + ".bak").good());
+    EXPECT_FALSE(std::ifstream(dataFile + ".bak").good());
+}
+#endif // _WIN32
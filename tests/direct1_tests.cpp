@@ -0,0 +1,513 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для B-деревьев с собственным кэшем и O_DIRECT
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "direct_btree.h"
+#include "btree_adapters.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+/** \brief Тестовый класс для тестирования кэша страниц и небуферизованного ввода-вывода. */
+class DirectTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class DirectTest
+
+
+
+TEST_F(DirectTest, PageCache1)
+{
+    PageCache pc;
+    EXPECT_FALSE(pc.isEnabled());
+
+    pc.reset(2, 64, 64);
+    EXPECT_TRUE(pc.isEnabled());
+    EXPECT_EQ(nullptr, pc.find(1));
+
+    Byte* f1 = pc.insert(1);
+    EXPECT_EQ(0u, (size_t)f1 % 64);
+    f1[0] = 'A';
+    pc.insert(2)[0] = 'B';
+    EXPECT_EQ(2u, pc.getSize());
+
+    // 1 становится самой свежей, поэтому вытесняется 2
+    EXPECT_EQ('A', pc.find(1)[0]);
+    pc.insert(3)[0] = 'C';
+    EXPECT_TRUE(pc.contains(1));
+    EXPECT_FALSE(pc.contains(2));
+    EXPECT_TRUE(pc.contains(3));
+
+    pc.invalidate(1);
+    EXPECT_FALSE(pc.contains(1));
+    EXPECT_EQ(1u, pc.getSize());
+}
+
+
+TEST_F(DirectTest, CachedTree1)
+{
+    std::string& fn = getFn("CachedTree1.xibt");
+
+    BTreeOrderedIntAdapter bt;
+    bt.getTree().setCacheSize(4);                   // гораздо меньше, чем страниц в дереве
+    bt.create(3, fn);
+    EXPECT_EQ(4u, bt.getTree().getPageCache().getCapacity());
+
+    for (int i = 0; i < 500; ++i)
+        bt.insert((i * 7) % 500);
+
+    EXPECT_LT(4u, bt.getTree().getLastPageNum());
+    EXPECT_EQ(4u, bt.getTree().getPageCache().getSize());
+
+    int res;
+    for (int i = 0; i < 500; ++i)
+    {
+        ASSERT_TRUE(bt.search(i, res));
+        EXPECT_EQ(i, res);
+    }
+
+    // то же самое, прочитанное без кэша
+    bt.close();
+    BTreeOrderedIntAdapter bt2(fn);
+    EXPECT_EQ(0u, bt2.getTree().getPageCache().getCapacity());
+    for (int i = 0; i < 500; ++i)
+        ASSERT_TRUE(bt2.search(i, res));
+}
+
+
+// простой сравниватель байт
+struct DirectByteComparator : public BaseBTree::IComparator {
+    virtual bool compare(const Byte* lhv, const Byte* rhv, UInt sz) override
+    {
+        return memcmp(lhv, rhv, sz) < 0;
+    }
+
+    virtual bool isEqual(const Byte* lhv, const Byte* rhv, UInt sz) override
+    {
+        return memcmp(lhv, rhv, sz) == 0;
+    }
+};
+
+
+TEST_F(DirectTest, DirectTree1)
+{
+    std::string& fn = getFn("DirectTree1.xibt");
+
+    DirectByteComparator comparator;
+    const UShort REC_SZ = 100;
+
+    {
+        DirectFileBaseBTree bt(4096, REC_SZ, &comparator, fn);
+        bt.setCacheSize(8);
+        EXPECT_TRUE(bt.isPageAligned());
+        EXPECT_EQ(4096u, bt.getNodePageSize());
+
+        Byte k[REC_SZ];
+        for (int i = 0; i < 1000; ++i)
+        {
+            memset(k, 0, REC_SZ);
+            sprintf((char*)k, "key-%06d", (i * 389) % 1000);
+            bt.insert(k);
+        }
+
+        // невыровненный пользовательский буфер читается через промежуточный
+        Byte* raw = new Byte[4096 + 1];
+        bt.readPage(bt.getRootPageNum(), raw + 1);
+        EXPECT_FALSE(((BaseBTree::PageWrapper&)bt.getRootPage()).isLeaf());
+        EXPECT_EQ(0, memcmp(raw + 1, bt.getRootPage().getData(), 4096));
+        delete[] raw;
+    }
+
+    // читаем обычным деревом через поток: все, что записано в обход кэша ОС, на месте
+    FileBaseBTree bt2(fn, &comparator);
+    EXPECT_EQ(4096u, bt2.getNodePageSize());
+
+    Byte k[REC_SZ];
+    for (int i = 0; i < 1000; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "key-%06d", i);
+        Byte* res = bt2.search(k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+    }
+    bt2.close();
+
+    // и снова небуферизованным
+    DirectFileBaseBTree bt3(fn, &comparator);
+    memset(k, 0, REC_SZ);
+    sprintf((char*)k, "key-%06d", 999);
+    Byte* res = bt3.search(k);
+    ASSERT_NE(nullptr, res);
+    delete[] res;
+}
+
+
+TEST_F(DirectTest, WriteBack1)
+{
+    std::string& fn = getFn("WriteBack1.xibt");
+
+    DirectByteComparator comparator;
+    const UShort REC_SZ = 100;
+
+    {
+        DirectFileBaseBTree bt(4096, REC_SZ, &comparator, fn);
+        bt.setCacheSize(64);
+        bt.setWriteBack(true);
+        EXPECT_TRUE(bt.isWriteBack());
+
+        Byte k[REC_SZ];
+        for (int i = 0; i < 300; ++i)
+        {
+            memset(k, 0, REC_SZ);
+            sprintf((char*)k, "key-%06d", (i * 389) % 1000);
+            bt.insert(k);
+        }
+
+        // все страницы дерева помещаются в кэш, поэтому на носитель еще ничего не сброшено
+        UInt pages = bt.getLastPageNum();
+        EXPECT_LT(1u, pages);
+        EXPECT_GT(64u, pages);
+        EXPECT_EQ(pages, bt.getPageCache().getDirtyCount());
+
+        bt.checkpoint();
+        EXPECT_EQ(0u, bt.getPageCache().getDirtyCount());
+
+        // кэш меньше дерева: грязные страницы сбрасываются при вытеснении
+        bt.setCacheSize(4);
+        for (int i = 300; i < 1000; ++i)
+        {
+            memset(k, 0, REC_SZ);
+            sprintf((char*)k, "key-%06d", (i * 389) % 1000);
+            bt.insert(k);
+        }
+        EXPECT_LT(4u, bt.getLastPageNum());
+        EXPECT_GE(4u, bt.getPageCache().getDirtyCount());
+    }                                                   // остальное сбрасывает закрытие
+
+    FileBaseBTree bt2(fn, &comparator);
+    Byte k[REC_SZ];
+    for (int i = 0; i < 1000; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "key-%06d", i);
+        Byte* res = bt2.search(k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+    }
+}
+
+/** \brief Дерево, запись страниц которого по флагу завершается ошибкой. */
+class FailingWriteBTree : public FileBaseBTree {
+public:
+    FailingWriteBTree() : failWrites(false) {}
+
+    bool failWrites;
+
+protected:
+    virtual void writePageInternal(UInt pnum, const Byte* src) override
+    {
+        if (failWrites)
+            throw std::runtime_error("Write failed");
+        FileBaseBTree::writePageInternal(pnum, src);
+    }
+
+    virtual void writePagesInternal(UInt n, const UInt* pnums, const Byte* const* srcs) override
+    {
+        if (failWrites)
+            throw std::runtime_error("Write failed");
+        FileBaseBTree::writePagesInternal(n, pnums, srcs);
+    }
+}; // class FailingWriteBTree
+
+
+TEST_F(DirectTest, WriteBack2)
+{
+    std::string& fn = getFn("WriteBack2.xibt");
+    DirectByteComparator comparator;
+
+    FailingWriteBTree bt;
+    bt.setComparator(&comparator);
+    bt.create(3, 4, fn);
+    bt.setCacheSize(16);
+    bt.setWriteBack(true);
+
+    Byte k[4] = { 0 };
+    for (Byte i = 0; i < 20; ++i)
+    {
+        k[3] = i;
+        bt.insert(k);
+    }
+    ASSERT_LT(0u, bt.getPageCache().getDirtyCount());
+
+    // ошибка записи отложенных страниц доходит до вызывающего, дерево остается открытым
+    bt.failWrites = true;
+    EXPECT_THROW(bt.close(), std::runtime_error);
+    EXPECT_TRUE(bt.isOpen());
+    EXPECT_LT(0u, bt.getPageCache().getDirtyCount());
+
+    // повторное закрытие сбрасывает страницы
+    bt.failWrites = false;
+    bt.close();
+    EXPECT_FALSE(bt.isOpen());
+
+    FileBaseBTree bt2(fn, &comparator);
+    for (Byte i = 0; i < 20; ++i)
+    {
+        k[3] = i;
+        Byte* res = bt2.search(k);
+        ASSERT_NE(nullptr, res);
+        delete[] res;
+    }
+
+    // без исключений закрытие, как в деструкторе, теряет страницы молча
+    bt.setComparator(&comparator);
+    bt.open(fn);
+    bt.setCacheSize(16);
+    bt.setWriteBack(true);
+    k[3] = 100;
+    bt.insert(k);
+    bt.failWrites = true;
+    bt.closeNoThrow();
+    EXPECT_FALSE(bt.isOpen());
+}
+
+
+TEST_F(DirectTest, DirectFallback1)
+{
+    std::string& fn = getFn("DirectFallback1.xibt");
+
+    // для обычной геометрии страницы обслуживает поток
+    DirectFileBaseBTree bt;
+    bt.create(2, 10, fn);
+    EXPECT_FALSE(bt.isDirectIO());
+
+    FileBaseBTree::PageWrapper wp(&bt);
+    bt.allocPage(wp, 1, true);
+    wp.readPage(2);
+    EXPECT_TRUE(wp.isLeaf());
+    EXPECT_EQ(1, wp.getKeysNum());
+}
+
+
+TEST_F(DirectTest, AsyncIO1)
+{
+#ifndef _WIN32
+    std::string& fn = getFn("AsyncIO1.bin");
+
+    const UInt PAGE_SZ = 4096;
+    const UInt PAGES = 64;
+
+    // файл из страниц, заполненных своими номерами
+    Byte* buf = allocAligned(PAGE_SZ * PAGES, PAGE_SZ);
+    for (UInt i = 0; i < PAGES; ++i)
+        memset(buf + i * PAGE_SZ, (int) i, PAGE_SZ);
+    {
+        std::ofstream f(fn, std::ios::binary | std::ios::trunc);
+        f.write((const char*) buf, PAGE_SZ * PAGES);
+    }
+    memset(buf, 0xFF, PAGE_SZ * PAGES);
+
+    int fd = ::open(fn.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+
+    std::vector<IAsyncPageIO*> engines;
+    engines.push_back(new ThreadPoolPageIO(fd, 3));
+#ifdef __linux__
+    IAsyncPageIO* uring = UringPageIO::create(fd, 8);   // может быть запрещен в песочнице
+    if (uring)
+        engines.push_back(uring);
+#endif
+
+    for (IAsyncPageIO* engine : engines)
+    {
+        // запросов больше, чем глубина очереди; страницы читаем вразнобой,
+        // последний запрос — за концом файла
+        std::vector<PageIORequest> reqs(PAGES);
+        for (UInt i = 0; i < PAGES; ++i)
+        {
+            PageIORequest& r = reqs[i];
+            r.buf = buf + i * PAGE_SZ;
+            r.size = PAGE_SZ;
+            r.offset = (long long) ((i * 37) % PAGES) * PAGE_SZ;
+            r.isWrite = false;
+            r.result = 0;
+        }
+        reqs[PAGES - 1].offset = (long long) PAGES * PAGE_SZ;
+
+        engine->execute(reqs.data(), PAGES);
+        for (UInt i = 0; i + 1 < PAGES; ++i)
+        {
+            EXPECT_EQ((long) PAGE_SZ, reqs[i].result) << engine->getName();
+            EXPECT_EQ((Byte) ((i * 37) % PAGES), buf[i * PAGE_SZ + PAGE_SZ - 1]) << engine->getName();
+        }
+        EXPECT_EQ(0, reqs[PAGES - 1].result) << engine->getName();
+
+        // запись через движок видна синхронному чтению
+        memset(buf, 0xAB, PAGE_SZ);
+        PageIORequest w = { buf, PAGE_SZ, 0, true, 0 };
+        engine->execute(&w, 1);
+        EXPECT_EQ((long) PAGE_SZ, w.result);
+
+        PageIORequest r = { buf + PAGE_SZ, PAGE_SZ, 0, false, 0 };
+        IAsyncPageIO::executeSync(fd, r);
+        EXPECT_EQ((long) PAGE_SZ, r.result);
+        EXPECT_EQ(0xAB, buf[PAGE_SZ + 100]);
+
+        // возвращаем страницу на место для следующего движка
+        memset(buf, 0, PAGE_SZ);
+        IAsyncPageIO::executeSync(fd, w);
+
+        delete engine;
+    }
+
+    ::close(fd);
+    freeAligned(buf);
+#endif
+}
+
+
+TEST_F(DirectTest, BatchRead1)
+{
+    std::string& fn = getFn("BatchRead1.xibt");
+
+    DirectByteComparator comparator;
+    const UShort REC_SZ = 100;
+
+    DirectFileBaseBTree bt(4096, REC_SZ, &comparator, fn);
+    Byte k[REC_SZ];
+    for (int i = 0; i < 2000; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "key-%06d", (i * 389) % 2000);
+        bt.insert(k);
+    }
+
+    const UInt PAGES = bt.getLastPageNum();
+    ASSERT_GT(PAGES, 20u);
+
+    // эталон — постраничное чтение
+    std::vector<Byte> expected((size_t) PAGES * 4096);
+    for (UInt p = 1; p <= PAGES; ++p)
+        bt.readPage(p, &expected[(size_t) (p - 1) * 4096]);
+
+    // пакетное чтение в обход кэша, в том числе в невыровненные буферы
+    bt.setCacheSize(0);
+    std::vector<UInt> pnums;
+    for (UInt p = PAGES; p >= 1; --p)
+        pnums.push_back(p);
+    std::vector<Byte> raw((size_t) PAGES * 4096 + 1);
+    std::vector<Byte*> dsts;
+    for (UInt i = 0; i < PAGES; ++i)
+        dsts.push_back(&raw[1 + (size_t) i * 4096]);
+
+    bt.readPages(PAGES, pnums.data(), dsts.data());
+    for (UInt i = 0; i < PAGES; ++i)
+        EXPECT_EQ(0, memcmp(dsts[i], &expected[(size_t) (pnums[i] - 1) * 4096], 4096));
+
+    // упреждающее чтение загружает в кэш не больше его емкости
+    bt.setCacheSize(8);
+    bt.prefetchPages(PAGES, pnums.data());
+    EXPECT_EQ(8u, bt.getPageCache().getSize());
+    EXPECT_TRUE(bt.getPageCache().contains(PAGES));
+    EXPECT_FALSE(bt.getPageCache().contains(1));
+
+    // пакет из попаданий и промахов
+    bt.readPages(PAGES, pnums.data(), dsts.data());
+    for (UInt i = 0; i < PAGES; ++i)
+        EXPECT_EQ(0, memcmp(dsts[i], &expected[(size_t) (pnums[i] - 1) * 4096], 4096));
+
+    if (bt.isDirectIO())
+    {
+        EXPECT_NE(nullptr, bt.getAsyncIOName());
+    }
+}
+
+
+TEST_F(DirectTest, ReadAhead1)
+{
+    std::string& fn = getFn("ReadAhead1.xibt");
+
+    DirectByteComparator comparator;
+    const UShort REC_SZ = 100;
+
+    DirectFileBaseBTree bt(4096, REC_SZ, &comparator, fn);
+    Byte k[REC_SZ];
+    for (int i = 0; i < 3000; ++i)
+    {
+        memset(k, 0, REC_SZ);
+        sprintf((char*)k, "key-%06d", (i * 389) % 3000);
+        bt.insert(k);
+    }
+
+    // сбрасываем кэш, чтобы листья пришлось читать
+    bt.setCacheSize(0);
+    bt.setCacheSize(64);
+
+    BaseBTree::RangeCursor cur(&bt);
+    cur.setReadAhead(4);
+    cur.seek(nullptr);
+    ASSERT_TRUE(cur.next());
+
+    // с асинхронным движком соседние листья еще читаются, пока обрабатывается первый
+    if (bt.getAsyncIOName())
+    {
+        EXPECT_TRUE(bt.isPrefetchPending());
+    }
+
+    int num = 1;
+    while (cur.next())
+    {
+        char expected[REC_SZ];
+        sprintf(expected, "key-%06d", num);
+        EXPECT_STREQ(expected, (const char*)cur.getKey());
+        ++num;
+    }
+    EXPECT_EQ(3000, num);
+
+    // любое обращение к кэшу дожидается чтения
+    bt.checkpoint();
+    EXPECT_FALSE(bt.isPrefetchPending());
+
+    // без кэша упреждающего чтения нет
+    bt.setCacheSize(0);
+    cur.seek(nullptr);
+    ASSERT_TRUE(cur.next());
+    EXPECT_FALSE(bt.isPrefetchPending());
+    EXPECT_EQ(0u, bt.getPageCache().getSize());
+}
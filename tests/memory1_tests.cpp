@@ -0,0 +1,185 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для B-деревьев в оперативной памяти
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include "memory_btree.h"
+#include "btree_adapters.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+typedef OrderedKeyCodec<UInt> UIntCodec;
+
+
+/** \brief Тестовый класс для тестирования деревьев в оперативной памяти. */
+class MemoryTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+    /** \brief Вставляет в дерево \c bt ключи 0..n-1 вперемешку. */
+    static void fill(BaseBTree& bt, UInt n)
+    {
+        Byte k[UIntCodec::SIZE];
+        for (UInt i = 0; i < n; ++i)
+        {
+            UIntCodec::encode(k, (i * 7919) % n);
+            bt.insert(k);
+        }
+    }
+
+    /** \brief Проверяет, что в дереве \c bt есть все ключи 0..n-1 и нет ключа n. */
+    static void checkAll(BaseBTree& bt, UInt n)
+    {
+        Byte k[UIntCodec::SIZE];
+        for (UInt i = 0; i < n; ++i)
+        {
+            UIntCodec::encode(k, i);
+            Byte* res = bt.search(k);
+            ASSERT_NE(nullptr, res) << i;
+            EXPECT_EQ(0, memcmp(k, res, UIntCodec::SIZE));
+            delete[] res;
+        }
+
+        UIntCodec::encode(k, n);
+        EXPECT_EQ(nullptr, bt.search(k));
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class MemoryTest
+
+
+
+TEST_F(MemoryTest, MemoryTree1)
+{
+    BTreeLexComparator comparator;
+
+    MemoryBaseBTree bt;
+    EXPECT_FALSE(bt.isOpen());
+    bt.setComparator(&comparator);
+    bt.create(3, UIntCodec::SIZE);
+    EXPECT_TRUE(bt.isOpen());
+    EXPECT_THROW(bt.create(3, UIntCodec::SIZE), std::runtime_error);
+
+    fill(bt, 3001);     // 7919 и 3001 взаимно просты
+    checkAll(bt, 3001);
+    EXPECT_GT(bt.getLastPageNum(), 100u);
+    EXPECT_GE(bt.getArenaSize(), (size_t) bt.getLastPageNum() * bt.getNodePageSize());
+
+    // чтение страницы не копирует ее, а дает представление страницы арены
+    BaseBTree::PageWrapper a(&bt);
+    BaseBTree::PageWrapper b(&bt);
+    a.readPage(bt.getRootPageNum());
+    b.readPage(bt.getRootPageNum());
+    EXPECT_FALSE(a.isDataOwned());
+    EXPECT_EQ(a.getData(), b.getData());
+    EXPECT_EQ(a.getData(), bt.getRootPage().getData());
+
+    // а явное чтение в буфер — копирует
+    std::vector<Byte> buf(bt.getNodePageSize());
+    bt.readPage(bt.getRootPageNum(), buf.data());
+    EXPECT_EQ(0, memcmp(buf.data(), a.getData(), buf.size()));
+
+    // упорядоченный просмотр и пакетный поиск работают и здесь
+    std::list<Byte*> keys;
+    EXPECT_EQ(3001, bt.searchRange(nullptr, nullptr, keys));
+    UInt expected = 0;
+    for (Byte* key : keys)
+    {
+        UInt v;
+        UIntCodec::decode(key, v);
+        EXPECT_EQ(expected++, v);
+        delete[] key;
+    }
+
+    Byte raw[2][UIntCodec::SIZE];
+    UIntCodec::encode(raw[0], 42);
+    UIntCodec::encode(raw[1], 5000);
+    const Byte* probes[] = { raw[0], raw[1] };
+    Byte* results[2];
+    bt.searchBatch(2, probes, results);
+    ASSERT_NE(nullptr, results[0]);
+    EXPECT_EQ(nullptr, results[1]);
+    delete[] results[0];
+
+    bt.close();
+    EXPECT_FALSE(bt.isOpen());
+    EXPECT_EQ(0u, bt.getArenaSize());
+}
+
+
+TEST_F(MemoryTest, Snapshot1)
+{
+    std::string& fn = getFn("Snapshot1.xibt");
+    BTreeLexComparator comparator;
+
+    {
+        MemoryBaseBTree bt(4, UIntCodec::SIZE, &comparator);
+        fill(bt, 2000);
+        bt.saveSnapshot(fn);
+    }
+
+    // снимок — обычный файл B-дерева
+    {
+        FileBaseBTree fbt(fn, &comparator);
+        EXPECT_EQ(4, fbt.getOrder());
+        checkAll(fbt, 2000);
+        fill(fbt, 3);                   // дописываем 0, 1, 2 еще раз
+    }
+
+    MemoryBaseBTree bt(fn, &comparator);
+    checkAll(bt, 2000);
+
+    std::list<Byte*> keys;
+    Byte k[UIntCodec::SIZE];
+    UIntCodec::encode(k, 1);
+    EXPECT_EQ(2, bt.searchAll(k, keys));
+    for (Byte* key : keys)
+        delete[] key;
+
+    EXPECT_THROW(MemoryBaseBTree(getFn("Snapshot1-missing.xibt"), &comparator), std::runtime_error);
+}
+
+
+TEST_F(MemoryTest, AlignedSnapshot1)
+{
+    std::string& fn = getFn("AlignedSnapshot1.xibt");
+    BTreeLexComparator comparator;
+
+    MemoryBaseBTree bt;
+    bt.setComparator(&comparator);
+    bt.createForPageSize(512, UIntCodec::SIZE);
+    EXPECT_TRUE(bt.isPageAligned());
+    fill(bt, 5000);
+    bt.saveSnapshot(fn);
+
+    FileBaseBTree fbt(fn, &comparator);
+    EXPECT_TRUE(fbt.isPageAligned());
+    EXPECT_EQ(512u, fbt.getNodePageSize());
+    EXPECT_EQ(bt.getLastPageNum(), fbt.getLastPageNum());
+    checkAll(fbt, 5000);
+}
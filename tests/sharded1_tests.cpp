@@ -0,0 +1,260 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для разделенных (sharded) B-деревьев
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <thread>
+
+#include "sharded_btree.h"
+#include "btree_adapters.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+typedef OrderedKeyCodec<UInt> UIntCodec;
+
+
+/** \brief Возвращает число, закодированное в ключе \c raw. */
+static UInt decodeKey(const Byte* raw)
+{
+    UInt v;
+    UIntCodec::decode(raw, v);
+    return v;
+}
+
+
+/** \brief Тестовый класс для тестирования разделенных B-деревьев. */
+class ShardedTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+    /** \brief Вставляет числа \c keys в \c st из \c threadsNum потоков (поток i — каждое
+     *  threadsNum-е число, начиная с i).
+     */
+    void insertParallel(ShardedBTree& st, const std::vector<UInt>& keys, UInt threadsNum)
+    {
+        std::vector<std::thread> threads;
+        for (UInt t = 0; t < threadsNum; ++t)
+            threads.push_back(std::thread([&st, &keys, t, threadsNum]() {
+                Byte k[sizeof(UInt)];
+                for (size_t i = t; i < keys.size(); i += threadsNum)
+                {
+                    UIntCodec::encode(k, keys[i]);
+                    st.insert(k);
+                }
+            }));
+
+        for (std::thread& th : threads)
+            th.join();
+    }
+
+    /** \brief Возвращает ключи диапазона [from, to] в порядке просмотра курсором. */
+    std::vector<UInt> scan(ShardedBTree& st, const Byte* from, const Byte* to)
+    {
+        std::vector<UInt> res;
+        ShardedBTree::RangeCursor cur(&st);
+        cur.seek(from, to);
+        while (cur.next())
+        {
+            EXPECT_EQ(st.getShardFor(cur.getKey()), cur.getShard());
+            res.push_back(decodeKey(cur.getKey()));
+        }
+        return res;
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class ShardedTest
+
+
+
+TEST_F(ShardedTest, Hash1)
+{
+    std::string fn = getFn("Hash1.xish");
+    BTreeLexComparator comparator;
+
+    // ключи с повторами: i % 2500, по четыре экземпляра
+    std::vector<UInt> keys;
+    for (UInt i = 0; i < 10000; ++i)
+        keys.push_back((i * 7919) % 2500);
+
+    ShardedBTree st;
+    st.create(3, sizeof(UInt), &comparator, fn, 4, ShardedBTree::ptHash);
+    EXPECT_EQ(4u, st.getShardsNum());
+    EXPECT_EQ(sizeof(UInt), st.getKeySize());
+
+    insertParallel(st, keys, 4);
+
+    // ключи разошлись по всем шардам
+    for (UInt i = 0; i < st.getShardsNum(); ++i)
+        EXPECT_NE(0, st.getShard(i).getRootPage().getKeysNum());
+
+    Byte k[sizeof(UInt)];
+    UIntCodec::encode(k, 1234);
+    Byte* found = st.search(k);
+    ASSERT_NE(nullptr, found);
+    EXPECT_EQ(1234u, decodeKey(found));
+    delete[] found;
+
+    std::list<Byte*> all;
+    EXPECT_EQ(4, st.searchAll(k, all));
+    for (Byte* r : all)
+    {
+        EXPECT_EQ(1234u, decodeKey(r));
+        delete[] r;
+    }
+
+    UIntCodec::encode(k, 2500);
+    EXPECT_EQ(nullptr, st.search(k));
+
+    // слияние курсоров шардов дает упорядоченную последовательность всех ключей
+    std::vector<UInt> expected = keys;
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(expected, scan(st, nullptr, nullptr));
+
+    Byte from[sizeof(UInt)], to[sizeof(UInt)];
+    UIntCodec::encode(from, 100);
+    UIntCodec::encode(to, 199);
+    std::list<Byte*> range;
+    EXPECT_EQ(400, st.searchRange(from, to, range));
+    UInt prev = 0;
+    for (Byte* r : range)
+    {
+        UInt v = decodeKey(r);
+        EXPECT_LE(100u, v);
+        EXPECT_GE(199u, v);
+        EXPECT_LE(prev, v);
+        prev = v;
+        delete[] r;
+    }
+}
+
+
+TEST_F(ShardedTest, Range1)
+{
+    std::string fn = getFn("Range1.xish");
+    BTreeLexComparator comparator;
+
+    std::vector<UInt> keys;
+    for (UInt i = 0; i < 6000; ++i)
+        keys.push_back((i * 4001) % 6000);
+
+    // границы — квантили выборки
+    std::vector<Byte> sample(keys.size() * sizeof(UInt));
+    for (size_t i = 0; i < keys.size(); ++i)
+        UIntCodec::encode(&sample[i * sizeof(UInt)], keys[i]);
+
+    std::vector<Byte> splitKeys;
+    ShardedBTree::calcSplitKeys(sample.data(), keys.size(), sizeof(UInt), &comparator, 3, splitKeys);
+    ASSERT_EQ(2 * sizeof(UInt), splitKeys.size());
+    EXPECT_EQ(2000u, decodeKey(&splitKeys[0]));
+    EXPECT_EQ(4000u, decodeKey(&splitKeys[sizeof(UInt)]));
+
+    {
+        ShardedBTree st;
+        st.create(3, sizeof(UInt), &comparator, fn, 3, ShardedBTree::ptRange, splitKeys.data());
+
+        Byte k[sizeof(UInt)];
+        UIntCodec::encode(k, 1999);
+        EXPECT_EQ(0u, st.getShardFor(k));
+        UIntCodec::encode(k, 2000);
+        EXPECT_EQ(1u, st.getShardFor(k));
+        UIntCodec::encode(k, 5999);
+        EXPECT_EQ(2u, st.getShardFor(k));
+
+        insertParallel(st, keys, 3);
+    }
+
+    // параметры разделения восстанавливаются из описателя
+    ShardedBTree st;
+    st.open(fn, &comparator);
+    EXPECT_EQ(ShardedBTree::ptRange, st.getPartitioning());
+    EXPECT_EQ(3u, st.getShardsNum());
+
+    Byte k[sizeof(UInt)];
+    UIntCodec::encode(k, 4500);
+    EXPECT_EQ(2u, st.getShardFor(k));
+    Byte* found = st.search(k);
+    ASSERT_NE(nullptr, found);
+    EXPECT_EQ(4500u, decodeKey(found));
+    delete[] found;
+
+    std::vector<UInt> expected;
+    for (UInt i = 0; i < 6000; ++i)
+        expected.push_back(i);
+    EXPECT_EQ(expected, scan(st, nullptr, nullptr));
+
+    // диапазон внутри одного шарда и через границу шардов
+    Byte from[sizeof(UInt)], to[sizeof(UInt)];
+    UIntCodec::encode(from, 2100);
+    UIntCodec::encode(to, 2199);
+    EXPECT_EQ(std::vector<UInt>(expected.begin() + 2100, expected.begin() + 2200), scan(st, from, to));
+
+    UIntCodec::encode(from, 1900);
+    UIntCodec::encode(to, 4100);
+    EXPECT_EQ(std::vector<UInt>(expected.begin() + 1900, expected.begin() + 4101), scan(st, from, to));
+
+    // во время просмотра в шарды вне диапазона можно вставлять из другого потока
+    {
+        ShardedBTree::RangeCursor cur(&st);
+        UIntCodec::encode(from, 0);
+        UIntCodec::encode(to, 10);
+        cur.seek(from, to);
+        ASSERT_TRUE(cur.next());
+
+        std::thread th([&st]() {
+            Byte k[sizeof(UInt)];
+            UIntCodec::encode(k, 7000);
+            st.insert(k);
+        });
+        th.join();
+        EXPECT_EQ(0u, decodeKey(cur.getKey()));
+    }
+
+    EXPECT_EQ(6001u, scan(st, nullptr, nullptr).size());
+}
+
+
+TEST_F(ShardedTest, Errors1)
+{
+    std::string fn = getFn("Errors1.xish");
+    BTreeLexComparator comparator;
+
+    ShardedBTree st;
+    EXPECT_THROW(st.create(3, sizeof(UInt), &comparator, fn, 0, ShardedBTree::ptHash), std::invalid_argument);
+    EXPECT_THROW(st.create(3, sizeof(UInt), &comparator, fn, 2, ShardedBTree::ptRange), std::invalid_argument);
+    EXPECT_FALSE(st.isOpen());
+
+    Byte k[sizeof(UInt)];
+    UIntCodec::encode(k, 1);
+    EXPECT_THROW(st.insert(k), std::runtime_error);
+
+    std::string badFn = getFn("Errors1_none.xish");
+    EXPECT_THROW(st.open(badFn, &comparator), std::runtime_error);
+}
@@ -0,0 +1,125 @@
+﻿////////////////////////////////////////////////////////////////////////////////
+/// \file
+/// \brief     Unit-тесты для генератора YCSB-нагрузки
+/// \version   0.1.0
+///            This is a part of the course "Algorithms and Data Structures" 
+///            provided by  the School of Software Engineering of the Faculty 
+///            of Computer Science at the Higher School of Economics.
+///
+/// Gtest-based unit test.
+/// The naming conventions imply the name of a unit-test module is the same as 
+/// the name of the corresponding tested module with _test suffix
+///
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <sstream>
+
+#include "ycsb.h"
+
+
+/** \brief Путь к каталогу с рабочими тестовыми файлами. */
+static const char* TEST_FILES_PATH = "../../out/";
+
+
+
+using namespace xi;
+
+
+/** \brief Тестовый класс для тестирования генератора нагрузки. */
+class YcsbTest : public ::testing::Test {
+public:
+    std::string& getFn(const char* fn)
+    {
+        _fn = TEST_FILES_PATH;
+        _fn.append(fn);
+        return _fn;
+    }
+
+protected:
+    std::string _fn;        ///< Имя файла
+}; // class YcsbTest
+
+
+
+TEST_F(YcsbTest, Workload1)
+{
+    YcsbWorkload w;
+    w.setPreset('b');
+    EXPECT_EQ(0.95, w.proportions[YcsbWorkload::opRead]);
+    EXPECT_EQ(0.05, w.proportions[YcsbWorkload::opUpdate]);
+
+    w.parse("workload=d");
+    EXPECT_EQ(YcsbWorkload::dsLatest, w.requestDistribution);
+    EXPECT_EQ(0.05, w.proportions[YcsbWorkload::opInsert]);
+
+    w.parse("requestdistribution=uniform");
+    w.parse("btree.store=adapter");
+    w.parse("threadcount=3");
+    EXPECT_EQ(YcsbWorkload::dsUniform, w.requestDistribution);
+    EXPECT_EQ(YcsbWorkload::stAdapter, w.store);
+    EXPECT_EQ(3u, w.threadCount);
+
+    EXPECT_THROW(w.parse("nosuchproperty=1"), std::invalid_argument);
+    EXPECT_THROW(w.parse("readproportion=-1"), std::invalid_argument);
+    EXPECT_THROW(w.parse("readproportion"), std::invalid_argument);
+    EXPECT_THROW(w.setPreset('z'), std::invalid_argument);
+
+    // ранг 0 самый популярный, все ранги в пределах
+    ZipfianGenerator zipf(1000);
+    std::mt19937_64 rng(1);
+    UInt zeros = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        unsigned long long r = zipf.next(rng);
+        ASSERT_LT(r, 1000u);
+        zeros += (r == 0);
+    }
+    EXPECT_LT(1000u, zeros);
+}
+
+
+TEST_F(YcsbTest, Run1)
+{
+    const char* stores[] = { "btree.store=file", "btree.store=adapter" };
+    for (const char* store : stores)
+    {
+        YcsbWorkload w;
+        w.parse(store);
+        w.fileName = getFn("Ycsb1.xibt");
+        w.recordCount = 2000;
+        w.operationCount = 4000;
+        w.threadCount = 2;
+        w.parse("readproportion=0.4");
+        w.parse("updateproportion=0.2");
+        w.parse("insertproportion=0.2");
+        w.parse("scanproportion=0.2");
+        w.parse("maxscanlength=10");
+
+        YcsbDriver driver(w);
+        driver.load();
+        driver.run();
+
+        EXPECT_EQ(4000u, driver.getRunOps());
+        for (int op = 0; op < YcsbWorkload::OPS_NUM; ++op)
+        {
+            const YcsbOpStats& s = driver.getStats((YcsbWorkload::Operation) op);
+            EXPECT_LT(0u, s.getCount());
+            EXPECT_EQ(0u, s.failed);                // читаются и обновляются только вставленные
+            EXPECT_LE(s.percentile(50), s.percentile(99));
+            EXPECT_LE(s.percentile(99), s.percentile(100));
+        }
+
+        std::ostringstream os;
+        driver.report(os);
+        EXPECT_NE(std::string::npos, os.str().find("[OVERALL], Throughput(ops/sec)"));
+        EXPECT_NE(std::string::npos, os.str().find("[SCAN], 99thPercentileLatency(us)"));
+    }
+
+    YcsbWorkload bad;
+    bad.operationCount = 0;
+    EXPECT_THROW(YcsbDriver d(bad), std::invalid_argument);
+}